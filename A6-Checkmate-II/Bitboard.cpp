@@ -0,0 +1,186 @@
+//
+// Bitboard.cpp
+//
+// Attack tables for the rules engine, and the search for the magic
+// numbers that index the sliding piece tables.
+//
+
+#include "Bitboard.h"
+
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+Magic rookMagics[ 64 ], bishopMagics[ 64 ];
+Bitboard knightTable[ 64 ], kingTable[ 64 ];
+Bitboard pawnTable[ 2 ][ 64 ];
+Bitboard betweenTable[ 64 ][ 64 ], lineTable[ 64 ][ 64 ];
+
+// Shared storage for every square's sliding attack sets.  Rooks need
+// 2^12 entries in the corners down to 2^10 in the middle, bishops 2^9 at
+// most, and these are the totals over the whole board.
+static Bitboard rookTable[ 102400 ], bishopTable[ 5248 ];
+
+// Steps, as (file, rank) offsets, along the lines each slider moves on.
+static const int ROOK_STEPS[ 4 ][ 2 ] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+static const int BISHOP_STEPS[ 4 ][ 2 ] = { { 1, 1 }, { 1, -1 }, { -1, 1 }, { -1, -1 } };
+
+// Return true if file f and rank r are on the board.
+static bool onBoard( int f, int r ) {
+    return f >= 0 && f < 8 && r >= 0 && r < 8;
+}
+
+// Return the squares a slider on sq attacks along the four given steps,
+// the slow way, stopping at (and including) the first piece in occupied
+// on each line.
+static Bitboard slideAttacks( int sq, Bitboard occupied, int const steps[ 4 ][ 2 ] ) {
+    Bitboard result = 0;
+    for ( int d = 0; d < 4; d++ ) {
+        int f = sq % 8 + steps[ d ][ 0 ], r = sq / 8 + steps[ d ][ 1 ];
+        for ( ; onBoard( f, r ); f += steps[ d ][ 0 ], r += steps[ d ][ 1 ] ) {
+            result |= squareBit( r * 8 + f );
+            if ( occupied & squareBit( r * 8 + f ) )
+                break;
+        }
+    }
+    return result;
+}
+
+// Return the set of squares that are each the given offsets away from
+// sq, for the leaping pieces.
+static Bitboard leapAttacks( int sq, int const offsets[][ 2 ], int count ) {
+    Bitboard result = 0;
+    for ( int i = 0; i < count; i++ ) {
+        int f = sq % 8 + offsets[ i ][ 0 ], r = sq / 8 + offsets[ i ][ 1 ];
+        if ( onBoard( f, r ) )
+            result |= squareBit( r * 8 + f );
+    }
+    return result;
+}
+
+// Small, fast generator for candidate magic numbers (xorshift64*).
+// It's seeded the same way every run, so the magics come out the same.
+class MagicRandom {
+public:
+    MagicRandom( uint64_t seed ) : state( seed ) {
+    }
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ull;
+    }
+
+    // Magics with few bits set work best, so and a few draws together.
+    uint64_t sparse() {
+        return next() & next() & next();
+    }
+
+private:
+    uint64_t state;
+};
+
+// Find a magic number for a slider on sq that moves along steps, and
+// fill in its entries in table, which has room for them.  Returns the
+// number of entries used.
+static int findMagic( int sq, int const steps[ 4 ][ 2 ], Magic &m, Bitboard *table,
+                      MagicRandom &random ) {
+    // Pieces on the edge of the board never block anything further on,
+    // so they're left out of the mask (unless the slider is on that
+    // edge itself).
+    Bitboard rank1 = 0xffull, rank8 = rank1 << 56;
+    Bitboard fileA = 0x0101010101010101ull, fileH = fileA << 7;
+    Bitboard edges = ( ( rank1 | rank8 ) & ~( rank1 << ( sq / 8 * 8 ) ) ) |
+        ( ( fileA | fileH ) & ~( fileA << ( sq % 8 ) ) );
+    m.mask = slideAttacks( sq, 0, steps ) & ~edges;
+    m.shift = 64 - squareCount( m.mask );
+    m.attacks = table;
+
+    // Every subset of the mask, with the attacks it allows, from the
+    // carry-rippler trick.
+    vector< Bitboard > occupancy, reference;
+    Bitboard b = 0;
+    do {
+        occupancy.push_back( b );
+        reference.push_back( slideAttacks( sq, b, steps ) );
+        b = ( b - m.mask ) & m.mask;
+    } while ( b );
+
+    // Try candidates until one sends every subset to an entry that's
+    // either unused or already holds the same attacks.  used records
+    // which attempt last wrote each entry, so it needn't be cleared.
+    int size = occupancy.size();
+    vector< int > used( size, 0 );
+    for ( int attempt = 1;; attempt++ ) {
+        do {
+            m.magic = random.sparse();
+        } while ( squareCount( ( m.mask * m.magic ) >> 56 ) < 6 );
+
+        int i = 0;
+        for ( ; i < size; i++ ) {
+            int index = ( occupancy[ i ] * m.magic ) >> m.shift;
+            if ( used[ index ] < attempt ) {
+                used[ index ] = attempt;
+                table[ index ] = reference[ i ];
+            } else if ( table[ index ] != reference[ i ] ) {
+                break;
+            }
+        }
+        if ( i == size )
+            return size;
+    }
+}
+
+// Fill in all the tables; initBitboards() makes sure this runs once.
+static void buildTables() {
+    static const int KNIGHT_JUMPS[ 8 ][ 2 ] = {
+        { 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 },
+        { -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 }
+    };
+    static const int KING_STEPS[ 8 ][ 2 ] = {
+        { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 },
+        { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 }
+    };
+    static const int PAWN_CAPTURES[ 2 ][ 2 ][ 2 ] = {
+        { { -1, 1 }, { 1, 1 } }, { { -1, -1 }, { 1, -1 } }
+    };
+
+    for ( int sq = 0; sq < 64; sq++ ) {
+        knightTable[ sq ] = leapAttacks( sq, KNIGHT_JUMPS, 8 );
+        kingTable[ sq ] = leapAttacks( sq, KING_STEPS, 8 );
+        for ( int color = 0; color < 2; color++ )
+            pawnTable[ color ][ sq ] = leapAttacks( sq, PAWN_CAPTURES[ color ], 2 );
+    }
+
+    MagicRandom random( 0x9e3779b97f4a7c15ull );
+    Bitboard *rookNext = rookTable, *bishopNext = bishopTable;
+    for ( int sq = 0; sq < 64; sq++ ) {
+        rookNext += findMagic( sq, ROOK_STEPS, rookMagics[ sq ], rookNext, random );
+        bishopNext += findMagic( sq, BISHOP_STEPS, bishopMagics[ sq ], bishopNext, random );
+    }
+
+    // Two squares share a line if each is on the other's empty-board
+    // attacks; the squares between are where their attacks toward each
+    // other overlap.
+    for ( int a = 0; a < 64; a++ )
+        for ( int b = 0; b < 64; b++ ) {
+            betweenTable[ a ][ b ] = lineTable[ a ][ b ] = 0;
+            if ( a == b )
+                continue;
+            Bitboard bit = squareBit( a ) | squareBit( b );
+            if ( rookAttacks( a, 0 ) & squareBit( b ) ) {
+                lineTable[ a ][ b ] = ( rookAttacks( a, 0 ) & rookAttacks( b, 0 ) ) | bit;
+                betweenTable[ a ][ b ] = rookAttacks( a, bit ) & rookAttacks( b, bit );
+            } else if ( bishopAttacks( a, 0 ) & squareBit( b ) ) {
+                lineTable[ a ][ b ] = ( bishopAttacks( a, 0 ) & bishopAttacks( b, 0 ) ) | bit;
+                betweenTable[ a ][ b ] = bishopAttacks( a, bit ) & bishopAttacks( b, bit );
+            }
+        }
+}
+
+void initBitboards() {
+    static once_flag once;
+    call_once( once, buildTables );
+}
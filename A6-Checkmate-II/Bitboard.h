@@ -0,0 +1,123 @@
+#ifndef __BITBOARD_H__
+#define __BITBOARD_H__
+
+#include <stdint.h>
+
+//
+// Sets of squares held in 64-bit integers, one bit per square, and the
+// attack tables the rules engine (see Position.h) is built on.  Squares
+// are numbered along each rank from a1 = 0 to h8 = 63, so a square is
+// rank * 8 + file.
+//
+// Sliding pieces find their attacks with magic bitboards: the pieces on
+// the lines through a square are masked out of the board, multiplied by
+// a magic number for that square, and the top bits of the product index
+// a table of the attack sets for every arrangement of blockers.
+//
+
+typedef uint64_t Bitboard;
+
+/** Return the set holding just square sq. */
+inline Bitboard squareBit( int sq ) {
+    return Bitboard( 1 ) << sq;
+}
+
+/** Return the lowest square in the non-empty set b. */
+inline int firstSquare( Bitboard b ) {
+    return __builtin_ctzll( b );
+}
+
+/** Remove the lowest square from the non-empty set b, and return it. */
+inline int popSquare( Bitboard &b ) {
+    int sq = firstSquare( b );
+    b &= b - 1;
+    return sq;
+}
+
+/** Return the number of squares in b. */
+inline int squareCount( Bitboard b ) {
+    return __builtin_popcountll( b );
+}
+
+/** Fill in the attack tables.  This has to happen before any of the
+    lookups below are used; calling it again does nothing, and it's safe
+    to call from several threads at once. */
+void initBitboards();
+
+/** Everything a sliding piece's attack lookup needs for one square. */
+struct Magic {
+    /** Squares on the piece's lines, less the edges, whose pieces can
+        block it. */
+    Bitboard mask;
+
+    /** Multiplier that maps every arrangement of blockers in mask to a
+        distinct (or equivalent) table entry. */
+    Bitboard magic;
+
+    /** Attack sets, indexed by the top bits of the product. */
+    Bitboard *attacks;
+
+    /** 64 less the number of index bits. */
+    int shift;
+};
+
+/** Lookup data for rooks and bishops on each square. */
+extern Magic rookMagics[ 64 ], bishopMagics[ 64 ];
+
+/** Squares a knight or king on each square attacks. */
+extern Bitboard knightTable[ 64 ], kingTable[ 64 ];
+
+/** Squares a pawn of each color (white, then black) on each square
+    attacks. */
+extern Bitboard pawnTable[ 2 ][ 64 ];
+
+/** For each pair of squares on a common rank, file or diagonal, the
+    squares strictly between them, and the whole line through them. */
+extern Bitboard betweenTable[ 64 ][ 64 ], lineTable[ 64 ][ 64 ];
+
+/** Return the squares a rook on sq attacks, with pieces on occupied. */
+inline Bitboard rookAttacks( int sq, Bitboard occupied ) {
+    Magic const &m = rookMagics[ sq ];
+    return m.attacks[ ( ( occupied & m.mask ) * m.magic ) >> m.shift ];
+}
+
+/** Return the squares a bishop on sq attacks, with pieces on occupied. */
+inline Bitboard bishopAttacks( int sq, Bitboard occupied ) {
+    Magic const &m = bishopMagics[ sq ];
+    return m.attacks[ ( ( occupied & m.mask ) * m.magic ) >> m.shift ];
+}
+
+/** Return the squares a queen on sq attacks, with pieces on occupied. */
+inline Bitboard queenAttacks( int sq, Bitboard occupied ) {
+    return rookAttacks( sq, occupied ) | bishopAttacks( sq, occupied );
+}
+
+/** Return the squares a knight on sq attacks. */
+inline Bitboard knightAttacks( int sq ) {
+    return knightTable[ sq ];
+}
+
+/** Return the squares a king on sq attacks. */
+inline Bitboard kingAttacks( int sq ) {
+    return kingTable[ sq ];
+}
+
+/** Return the squares a pawn of the given color (0 for white, 1 for
+    black) on sq attacks. */
+inline Bitboard pawnAttacks( int color, int sq ) {
+    return pawnTable[ color ][ sq ];
+}
+
+/** Return the squares strictly between a and b if they share a rank,
+    file or diagonal, otherwise the empty set. */
+inline Bitboard betweenSquares( int a, int b ) {
+    return betweenTable[ a ][ b ];
+}
+
+/** Return every square on the rank, file or diagonal through a and b,
+    or the empty set if there isn't one. */
+inline Bitboard lineThrough( int a, int b ) {
+    return lineTable[ a ][ b ];
+}
+
+#endif
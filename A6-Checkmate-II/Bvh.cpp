@@ -0,0 +1,189 @@
+//
+// Bvh.cpp
+//
+// Bounding volume hierarchy for CPU ray casts.
+//
+
+#include "Bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+
+using namespace std;
+
+// Triangles per leaf before we stop splitting.
+static const int LEAF_SIZE = 4;
+
+// Orders triangles by centroid along one axis, for splitting a node.
+struct CentroidLess {
+    vector< float > const *centroids;
+    int axis;
+
+    bool operator()( int a, int b ) const {
+        return ( *centroids )[ a * 3 + axis ] < ( *centroids )[ b * 3 + axis ];
+    }
+};
+
+Bvh :: Bvh() {
+}
+
+void Bvh :: build( float const *positions, vector< unsigned > const &triangles ) {
+    nodes.clear();
+    tris.clear();
+
+    int triCount = triangles.size() / 3;
+    if ( triCount == 0 )
+        return;
+
+    // Gather each triangle's corners and centroid up front.
+    vector< float > corners( triCount * 9 ), centroids( triCount * 3 );
+    vector< int > order( triCount );
+    for ( int i = 0; i < triCount; i++ ) {
+        order[ i ] = i;
+        for ( int c = 0; c < 3; c++ )
+            for ( int a = 0; a < 3; a++ ) {
+                float v = positions[ triangles[ i * 3 + c ] * 3 + a ];
+                corners[ i * 9 + c * 3 + a ] = v;
+                centroids[ i * 3 + a ] += v / 3;
+            }
+    }
+
+    nodes.reserve( 2 * triCount / LEAF_SIZE + 1 );
+    buildNode( order, centroids, corners, 0, triCount );
+
+    // Store the corners in leaf order, so each leaf's triangles are
+    // contiguous.
+    tris.resize( triCount * 9 );
+    for ( int i = 0; i < triCount; i++ )
+        copy( &corners[ order[ i ] * 9 ], &corners[ order[ i ] * 9 ] + 9,
+              &tris[ i * 9 ] );
+}
+
+int Bvh :: buildNode( vector< int > &order, vector< float > const &centroids,
+                      vector< float > const &corners, int begin, int end ) {
+    int index = nodes.size();
+    nodes.push_back( Node() );
+
+    // Bound the triangles, and their centroids.
+    Node node;
+    float clo[ 3 ], chi[ 3 ];
+    for ( int a = 0; a < 3; a++ ) {
+        node.lo[ a ] = clo[ a ] = FLT_MAX;
+        node.hi[ a ] = chi[ a ] = -FLT_MAX;
+    }
+    for ( int i = begin; i < end; i++ )
+        for ( int a = 0; a < 3; a++ ) {
+            for ( int c = 0; c < 3; c++ ) {
+                float v = corners[ order[ i ] * 9 + c * 3 + a ];
+                node.lo[ a ] = min( node.lo[ a ], v );
+                node.hi[ a ] = max( node.hi[ a ], v );
+            }
+            clo[ a ] = min( clo[ a ], centroids[ order[ i ] * 3 + a ] );
+            chi[ a ] = max( chi[ a ], centroids[ order[ i ] * 3 + a ] );
+        }
+
+    if ( end - begin <= LEAF_SIZE ) {
+        node.start = begin;
+        node.count = end - begin;
+        nodes[ index ] = node;
+        return index;
+    }
+
+    // Split at the median centroid along the widest axis.
+    CentroidLess less;
+    less.centroids = &centroids;
+    less.axis = 0;
+    for ( int a = 1; a < 3; a++ )
+        if ( chi[ a ] - clo[ a ] > chi[ less.axis ] - clo[ less.axis ] )
+            less.axis = a;
+    int mid = ( begin + end ) / 2;
+    nth_element( order.begin() + begin, order.begin() + mid,
+                 order.begin() + end, less );
+
+    // The left child lands right after this node.
+    buildNode( order, centroids, corners, begin, mid );
+    node.start = buildNode( order, centroids, corners, mid, end );
+    node.count = 0;
+    nodes[ index ] = node;
+    return index;
+}
+
+// Return true if the ray enters the box before parameter t.
+static inline bool hitBox( float const lo[], float const hi[],
+                           float const origin[], float const inv[], float t ) {
+    float tmin = 0, tmax = t;
+    for ( int a = 0; a < 3; a++ ) {
+        float t0 = ( lo[ a ] - origin[ a ] ) * inv[ a ];
+        float t1 = ( hi[ a ] - origin[ a ] ) * inv[ a ];
+        if ( t0 > t1 )
+            swap( t0, t1 );
+        tmin = max( tmin, t0 );
+        tmax = min( tmax, t1 );
+        if ( tmin > tmax )
+            return false;
+    }
+    return true;
+}
+
+bool Bvh :: intersect( float const origin[ 3 ], float const dir[ 3 ],
+                       float &t ) const {
+    if ( nodes.empty() )
+        return false;
+
+    // Infinities from division by zero do the right thing in hitBox().
+    float inv[ 3 ];
+    for ( int a = 0; a < 3; a++ )
+        inv[ a ] = 1.0f / dir[ a ];
+
+    bool hit = false;
+    int stack[ 64 ];
+    int top = 0;
+    stack[ top++ ] = 0;
+    while ( top ) {
+        Node const &node = nodes[ stack[ --top ] ];
+        if ( !hitBox( node.lo, node.hi, origin, inv, t ) )
+            continue;
+
+        if ( node.count == 0 ) {
+            stack[ top++ ] = node.start;
+            stack[ top++ ] = &node - &nodes[ 0 ] + 1;
+            continue;
+        }
+
+        // Moller-Trumbore against each triangle in the leaf.
+        for ( int i = node.start; i < node.start + node.count; i++ ) {
+            float const *p = &tris[ i * 9 ];
+            float e1[ 3 ], e2[ 3 ], s[ 3 ], pv[ 3 ], qv[ 3 ];
+            for ( int a = 0; a < 3; a++ ) {
+                e1[ a ] = p[ 3 + a ] - p[ a ];
+                e2[ a ] = p[ 6 + a ] - p[ a ];
+                s[ a ] = origin[ a ] - p[ a ];
+            }
+            pv[ 0 ] = dir[ 1 ] * e2[ 2 ] - dir[ 2 ] * e2[ 1 ];
+            pv[ 1 ] = dir[ 2 ] * e2[ 0 ] - dir[ 0 ] * e2[ 2 ];
+            pv[ 2 ] = dir[ 0 ] * e2[ 1 ] - dir[ 1 ] * e2[ 0 ];
+            float det = e1[ 0 ] * pv[ 0 ] + e1[ 1 ] * pv[ 1 ] + e1[ 2 ] * pv[ 2 ];
+            if ( det == 0 )
+                continue;
+            float invDet = 1 / det;
+
+            float u = ( s[ 0 ] * pv[ 0 ] + s[ 1 ] * pv[ 1 ] + s[ 2 ] * pv[ 2 ] ) * invDet;
+            if ( u < 0 || u > 1 )
+                continue;
+
+            qv[ 0 ] = s[ 1 ] * e1[ 2 ] - s[ 2 ] * e1[ 1 ];
+            qv[ 1 ] = s[ 2 ] * e1[ 0 ] - s[ 0 ] * e1[ 2 ];
+            qv[ 2 ] = s[ 0 ] * e1[ 1 ] - s[ 1 ] * e1[ 0 ];
+            float v = ( dir[ 0 ] * qv[ 0 ] + dir[ 1 ] * qv[ 1 ] + dir[ 2 ] * qv[ 2 ] ) * invDet;
+            if ( v < 0 || u + v > 1 )
+                continue;
+
+            float d = ( e2[ 0 ] * qv[ 0 ] + e2[ 1 ] * qv[ 1 ] + e2[ 2 ] * qv[ 2 ] ) * invDet;
+            if ( d > 0 && d < t ) {
+                t = d;
+                hit = true;
+            }
+        }
+    }
+    return hit;
+}
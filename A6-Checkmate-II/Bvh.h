@@ -0,0 +1,54 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+
+//
+// Bounding volume hierarchy over a triangle mesh, for casting rays
+// against it on the CPU.  Nodes are axis-aligned boxes, split at the
+// median of the longest axis until each leaf holds a handful of
+// triangles.
+//
+class Bvh {
+public:
+    // Make an empty hierarchy; rays never hit it.
+    Bvh();
+
+    /** Build the hierarchy over the given triangles.  positions holds
+        x, y, z for each vertex, and triangles holds three vertex indices
+        for each triangle.  The triangle corners are copied, so the
+        arrays don't need to outlive the call. */
+    void build( float const *positions, std::vector< unsigned > const &triangles );
+
+    /** Cast a ray from origin along dir (not necessarily normalized).
+        If it hits a triangle at a parameter between zero and t, set t to
+        the parameter of the closest hit and return true. */
+    bool intersect( float const origin[ 3 ], float const dir[ 3 ], float &t ) const;
+
+    /** Return true if build() has been given at least one triangle. */
+    bool empty() const {
+        return nodes.empty();
+    }
+
+private:
+    /** A node of the tree.  Interior nodes have count zero, with their
+        left child right after them and their right child at start.
+        Leaves cover triangles start up to start + count. */
+    struct Node {
+        float lo[ 3 ], hi[ 3 ];
+        int start, count;
+    };
+
+    /** Build the subtree over triangles order[ begin ] up to
+        order[ end ], returning the index of its root node. */
+    int buildNode( std::vector< int > &order, std::vector< float > const &centroids,
+                   std::vector< float > const &corners, int begin, int end );
+
+    /** Nodes of the tree, with the root first. */
+    std::vector< Node > nodes;
+
+    /** Triangle corners, nine floats per triangle, in leaf order. */
+    std::vector< float > tris;
+};
+
+#endif
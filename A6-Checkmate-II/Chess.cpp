@@ -13,6 +13,9 @@
 #include <ctime>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <random>
 
 #ifdef __APPLE__
 #include <glut/glut.h>
@@ -22,43 +25,293 @@
 
 #include "Geometry.h"
 #include "Mesh.h"
+#include "MeshLoader.h"
+#include "Instancer.h"
+#include "ShadowMap.h"
+#include "Headless.h"
+#include "SceneGraph.h"
+#include "Pgn.h"
+#include "PgnIndex.h"
+#include "Position.h"
+#include "Search.h"
 
 using namespace std;
 
+// GLUT idle callback, defined below.  The board turns it back on when
+// it has something to do between events.
+void idle();
+
 class ChessBoard {
     /* Different types of pieces, also, indices into meshList */
     enum PieceType { PAWN, ROOK, KNIGHT, BISHOP, QUEEN, KING };
 
-    /** List of meshes, one for each piece type. */
+    /** List of meshes, one for each piece type.  An entry is NULL
+        until its mesh has finished loading. */
     vector< Mesh * > meshList;
 
+    /** Background loader for meshList, or NULL once every mesh has
+        been installed. */
+    MeshLoader *loader;
+
     /** Enum-hacked integer constants */
     enum { 
         /** Size of the board. */
         BOARD_SIZE = 8,
+
+        /** Number of pieces in the starting position, and of objects
+            each board has for pieces, half of each color. */
+        PIECE_COUNT = 32,
+
+        /** Gap between neighboring boards when several are shown. */
+        BOARD_GAP = 2,
+
+        /** How many frames to average over for the stress mode report. */
+        STATS_FRAMES = 50,
+
+        /** Width and height of the shadow map texture. */
+        SHADOW_MAP_SIZE = 2048,
+
+        /** Largest error, in pixels, a level of detail may show on the
+            screen before a finer one is used. */
+        LOD_PIXELS = 1,
+
+        /** Milliseconds the computer thinks about each move, unless
+            told otherwise. */
+        THINK_MS = 1000,
+
+        /** Milliseconds a piece takes to slide to its new square when
+            the computer moves it. */
+        ANIMATION_MS = 400,
     };
 
+    /** The passes drawScene makes over the objects. */
+    enum Pass { REFLECTION, SHADOW, PIECE };
+
     /** Record for an individual object in our scene. */
     struct Object {
-        /** Transformation for the model. */
-        Matrix trans;
+        /** Node in scene holding the model's transformation, relative to
+            the square it stands on, and the matrices derived from it. */
+        int node;
 
         /** Color for the model */
         Vector color;
     
         /** Index in meshList of the mesh used to draw the model. */
         PieceType mesh;
+
+        /** Square the piece stands on (see Position.h) on its board, or
+            -1 once it's been captured. */
+        int square;
     };
 
     /** List of objects in the scene. */
     vector< Object > objectList;
 
+    /** Transformations for everything in the scene: each board holds its
+        squares, which hold the pieces standing on them, and the camera
+        rig holds the view. */
+    SceneGraph scene;
+
+    /** For each board, the scene nodes of its squares, row by row. */
+    vector< vector< int > > squareNodes;
+
+    /** The game being played on the first board.  The other boards, if
+        there are any, just hold the starting position. */
+    Position game;
+
+    /** Index in objectList of the piece on each square of the first
+        board, by Position square, or -1 for an empty square. */
+    int squareObject[ 64 ];
+
+    /** Objects of each color (Position::Color) parked beside the first
+        board, captured or not needed by its position, in the order they
+        were parked, and how many there are. */
+    int parked[ 2 ][ PIECE_COUNT / 2 ];
+    int parkedCount[ 2 ];
+
+    /** Squares of the first board the selected piece can move to. */
+    Bitboard destinations;
+
+    /** Keys of the positions played on the first board before the
+        current one, so the computer can see repetitions coming. */
+    vector< uint64_t > gameKeys;
+
+    /** A move played on the first board, with what it takes to take it
+        back: the object it captured (or -1) and the square that stood
+        on. */
+    struct Played {
+        Move move;
+        Position::Undo undo;
+        int captured, capturedSquare;
+    };
+
+    /** Moves played on the first board, oldest first. */
+    vector< Played > played;
+
+    /** PGN file being replayed on the first board, if replaying is true,
+        the game from it that's shown, and that game's index, from 0. */
+    PgnReader pgn;
+    bool replaying;
+    PgnGame pgnGame;
+    int pgnIndex;
+
+    /** Where each game in the PGN file starts, as far as it's been read. */
+    vector< uint64_t > pgnOffsets;
+
+    /** Index of the games being replayed, if indexed is true.  Games
+        then come from the index rather than the PGN file, and positions
+        can be looked up. */
+    PgnIndex archive;
+    bool indexed;
+
+    /** Number of pgnGame's moves at the start of played.  Moves played
+        after those, by hand or by the computer, come after them. */
+    int pgnPlies;
+
+    /** The computer player. */
+    Search search;
+
+    /** True if the computer is playing the first board, and the color
+        (Position::Color) it plays. */
+    bool computerPlaying;
+    int computerColor;
+
+    /** Milliseconds the computer thinks about each move. */
+    int thinkMs;
+
+    /** True from starting the computer on a move until its choice has
+        been picked up. */
+    bool thinking;
+
+    /** The search's result, handed over from the search's thread, and
+        whether it's waiting to be picked up.  Both are guarded by
+        resultLock. */
+    Search::Result searchResult;
+    bool resultReady;
+    mutex resultLock;
+
+    /** Object sliding to a new square to play animMove, or -1, when it
+        started, and its transformation before it moved. */
+    int animObject;
+    Move animMove;
+    double animStart;
+    Matrix animLocal;
+
+    /** Scene node for the camera's orbit around the board, and its child
+        whose world matrix is the camera transformation. */
+    int orbitNode, cameraNode;
+
+    /** Number of boards in the scene, each with a full set of pieces.
+        This is normally one; more are used to stress the renderer. */
+    int boardCount;
+
+    /** Draws each type of piece with a single instanced call. */
+    Instancer instancer;
+
+    /** True if pieces should be drawn with the instancer, when it's
+        available. */
+    bool instancing;
+
+    /** Instances for one pass over the objects, grouped by mesh and
+        kept in a buffer object until something about the objects
+        changes. */
+    struct DrawList {
+        /** Buffer object holding the instances. */
+        GLuint buffer;
+
+        /** For each mesh and level of detail (at index mesh *
+            Mesh::MAX_LODS + level), index in buffer of its first
+            instance and number of instances. */
+        vector< int > first, count;
+
+        /** True if the buffer needs to be rebuilt before it's drawn. */
+        bool dirty;
+
+        /** For each object, the level of detail the buffer includes it
+            at, or -1 if it's left out. */
+        vector< int > included;
+
+        /** For each object, the level of detail the pass draws it at,
+            or -1 if it's skipped, and how many objects and triangles
+            that draws and culls.  These are only worked out again when
+            the view, the scene or the objects change. */
+        vector< int > detail;
+        int drawn, culled;
+        long triangles;
+
+        /** True if detail has to be worked out again whatever else has
+            changed. */
+        bool stale;
+
+        /** Values of scene.recomputed() and frustumChanges when detail
+            was worked out. */
+        long sceneVersion, frustumVersion;
+    };
+
+    /** Cached instance lists, one for each Pass, culled ( [ 1 ] ) or
+        not ( [ 0 ] ).  The shadow map draws the pieces unculled, so it
+        has a list of its own rather than rebuilding the main one. */
+    DrawList drawLists[ PIECE + 1 ][ 2 ];
+
+    /** Scratch list of instances, used while rebuilding a draw list. */
+    vector< Instancer::Instance > instances;
+
+    /** True if small pieces should be drawn with simplified meshes. */
+    bool useLods;
+
+    /** Position of light 0, in world coordinates. */
+    Vector lightPos;
+
+    /** Shadows cast by the pieces, from light 0. */
+    ShadowMap shadowMap;
+
+    /** True if the pieces have changed since shadowMap was rendered. */
+    bool shadowDirty;
+
+    /** Number of mesh draw calls made for the current frame. */
+    int drawCalls;
+
+    /** Planes bounding the view volume, in world coordinates, with the
+        normals (x, y, z) pointing in and the offset in w.  There are
+        five, since the projection has no far plane. */
+    vector< Vector > frustum;
+
+    /** Aspect ratio and camera node version the projection and frustum
+        were found for, and the number of times they've been found. */
+    double frustumAspect;
+    long frustumCamera, frustumChanges;
+
+    /** For each pass, objects drawn and culled in the current frame. */
+    int drawnCount[ PIECE + 1 ], culledCount[ PIECE + 1 ];
+
+    /** Triangles drawn for the pieces, reflections and shadows in the
+        current frame, including the pieces drawn into the shadow map
+        when it's rendered again. */
+    long triangleCount;
+
+    /** True if the culling statistics should be shown over the scene. */
+    bool showStats;
+
+    /** Frame count and elapsed milliseconds at the start of the current
+        stress mode reporting period. */
+    int statsFrames;
+    double statsStart;
+
+    /** True if we're rendering offscreen, without GLUT or a window. */
+    bool headless;
+
+    /** Current size of the window (or offscreen framebuffer). */
+    int winWidth, winHeight;
+
     /** Rotation angle for the view. */
     double camRotation;
 
     /** View elevation angle. */
     double camElevation;
 
+    /** Distance from the camera to the middle of the first board. */
+    double camDistance;
+
     /** Mouse location for the last known mouse location, these are used
         for some of the mouse dragging operations. */
     int lastMouseX, lastMouseY;
@@ -102,35 +355,847 @@ class ChessBoard {
         if ( wipeProjection )
             glLoadIdentity();
         
-        // projection matrix, based on the matrix in OpenGL's
-        // documentation for gluPerspective
-        float tmpProjMatrix[16] = {2/(float)aspect, 0, 0, 0,
-            0, 2, 0, 0,
-            0, 0, -1, -1,
-            0, 0, -8.2, 0};
-        
+        // The camera rig keeps the view up to date as the camera moves.
+        // The matrices and frustum only change with it and the aspect,
+        // so a frame where neither has changed reuses them.
+        scene.update();
+        if ( aspect != frustumAspect || scene.version( cameraNode ) != frustumCamera ) {
+            // projection matrix, based on the matrix in OpenGL's
+            // documentation for gluPerspective
+            float tmpProjMatrix[16] = {2/(float)aspect, 0, 0, 0,
+                0, 2, 0, 0,
+                0, 0, -1, -1,
+                0, 0, -8.2, 0};
+            projectionMatrix = Matrix::glConvert(tmpProjMatrix);
+            cameraMatrix = scene.world( cameraNode );
+            findFrustum();
+            frustumAspect = aspect;
+            frustumCamera = scene.version( cameraNode );
+            frustumChanges++;
+        }
+
         // set the projection matrix
-        projectionMatrix = Matrix::glConvert(tmpProjMatrix);
         projectionMatrix.glMult();
         
-        // half of the board size
-        double halfBoard = BOARD_SIZE / 2.0;
-        
-        // move camera to center of board, rotate about the Y axis,
-        // rotate about the X axis, translate back along the Z axis
-        cameraMatrix = Matrix::identity();
-        cameraMatrix = cameraMatrix * Matrix::translate(0, 0, -12);
-        cameraMatrix = cameraMatrix * Matrix::rotateX(camElevation);
-        cameraMatrix = cameraMatrix * Matrix::rotateY(camRotation);
-        cameraMatrix = cameraMatrix * Matrix::translate(-halfBoard, 0, -halfBoard);
-        
         // set OpenGl's MODELVIEW matrix to cameraMatrix
         glMatrixMode(GL_MODELVIEW);
         glLoadIdentity();
         cameraMatrix.glMult();
+
+        // The light is fixed in the world (that's what the shadow map
+        // assumes), so place it under the camera transformation.
+        GLfloat light0_pos[] = { GLfloat( lightPos.x ), GLfloat( lightPos.y ),
+                                 GLfloat( lightPos.z ), 1.0 };
+        glLightfv(GL_LIGHT0, GL_POSITION, light0_pos);
+    }
+
+    /** Pull the planes of the view volume out of the projection and
+        camera matrices.  Each is a sum or difference of the last row of
+        the combined matrix and one of the others. */
+    void findFrustum() {
+        Matrix clip = projectionMatrix * cameraMatrix;
+        frustum.clear();
+        for ( int r = 0; r < 3; r++ )
+            for ( int sign = -1; sign <= 1; sign += 2 ) {
+                Vector plane( clip[ 3 ][ 0 ] + sign * clip[ r ][ 0 ],
+                              clip[ 3 ][ 1 ] + sign * clip[ r ][ 1 ],
+                              clip[ 3 ][ 2 ] + sign * clip[ r ][ 2 ],
+                              clip[ 3 ][ 3 ] + sign * clip[ r ][ 3 ] );
+
+                // The far plane of an infinite projection comes out
+                // with no normal; there's nothing to cull against.
+                double len = plane.mag();
+                if ( len > 1e-9 )
+                    frustum.push_back( plane / len );
+            }
+    }
+
+    /** Return true if object i might be visible when drawn in the given
+        pass.  Pieces and reflections are rigid copies of the mesh, so
+        its bounding sphere is checked; shadows are flattened by a
+        projection, so the corners of its box are. */
+    bool inFrustum( int i, Pass pass ) {
+        Mesh *mesh = meshList[ objectList[ i ].mesh ];
+        Matrix const &m = passMatrix( i, pass );
+
+        if ( pass != SHADOW ) {
+            Vector c = mesh->center();
+            c.w = 1;
+            c = m * c;
+
+            // Allow for any scaling in the transformation.
+            double r = mesh->radius() * maxScale( m );
+            for ( int p = 0; p < frustum.size(); p++ )
+                if ( frustum[ p ] * c + frustum[ p ].w < -r )
+                    return false;
+            return true;
+        }
+
+        // Culled if all eight corners are outside the same plane.
+        Vector lo = mesh->lowCorner(), hi = mesh->highCorner();
+        Vector corners[ 8 ];
+        for ( int k = 0; k < 8; k++ ) {
+            Vector v = m * Vector( k & 1 ? hi.x : lo.x, k & 2 ? hi.y : lo.y,
+                                   k & 4 ? hi.z : lo.z, 1 );
+            corners[ k ] = v / v.w;
+        }
+        for ( int p = 0; p < frustum.size(); p++ ) {
+            int k = 0;
+            while ( k < 8 && frustum[ p ] * corners[ k ] + frustum[ p ].w < 0 )
+                k++;
+            if ( k == 8 )
+                return false;
+        }
+        return true;
+    }
+
+    /** Return the most the given affine transformation stretches any
+        vector by, taken as the length of its longest column. */
+    static double maxScale( Matrix const &m ) {
+        double scale = 0;
+        for ( int col = 0; col < 3; col++ )
+            scale = max( scale, Vector( m[ 0 ][ col ], m[ 1 ][ col ],
+                                        m[ 2 ][ col ] ).magSquared() );
+        return sqrt( scale );
+    }
+
+    /** Return the level of detail to draw object i at: the coarsest
+        one whose error, scaled by how many pixels a unit covers at the
+        object's nearest point, stays under LOD_PIXELS.  Shadows use the
+        level of the piece casting them. */
+    int lodLevel( int i, Pass pass ) {
+        Mesh *mesh = meshList[ objectList[ i ].mesh ];
+        if ( !useLods || mesh->lodCount() == 1 )
+            return 0;
+
+        Matrix const &m = passMatrix( i, pass == SHADOW ? PIECE : pass );
+        Vector c = mesh->center();
+        c.w = 1;
+        c = cameraMatrix * ( m * c );
+        double scale = maxScale( m );
+        double depth = -c.z - mesh->radius() * scale;
+        if ( depth <= 0 )
+            return 0;
+
+        // The projection takes a unit at this depth to
+        // projectionMatrix[ 1 ][ 1 ] / depth of the window's half height.
+        double pixels = scale * projectionMatrix[ 1 ][ 1 ] * winHeight / 2 / depth;
+        int level = 0;
+        while ( level + 1 < mesh->lodCount() &&
+                mesh->lodError( level + 1 ) * pixels <= LOD_PIXELS )
+            level++;
+        return level;
+    }
+
+    /** Move the camera to the given rotation and elevation angles. */
+    void orbitCamera( double rotation, double elevation ) {
+        camRotation = rotation;
+        camElevation = elevation;
+
+        // rotate about the Y axis, rotate about the X axis, translate
+        // back along the Z axis
+        scene.setLocal( orbitNode, Matrix::translate( 0, 0, -camDistance ) *
+                        Matrix::rotateX( camElevation ) *
+                        Matrix::rotateY( camRotation ) );
+    }
+
+    /** Return the location of the corner of board number b.  Boards are
+        laid out in a square grid, with the first at the origin. */
+    Vector boardOrigin( int b ) {
+        int columns = int( ceil( sqrt( double( boardCount ) ) ) );
+        return Vector( ( b % columns ) * ( BOARD_SIZE + BOARD_GAP ), 0,
+                       ( b / columns ) * ( BOARD_SIZE + BOARD_GAP ) );
+    }
+
+    /** Return the transformation for drawing object i in the given
+        pass. */
+    Matrix const &passMatrix( int i, Pass pass ) {
+        int node = objectList[ i ].node;
+        if ( pass == REFLECTION )
+            return scene.mirrored( node );
+        if ( pass == SHADOW )
+            return scene.shadowed( node );
+        return scene.world( node );
+    }
+
+    /** Return the transformation for drawing object i in the given
+        pass, and fill in the RGBA color to draw it with. */
+    Matrix const &passTransform( int i, Pass pass, GLfloat color[] ) {
+        // Get the object into a local variable, for convenience.
+        Object &obj = objectList[ i ];
+
+        Vector scaledColor = obj.color;
+        
+        // if the current chess piece is selected
+        if (i == selection) {
+            scaledColor = scaledColor * 1.5;
+        }
+        
+        color[ 0 ] = scaledColor.x;
+        color[ 1 ] = scaledColor.y;
+        color[ 2 ] = scaledColor.z;
+        color[ 3 ] = 1.0;
+
+        if ( pass == REFLECTION ) {
+            // mirror the piece through the board, half transparent
+            color[ 3 ] = 0.50;
+        }
+
+        if ( pass == SHADOW ) {
+            // set the shadow color to transparent black
+            color[ 0 ] = color[ 1 ] = color[ 2 ] = 0;
+            color[ 3 ] = 0.50;
+        }
+
+        return passMatrix( i, pass );
+    }
+
+    /** Return the Position square for square x, z of a board.  The
+        light side plays white, from the far row. */
+    static int squareAt( int x, int z ) {
+        return ( BOARD_SIZE - 1 - z ) * BOARD_SIZE + x;
+    }
+
+    /** Return the scene node for Position square sq of board b. */
+    int squareNode( int b, int sq ) {
+        return squareNodes[ b ][ ( BOARD_SIZE - 1 - sq / BOARD_SIZE ) * BOARD_SIZE +
+                                 sq % BOARD_SIZE ];
+    }
+
+    /** Return the mesh that draws Position piece type piece. */
+    static PieceType meshFor( int piece ) {
+        static const PieceType meshes[] = { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING };
+        return meshes[ piece ];
+    }
+
+    /** Return the local matrix of a piece of the given color standing
+        on a square.  The light side's pieces are turned around, to face
+        the dark side's. */
+    static Matrix facing( int color ) {
+        static constexpr Matrix turn = Matrix::rotateY( 180 );
+        return color == Position::WHITE ? turn : Matrix::identity();
+    }
+
+    /** Add a piece of the given type (Position::Piece) and color on
+        Position square sq of board b, or just on the board, to be
+        parked, if sq is -1.  Returns its index in objectList. */
+    int addPiece( int b, int piece, int color, int sq ) {
+        Object obj;
+        obj.mesh = meshFor( piece );
+        obj.color = color == Position::WHITE ? Vector( 0.7, 0.7, 0.4 ) : Vector( 1, 0.3, 0.3 );
+        obj.square = sq;
+        obj.node = scene.add( sq >= 0 ? squareNode( b, sq ) : scene.parent( squareNode( b, 0 ) ),
+                              facing( color ), true );
+        if ( b == 0 && sq >= 0 )
+            squareObject[ sq ] = objectList.size();
+        objectList.push_back( obj );
+        invalidateDrawLists();
+        shadowDirty = true;
+        return objectList.size() - 1;
+    }
+
+    /** Return true if it's the computer's move on the first board. */
+    bool computerTurn() {
+        return computerPlaying && game.sideToMove() == computerColor;
+    }
+
+    /** Select object i (or nothing, if i is -1), and find the squares it
+        can move to, if it's on the first board, its side is to move, and
+        that side isn't the computer's. */
+    void select( int i ) {
+        selection = i;
+        destinations = 0;
+        if ( i >= 0 && objectList[ i ].square >= 0 &&
+             squareObject[ objectList[ i ].square ] == i && !computerTurn() ) {
+            Move moves[ Position::MAX_MOVES ];
+            int count = game.legalMoves( moves );
+            for ( int m = 0; m < count; m++ )
+                if ( moves[ m ].from() == objectList[ i ].square )
+                    destinations |= squareBit( moves[ m ].to() );
+        }
+        // the selected piece is drawn brighter
+        invalidateDrawLists();
+    }
+
+    /** Move the piece on square from of the first board to square to,
+        keeping squareObject up to date. */
+    void movePiece( int from, int to ) {
+        int i = squareObject[ from ];
+        squareObject[ to ] = i;
+        squareObject[ from ] = -1;
+        objectList[ i ].square = to;
+        scene.setParent( objectList[ i ].node, squareNode( 0, to ) );
+    }
+
+    /** Return where the k-th captured piece of the given color is
+        parked, relative to the corner of the first board. */
+    static Vector parkingPlace( int color, int k ) {
+        double x = color == Position::WHITE ? -0.75 - 0.9 * ( k / BOARD_SIZE ) :
+            BOARD_SIZE + 0.75 + 0.9 * ( k / BOARD_SIZE );
+        return Vector( x, 0, k % BOARD_SIZE + 0.5 );
+    }
+
+    /** Park object i, a piece of the given color that's off the first
+        board, beside it, after the others of its color. */
+    void parkPiece( int i, int color ) {
+        Vector place = parkingPlace( color, parkedCount[ color ] );
+        parked[ color ][ parkedCount[ color ]++ ] = i;
+        objectList[ i ].square = -1;
+        int board = scene.parent( squareNode( 0, 0 ) );
+        scene.setParent( objectList[ i ].node, board );
+        scene.setLocal( objectList[ i ].node,
+                        Matrix::translate( place.x, place.y, place.z ) *
+                        scene.local( objectList[ i ].node ) );
+    }
+
+    /** Take the piece on square sq of the first board off, park it
+        beside the board with the others of its color, and return its
+        index in objectList. */
+    int capturePiece( int sq ) {
+        int i = squareObject[ sq ];
+        squareObject[ sq ] = -1;
+        parkPiece( i, game.colorOn( sq ) );
+        return i;
+    }
+
+    /** Put object i, the last piece parked of the color now on square
+        sq of the first board, back on that square. */
+    void restorePiece( int i, int sq ) {
+        int color = game.colorOn( sq );
+        Vector place = parkingPlace( color, --parkedCount[ color ] );
+        squareObject[ sq ] = i;
+        objectList[ i ].square = sq;
+        scene.setParent( objectList[ i ].node, squareNode( 0, sq ) );
+        scene.setLocal( objectList[ i ].node,
+                        Matrix::translate( -place.x, -place.y, -place.z ) *
+                        scene.local( objectList[ i ].node ) );
+    }
+
+    /** Play the legal move m on the first board, moving only the
+        objects it touches. */
+    void playMove( Move m ) {
+        Played record;
+        record.move = m;
+        record.captured = -1;
+        int from = m.from(), to = m.to();
+        if ( m.kind() == Move::EN_PASSANT ) {
+            record.capturedSquare = to + ( game.sideToMove() == Position::WHITE ?
+                                           -BOARD_SIZE : BOARD_SIZE );
+            record.captured = capturePiece( record.capturedSquare );
+        } else if ( squareObject[ to ] >= 0 ) {
+            record.capturedSquare = to;
+            record.captured = capturePiece( to );
+        }
+        movePiece( from, to );
+
+        // The rook comes along when castling, from the corner on the
+        // king's side of the move to the square the king passed over.
+        if ( m.kind() == Move::CASTLE )
+            movePiece( to > from ? from + 3 : from - 4, ( from + to ) / 2 );
+        if ( m.kind() == Move::PROMOTION )
+            objectList[ squareObject[ to ] ].mesh = meshFor( m.promotion() );
+
+        gameKeys.push_back( game.hashKey() );
+        game.makeMove( m, record.undo );
+        played.push_back( record );
+        invalidateDrawLists();
+        shadowDirty = true;
+    }
+
+    /** Take back the last move played on the first board, moving only
+        the objects it touched. */
+    void unplayMove() {
+        Played record = played.back();
+        played.pop_back();
+        game.unmakeMove( record.move, record.undo );
+        gameKeys.pop_back();
+
+        int from = record.move.from(), to = record.move.to();
+        if ( record.move.kind() == Move::PROMOTION )
+            objectList[ squareObject[ to ] ].mesh = PAWN;
+        if ( record.move.kind() == Move::CASTLE )
+            movePiece( ( from + to ) / 2, to > from ? from + 3 : from - 4 );
+        movePiece( to, from );
+        if ( record.captured >= 0 )
+            restorePiece( record.captured, record.capturedSquare );
+        invalidateDrawLists();
+        shadowDirty = true;
+    }
+
+    /** Show pos on the first board, as a fresh start, forgetting the
+        moves played to get here.  Only the squares that change are
+        touched: a piece that stays its color keeps its object, with a
+        new mesh if it changes type, and pieces that appear take objects
+        lifted off other squares, then parked ones.  Nothing is added to
+        the scene or allocated, so this is quick enough to flip through
+        thousands of positions a second.  Returns false, leaving the
+        board alone, if either side has more pieces than objects. */
+    bool setPosition( Position const &pos ) {
+        for ( int color = 0; color < 2; color++ )
+            if ( squareCount( pos.pieces( color ) ) > PIECE_COUNT / 2 )
+                return false;
+        stopThinking();
+
+        Bitboard changed = 0;
+        for ( int color = 0; color < 2; color++ )
+            for ( int piece = 0; piece < 6; piece++ )
+                changed |= game.pieces( color, piece ) ^ pos.pieces( color, piece );
+
+        // Lift off the pieces that go, keeping their objects to hand.
+        int lifted[ 2 ][ PIECE_COUNT / 2 ];
+        int liftedCount[ 2 ] = { 0, 0 };
+        Bitboard going = changed & game.occupied();
+        while ( going ) {
+            int sq = popSquare( going );
+            int i = squareObject[ sq ], color = game.colorOn( sq );
+            if ( pos.pieceOn( sq ) != Position::NO_PIECE && pos.colorOn( sq ) == color ) {
+                objectList[ i ].mesh = meshFor( pos.pieceOn( sq ) );
+                continue;
+            }
+            lifted[ color ][ liftedCount[ color ]++ ] = i;
+            squareObject[ sq ] = -1;
+        }
+
+        // Put pieces on the squares left empty, then park what's over.
+        Bitboard coming = changed & pos.occupied();
+        while ( coming ) {
+            int sq = popSquare( coming );
+            if ( squareObject[ sq ] >= 0 )
+                continue;
+            int color = pos.colorOn( sq ), i;
+            if ( liftedCount[ color ] > 0 ) {
+                i = lifted[ color ][ --liftedCount[ color ] ];
+            } else {
+                i = parked[ color ][ --parkedCount[ color ] ];
+                scene.setLocal( objectList[ i ].node, facing( color ) );
+            }
+            objectList[ i ].mesh = meshFor( pos.pieceOn( sq ) );
+            objectList[ i ].square = sq;
+            squareObject[ sq ] = i;
+            scene.setParent( objectList[ i ].node, squareNode( 0, sq ) );
+        }
+        for ( int color = 0; color < 2; color++ )
+            while ( liftedCount[ color ] > 0 )
+                parkPiece( lifted[ color ][ --liftedCount[ color ] ], color );
+
+        game = pos;
+        played.clear();
+        gameKeys.clear();
+        pgnPlies = 0;
+        select( -1 );
+        shadowDirty = true;
+        return true;
+    }
+
+    /** Show the position after the first n moves of the PGN game (as
+        many as there are, if n is past the end), playing or taking back
+        just the moves in between. */
+    void seekPly( int n ) {
+        n = max( 0, min( n, int( pgnGame.moves.size() ) ) );
+        stopThinking();
+        while ( int( played.size() ) > min( n, pgnPlies ) )
+            unplayMove();
+        pgnPlies = played.size();
+        while ( pgnPlies < n )
+            playMove( pgnGame.moves[ pgnPlies++ ] );
+        select( -1 );
+    }
+
+    /** Show game number index (from 0) of the PGN file from its first
+        position, and return true, or return false if the file doesn't
+        have that many games.  Without an index, games before it that
+        haven't been seen yet are skipped over, just noting where they
+        start. */
+    bool loadGame( int index ) {
+        if ( !replaying || index < 0 )
+            return false;
+
+        PgnGame next;
+        if ( indexed ) {
+            if ( !archive.game( index, next ) )
+                return false;
+        } else if ( !readGame( index, next ) ) {
+            return false;
+        }
+
+        // Back to the starting position, then on to the new game.
+        seekPly( 0 );
+        swap( pgnGame, next );
+        pgnIndex = index;
+        pgnPlies = 0;
+
+        printf( "game %d: %s - %s, %s, %d plies\n", index + 1,
+                pgnGame.tag( "White" ).c_str(), pgnGame.tag( "Black" ).c_str(),
+                pgnGame.result.empty() ? "no result" : pgnGame.result.c_str(),
+                int( pgnGame.moves.size() ) );
+        if ( !pgnGame.error.empty() )
+            printf( "  stops short: %s\n", pgnGame.error.c_str() );
+
+        // A game from a set-up position starts the board afresh.
+        if ( pgnGame.start.hashKey() != game.hashKey() && !setPosition( pgnGame.start ) ) {
+            printf( "  starts from a position with too many pieces to show\n" );
+            pgnGame.moves.clear();
+        }
+        return true;
+    }
+
+    /** Read game number index (from 0) of the PGN file into next, and
+        return true, or return false if the file doesn't have that many
+        games. */
+    bool readGame( int index, PgnGame &next ) {
+        if ( index >= int( pgnOffsets.size() ) ) {
+            double start = elapsedMs();
+            int known = pgnOffsets.size();
+            pgn.seek( pgnOffsets.empty() ? 0 : pgnOffsets.back() );
+            if ( !pgnOffsets.empty() )
+                pgn.skip();
+            while ( index >= int( pgnOffsets.size() ) ) {
+                uint64_t offset = pgn.tell();
+                if ( !pgn.skip() )
+                    return false;
+                pgnOffsets.push_back( offset );
+            }
+            double seconds = ( elapsedMs() - start ) / 1000;
+            if ( index - known > 1000 )
+                printf( "skipped %d games in %.3f s, %.0f games/s\n", index - known,
+                        seconds, ( index - known ) / max( seconds, 1e-6 ) );
+        }
+
+        pgn.seek( pgnOffsets[ index ] );
+        return pgn.next( next );
+    }
+
+    /** Look up the position with the given key in the index, and show
+        the first game that reaches it, at that point.  Returns false if
+        no game does. */
+    bool findPosition( uint64_t key ) {
+        if ( !indexed ) {
+            cout << "Finding positions needs an index (-index file)" << endl;
+            return false;
+        }
+        PgnIndex::Hit hit = archive.find( key );
+        if ( hit.game < 0 ) {
+            cout << "No game reaches that position" << endl;
+            return false;
+        }
+        if ( !loadGame( hit.game ) )
+            return false;
+        seekPly( hit.ply );
+        printf( "reached %d times, first at ply %d of game %d%s\n", hit.reached, hit.ply,
+                hit.game + 1, game.hashKey() == key ? "" : ", which can't be shown" );
+        return true;
+    }
+
+    /** If it's the computer's move, start it thinking in the
+        background.  idle() picks up its choice. */
+    void startThinking() {
+        if ( !computerTurn() || thinking )
+            return;
+
+        // The callback runs on the search's thread, so all it does is
+        // hand the result over.
+        Search::Limits limits;
+        limits.milliseconds = thinkMs;
+        thinking = true;
+        search.start( game, gameKeys, limits, [ this ]( Search::Result const &result ) {
+            lock_guard< mutex > hold( resultLock );
+            searchResult = result;
+            resultReady = true;
+        } );
+        if ( !headless )
+            glutIdleFunc( ::idle );
+    }
+
+    /** Stop the computer thinking, and throw away its move. */
+    void stopThinking() {
+        search.stop();
+        search.wait();
+        lock_guard< mutex > hold( resultLock );
+        resultReady = false;
+        thinking = false;
+    }
+
+    /** Stop the computer playing, if it is.  Stepping around a game is
+        no place for it. */
+    void stopComputer() {
+        if ( computerPlaying ) {
+            stopThinking();
+            computerPlaying = false;
+            cout << "Computer stops playing" << endl;
+        }
+    }
+
+    /** If the computer has chosen its move, start the piece sliding
+        over to play it.  Returns true if it had. */
+    bool takeComputerMove() {
+        Search::Result result;
+        {
+            lock_guard< mutex > hold( resultLock );
+            if ( !resultReady )
+                return false;
+            resultReady = false;
+            result = searchResult;
+        }
+        search.wait();
+        thinking = false;
+
+        if ( result.best.isNull() ) {
+            cout << "No legal moves, the computer stops playing" << endl;
+            computerPlaying = false;
+            return true;
+        }
+        printf( "computer plays %s, score %+.2f at depth %d, %.0f nodes/s on %d threads\n",
+                result.best.name().c_str(), result.score / 100.0, result.depth,
+                result.nodes / max( result.seconds, 1e-6 ), result.threads );
+
+        animObject = squareObject[ result.best.from() ];
+        animMove = result.best;
+        animStart = elapsedMs();
+        animLocal = scene.local( objectList[ animObject ].node );
+        select( animObject );
+        return true;
+    }
+
+    /** Move the sliding piece along, and play its move once it gets
+        there. */
+    void animate() {
+        int node = objectList[ animObject ].node;
+        double t = ( elapsedMs() - animStart ) / ANIMATION_MS;
+        if ( t >= 1 ) {
+            scene.setLocal( node, animLocal );
+            animObject = -1;
+            playMove( animMove );
+            select( -1 );
+            return;
+        }
+
+        // The piece still hangs off the square it started on; lift it a
+        // little on the way over.  Board rows run against the ranks.
+        int from = animMove.from(), to = animMove.to();
+        double dx = to % BOARD_SIZE - from % BOARD_SIZE;
+        double dz = from / BOARD_SIZE - to / BOARD_SIZE;
+        scene.setLocal( node, Matrix::translate( dx * t, 0.5 * sin( PI * t ), dz * t ) *
+                        animLocal );
+        invalidateDrawLists();
+        shadowDirty = true;
+    }
+
+    /** Add the pieces of pos to board b.  The first board gets spare
+        objects too, parked beside it, for the pieces pos doesn't have,
+        so setPosition() never runs short.  The dark side goes first,
+        then the light; each side's pieces go in the order of the
+        mesh types, from the side's own right hand file across, and its
+        spares are the pieces of the starting set that are missing. */
+    void addPieces( int b, Position const &pos ) {
+        static const int pieces[] = { Position::PAWN, Position::ROOK, Position::KNIGHT,
+                                      Position::BISHOP, Position::QUEEN, Position::KING };
+        static const int fullSet[] = { 8, 2, 2, 2, 1, 1 };
+        for ( int color = Position::BLACK; color >= Position::WHITE; color-- ) {
+            int spares = PIECE_COUNT / 2 - squareCount( pos.pieces( color ) );
+            for ( int k = 0; k < 6; k++ ) {
+                for ( int s = 0; s < 64; s++ ) {
+                    int sq = color == Position::BLACK ? s : 63 - s;
+                    if ( pos.pieces( color, pieces[ k ] ) & squareBit( sq ) )
+                        addPiece( b, pieces[ k ], color, sq );
+                }
+                int missing = fullSet[ k ] - squareCount( pos.pieces( color, pieces[ k ] ) );
+                for ( ; b == 0 && spares > 0 && missing > 0; spares--, missing-- )
+                    parkPiece( addPiece( b, pieces[ k ], color, -1 ), color );
+            }
+        }
+    }
+
+    /** Mark all the cached draw lists, and the detail they're drawn at,
+        as out of date.  Call this when an object is added, moved, or
+        changes color, or when a mesh or the way levels are chosen
+        changes. */
+    void invalidateDrawLists() {
+        for ( int p = 0; p <= PIECE; p++ )
+            for ( int c = 0; c < 2; c++ ) {
+                drawLists[ p ][ c ].dirty = true;
+                drawLists[ p ][ c ].stale = true;
+            }
+    }
+
+    /** Work out list's detail and counts for the given pass, culled or
+        not, unless nothing they depend on has changed since last time. */
+    void sortObjects( DrawList &list, Pass pass, bool cull ) {
+        if ( !list.stale && list.sceneVersion == scene.recomputed() &&
+             list.frustumVersion == frustumChanges &&
+             list.detail.size() == objectList.size() )
+            return;
+
+        list.detail.assign( objectList.size(), -1 );
+        list.drawn = list.culled = 0;
+        list.triangles = 0;
+        for ( int i = 0; i < objectList.size(); i++ ) {
+            Mesh *mesh = meshList[ objectList[ i ].mesh ];
+            if ( !mesh )
+                continue;
+            if ( !cull || inFrustum( i, pass ) ) {
+                list.detail[ i ] = cull ? lodLevel( i, pass ) : 0;
+                list.triangles += mesh->triangles( list.detail[ i ] );
+                list.drawn++;
+            } else {
+                list.culled++;
+            }
+        }
+        list.stale = false;
+        list.sceneVersion = scene.recomputed();
+        list.frustumVersion = frustumChanges;
+    }
+
+    /** Rebuild the cached instance list for the given pass from the
+        objects and levels of detail in its detail, grouping the
+        instances by mesh and level and uploading them in one go. */
+    void buildDrawList( DrawList &list, Pass pass ) {
+        int groups = meshList.size() * Mesh::MAX_LODS;
+        list.first.assign( groups, 0 );
+        list.count.assign( groups, 0 );
+
+        // Objects the pass skips, culled or still loading, have a
+        // detail of -1 and go in no group.
+        instances.clear();
+        for ( int g = 0; g < groups; g++ ) {
+            list.first[ g ] = instances.size();
+            for ( int i = 0; i < objectList.size(); i++ )
+                if ( list.detail[ i ] >= 0 &&
+                     objectList[ i ].mesh * Mesh::MAX_LODS + list.detail[ i ] == g ) {
+                    Instancer::Instance inst;
+                    passTransform( i, pass, inst.color ).glStore( inst.model );
+                    instances.push_back( inst );
+                }
+            list.count[ g ] = instances.size() - list.first[ g ];
+        }
+
+        if ( !list.buffer )
+            glGenBuffers( 1, &list.buffer );
+        glBindBuffer( GL_ARRAY_BUFFER, list.buffer );
+        glBufferData( GL_ARRAY_BUFFER,
+                      instances.size() * sizeof( Instancer::Instance ),
+                      instances.empty() ? NULL : &instances[ 0 ],
+                      GL_STATIC_DRAW );
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        list.dirty = false;
+        list.included = list.detail;
+    }
+
+    /** Draw every object whose mesh has loaded, for the given pass.  If
+        cull is true, skip any that are outside the view and draw the
+        rest at the level of detail their size on the screen calls for;
+        otherwise, draw everything in full.  If instancing is available,
+        the pass comes from its cached draw list, with one instanced call
+        for each type of piece and level; otherwise (and always while
+        selecting, since the pieces need their own names) objects are
+        drawn one at a time. */
+    void drawObjects( Pass pass, bool cull = true ) {
+        GLint renderMode;
+        glGetIntegerv( GL_RENDER_MODE, &renderMode );
+
+        // Decide what to draw and how finely, if anything has changed,
+        // and keep count for the statistics.  Every triangle counts,
+        // but objects drawn and culled are only counted for the view.
+        DrawList &list = drawLists[ pass ][ cull ];
+        sortObjects( list, pass, cull );
+        vector< int > const &detail = list.detail;
+        triangleCount += list.triangles;
+        if ( cull ) {
+            drawnCount[ pass ] += list.drawn;
+            culledCount[ pass ] += list.culled;
+        }
+
+        if ( instancing && instancer.available() && !Mesh::immediateMode &&
+             renderMode == GL_RENDER ) {
+            // The list only has to be rebuilt when what's visible, or the
+            // detail it's drawn at, changes, not every time the camera
+            // moves.
+            if ( list.dirty || list.included != detail )
+                buildDrawList( list, pass );
+
+            // The whole pass is already on the GPU; one call per mesh and
+            // level.
+            for ( int g = 0; g < list.count.size(); g++ ) {
+                Mesh *mesh = meshList[ g / Mesh::MAX_LODS ];
+                if ( mesh && list.count[ g ] ) {
+                    instancer.draw( mesh, list.buffer, list.first[ g ],
+                                    list.count[ g ], g % Mesh::MAX_LODS );
+                    drawCalls++;
+                }
+            }
+            return;
+        }
+
+        for ( int i = 0; i < objectList.size(); i++ ) {
+            // Skip pieces whose mesh is still loading, or can't be seen.
+            if ( detail[ i ] < 0 )
+                continue;
+
+            GLfloat color[ 4 ];
+            Matrix const &trans = passTransform( i, pass, color );
+            glColor4fv( color );
+            
+            // Apply the object's transformation.
+            glPushMatrix();
+            trans.glMult();
+            
+            // Add name to the namestack, so pieces can be selected.
+            if ( pass == PIECE )
+                glPushName(i);
+
+            // Draw the mesh.
+            meshList[ objectList[ i ].mesh ]->draw( detail[ i ] );
+            drawCalls++;
+            
+            if ( pass == PIECE )
+                glPopName();
+      
+            glPopMatrix();
+        }
+    }
+
+    /** Draw the squares of every board, marking the squares the
+        selected piece can move to. */
+    void drawBoards() {
+        glBegin( GL_QUADS );
+        for ( int b = 0; b < boardCount; b++ ) {
+            Vector origin = boardOrigin( b );
+            for ( int x = 0; x < BOARD_SIZE; x++ )
+                for ( int z = 0; z < BOARD_SIZE; z++ ) {
+                    // Pick a color based on the parity of the square.
+                    if ( b == 0 && ( destinations & squareBit( squareAt( x, z ) ) ) )
+                        glColor3f( 0.5, 0.8, 0.4 );
+                    else if ( ( x + z ) % 2 == 0 )
+                        glColor3f( 0.8, 0.6, 0.3 );
+                    else
+                        glColor3f( 0.9, 0.4, 0.3 );
+                
+                    // Draw a 1x1 quad for this square.
+                    glVertex3d( origin.x + x, 0, origin.z + z );
+                    glVertex3d( origin.x + x, 0, origin.z + z + 1 );
+                    glVertex3d( origin.x + x + 1, 0, origin.z + z + 1 );
+                    glVertex3d( origin.x + x + 1, 0, origin.z + z );
+                }
+        }
+        glEnd();
+    }
+
+    /** Render the pieces into the shadow map, if they've changed since
+        it was last rendered. */
+    void updateShadowMap() {
+        if ( !shadowMap.available() || !shadowDirty )
+            return;
+
+        // Pieces out of view can still cast shadows into it.
+        shadowMap.begin();
+        drawObjects( PIECE, false );
+        shadowMap.end();
+        shadowDirty = false;
     }
 
     void drawScene() {
+        GLint renderMode;
+        glGetIntegerv( GL_RENDER_MODE, &renderMode );
+
         // Don't use z-buffer while we draw the board and shadows.
         glDisable( GL_DEPTH_TEST );
         
@@ -148,22 +1213,7 @@ class ChessBoard {
         glStencilFunc(GL_ALWAYS, 1, 1);
         glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
         
-        glBegin( GL_QUADS );
-        for ( int x = 0; x < BOARD_SIZE; x++ )
-            for ( int z = 0; z < BOARD_SIZE; z++ ) {
-                // Pick a color based on the parity of the square.
-                if ( ( x + z ) % 2 == 0 )
-                    glColor3f( 0.8, 0.6, 0.3 );
-                else
-                    glColor3f( 0.9, 0.4, 0.3 );
-                
-                // Draw a 1x1 quad for this square.
-                glVertex3d( x, 0, z );
-                glVertex3d( x, 0, z + 1 );
-                glVertex3d( x + 1, 0, z + 1 );
-                glVertex3d( x + 1, 0, z );
-            }
-        glEnd();
+        drawBoards();
         
         glStencilFunc(GL_EQUAL, 1, 1);
         glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
@@ -174,67 +1224,22 @@ class ChessBoard {
         // Draw reflections
         //
         glEnable( GL_DEPTH_TEST );
-        for ( int i = 0; i < objectList.size(); i++ ) {
-            // Get the object into a local variable, for convenience.
-            Object &obj = objectList[ i ];
-            
-            Vector scaledColor = obj.color;
-            
-            // if the current chess piece is selected
-            if (i == selection) {
-                scaledColor = scaledColor * 1.5;
-            }
-            
-            glColor4f(scaledColor.x, scaledColor.y, scaledColor.z, 0.50);
-            
-            // Apply the object's transformation.
-            glPushMatrix();
-            
-            // apply the shadow matrix, flattening the y axis
-            Matrix trans = Matrix::identity();
-            trans = trans * obj.trans;
-            trans = trans * Matrix::rotateZ(180);
-            trans.glMult();
-            
-            //
-            // Draw the mesh.
-            meshList[ objectList[ i ].mesh ]->draw();
-            
-            glPopMatrix();
-        }
+        drawObjects( REFLECTION );
         
         //
-        // Draw shadows
+        // Draw shadows.  With a shadow map, that's just the board again,
+        // darkened where the map says it's in shadow.  Otherwise, fall
+        // back to flattening every piece onto the board.
         //
         glDisable(GL_DEPTH_TEST);
-        for ( int i = 0; i < objectList.size(); i++ ) {
-            // Get the object into a local variable, for convenience.
-            Object &obj = objectList[ i ];
-            
-            // set the shadow color to transparent black
-            glColor4f(0, 0, 0, 0.50);
-            
-            // Matrix to create shadows
-            float shadowMatrix[16] = {18, 0, 0, 0,
-                -1, 18, -1, -1,
-                0, 0, 18, 0,
-                0, 0, 0, 18};
-            
-            
-            // Apply the object's transformation.
-            glPushMatrix();
-            
-            // apply the shadow matrix, flattening the y axis
-            Matrix trans = Matrix::scale(1, 0, 1);
-            trans = trans * Matrix::glConvert(shadowMatrix);
-            trans = trans * obj.trans;
-            trans.glMult();
-            
-            //
-            // Draw the mesh.
-            meshList[ objectList[ i ].mesh ]->draw();
-            
-            glPopMatrix();
+        if ( shadowMap.available() ) {
+            if ( renderMode == GL_RENDER ) {
+                shadowMap.beginOverlay();
+                drawBoards();
+                shadowMap.endOverlay();
+            }
+        } else {
+            drawObjects( SHADOW );
         }
 
         // Done drawing shadows/reflection; disable blending
@@ -253,34 +1258,12 @@ class ChessBoard {
         // the pieces that we don't want clipped by the stencil.
         glDisable(GL_CLIP_PLANE0);
         glDisable(GL_STENCIL_TEST);
-        // Draw everything on the board.
-        for ( int i = 0; i < objectList.size(); i++ ) {
-            // Get the object into a local variable, for convenience.
-            Object &obj = objectList[ i ];
-            
-            Vector scaledColor = obj.color;
-            
-            // if the current chess piece is selected
-            if (i == selection) {
-                scaledColor = scaledColor * 1.5;
-            }
-            
-            glColor3f(scaledColor.x, scaledColor.y, scaledColor.z);
-
-            // Apply the object's transformation.
-            glPushMatrix();
-            obj.trans.glMult();
-            
-            // Add name to the namestack
-            glPushName(i);
-
-            // Draw the mesh.
-            meshList[ objectList[ i ].mesh ]->draw();
-            
-            glPopName();
-      
-            glPopMatrix();
-        }
+        // Draw everything on the board, with the pieces shadowing each
+        // other.
+        if ( shadowMap.available() && renderMode == GL_RENDER )
+            instancer.setShadowMap( &shadowMap );
+        drawObjects( PIECE );
+        instancer.setShadowMap( NULL );
         // reset the material properties for shadows and the board
         // to remove specular highlights
         GLfloat mat_specular_zero[] = { 0, 0, 0, 1.0 };
@@ -289,15 +1272,128 @@ class ChessBoard {
         glMaterialfv(GL_FRONT, GL_SHININESS, mat_shininess_zero);
     }
 
+    /** Upload and install any meshes the loader has finished, and drop
+        the loader once it's done.  Returns true if anything changed. */
+    bool installMeshes() {
+        bool changed = false;
+        for ( int i = 0; i < meshList.size(); i++ )
+            if ( !meshList[ i ] ) {
+                // A mesh that can't be loaded leaves its slot empty, and
+                // its pieces just aren't drawn.
+                string error;
+                Mesh *mesh = loader->take( i, error );
+                if ( mesh ) {
+                    mesh->upload();
+                    meshList[ i ] = mesh;
+                    changed = true;
+                    shadowDirty = true;
+                    invalidateDrawLists();
+                } else if ( !error.empty() ) {
+                    cerr << error << endl;
+                }
+            }
+
+        if ( loader->finished() ) {
+            delete loader;
+            loader = NULL;
+        }
+        return changed;
+    }
+
+    /** Return milliseconds on a steady clock, for timing frames. */
+    static double elapsedMs() {
+        return chrono::duration< double, milli >(
+            chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+    /** Find the ray under the mouse x, y location, in world
+        coordinates, as a point on the near plane and a direction. */
+    void pickRay( int x, int y, Vector &nearPt, Vector &dir ) {
+        // Take the mouse location to normalized device coordinates, and
+        // back through the view to a point on the near plane and one
+        // further in.  Our projection has no far plane (it's at
+        // infinity), so the second point can't be on it.
+        double nx = 2.0 * x / winWidth - 1;
+        double ny = 1 - 2.0 * y / winHeight;
+        Matrix unproject = ( projectionMatrix * cameraMatrix ).inverse();
+        nearPt = unproject * Vector( nx, ny, -1, 1 );
+        Vector farPt = unproject * Vector( nx, ny, 0, 1 );
+        nearPt = nearPt / nearPt.w;
+        farPt = farPt / farPt.w;
+        dir = farPt - nearPt;
+    }
+
+    /** Return the Position square of the first board under the mouse x,
+        y location, or -1 if the mouse isn't over the first board. */
+    int pickSquare( int x, int y ) {
+        Vector nearPt, dir;
+        pickRay( x, y, nearPt, dir );
+        if ( dir.y >= 0 )
+            return -1;
+
+        // The board is the y = 0 plane, from the origin to BOARD_SIZE
+        // along x and z.
+        double t = -nearPt.y / dir.y;
+        double bx = nearPt.x + t * dir.x, bz = nearPt.z + t * dir.z;
+        if ( bx < 0 || bx >= BOARD_SIZE || bz < 0 || bz >= BOARD_SIZE )
+            return -1;
+        return squareAt( int( bx ), int( bz ) );
+    }
+
+    /** Return the index in objectList of the closest piece under the
+        mouse x, y location, or -1 if there isn't one.  This casts a ray
+        through the stored projection and camera matrices and tests it
+        against each piece's bounding volume hierarchy, all on the CPU. */
+    int pickObject( int x, int y ) {
+        Vector nearPt, dir;
+        pickRay( x, y, nearPt, dir );
+
+        // The ray parameter is the same in every object's model space,
+        // so hits on different objects can be compared directly.
+        int closest = -1;
+        double t = 1e30;
+        for ( int i = 0; i < objectList.size(); i++ ) {
+            Mesh *mesh = meshList[ objectList[ i ].mesh ];
+            if ( !mesh )
+                continue;
+
+            Matrix const &inv = scene.inverse( objectList[ i ].node );
+            if ( mesh->intersect( inv * nearPt, inv * dir, t ) )
+                closest = i;
+        }
+        return closest;
+    }
+
+    /** Time picking at the mouse x, y location with the CPU ray cast
+        and with the GL_SELECT path, and report both. */
+    void benchmarkPicking( int x, int y ) {
+        typedef chrono::high_resolution_clock Clock;
+        const int SELECT_RUNS = 100, RAY_RUNS = 10000;
+
+        int rayPick = -1;
+        Clock::time_point start = Clock::now();
+        for ( int i = 0; i < RAY_RUNS; i++ )
+            rayPick = pickObject( x, y );
+        double rayTime = chrono::duration< double, micro >( Clock::now() - start ).count();
+
+        vector< GLuint > namestack;
+        start = Clock::now();
+        for ( int i = 0; i < SELECT_RUNS; i++ )
+            namestack = selectGeometry( x, y );
+        double selectTime = chrono::duration< double, micro >( Clock::now() - start ).count();
+        int selectPick = namestack.size() ? namestack[ 0 ] : -1;
+
+        printf( "ray cast:  %10.2f us/pick, picked %d\n", rayTime / RAY_RUNS, rayPick );
+        printf( "GL_SELECT: %10.2f us/pick, picked %d\n", selectTime / SELECT_RUNS,
+                selectPick );
+        glutPostRedisplay();
+    }
+
     /** Find any geometry that's near the mouse x, y location,
         and return a copy of the namestack for the closest object
         in depth at that location.  If no object is found, an empty
         vector is returned. */
     vector< GLuint > selectGeometry( int x, int y ) {
-        // Get the window size for setting up the camera.
-        int winWidth = glutGet( GLUT_WINDOW_WIDTH );
-        int winHeight = glutGet( GLUT_WINDOW_HEIGHT );
-
         // Get a copy of the viewport transformation.
         GLint view[ 4 ];
         glGetIntegerv( GL_VIEWPORT, view );
@@ -356,6 +1452,10 @@ class ChessBoard {
 
 public:
     ~ChessBoard() {
+        // Stop any loading or thinking that's still going on.
+        delete loader;
+        stopThinking();
+
         // Delete all the meshes we loaded.
         while ( meshList.size() ) {
             delete meshList.back();
@@ -363,20 +1463,67 @@ public:
         }
     }
 
-    /** Create output window, initialize OpenGL features for the driver. */
-    void init( int &argc, char *argv[] ) {
-        // Load peshes for all the pieces.
-        meshList.push_back( new Mesh( "pawn.mesh" ) );
-        meshList.push_back( new Mesh( "rook.mesh" ) );
-        meshList.push_back( new Mesh( "knight.mesh" ) );
-        meshList.push_back( new Mesh( "bishop.mesh" ) );
-        meshList.push_back( new Mesh( "queen.mesh" ) );
-        meshList.push_back( new Mesh( "king.mesh" ) );
+    /** Create output window, initialize OpenGL features for the driver.
+        If offscreen is true, render into an offscreen framebuffer
+        instead, without using GLUT at all.  Returns false if we can't
+        get a context to draw with. */
+    bool init( int &argc, char *argv[], bool offscreen ) {
+        // "-boards n" fills the scene with n boards worth of pieces, and
+        // keeps redrawing and reporting the frame time.
+        boardCount = 1;
+        for ( int i = 1; i + 1 < argc; i++ )
+            if ( string( argv[ i ] ) == "-boards" )
+                boardCount = max( 1, atoi( argv[ i + 1 ] ) );
+
+        // "-nolod" draws every piece in full detail, for comparison,
+        // "-distance d" backs the camera off to see more of the boards,
+        // and "-packed bits" packs the mesh vertex buffers, with normals
+        // of 8 or 16 bits.
+        useLods = true;
+        camDistance = 12;
+        for ( int i = 1; i < argc; i++ ) {
+            if ( string( argv[ i ] ) == "-nolod" )
+                useLods = false;
+            if ( string( argv[ i ] ) == "-distance" && i + 1 < argc )
+                camDistance = max( 1.0, atof( argv[ i + 1 ] ) );
+            if ( string( argv[ i ] ) == "-packed" && i + 1 < argc )
+                Mesh::packing.normalBits = atoi( argv[ i + 1 ] ) > 8 ? 16 : 8;
+        }
+
+        // "-think ms" sets how long the computer takes over a move.
+        thinkMs = THINK_MS;
+        for ( int i = 1; i + 1 < argc; i++ )
+            if ( string( argv[ i ] ) == "-think" )
+                thinkMs = max( 1, atoi( argv[ i + 1 ] ) );
+
+        // Start loading meshes for all the pieces, in PieceType order.
+        // They're parsed in the background, and installed by idle() as
+        // they finish, so the board can be shown in the meantime.
+        vector< string > meshFiles;
+        meshFiles.push_back( "pawn.mesh" );
+        meshFiles.push_back( "rook.mesh" );
+        meshFiles.push_back( "knight.mesh" );
+        meshFiles.push_back( "bishop.mesh" );
+        meshFiles.push_back( "queen.mesh" );
+        meshFiles.push_back( "king.mesh" );
+        loader = new MeshLoader( meshFiles );
+        meshList.assign( meshFiles.size(), NULL );
 
         // Make a new window with double buffering and with Z buffer.
-        glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_STENCIL );
-        glutInitWindowSize( 800, 600 );
-        glutCreateWindow( "Chess Board" );
+        headless = offscreen;
+        winWidth = 800;
+        winHeight = 600;
+        if ( headless ) {
+            if ( !createHeadlessContext( winWidth, winHeight ) )
+                return false;
+        } else {
+            glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_STENCIL );
+            glutInitWindowSize( winWidth, winHeight );
+            glutCreateWindow( "Chess Board" );
+        }
+
+        // Use instanced drawing for the pieces if the context supports it.
+        instancing = instancer.init();
     
         // Initialize background color.
         glClearColor( 0.6, 0.6, 0.6, 0 );
@@ -390,116 +1537,422 @@ public:
         // enable one light
         glEnable(GL_LIGHT0);
         
-        // position of light
-        GLfloat light0_pos[] = {1.0, 18.0, 1.0, 1.0};
         // anbient component
         GLfloat ambient0[] = {0.2, 0.2, 0.2, 1.0};
         // diffuse component
         GLfloat diffuse0[] = {0.5, 0.5, 0.5, 1.0};
         
-        // set light0's properties
-        glLightfv(GL_LIGHT0, GL_POSITION, light0_pos);
+        // set light0's properties; its position is set along with the
+        // camera
         glLightfv(GL_LIGHT0, GL_AMBIENT, ambient0);
         glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuse0);
 
-        // Place all the pieces on the chess board.  This should probably
-        // be driven by a data file, rather than hard-coded.
-        {
-            // Place all the dark pawns.
-            Object example;
-            example.color = Vector( 1, 0.3, 0.3 );
-            example.mesh = PAWN;
-            example.trans = Matrix::translate( 0.5, 0, 1.5 );
-            objectList.push_back( example );
-            example.trans = Matrix::translate( 1.5, 0, 1.5 );
-            objectList.push_back( example );
-            example.trans = Matrix::translate( 2.5, 0, 1.5 );
-            objectList.push_back( example );
-            example.trans = Matrix::translate( 3.5, 0, 1.5 );
-            objectList.push_back( example );
-            example.trans = Matrix::translate( 4.5, 0, 1.5 );
-            objectList.push_back( example );
-            example.trans = Matrix::translate( 5.5, 0, 1.5 );
-            objectList.push_back( example );
-            example.trans = Matrix::translate( 6.5, 0, 1.5 );
-            objectList.push_back( example );
-            example.trans = Matrix::translate( 7.5, 0, 1.5 );
-            objectList.push_back( example );
-
-            // Place the two dark rooks.
-            example.mesh = ROOK;
-            example.trans = Matrix::translate( 0.5, 0, 0.5 );
-            objectList.push_back( example );
-            example.trans = Matrix::translate( 7.5, 0, 0.5 );
-            objectList.push_back( example );
-
-            // Place the two dark knights.
-            example.mesh = KNIGHT;
-            example.trans = Matrix::translate( 1.5, 0, 0.5 );
-            objectList.push_back( example );
-            example.trans = Matrix::translate( 6.5, 0, 0.5 );
-            objectList.push_back( example );
-
-            // Place the two dark bishops.
-            example.mesh = BISHOP;
-            example.trans = Matrix::translate( 2.5, 0, 0.5 );
-            objectList.push_back( example );
-            example.trans = Matrix::translate( 5.5, 0, 0.5 );
-            objectList.push_back( example );
-
-            // Place the dark queen.
-            example.mesh = QUEEN;
-            example.trans = Matrix::translate( 3.5, 0, 0.5 );
-            objectList.push_back( example );
-
-            // Place the dark king.
-            example.mesh = KING;
-            example.trans = Matrix::translate( 4.5, 0, 0.5 );
-            objectList.push_back( example );
-
-            // Make the other side as copies of all the pieces, with different
-            // colors and rotated around the center of the board
-            for ( int i = 0; i < 16; i++ ) {
-                example = objectList[ i ];
-                example.color = Vector( 0.7, 0.7, 0.4 );
-                example.trans = Matrix::translate( 4, 0, 4 ) *
-                    Matrix::rotateY( 180 ) *
-                    Matrix::translate( -4, 0, -4 ) *
-                    example.trans;
-                objectList.push_back( example );
+        // Matrices the scene derives for every piece: its reflection in
+        // the board, and (without a shadow map) its shadow flattened onto
+        // the board.  Both are fixed, so they're built at compile time.
+        static constexpr Matrix mirror = Matrix::rotateZ( 180 );
+        static constexpr Matrix shadowMatrix =
+            Matrix::scale( 1, 0, 1 ) * Matrix( 18, -1, 0, 0,
+                                               0, 18, 0, 0,
+                                               0, -1, 18, 0,
+                                               0, -1, 0, 18 );
+        scene.setDerived( mirror, shadowMatrix );
+
+        // Lay out the boards and their squares.  Pieces come and go on
+        // the first board, so it has room for them all set aside: a
+        // square holds two for a moment in setPosition(), and the board
+        // holds the parked ones.
+        squareNodes.resize( boardCount );
+        for ( int b = 0; b < boardCount; b++ ) {
+            Vector origin = boardOrigin( b );
+            int board = scene.add( -1, Matrix::translate( origin.x, 0, origin.z ) );
+            for ( int z = 0; z < BOARD_SIZE; z++ )
+                for ( int x = 0; x < BOARD_SIZE; x++ )
+                    squareNodes[ b ].push_back(
+                        scene.add( board, Matrix::translate( x + 0.5, 0, z + 0.5 ) ) );
+            if ( b == 0 ) {
+                scene.reserve( board, BOARD_SIZE * BOARD_SIZE + PIECE_COUNT );
+                for ( int sq = 0; sq < BOARD_SIZE * BOARD_SIZE; sq++ )
+                    scene.reserve( squareNodes[ b ][ sq ], 2 );
+            }
+        }
+
+        // Place the pieces.  "-fen position" sets up the first board; the
+        // others, there for stress testing, hold the starting position.
+        Position start;
+        for ( int i = 1; i + 1 < argc; i++ )
+            if ( string( argv[ i ] ) == "-fen" && !start.setFen( argv[ i + 1 ] ) )
+                cout << "Can't read the position to set up: " << argv[ i + 1 ] << endl;
+        for ( int color = 0; color < 2; color++ )
+            if ( squareCount( start.pieces( color ) ) > PIECE_COUNT / 2 ) {
+                cout << "Too many pieces to set up, so the game starts as usual" << endl;
+                start = Position();
+            }
+        fill( squareObject, squareObject + 64, -1 );
+        parkedCount[ Position::WHITE ] = parkedCount[ Position::BLACK ] = 0;
+        for ( int b = 0; b < boardCount; b++ )
+            addPieces( b, b == 0 ? start : Position() );
+        game = start;
+
+        // Set initial camera configuration.  The rig orbits the middle of
+        // the first board.
+        double halfBoard = BOARD_SIZE / 2.0;
+        orbitNode = scene.add( -1, Matrix::identity() );
+        cameraNode = scene.add( orbitNode, Matrix::translate( -halfBoard, 0, -halfBoard ) );
+        orbitCamera( 0, 30 );
+        scene.update();
+
+        // Put the light above the middle of the boards, about where the
+        // old camera-relative light sat for the starting view, and aim
+        // the shadow map so it covers all the boards and pieces.
+        Vector farCorner = boardOrigin( boardCount - 1 ) +
+            Vector( BOARD_SIZE, 0, BOARD_SIZE );
+        int columns = int( ceil( sqrt( double( boardCount ) ) ) );
+        farCorner.x = columns * ( BOARD_SIZE + BOARD_GAP ) - BOARD_GAP;
+        Vector center = farCorner * 0.5;
+        lightPos = center + Vector( 1, 22, 2 );
+        if ( shadowMap.init( SHADOW_MAP_SIZE ) )
+            shadowMap.aim( lightPos, center, center.mag() + 2 );
+        shadowDirty = true;
+
+        // Nothing is selected yet, and the computer isn't playing.
+        selection = -1;
+        destinations = 0;
+        showStats = false;
+        computerPlaying = false;
+        thinking = resultReady = false;
+        animObject = -1;
+
+        // "-pgn file" replays the games in a PGN file, starting from
+        // "-game n", counting from 1.  "-index file" takes the games
+        // from an index made by pgnindex instead, and "-find fen" starts
+        // at the first game that reaches the given position.
+        replaying = indexed = false;
+        pgnIndex = pgnPlies = 0;
+        char const *find = NULL;
+        for ( int i = 1; i + 1 < argc; i++ ) {
+            if ( string( argv[ i ] ) == "-pgn" )
+                replaying = pgn.open( argv[ i + 1 ] );
+            if ( string( argv[ i ] ) == "-index" )
+                indexed = archive.open( argv[ i + 1 ] );
+            if ( string( argv[ i ] ) == "-find" )
+                find = argv[ i + 1 ];
+        }
+        if ( indexed && replaying && archive.pgnSize() != pgn.size() ) {
+            cout << "The index is out of date, so it isn't used" << endl;
+            archive.close();
+            indexed = false;
+        }
+        replaying = replaying || indexed;
+        Position wanted;
+        if ( find && !wanted.setFen( find ) ) {
+            cout << "Can't read the position to find: " << find << endl;
+            find = NULL;
+        }
+        bool found = find && findPosition( wanted.hashKey() );
+        if ( replaying && !found ) {
+            int first = 0;
+            for ( int i = 1; i + 1 < argc; i++ )
+                if ( string( argv[ i ] ) == "-game" )
+                    first = max( 0, atoi( argv[ i + 1 ] ) - 1 );
+            if ( !loadGame( first ) && !loadGame( 0 ) ) {
+                cout << "No games to replay" << endl;
+                replaying = false;
+            }
+        }
+
+        // Draw lists are built on first use.
+        for ( int p = 0; p <= PIECE; p++ )
+            for ( int c = 0; c < 2; c++ ) {
+                drawLists[ p ][ c ].buffer = 0;
+                drawLists[ p ][ c ].dirty = true;
+                drawLists[ p ][ c ].stale = true;
             }
+        frustumAspect = 0;
+        frustumCamera = frustumChanges = 0;
 
-            // Queens actually need to be facing each other, so swap light
-            // king and queen.
-            swap( (objectList.end() - 1)->trans, (objectList.end() - 2)->trans );
+        statsFrames = 0;
+        statsStart = elapsedMs();
+        return true;
+    }
+
+    /** Callback for when there are no other events to handle.  Installs
+        any meshes that have finished loading, uploading them on this
+        (the GL) thread, and plays the computer's moves. */
+    void idle() {
+        // In stress mode, draw continuously to measure the frame rate.
+        if ( boardCount > 1 )
+            glutPostRedisplay();
+
+        bool changed = false;
+        if ( loader )
+            changed = installMeshes();
+
+        // The computer's move slides into place over a few frames.
+        // Until it's chosen, there's no need to check back very often.
+        if ( thinking && !takeComputerMove() && !loader )
+            this_thread::sleep_for( chrono::milliseconds( 10 ) );
+        if ( animObject >= 0 ) {
+            animate();
+            changed = true;
         }
 
-        // Set initial camera configuration
-        camRotation = 0;
-        camElevation = 30;
+        // Once everything is in and nothing's moving, we don't need idle
+        // calls any more.
+        if ( !loader && !thinking && animObject < 0 && boardCount == 1 )
+            glutIdleFunc( NULL );
 
-        // Nothing is selected yet.
-        selection = -1;
-    
+        if ( changed )
+            glutPostRedisplay();
+    }
+
+    /** Callback for when the window changes size. */
+    void reshape( int width, int height ) {
+        winWidth = width;
+        winHeight = max( height, 1 );
+        glViewport( 0, 0, winWidth, winHeight );
+
+        // Levels of detail depend on the size of the window.
+        invalidateDrawLists();
+    }
+
+    /** Draw frames offscreen, moving the camera around the board and
+        selecting pieces along the way, then report how long the frames
+        took and a checksum of what they drew.  The script is the same
+        every run, so the checksum only changes if the rendering does.
+        Then, if flips isn't 0, time flipping through that many positions
+        with benchmarkPositions(). */
+    void runHeadless( int frames, int flips ) {
+        // Measure drawing, not loading.
+        loader->wait();
+        installMeshes();
+
+        vector< double > times;
+        long recomputed = scene.recomputed();
+        long drawn = 0, culled = 0, triangles = 0;
+        int replayed = 0;
+        double replayMs = 0;
+        vector< unsigned char > pixels( winWidth * winHeight * 4 );
+        unsigned hash = 2166136261u;
+        for ( int f = 0; f < frames; f++ ) {
+            double t = double( f ) / frames;
+
+            // Two full orbits, while bobbing up and down once.
+            orbitCamera( 720 * t, 45 + 35 * sin( 2 * PI * t ) );
+
+            // Every so often, click somewhere along a circle around the
+            // middle of the window.
+            if ( f % 10 == 0 ) {
+                double a = 2 * PI * f / 70;
+                select( pickObject( int( winWidth * ( 0.5 + 0.25 * cos( a ) ) ),
+                                    int( winHeight * ( 0.5 + 0.25 * sin( a ) ) ) ) );
+            }
+
+            // When replaying a PGN file, the game moves on a ply every
+            // frame, and on to the next game at the end of each one.
+            if ( replaying ) {
+                double start = elapsedMs();
+                if ( pgnPlies < int( pgnGame.moves.size() ) )
+                    seekPly( pgnPlies + 1 );
+                else if ( !loadGame( pgnIndex + 1 ) )
+                    loadGame( 0 );
+                replayMs += elapsedMs() - start;
+                replayed++;
+            }
+
+            double start = elapsedMs();
+            display();
+            glFinish();
+            times.push_back( elapsedMs() - start );
+            drawn += drawnCount[ PIECE ];
+            culled += culledCount[ PIECE ];
+            triangles += triangleCount;
+
+            // Fold the frame into the checksum, outside the timed part.
+            glReadPixels( 0, 0, winWidth, winHeight, GL_RGBA, GL_UNSIGNED_BYTE,
+                          pixels.data() );
+            for ( int i = 0; i < pixels.size(); i++ )
+                hash = ( hash ^ pixels[ i ] ) * 16777619u;
+        }
+
+        if ( times.empty() )
+            return;
+        sort( times.begin(), times.end() );
+        printf( "%d frames at %dx%d, %d pieces (%s, %s)\n", frames, winWidth,
+                winHeight, int( objectList.size() ),
+                instancing && instancer.available() ? "instanced" :
+                "one draw per piece", useLods ? "levels of detail" : "full detail" );
+        printf( "min %.3f ms, median %.3f ms, p99 %.3f ms\n", times.front(),
+                times[ times.size() / 2 ], times[ ( times.size() - 1 ) * 99 / 100 ] );
+        printf( "%.1f pieces drawn, %.1f culled per frame\n", double( drawn ) / frames,
+                double( culled ) / frames );
+        printf( "%.0f triangles per frame\n", double( triangles ) / frames );
+        int vertexBytes = 0;
+        for ( int i = 0; i < meshList.size(); i++ )
+            if ( meshList[ i ] )
+                vertexBytes += meshList[ i ]->vertexBytes();
+        printf( "%d bytes of vertex buffers\n", vertexBytes );
+        printf( "%ld scene nodes recomputed, of %d\n",
+                scene.recomputed() - recomputed, scene.size() );
+        if ( replayed )
+            printf( "%d replay steps, %.1f us each\n", replayed, replayMs * 1000 / replayed );
+        printf( "checksum %08x\n", hash );
+        if ( flips > 0 )
+            benchmarkPositions( flips );
+    }
+
+    /** Return true if the first board shows game: each piece's object
+        on its square with the right mesh, and the rest parked. */
+    bool boardMatches() {
+        int parkedPieces = parkedCount[ Position::WHITE ] + parkedCount[ Position::BLACK ];
+        if ( squareCount( game.occupied() ) + parkedPieces != PIECE_COUNT )
+            return false;
+        for ( int sq = 0; sq < BOARD_SIZE * BOARD_SIZE; sq++ ) {
+            int i = squareObject[ sq ];
+            if ( game.pieceOn( sq ) == Position::NO_PIECE ? i >= 0 :
+                 i < 0 || objectList[ i ].square != sq ||
+                 objectList[ i ].mesh != meshFor( game.pieceOn( sq ) ) ||
+                 scene.parent( objectList[ i ].node ) != squareNode( 0, sq ) )
+                return false;
+        }
+        return true;
+    }
+
+    /** Flip the first board through count positions from random games,
+        in the order they're played and then shuffled, timing
+        setPosition() and the scene update after it, and report how many
+        squares each flip changed.  Then go through them again, checking
+        each is shown right, and that the scene hasn't grown. */
+    void benchmarkPositions( int count ) {
+        // Games of up to 120 plies, one after another.
+        vector< Position > positions;
+        positions.reserve( count );
+        minstd_rand random( 1 );
+        Position pos;
+        for ( int ply = 0; int( positions.size() ) < count; ply++ ) {
+            Move moves[ Position::MAX_MOVES ];
+            int moveCount = pos.legalMoves( moves );
+            if ( moveCount == 0 || ply == 120 ) {
+                pos = Position();
+                ply = 0;
+            } else {
+                Position::Undo undo;
+                pos.makeMove( moves[ random() % moveCount ], undo );
+            }
+            positions.push_back( pos );
+        }
+
+        Position saved = game;
+        int nodes = scene.size(), objects = objectList.size();
+        size_t capacity = objectList.capacity();
+        for ( int pass = 0; pass < 2; pass++ ) {
+            if ( pass == 1 )
+                shuffle( positions.begin(), positions.end(), random );
+            long changed = 0;
+            for ( int i = 0; i < count; i++ ) {
+                Position const &before = i > 0 ? positions[ i - 1 ] : game;
+                for ( int color = 0; color < 2; color++ )
+                    for ( int piece = 0; piece < 6; piece++ )
+                        changed += squareCount( before.pieces( color, piece ) ^
+                                                positions[ i ].pieces( color, piece ) );
+            }
+
+            double start = elapsedMs();
+            for ( int i = 0; i < count; i++ ) {
+                setPosition( positions[ i ] );
+                scene.update();
+            }
+            double us = ( elapsedMs() - start ) * 1000 / count;
+            printf( "%d positions %s: %.2f us each, %.0f a second, %.1f squares changed\n",
+                    count, pass == 0 ? "in order" : "shuffled", us, 1e6 / us,
+                    double( changed ) / count );
+        }
+
+        int wrong = 0;
+        for ( int i = 0; i < count; i++ ) {
+            setPosition( positions[ i ] );
+            wrong += !boardMatches();
+        }
+        setPosition( saved );
+        scene.update();
+        printf( "%d shown wrong, %d objects and %d scene nodes added, object list %s\n",
+                wrong, int( objectList.size() ) - objects, scene.size() - nodes,
+                objectList.capacity() == capacity ? "kept" : "regrown" );
+    }
+
+    /** Show how many objects each pass drew and culled, in the corner
+        of the window, if the statistics are turned on. */
+    void drawStats() {
+        // Text goes through GLUT, which we don't have offscreen.
+        if ( !showStats || headless )
+            return;
+
+        char text[ PIECE + 2 ][ 64 ];
+        static const char *names[] = { "reflections", "shadows", "pieces" };
+        for ( int p = 0; p <= PIECE; p++ )
+            snprintf( text[ p ], sizeof( text[ p ] ), "%-12s %4d drawn %4d culled",
+                      names[ p ], drawnCount[ p ], culledCount[ p ] );
+        snprintf( text[ PIECE + 1 ], sizeof( text[ PIECE + 1 ] ), "%-12s %ld%s",
+                  "triangles", triangleCount, useLods ? "" : " (full detail)" );
+
+        // Draw in window coordinates, over everything else.
+        glMatrixMode( GL_PROJECTION );
+        glPushMatrix();
+        glLoadIdentity();
+        gluOrtho2D( 0, winWidth, 0, winHeight );
+        glMatrixMode( GL_MODELVIEW );
+        glPushMatrix();
+        glLoadIdentity();
+        glPushAttrib( GL_ENABLE_BIT | GL_CURRENT_BIT );
+        glDisable( GL_LIGHTING );
+        glDisable( GL_DEPTH_TEST );
+        glColor3f( 0, 0, 0 );
+
+        for ( int p = 0; p <= PIECE + 1; p++ ) {
+            glRasterPos2i( 10, winHeight - 20 - 16 * p );
+            for ( char const *c = text[ p ]; *c; c++ )
+                glutBitmapCharacter( GLUT_BITMAP_9_BY_15, *c );
+        }
+
+        glPopAttrib();
+        glPopMatrix();
+        glMatrixMode( GL_PROJECTION );
+        glPopMatrix();
+        glMatrixMode( GL_MODELVIEW );
     }
 
     /** Redraw the contetns of the display */  
     void display() {
-        // Figure out the aspect ratio.
-        int winWidth = glutGet( GLUT_WINDOW_WIDTH );
-        int winHeight = glutGet( GLUT_WINDOW_HEIGHT );
-
         // Make sure we take camera position into account.
         placeCamera( double( winWidth ) / winHeight );
 
         // Clear the color and the Z-Buffer components.
         glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
-        // Draw everything
+        // Draw everything, counting from the shadow map on.
+        drawCalls = 0;
+        for ( int p = 0; p <= PIECE; p++ )
+            drawnCount[ p ] = culledCount[ p ] = 0;
+        triangleCount = 0;
+        updateShadowMap();
         drawScene();
+        drawStats();
 
         // Show it to the user.
-        glutSwapBuffers();
+        if ( !headless )
+            glutSwapBuffers();
+
+        // In stress mode, periodically report how long frames are taking.
+        if ( boardCount > 1 && ++statsFrames == STATS_FRAMES ) {
+            double now = elapsedMs();
+            printf( "%d pieces, %d culled, %ld triangles, %d draw calls, %.2f ms/frame (%s)\n",
+                    int( objectList.size() ), culledCount[ PIECE ], triangleCount, drawCalls,
+                    ( now - statsStart ) / statsFrames,
+                    instancing && instancer.available() ? "instanced" :
+                    "one draw per piece" );
+            statsFrames = 0;
+            statsStart = now;
+        }
     }
 
     /** Callback for key down events */
@@ -508,11 +1961,114 @@ public:
         if ( !keyPressed( key ) )
             dkeys.push_back( key );
 
+        // 'n' turns instanced drawing of the pieces on and off.
+        if ( key == 'n' ) {
+            instancing = !instancing;
+            cout << ( instancing ? "Instanced" : "Per-piece" )
+                 << " piece drawing" << endl;
+            glutPostRedisplay();
+        }
+
+        // 'b' compares the two ways of picking, at the mouse location.
+        if ( key == 'b' )
+            benchmarkPicking( x, y );
+
+        // 'l' turns the levels of detail on and off.
+        if ( key == 'l' ) {
+            useLods = !useLods;
+            invalidateDrawLists();
+            cout << ( useLods ? "Levels of detail" : "Full detail" )
+                 << " piece drawing" << endl;
+            glutPostRedisplay();
+        }
+
+        // 'c' has the computer take over the side to move, or stop
+        // playing.
+        if ( key == 'c' && animObject < 0 ) {
+            computerPlaying = !computerPlaying;
+            if ( computerPlaying ) {
+                computerColor = game.sideToMove();
+                cout << "Computer plays "
+                     << ( computerColor == Position::WHITE ? "white" : "black" ) << endl;
+                select( -1 );
+                startThinking();
+            } else {
+                stopThinking();
+                cout << "Computer stops playing" << endl;
+            }
+            glutPostRedisplay();
+        }
+
+        // 'f' finds the first board's position in the index, and shows
+        // the first game that reaches it.
+        if ( key == 'f' && animObject < 0 ) {
+            stopComputer();
+            findPosition( game.hashKey() );
+            glutPostRedisplay();
+        }
+
+        // 'p' prints the first board's position, in FEN.
+        if ( key == 'p' )
+            cout << game.fen() << endl;
+
+        // 's' shows and hides the culling statistics.
+        if ( key == 's' ) {
+            showStats = !showStats;
+            glutPostRedisplay();
+        }
+
+        // 'i' switches meshes between buffer objects and immediate mode.
+        if ( key == 'i' ) {
+            Mesh::immediateMode = !Mesh::immediateMode;
+            cout << ( Mesh::immediateMode ? "Immediate mode" : "Buffer objects" )
+                 << " mesh drawing" << endl;
+            glutPostRedisplay();
+        }
+
         // Remember where the mouse was when this key was pressed.
         lastMouseX = x;
         lastMouseY = y;
     }
 
+    /** Callback for special keys, which step through the PGN game being
+        replayed: the left and right arrows by a move, home and end to
+        its ends, and up and down to the games before and after it.  The
+        left arrow also takes back moves played by hand. */
+    void specialKey( int key, int x, int y ) {
+        // Leave the board alone while a move slides into place.
+        if ( animObject >= 0 )
+            return;
+
+        stopComputer();
+        switch ( key ) {
+        case GLUT_KEY_LEFT:
+            if ( int( played.size() ) > pgnPlies ) {
+                unplayMove();
+                select( -1 );
+            } else {
+                seekPly( pgnPlies - 1 );
+            }
+            break;
+        case GLUT_KEY_RIGHT:
+            seekPly( pgnPlies + 1 );
+            break;
+        case GLUT_KEY_HOME:
+            seekPly( 0 );
+            break;
+        case GLUT_KEY_END:
+            seekPly( pgnGame.moves.size() );
+            break;
+        case GLUT_KEY_UP:
+            loadGame( pgnIndex - 1 );
+            break;
+        case GLUT_KEY_DOWN:
+            if ( replaying && !loadGame( pgnIndex + 1 ) )
+                cout << "No more games" << endl;
+            break;
+        }
+        glutPostRedisplay();
+    }
+
     /** Callback for key down events */
     void keyUp( unsigned char key, int x, int y ) {
         // Remove key from the list of down keys, if it's in there.
@@ -527,13 +2083,23 @@ public:
 
     /** Callback for when the mouse button is pressed or released */
     void mouse( int button, int state, int x, int y ) {
-        if (button == GLUT_LEFT_BUTTON) {
-            vector<GLuint> namestack = selectGeometry(x, y);
-            if (namestack.size() > 0) {
-                selection = namestack[0];
-            } else {
-                selection = -1;
+        // Leave the board alone while the computer moves.
+        if ( thinking || animObject >= 0 )
+            return;
+
+        if ( button == GLUT_LEFT_BUTTON && state == GLUT_DOWN ) {
+            // With a piece selected, clicking one of its destinations
+            // (or the piece standing there) moves it.  Anything else
+            // selects whatever was clicked.
+            int picked = pickObject( x, y );
+            int to = picked >= 0 ? objectList[ picked ].square : pickSquare( x, y );
+            if ( to >= 0 && ( destinations & squareBit( to ) ) &&
+                 ( picked < 0 || squareObject[ to ] == picked ) ) {
+                playMove( game.findMove( objectList[ selection ].square, to ) );
+                picked = -1;
             }
+            select( picked );
+            startThinking();
         }
         glutPostRedisplay();
     }
@@ -547,8 +2113,8 @@ public:
         // If 'a' is being held down, move the camera around.
         if ( keyPressed( 'a' ) ) {
             // Rotate the camera when a is pressed (for angle)
-            camElevation = clamp( camElevation + ( y - lastMouseY ) / 2.0, 10, 80 );
-            camRotation = camRotation + ( x - lastMouseX ) / 2.0;
+            orbitCamera( camRotation + ( x - lastMouseX ) / 2.0,
+                         clamp( camElevation + ( y - lastMouseY ) / 2.0, 10, 80 ) );
 
             glutPostRedisplay();
         }
@@ -569,6 +2135,11 @@ void display() {
     chessBoard.display();
 }
 
+// Callback for when there's nothing else to do.
+void idle() {
+    chessBoard.idle();
+}
+
 // Callback for when keys are pressed down.
 void keyDown( unsigned char key, int x, int y ) {
     chessBoard.keyDown( key, x, y );
@@ -579,6 +2150,11 @@ void keyUp( unsigned char key, int x, int y ) {
     chessBoard.keyUp( key, x, y );
 }
 
+// Callback for when special keys, like the arrows, are pressed.
+void specialKey( int key, int x, int y ) {
+    chessBoard.specialKey( key, x, y );
+}
+
 // Callback for when the mouse button is pressed.
 void mouse( int button, int state, int x, int y ) {
     chessBoard.mouse( button, state, x, y );
@@ -594,24 +2170,53 @@ void passiveMotion( int x, int y ) {
     chessBoard.passiveMotion( x, y );
 }
 
+// Callback for when the window is resized.
+void reshape( int width, int height ) {
+    chessBoard.reshape( width, height );
+}
+
 /////////////////////////////////////////////////////////////////
 // Glut callback functions.
 /////////////////////////////////////////////////////////////////
 
 int main( int argc, char **argv ) {
+    // "-headless [frames]" draws a scripted run offscreen and reports
+    // frame times, instead of opening a window.
+    // "-flip [n]" then times flipping the first board through n
+    // positions.
+    int headlessFrames = 0, flips = 0;
+    for ( int i = 1; i < argc; i++ ) {
+        if ( string( argv[ i ] ) == "-headless" )
+            headlessFrames = i + 1 < argc && atoi( argv[ i + 1 ] ) > 0 ?
+                atoi( argv[ i + 1 ] ) : 200;
+        if ( string( argv[ i ] ) == "-flip" )
+            flips = i + 1 < argc && atoi( argv[ i + 1 ] ) > 0 ?
+                atoi( argv[ i + 1 ] ) : 10000;
+    }
+
+    if ( headlessFrames ) {
+        if ( !chessBoard.init( argc, argv, true ) )
+            return 1;
+        chessBoard.runHeadless( headlessFrames, flips );
+        return 0;
+    }
+
     // Init glut and make a window.
     glutInit( &argc, argv );
 
-    chessBoard.init( argc, argv );
+    chessBoard.init( argc, argv, false );
 
     // Register all our callbacks.
     glutDisplayFunc( display );
+    glutReshapeFunc( reshape );
     glutIgnoreKeyRepeat( true );
     glutKeyboardFunc( keyDown );
     glutKeyboardUpFunc( keyUp );
+    glutSpecialFunc( specialKey );
     glutMouseFunc( mouse );
     glutMotionFunc( motion );
     glutPassiveMotionFunc( passiveMotion );
+    glutIdleFunc( idle );
 
     // Let glut handle UI events.
     glutMainLoop();
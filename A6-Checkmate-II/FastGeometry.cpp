@@ -0,0 +1,214 @@
+#include "FastGeometry.h"
+
+#if defined( __AVX__ )
+#include <immintrin.h>
+#endif
+
+// Kernels for FMatrix that are too big to inline.  Everything is done a
+// column at a time, with Float4.
+
+FMatrix FMatrix :: transpose() const {
+    Float4 c0 = column( 0 ), c1 = column( 1 ), c2 = column( 2 ), c3 = column( 3 );
+
+    // Interleave pairs of columns, then pairs of those.
+    Float4 t0 = shuffle< 0, 1, 0, 1 >( c0, c1 );
+    Float4 t1 = shuffle< 2, 3, 2, 3 >( c0, c1 );
+    Float4 t2 = shuffle< 0, 1, 0, 1 >( c2, c3 );
+    Float4 t3 = shuffle< 2, 3, 2, 3 >( c2, c3 );
+
+    FMatrix result;
+    result.setColumn( 0, shuffle< 0, 2, 0, 2 >( t0, t2 ) );
+    result.setColumn( 1, shuffle< 1, 3, 1, 3 >( t0, t2 ) );
+    result.setColumn( 2, shuffle< 0, 2, 0, 2 >( t1, t3 ) );
+    result.setColumn( 3, shuffle< 1, 3, 1, 3 >( t1, t3 ) );
+    return result;
+}
+
+// Return the 2x2 determinants from rows r and s of columns 1, 2 and 3
+// of a matrix, in the arrangement inverse() needs:
+//   ( d23, d23, d13, d12 )
+// where dij = m( r, i ) * m( s, j ) - m( r, j ) * m( s, i ).
+template< int r, int s >
+static Float4 minors( Float4 c1, Float4 c2, Float4 c3 ) {
+    Float4 a = shuffle< r, r, r, r >( c2, c1 );
+    Float4 b = shuffle< s, s, s, s >( c2, c1 );
+    Float4 sa = shuffle< s, s, s, s >( c3, c2 );
+    Float4 ra = shuffle< r, r, r, r >( c3, c2 );
+    return a * shuffle< 0, 0, 0, 2 >( sa, sa ) -
+        shuffle< 0, 0, 0, 2 >( ra, ra ) * b;
+}
+
+// Return ( m( r, 1 ), m( r, 0 ), m( r, 0 ), m( r, 0 ) ).
+template< int r >
+static Float4 rowPick( Float4 c0, Float4 c1 ) {
+    Float4 t = shuffle< r, r, r, r >( c1, c0 );
+    return shuffle< 0, 2, 2, 2 >( t, t );
+}
+
+FMatrix FMatrix :: inverse() const {
+    // Cofactor expansion, sharing the 2x2 determinants between the
+    // cofactors that use them.
+    Float4 c0 = column( 0 ), c1 = column( 1 ), c2 = column( 2 ), c3 = column( 3 );
+
+    Float4 f0 = minors< 2, 3 >( c1, c2, c3 );
+    Float4 f1 = minors< 1, 3 >( c1, c2, c3 );
+    Float4 f2 = minors< 1, 2 >( c1, c2, c3 );
+    Float4 f3 = minors< 0, 3 >( c1, c2, c3 );
+    Float4 f4 = minors< 0, 2 >( c1, c2, c3 );
+    Float4 f5 = minors< 0, 1 >( c1, c2, c3 );
+
+    Float4 v0 = rowPick< 0 >( c0, c1 );
+    Float4 v1 = rowPick< 1 >( c0, c1 );
+    Float4 v2 = rowPick< 2 >( c0, c1 );
+    Float4 v3 = rowPick< 3 >( c0, c1 );
+
+    // Columns of the adjugate (the transposed cofactors), with their
+    // alternating signs.
+    alignas( 16 ) static const float signs[ 2 ][ 4 ] = {
+        { 1, -1, 1, -1 }, { -1, 1, -1, 1 } };
+    Float4 sa = Float4::load( signs[ 0 ] ), sb = Float4::load( signs[ 1 ] );
+    Float4 i0 = ( v1 * f0 - v2 * f1 + v3 * f2 ) * sa;
+    Float4 i1 = ( v0 * f0 - v2 * f3 + v3 * f4 ) * sb;
+    Float4 i2 = ( v0 * f1 - v1 * f3 + v3 * f5 ) * sa;
+    Float4 i3 = ( v0 * f2 - v1 * f4 + v2 * f5 ) * sb;
+
+    // The determinant is the first column dotted with the first
+    // cofactor of each column.
+    Float4 firsts = shuffle< 0, 2, 0, 2 >( shuffle< 0, 0, 0, 0 >( i0, i1 ),
+                                           shuffle< 0, 0, 0, 0 >( i2, i3 ) );
+    alignas( 16 ) float dot[ 4 ];
+    ( c0 * firsts ).store( dot );
+    Float4 scale = Float4::splat( 1 / ( ( dot[ 0 ] + dot[ 1 ] ) + ( dot[ 2 ] + dot[ 3 ] ) ) );
+
+    FMatrix result;
+    result.setColumn( 0, i0 * scale );
+    result.setColumn( 1, i1 * scale );
+    result.setColumn( 2, i2 * scale );
+    result.setColumn( 3, i3 * scale );
+    return result;
+}
+
+FMatrix operator*( FMatrix const &a, FMatrix const &b ) {
+    FMatrix result;
+
+#if defined( __AVX__ )
+    // Two result columns at a time, each a sum of the columns of a
+    // scaled by the matching column of b.
+    // (FMatrix is only 16-byte aligned, so the loads are unaligned.)
+    __m256 a0 = _mm256_broadcast_ps( (__m128 const *) a.val );
+    __m256 a1 = _mm256_broadcast_ps( (__m128 const *) ( a.val + 4 ) );
+    __m256 a2 = _mm256_broadcast_ps( (__m128 const *) ( a.val + 8 ) );
+    __m256 a3 = _mm256_broadcast_ps( (__m128 const *) ( a.val + 12 ) );
+    for ( int c = 0; c < 4; c += 2 ) {
+        __m256 bc = _mm256_loadu_ps( b.val + c * 4 );
+        __m256 r = _mm256_mul_ps( a0, _mm256_shuffle_ps( bc, bc, 0x00 ) );
+        r = _mm256_add_ps( r, _mm256_mul_ps( a1, _mm256_shuffle_ps( bc, bc, 0x55 ) ) );
+        r = _mm256_add_ps( r, _mm256_mul_ps( a2, _mm256_shuffle_ps( bc, bc, 0xAA ) ) );
+        r = _mm256_add_ps( r, _mm256_mul_ps( a3, _mm256_shuffle_ps( bc, bc, 0xFF ) ) );
+        _mm256_storeu_ps( result.val + c * 4, r );
+    }
+#else
+    Float4 a0 = a.column( 0 ), a1 = a.column( 1 ), a2 = a.column( 2 ), a3 = a.column( 3 );
+    for ( int c = 0; c < 4; c++ ) {
+        Float4 bc = b.column( c );
+        result.setColumn( c, a0 * broadcast< 0 >( bc ) + a1 * broadcast< 1 >( bc ) +
+                          a2 * broadcast< 2 >( bc ) + a3 * broadcast< 3 >( bc ) );
+    }
+#endif
+
+    return result;
+}
+
+// Transform n coordinates by the rows of a 3x4 matrix, given as splats
+// of its elements, storing the results in ox, oy, oz.  If proj isn't
+// NULL, it's the bottom row, and results are divided by it.  If
+// normalize is true, results are scaled to unit length.  Leftover
+// points past a multiple of four go through a scratch block.
+static void transformBlock( Float4 const row[ 3 ][ 4 ], Float4 const *proj, int n,
+                            float const *x, float const *y, float const *z,
+                            float *ox, float *oy, float *oz, bool normalize ) {
+    for ( int i = 0; i < n; i += 4 ) {
+        alignas( 16 ) float sx[ 4 ], sy[ 4 ], sz[ 4 ];
+        int left = n - i;
+        Float4 px, py, pz;
+        if ( left >= 4 ) {
+            px = Float4::loadu( x + i );
+            py = Float4::loadu( y + i );
+            pz = Float4::loadu( z + i );
+        } else {
+            for ( int j = 0; j < 4; j++ ) {
+                sx[ j ] = j < left ? x[ i + j ] : 0;
+                sy[ j ] = j < left ? y[ i + j ] : 0;
+                sz[ j ] = j < left ? z[ i + j ] : 1;
+            }
+            px = Float4::load( sx );
+            py = Float4::load( sy );
+            pz = Float4::load( sz );
+        }
+
+        Float4 r[ 3 ];
+        for ( int k = 0; k < 3; k++ )
+            r[ k ] = row[ k ][ 0 ] * px + row[ k ][ 1 ] * py + row[ k ][ 2 ] * pz +
+                row[ k ][ 3 ];
+        if ( proj ) {
+            Float4 w = proj[ 0 ] * px + proj[ 1 ] * py + proj[ 2 ] * pz + proj[ 3 ];
+            for ( int k = 0; k < 3; k++ )
+                r[ k ] = r[ k ] / w;
+        }
+        if ( normalize ) {
+            Float4 len = sqrt( r[ 0 ] * r[ 0 ] + r[ 1 ] * r[ 1 ] + r[ 2 ] * r[ 2 ] );
+            for ( int k = 0; k < 3; k++ )
+                r[ k ] = r[ k ] / len;
+        }
+
+        if ( left >= 4 ) {
+            r[ 0 ].storeu( ox + i );
+            r[ 1 ].storeu( oy + i );
+            r[ 2 ].storeu( oz + i );
+        } else {
+            r[ 0 ].store( sx );
+            r[ 1 ].store( sy );
+            r[ 2 ].store( sz );
+            for ( int j = 0; j < left; j++ ) {
+                ox[ i + j ] = sx[ j ];
+                oy[ i + j ] = sy[ j ];
+                oz[ i + j ] = sz[ j ];
+            }
+        }
+    }
+}
+
+void transformPoints( Matrix const &m, int n,
+                      float const *x, float const *y, float const *z,
+                      float *ox, float *oy, float *oz ) {
+    Float4 row[ 3 ][ 4 ], proj[ 4 ];
+    for ( int r = 0; r < 3; r++ )
+        for ( int c = 0; c < 4; c++ )
+            row[ r ][ c ] = Float4::splat( m[ r ][ c ] );
+    for ( int c = 0; c < 4; c++ )
+        proj[ c ] = Float4::splat( m[ 3 ][ c ] );
+
+    bool affine = m[ 3 ][ 0 ] == 0 && m[ 3 ][ 1 ] == 0 && m[ 3 ][ 2 ] == 0 &&
+        m[ 3 ][ 3 ] == 1;
+    transformBlock( row, affine ? NULL : proj, n, x, y, z, ox, oy, oz, false );
+}
+
+void transformNormals( Matrix const &m, int n,
+                       float const *x, float const *y, float const *z,
+                       float *ox, float *oy, float *oz ) {
+    Matrix nm = m.normalMatrix();
+    Float4 row[ 3 ][ 4 ];
+    for ( int r = 0; r < 3; r++ )
+        for ( int c = 0; c < 4; c++ )
+            row[ r ][ c ] = Float4::splat( nm[ r ][ c ] );
+
+    transformBlock( row, NULL, n, x, y, z, ox, oy, oz, true );
+}
+
+void deinterleave( float const *xyz, int n, float *x, float *y, float *z ) {
+    for ( int i = 0; i < n; i++ ) {
+        x[ i ] = xyz[ i * 3 ];
+        y[ i ] = xyz[ i * 3 + 1 ];
+        z[ i ] = xyz[ i * 3 + 2 ];
+    }
+}
@@ -0,0 +1,351 @@
+#ifndef __FAST_GEOMETRY_H__
+#define __FAST_GEOMETRY_H__
+
+#include "Geometry.h"
+
+#include <cstring>
+
+#if defined( __SSE__ ) || defined( _M_X64 )
+#define FAST_GEOMETRY_SSE
+#include <xmmintrin.h>
+#elif defined( __ARM_NEON )
+#define FAST_GEOMETRY_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+   Single precision counterparts of Vector and Matrix, for code where
+   speed matters more than precision.  Both are 16-byte aligned, and
+   FMatrix is stored column major, so it can go straight to OpenGL.
+   Operations use SSE (or NEON) when the compiler targets it, and plain
+   C++ otherwise.  Convert to and from the double types where needed;
+   nothing else in Geometry.h depends on these.
+*/
+
+/**
+   Four floats packed into one SIMD register.  This is the only part of
+   the file that knows which instruction set is being used; the kernels
+   below are written in terms of it.
+*/
+struct Float4 {
+#if defined( FAST_GEOMETRY_SSE )
+    __m128 v;
+
+    static Float4 load( float const *p ) { return make( _mm_load_ps( p ) ); }
+    void store( float *p ) const { _mm_store_ps( p, v ); }
+    static Float4 loadu( float const *p ) { return make( _mm_loadu_ps( p ) ); }
+    void storeu( float *p ) const { _mm_storeu_ps( p, v ); }
+    static Float4 splat( float s ) { return make( _mm_set1_ps( s ) ); }
+    static Float4 make( __m128 m ) { Float4 r; r.v = m; return r; }
+#elif defined( FAST_GEOMETRY_NEON )
+    float32x4_t v;
+
+    static Float4 load( float const *p ) { return make( vld1q_f32( p ) ); }
+    void store( float *p ) const { vst1q_f32( p, v ); }
+    static Float4 loadu( float const *p ) { return load( p ); }
+    void storeu( float *p ) const { store( p ); }
+    static Float4 splat( float s ) { return make( vdupq_n_f32( s ) ); }
+    static Float4 make( float32x4_t m ) { Float4 r; r.v = m; return r; }
+#else
+    float v[ 4 ];
+
+    static Float4 load( float const *p ) {
+        Float4 r;
+        memcpy( r.v, p, sizeof( r.v ) );
+        return r;
+    }
+    void store( float *p ) const { memcpy( p, v, sizeof( v ) ); }
+    static Float4 loadu( float const *p ) { return load( p ); }
+    void storeu( float *p ) const { store( p ); }
+    static Float4 splat( float s ) {
+        Float4 r;
+        r.v[ 0 ] = r.v[ 1 ] = r.v[ 2 ] = r.v[ 3 ] = s;
+        return r;
+    }
+#endif
+};
+
+#if defined( FAST_GEOMETRY_SSE )
+
+inline Float4 operator+( Float4 a, Float4 b ) { return Float4::make( _mm_add_ps( a.v, b.v ) ); }
+inline Float4 operator-( Float4 a, Float4 b ) { return Float4::make( _mm_sub_ps( a.v, b.v ) ); }
+inline Float4 operator*( Float4 a, Float4 b ) { return Float4::make( _mm_mul_ps( a.v, b.v ) ); }
+inline Float4 operator/( Float4 a, Float4 b ) { return Float4::make( _mm_div_ps( a.v, b.v ) ); }
+inline Float4 sqrt( Float4 a ) { return Float4::make( _mm_sqrt_ps( a.v ) ); }
+
+/**
+   Return ( a[ i ], a[ j ], b[ k ], b[ l ] ).
+*/
+template< int i, int j, int k, int l >
+inline Float4 shuffle( Float4 a, Float4 b ) {
+    return Float4::make( _mm_shuffle_ps( a.v, b.v, _MM_SHUFFLE( l, k, j, i ) ) );
+}
+
+#elif defined( FAST_GEOMETRY_NEON )
+
+inline Float4 operator+( Float4 a, Float4 b ) { return Float4::make( vaddq_f32( a.v, b.v ) ); }
+inline Float4 operator-( Float4 a, Float4 b ) { return Float4::make( vsubq_f32( a.v, b.v ) ); }
+inline Float4 operator*( Float4 a, Float4 b ) { return Float4::make( vmulq_f32( a.v, b.v ) ); }
+inline Float4 operator/( Float4 a, Float4 b ) { return Float4::make( vdivq_f32( a.v, b.v ) ); }
+inline Float4 sqrt( Float4 a ) { return Float4::make( vsqrtq_f32( a.v ) ); }
+
+template< int i, int j, int k, int l >
+inline Float4 shuffle( Float4 a, Float4 b ) {
+    float32x4_t r = vdupq_n_f32( vgetq_lane_f32( a.v, i ) );
+    r = vsetq_lane_f32( vgetq_lane_f32( a.v, j ), r, 1 );
+    r = vsetq_lane_f32( vgetq_lane_f32( b.v, k ), r, 2 );
+    r = vsetq_lane_f32( vgetq_lane_f32( b.v, l ), r, 3 );
+    return Float4::make( r );
+}
+
+#else
+
+inline Float4 operator+( Float4 a, Float4 b ) {
+    for ( int i = 0; i < 4; i++ )
+        a.v[ i ] += b.v[ i ];
+    return a;
+}
+
+inline Float4 operator-( Float4 a, Float4 b ) {
+    for ( int i = 0; i < 4; i++ )
+        a.v[ i ] -= b.v[ i ];
+    return a;
+}
+
+inline Float4 operator*( Float4 a, Float4 b ) {
+    for ( int i = 0; i < 4; i++ )
+        a.v[ i ] *= b.v[ i ];
+    return a;
+}
+
+inline Float4 operator/( Float4 a, Float4 b ) {
+    for ( int i = 0; i < 4; i++ )
+        a.v[ i ] /= b.v[ i ];
+    return a;
+}
+
+inline Float4 sqrt( Float4 a ) {
+    for ( int i = 0; i < 4; i++ )
+        a.v[ i ] = sqrtf( a.v[ i ] );
+    return a;
+}
+
+template< int i, int j, int k, int l >
+inline Float4 shuffle( Float4 a, Float4 b ) {
+    Float4 r;
+    r.v[ 0 ] = a.v[ i ];
+    r.v[ 1 ] = a.v[ j ];
+    r.v[ 2 ] = b.v[ k ];
+    r.v[ 3 ] = b.v[ l ];
+    return r;
+}
+
+#endif
+
+/**
+   Return a copy of a with every lane set to its lane i.
+*/
+template< int i >
+inline Float4 broadcast( Float4 a ) {
+    return shuffle< i, i, i, i >( a, a );
+}
+
+/**
+   Single precision 3D vector/point in homogeneous coordinates.
+*/
+struct alignas( 16 ) FVector {
+    /**
+       Make a zero vector.
+    */
+    FVector() {
+        x = y = z = w = 0;
+    }
+
+    /**
+       Make a vector/point from its components.
+    */
+    FVector( float xv, float yv, float zv, float wv = 0 ) {
+        x = xv;
+        y = yv;
+        z = zv;
+        w = wv;
+    }
+
+    /**
+       Make a single precision copy of the given vector.
+    */
+    explicit FVector( Vector const &v ) {
+        x = v.x;
+        y = v.y;
+        z = v.z;
+        w = v.w;
+    }
+
+    /**
+       Return a double precision copy of this vector.
+    */
+    Vector toVector() const {
+        return Vector( x, y, z, w );
+    }
+
+    /**
+       Representation of the vector.
+    */
+    float x, y, z, w;
+};
+
+/**
+   Single precision 4x4 matrix, stored column major as OpenGL expects.
+*/
+class alignas( 16 ) FMatrix {
+ public:
+    /**
+       Make an uninitialized matrix.
+    */
+    FMatrix() {
+    }
+
+    /**
+       Make a single precision copy of the given matrix.
+    */
+    explicit FMatrix( Matrix const &m ) {
+        m.glStore( val );
+    }
+
+    /**
+       Return a double precision copy of this matrix.
+    */
+    Matrix toMatrix() const {
+        return Matrix::glConvert( const_cast< float * >( val ) );
+    }
+
+    /**
+       Return the element at row r, column c.
+    */
+    float &operator()( int r, int c ) {
+        return val[ r + c * 4 ];
+    }
+
+    /**
+       For a constant matrix, return the element at row r, column c.
+    */
+    float operator()( int r, int c ) const {
+        return val[ r + c * 4 ];
+    }
+
+    /**
+       Return column c, as four floats in a register.
+    */
+    Float4 column( int c ) const {
+        return Float4::load( val + c * 4 );
+    }
+
+    /**
+       Replace column c with the given floats.
+    */
+    void setColumn( int c, Float4 f ) {
+        f.store( val + c * 4 );
+    }
+
+    /**
+       Return the matrix as 16 floats in column major order, ready for
+       glLoadMatrixf() or glUniformMatrix4fv().
+    */
+    GLfloat const *data() const {
+        return val;
+    }
+
+    /**
+       Return a copy of the identity matrix.
+    */
+    static FMatrix identity() {
+        FMatrix result;
+        for ( int i = 0; i < 16; i++ )
+            result.val[ i ] = i % 5 == 0 ? 1 : 0;
+        return result;
+    }
+
+    /**
+       Return a new matrix that is the transpose of this one.
+    */
+    FMatrix transpose() const;
+
+    /**
+       Return the inverse of this matrix.  Behavior is undefined if the
+       matrix is singular.
+    */
+    FMatrix inverse() const;
+
+    /**
+       Postmultiply the current OpenGL transformation matrix by this one.
+    */
+    void glMult() const {
+        glMultMatrixf( val );
+    }
+
+    /**
+       Copy this matrix into the given array of 16 floats, in column
+       major order.
+    */
+    void glStore( GLfloat mat[] ) const {
+        memcpy( mat, val, sizeof( val ) );
+    }
+
+ private:
+    friend FMatrix operator*( FMatrix const &a, FMatrix const &b );
+
+    /** Contents of the matrix, column major. */
+    GLfloat val[ 16 ];
+};
+
+/**
+   Return the product of the matrix, m and the given vector, v.
+*/
+inline FVector operator*( FMatrix const &m, FVector const &v ) {
+    Float4 p = Float4::load( &v.x );
+    Float4 r = m.column( 0 ) * broadcast< 0 >( p ) +
+               m.column( 1 ) * broadcast< 1 >( p ) +
+               m.column( 2 ) * broadcast< 2 >( p ) +
+               m.column( 3 ) * broadcast< 3 >( p );
+    FVector result;
+    r.store( &result.x );
+    return result;
+}
+
+/**
+   Return the product of the two given matrices.
+*/
+FMatrix operator*( FMatrix const &a, FMatrix const &b );
+
+/**
+   Batch transformations over structure-of-arrays data: n points (or
+   normals) stored as separate, contiguous arrays of x, y and z
+   coordinates.  These work four points at a time, and never build a
+   Vector for a point.  The output arrays may be the same as the input
+   ones, to transform in place.
+*/
+
+/**
+   Transform the n points in x, y, z by m, storing the results in ox,
+   oy, oz.  If m is projective (its last row isn't 0 0 0 1), the
+   results are divided through by w.
+*/
+void transformPoints( Matrix const &m, int n,
+                      float const *x, float const *y, float const *z,
+                      float *ox, float *oy, float *oz );
+
+/**
+   Transform the n normals in x, y, z by m.normalMatrix(), and store
+   them, normalized, in ox, oy, oz.
+*/
+void transformNormals( Matrix const &m, int n,
+                       float const *x, float const *y, float const *z,
+                       float *ox, float *oy, float *oz );
+
+/**
+   Split n packed x, y, z triples (like a vertex array) into separate
+   x, y and z arrays.
+*/
+void deinterleave( float const *xyz, int n, float *x, float *y, float *z );
+
+#endif
@@ -30,6 +30,13 @@ Matrix Matrix :: transpose() const {
 }
 
 Matrix Matrix :: inverse() const {
+    // Everything but a projection has a cheaper closed form.
+    if ( isAffine() )
+        return affineInverse();
+    return generalInverse();
+}
+
+Matrix Matrix :: generalInverse() const {
     Matrix result = Matrix :: identity();
     Matrix m = *this;
 
@@ -71,79 +78,96 @@ Matrix Matrix :: inverse() const {
     return result;
 }
 
-Matrix Matrix :: identity() {
-    Matrix result;
-
-    for( int r = 0; r < 4; r++ )
-        for( int c = 0; c < 4; c++ )
-            // Store a 1 iff we are on the diagonal.
-            if( r == c )
-                result[ r ][ c ] = 1;
-            else
-                result[ r ][ c ] = 0;
+// Fill in cof with the cofactors of the upper 3x3 of m, and return its
+// determinant.
+static double cofactors( Matrix const &m, double cof[ 3 ][ 3 ] ) {
+    // Taking rows and columns cyclically gets the signs right for free.
+    for( int r = 0; r < 3; r++ )
+        for( int c = 0; c < 3; c++ ) {
+            int r1 = ( r + 1 ) % 3, r2 = ( r + 2 ) % 3;
+            int c1 = ( c + 1 ) % 3, c2 = ( c + 2 ) % 3;
+            cof[ r ][ c ] = m[ r1 ][ c1 ] * m[ r2 ][ c2 ] - m[ r1 ][ c2 ] * m[ r2 ][ c1 ];
+        }
 
-    return result;
+    return m[ 0 ][ 0 ] * cof[ 0 ][ 0 ] + m[ 0 ][ 1 ] * cof[ 0 ][ 1 ] +
+        m[ 0 ][ 2 ] * cof[ 0 ][ 2 ];
 }
 
-Matrix Matrix :: translate( double dx, double dy, double dz ) {
-    // Make the matrix as a modification from the identity.
-    Matrix result = identity();
-    result.val[ 0 ][ 3 ] = dx;
-    result.val[ 1 ][ 3 ] = dy;
-    result.val[ 2 ][ 3 ] = dz;
+Matrix Matrix :: affineInverse() const {
+    Matrix result;
 
-    return result;
-}
+    // The upper 3x3 is the transposed cofactors over the determinant.
+    double cof[ 3 ][ 3 ];
+    double scale = 1 / cofactors( *this, cof );
+    for( int r = 0; r < 3; r++ )
+        for( int c = 0; c < 3; c++ )
+            result.val[ r ][ c ] = cof[ c ][ r ] * scale;
 
-Matrix Matrix :: scale( double sx, double sy, double sz ) {
-    // Make the matrix as a modification from the identity.
-    Matrix result = identity();
-    result.val[ 0 ][ 0 ] = sx;
-    result.val[ 1 ][ 1 ] = sy;
-    result.val[ 2 ][ 2 ] = sz;
-    
+    // Then undo the translation, in the inverted frame.
+    for( int r = 0; r < 3; r++ )
+        result.val[ r ][ 3 ] = -( result.val[ r ][ 0 ] * val[ 0 ][ 3 ] +
+                                  result.val[ r ][ 1 ] * val[ 1 ][ 3 ] +
+                                  result.val[ r ][ 2 ] * val[ 2 ][ 3 ] );
+
+    result.val[ 3 ][ 0 ] = result.val[ 3 ][ 1 ] = result.val[ 3 ][ 2 ] = 0;
+    result.val[ 3 ][ 3 ] = 1;
     return result;
 }
 
-Matrix Matrix :: rotateX( double angle ) {
-    // Make the matrix as a modification from the identity.
-    Matrix result = identity();
-    double c = cos( angle / 180 * PI );
-    double s = sin( angle / 180 * PI );
-    result.val[ 1 ][ 1 ] = c;
-    result.val[ 1 ][ 2 ] = -s;
-    result.val[ 2 ][ 1 ] = s;
-    result.val[ 2 ][ 2 ] = c;
+Matrix Matrix :: rigidInverse() const {
+    Matrix result;
 
-    return result;
-}
+    // A rotation's inverse is its transpose.
+    for( int r = 0; r < 3; r++ )
+        for( int c = 0; c < 3; c++ )
+            result.val[ r ][ c ] = val[ c ][ r ];
 
-Matrix Matrix :: rotateY( double angle ) {
-    // Make the matrix as a modification from the identity.
-    Matrix result = identity();
-    double c = cos( angle / 180 * PI );
-    double s = sin( angle / 180 * PI );
-    result.val[ 0 ][ 0 ] = c;
-    result.val[ 0 ][ 2 ] = s;
-    result.val[ 2 ][ 0 ] = -s;
-    result.val[ 2 ][ 2 ] = c;
+    for( int r = 0; r < 3; r++ )
+        result.val[ r ][ 3 ] = -( val[ 0 ][ r ] * val[ 0 ][ 3 ] +
+                                  val[ 1 ][ r ] * val[ 1 ][ 3 ] +
+                                  val[ 2 ][ r ] * val[ 2 ][ 3 ] );
 
+    result.val[ 3 ][ 0 ] = result.val[ 3 ][ 1 ] = result.val[ 3 ][ 2 ] = 0;
+    result.val[ 3 ][ 3 ] = 1;
     return result;
 }
 
-Matrix Matrix :: rotateZ( double angle ) {
-    // Make the matrix as a modification from the identity.
+Matrix Matrix :: normalMatrix() const {
     Matrix result = identity();
-    double c = cos( angle / 180 * PI );
-    double s = sin( angle / 180 * PI );
-    result.val[ 0 ][ 0 ] = c;
-    result.val[ 0 ][ 1 ] = -s;
-    result.val[ 1 ][ 0 ] = s;
-    result.val[ 1 ][ 1 ] = c;
+
+    // The inverse transpose is the cofactors over the determinant.
+    double cof[ 3 ][ 3 ];
+    double scale = 1 / cofactors( *this, cof );
+    for( int r = 0; r < 3; r++ )
+        for( int c = 0; c < 3; c++ )
+            result.val[ r ][ c ] = cof[ r ][ c ] * scale;
 
     return result;
 }
 
+void Matrix :: decompose( Vector &translation, Matrix &rotation,
+                          Vector &scale ) const {
+    translation = Vector( val[ 0 ][ 3 ], val[ 1 ][ 3 ], val[ 2 ][ 3 ] );
+
+    // Each column of the upper 3x3 is an axis of the rotation, stretched
+    // by the scale on that axis.
+    double s[ 3 ];
+    for( int c = 0; c < 3; c++ )
+        s[ c ] = sqrt( val[ 0 ][ c ] * val[ 0 ][ c ] + val[ 1 ][ c ] * val[ 1 ][ c ] +
+                       val[ 2 ][ c ] * val[ 2 ][ c ] );
+
+    // Keep the rotation proper by putting any mirroring into the scale.
+    double cof[ 3 ][ 3 ];
+    if ( cofactors( *this, cof ) < 0 )
+        s[ 0 ] = -s[ 0 ];
+
+    rotation = identity();
+    for( int r = 0; r < 3; r++ )
+        for( int c = 0; c < 3; c++ )
+            rotation.val[ r ][ c ] = val[ r ][ c ] / s[ c ];
+    scale = Vector( s[ 0 ], s[ 1 ], s[ 2 ] );
+}
+
 Matrix Matrix :: frame( Vector const &vx, Vector const &vy, 
                         Vector const &vz, Vector const &o ) {
     Matrix result;
@@ -196,20 +220,11 @@ void Matrix :: glMult() const {
     glMultMatrixd( mat );
 }
 
-Matrix operator*( Matrix const &a, Matrix const &b ) {
-    Matrix result;
-
-    // For each cell of the result matrix.
+void Matrix :: glStore( GLfloat mat[] ) const {
+    // Convert to column major order.
     for( int r = 0; r < 4; r++ )
-        for( int c = 0; c < 4; c++ ){
-            // Compute the dot product of a row of a and a column of b.
-            double sum = 0;
-            for( int i = 0; i < 4; i++ )
-                sum += a[ r ][ i ] * b[ i ][ c ];
-            result[ r ][ c ] = sum;
-        }
-  
-    return result;
+        for( int c = 0; c < 4; c++ )
+            mat[ r + c * 4 ] = val[ r ][ c ];
 }
 
 ostream &operator<<( ostream &s, Matrix const &m ) {
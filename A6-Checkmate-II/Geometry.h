@@ -10,7 +10,7 @@
 #include <GL/glut.h>
 #endif
 
-const double PI = acos(-1.0);
+constexpr double PI = 3.14159265358979323846;
 
 /**
    Geometry utility types and operations to help with common 3D graphics
@@ -19,7 +19,7 @@ const double PI = acos(-1.0);
 
 // Forward declarations for free functions used in the class.
 struct Vector;
-inline Vector operator/( Vector const &a, double b );
+constexpr Vector operator/( Vector const &a, double b );
 
 /**
    A 3D vector/point in homogeneous coordinates.  Defined as a struct
@@ -31,32 +31,22 @@ struct Vector {
     /**
        Make an uninitialized vector.
     */
-    Vector() {
-        x = 0;
-        y = 0;
-        z = 0;
-        w = 0;
+    constexpr Vector() : x( 0 ), y( 0 ), z( 0 ), w( 0 ) {
     }
 
     /**
        Make a 3D vector in homogeneous coordinates (last component is zero)
     */
-    Vector( double xv, double yv, double zv ) {
-        x = xv;
-        y = yv;
-        z = zv;
-        w = 0;
+    constexpr Vector( double xv, double yv, double zv ) :
+        x( xv ), y( yv ), z( zv ), w( 0 ) {
     }
 
     /**
        Make a 3D vector/point in homogeneous coordinates (last component is 
        supplied by the caller)
     */
-    Vector( double xv, double yv, double zv, double wv ) {
-        x = xv;
-        y = yv;
-        z = zv;
-        w = wv;
+    constexpr Vector( double xv, double yv, double zv, double wv ) :
+        x( xv ), y( yv ), z( zv ), w( wv ) {
     }
 
     /**
@@ -103,7 +93,7 @@ struct Vector {
        Return the cross product of this vector with the given vector.
        Only meaningful for vectors (not points)
     */
-    Vector cross( Vector const &b ) const {
+    constexpr Vector cross( Vector const &b ) const {
         return Vector( y * b.z - z * b.y,
                        z * b.x - x * b.z,
                        x * b.y - y * b.x );
@@ -113,7 +103,7 @@ struct Vector {
        Return the squared magnitude of this vector.  This is only
        meaningful for vectors (not points)
     */
-    double magSquared() const {
+    constexpr double magSquared() const {
         return x * x + y * y + z * z;
     }
 
@@ -165,7 +155,7 @@ struct Vector {
    Overloaded operator for vector vector addition.
    Return a vector that is the sum of the given two vectors.
 */
-inline Vector operator+( Vector const &a, Vector const &b ) {
+constexpr Vector operator+( Vector const &a, Vector const &b ) {
     return Vector( a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w );
 }
 
@@ -173,7 +163,7 @@ inline Vector operator+( Vector const &a, Vector const &b ) {
    Overloaded operator for vector vector subtraction.
    Return a vector that is the difference of the given two vectors.
 */
-inline Vector operator-( Vector const &a, Vector const &b ) {
+constexpr Vector operator-( Vector const &a, Vector const &b ) {
     return Vector( a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w );
 }
 
@@ -182,7 +172,7 @@ inline Vector operator-( Vector const &a, Vector const &b ) {
    product.  Since dot product is only meaningful for actual vectors
    (not points) the 4th component is ignored.
 */
-inline double operator*( Vector const &a, Vector const &b ) {
+constexpr double operator*( Vector const &a, Vector const &b ) {
     return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
@@ -191,7 +181,7 @@ inline double operator*( Vector const &a, Vector const &b ) {
    result in a vector.  Generally, meaningful for vector and points when they
    are part of an affine sum.
 */
-inline Vector operator*( double a, Vector const &b ) {
+constexpr Vector operator*( double a, Vector const &b ) {
     return Vector( a * b.x, a * b.y, a * b.z, a * b.w );
 }
 
@@ -200,7 +190,7 @@ inline Vector operator*( double a, Vector const &b ) {
    result in a vector.  Generally, meaningful for vector and points
    when they are part of an affine sum.
 */
-inline Vector operator*( Vector const &a, double b ) {
+constexpr Vector operator*( Vector const &a, double b ) {
     return Vector( a.x * b, a.y * b, a.z * b, a.w * b );
 }
 
@@ -209,7 +199,7 @@ inline Vector operator*( Vector const &a, double b ) {
    scalar.  Generally, meaningful for vector and points when they are
    part of an affine sum.
 */
-inline Vector operator/( Vector const &a, double b ) {
+constexpr Vector operator/( Vector const &a, double b ) {
     return Vector( a.x / b, a.y / b, a.z / b, a.w / b );
 }
 
@@ -230,6 +220,18 @@ class Matrix {
     Matrix() {
     }
 
+    /**
+       Make a matrix with the given elements, listed a row at a time.
+       This can be evaluated at compile time.
+    */
+    constexpr Matrix( double m00, double m01, double m02, double m03,
+                      double m10, double m11, double m12, double m13,
+                      double m20, double m21, double m22, double m23,
+                      double m30, double m31, double m32, double m33 ) :
+        val{ { m00, m01, m02, m03 }, { m10, m11, m12, m13 },
+             { m20, m21, m22, m23 }, { m30, m31, m32, m33 } } {
+    }
+
     /**
        Return a new matrix that is the transpose of this one.
     */
@@ -237,59 +239,135 @@ class Matrix {
 
     /**
        Return the inverse of this matrix.  Behavior is undefined if the matrix
-       is singular.
+       is singular.  Affine matrices are inverted with affineInverse(), and
+       only projective ones need generalInverse().
     */
     Matrix inverse() const;
 
+    /**
+       Return the inverse of this matrix by Gauss-Jordan elimination, which
+       works for any nonsingular matrix, projective or not.
+    */
+    Matrix generalInverse() const;
+
+    /**
+       Return the inverse of this matrix, which must be affine, using the
+       inverse of its upper 3x3 and the translation.
+    */
+    Matrix affineInverse() const;
+
+    /**
+       Return the inverse of this matrix, which must be a rigid motion
+       (only rotations and translations), by transposing the rotation and
+       undoing the translation.
+    */
+    Matrix rigidInverse() const;
+
+    /**
+       Return true if the last row of this matrix is 0 0 0 1, i.e. it's an
+       affine transformation rather than a projection.
+    */
+    bool isAffine() const {
+        return val[ 3 ][ 0 ] == 0 && val[ 3 ][ 1 ] == 0 && val[ 3 ][ 2 ] == 0 &&
+            val[ 3 ][ 3 ] == 1;
+    }
+
+    /**
+       Return the matrix for transforming normals the way this matrix
+       transforms surfaces: the inverse transpose of its upper 3x3, with
+       no translation.  Normals it produces need renormalizing if the
+       matrix scales.
+    */
+    Matrix normalMatrix() const;
+
+    /**
+       Split this matrix, which must be affine and have no shear, into a
+       translation, rotation and scale, so that it's equal to
+       translate( t ) * rotation * scale( s ).  A mirroring matrix gets a
+       negative x scale.
+    */
+    void decompose( Vector &translation, Matrix &rotation, Vector &scale ) const;
+
     /**
        Return the requested row of the matrix (as an array of doubles)
        This is useful since an extra pair of [] after this will give
        a particular element (e.g. m[1][3]
     */
-    double *operator[]( int ind ) {
+    constexpr double *operator[]( int ind ) {
         return val[ ind ];
     }
 
     /**
        For a constant matrix, return an unmodifiable row of the matrix.
     */
-    double const *operator[]( int ind ) const {
+    constexpr double const *operator[]( int ind ) const {
         return val[ ind ];
     }
 
     /**
        Return a copy of the identity matrix.
     */
-    static Matrix identity();
+    static constexpr Matrix identity() {
+        return Matrix( 1, 0, 0, 0,
+                       0, 1, 0, 0,
+                       0, 0, 1, 0,
+                       0, 0, 0, 1 );
+    }
 
     /**
        Return a translation matrix that translates by the given displacement
        on each of axis.
     */
-    static Matrix translate( double dx, double dy, double dz );
+    static constexpr Matrix translate( double dx, double dy, double dz ) {
+        return Matrix( 1, 0, 0, dx,
+                       0, 1, 0, dy,
+                       0, 0, 1, dz,
+                       0, 0, 0, 1 );
+    }
 
     /**
        Return a scaling matrix that scales by the given factors on each axis.
     */
-    static Matrix scale( double sx, double sy, double sz );
+    static constexpr Matrix scale( double sx, double sy, double sz ) {
+        return Matrix( sx, 0, 0, 0,
+                       0, sy, 0, 0,
+                       0, 0, sz, 0,
+                       0, 0, 0, 1 );
+    }
 
     /**
        Return a rotation matrix that rotates by the given angle (in degrees)
-       on the X axis.
+       on the X axis.  Whole quarter turns are exact, and can be evaluated
+       at compile time, as can the other rotations.
     */
-    static Matrix rotateX( double angle );
+    static constexpr Matrix rotateX( double angle ) {
+        return Matrix( 1, 0, 0, 0,
+                       0, cosDegrees( angle ), -sinDegrees( angle ), 0,
+                       0, sinDegrees( angle ), cosDegrees( angle ), 0,
+                       0, 0, 0, 1 );
+    }
 
     /**
        Return a rotation matrix that rotates by the given angle (in degrees)
        on the Y axis.
     */
-    static Matrix rotateY( double angle );
+    static constexpr Matrix rotateY( double angle ) {
+        return Matrix( cosDegrees( angle ), 0, sinDegrees( angle ), 0,
+                       0, 1, 0, 0,
+                       -sinDegrees( angle ), 0, cosDegrees( angle ), 0,
+                       0, 0, 0, 1 );
+    }
 
     /**
        Return a rotation matrix that rotates by the given angle (in degrees)
        on the Z axis.
     */
-    static Matrix rotateZ( double angle );
+    static constexpr Matrix rotateZ( double angle ) {
+        return Matrix( cosDegrees( angle ), -sinDegrees( angle ), 0, 0,
+                       sinDegrees( angle ), cosDegrees( angle ), 0, 0,
+                       0, 0, 1, 0,
+                       0, 0, 0, 1 );
+    }
 
     /**
        Return a new matrix corresponding to the given matrix
@@ -311,7 +389,42 @@ class Matrix {
     */
     void glMult() const;
 
+    /**
+       Store the contents of this matrix into the given array of 16
+       floats, in the column major order OpenGL uses.
+    */
+    void glStore( GLfloat mat[] ) const;
+
  private:
+    /**
+       Return the number of quarter turns (0 to 3) in the given angle,
+       in degrees, or -1 if it isn't a whole number of them.
+    */
+    static constexpr int quarterTurns( double angle ) {
+        double q = angle / 90;
+        if ( q < -1e9 || q > 1e9 || long( q ) != q )
+            return -1;
+        return int( ( long( q ) % 4 + 4 ) % 4 );
+    }
+
+    /**
+       Return the cosine of the given angle, in degrees.  This is exact,
+       and needs no library call, for whole quarter turns.
+    */
+    static constexpr double cosDegrees( double angle ) {
+        return quarterTurns( angle ) < 0 ? cos( angle / 180 * PI ) :
+            quarterTurns( angle ) == 0 ? 1 : quarterTurns( angle ) == 2 ? -1 : 0;
+    }
+
+    /**
+       Return the sine of the given angle, in degrees, exact for whole
+       quarter turns.
+    */
+    static constexpr double sinDegrees( double angle ) {
+        return quarterTurns( angle ) < 0 ? sin( angle / 180 * PI ) :
+            quarterTurns( angle ) == 1 ? 1 : quarterTurns( angle ) == 3 ? -1 : 0;
+    }
+
     /** representation for the contents of the matrix */
     double val[ 4 ][ 4 ];
 };
@@ -319,7 +432,7 @@ class Matrix {
 /**
    Return the product of the matrix, m and the given vector, v.
 */
-inline Vector operator*( Matrix const &m, Vector const &v ) {
+constexpr Vector operator*( Matrix const &m, Vector const &v ) {
     return Vector(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3] * v.w,
                   m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3] * v.w,
                   m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3] * v.w,
@@ -327,9 +440,24 @@ inline Vector operator*( Matrix const &m, Vector const &v ) {
 }
 
 /**
-   Return the product of the two given matrices.
+   Return the product of the two given matrices.  This can be evaluated
+   at compile time, to build fixed transformations.
 */
-Matrix operator*( Matrix const &a, Matrix const &b );
+constexpr Matrix operator*( Matrix const &a, Matrix const &b ) {
+    Matrix result( 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 );
+
+    // For each cell of the result matrix.
+    for( int r = 0; r < 4; r++ )
+        for( int c = 0; c < 4; c++ ){
+            // Compute the dot product of a row of a and a column of b.
+            double sum = 0;
+            for( int i = 0; i < 4; i++ )
+                sum += a[ r ][ i ] * b[ i ][ c ];
+            result[ r ][ c ] = sum;
+        }
+
+    return result;
+}
 
 /**
    Convenience function to print out the contents of a Vector.
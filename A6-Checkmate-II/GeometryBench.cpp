@@ -0,0 +1,250 @@
+//
+// GeometryBench.cpp
+//
+// Time the single precision FMatrix operations against the double
+// precision Matrix ones they stand in for, and check that they agree.
+//
+// Usage: geombench [rounds]
+//
+
+#include "Geometry.h"
+#include "FastGeometry.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/time.h>
+
+using namespace std;
+
+// Number of matrices (and vectors) each operation is timed over.
+static const int COUNT = 1024;
+
+// Return the current time in seconds.
+static double now() {
+    timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Return a random number in [ low, high ).
+static double uniform( double low, double high ) {
+    return low + ( high - low ) * ( rand() / ( RAND_MAX + 1.0 ) );
+}
+
+// Return a random transformation like the ones the chess board builds,
+// sometimes followed by a perspective projection.
+static Matrix randomMatrix() {
+    Matrix m = Matrix::translate( uniform( -8, 8 ), uniform( -8, 8 ), uniform( -8, 8 ) ) *
+        Matrix::rotateX( uniform( 0, 360 ) ) * Matrix::rotateY( uniform( 0, 360 ) ) *
+        Matrix::rotateZ( uniform( 0, 360 ) ) *
+        Matrix::scale( uniform( 0.5, 2 ), uniform( 0.5, 2 ), uniform( 0.5, 2 ) );
+    if ( rand() % 2 ) {
+        float proj[ 16 ] = { 1.5, 0, 0, 0,  0, 2, 0, 0,  0, 0, -1, -1,  0, 0, -8.2, 0 };
+        m = Matrix::glConvert( proj ) * m;
+    }
+    return m;
+}
+
+// Return the largest difference between elements of the two matrices,
+// relative to the largest element of a.
+static double difference( Matrix const &a, FMatrix const &b ) {
+    double diff = 0, size = 0;
+    for ( int r = 0; r < 4; r++ )
+        for ( int c = 0; c < 4; c++ ) {
+            diff = max( diff, fabs( a[ r ][ c ] - b( r, c ) ) );
+            size = max( size, fabs( a[ r ][ c ] ) );
+        }
+    return diff / size;
+}
+
+// Return the largest difference between elements of the two matrices,
+// relative to the largest element of a.
+static double difference( Matrix const &a, Matrix const &b ) {
+    double diff = 0, size = 0;
+    for ( int r = 0; r < 4; r++ )
+        for ( int c = 0; c < 4; c++ ) {
+            diff = max( diff, fabs( a[ r ][ c ] - b[ r ][ c ] ) );
+            size = max( size, fabs( a[ r ][ c ] ) );
+        }
+    return diff / size;
+}
+
+// Print one line of the report.
+static void report( char const *name, double dTime, double fTime, int ops, double error ) {
+    printf( "%-10s %10.2f %10.2f %8.2fx %12.2e\n", name, dTime / ops * 1e9,
+            fTime / ops * 1e9, dTime / fTime, error );
+}
+
+int main( int argc, char *argv[] ) {
+    int rounds = argc > 1 ? atoi( argv[ 1 ] ) : 2000;
+
+    srand( 1 );
+    vector< Matrix > dm( COUNT ), dr( COUNT );
+    vector< Vector > dv( COUNT ), dvr( COUNT );
+    vector< FMatrix > fm( COUNT ), fr( COUNT );
+    vector< FVector > fv( COUNT ), fvr( COUNT );
+    for ( int i = 0; i < COUNT; i++ ) {
+        dm[ i ] = randomMatrix();
+        fm[ i ] = FMatrix( dm[ i ] );
+        dv[ i ] = Vector( uniform( -1, 1 ), uniform( -1, 1 ), uniform( -1, 1 ), 1 );
+        fv[ i ] = FVector( dv[ i ] );
+    }
+
+    printf( "%d rounds over %d matrices, ns per operation\n", rounds, COUNT );
+    printf( "%-10s %10s %10s %9s %12s\n", "", "Matrix", "FMatrix", "speedup",
+            "max error" );
+    int ops = rounds * COUNT;
+
+    // Matrix times matrix, each with its neighbor.
+    double start = now();
+    for ( int r = 0; r < rounds; r++ )
+        for ( int i = 0; i < COUNT; i++ )
+            dr[ i ] = dm[ i ] * dm[ ( i + r ) % COUNT ];
+    double dTime = now() - start;
+    start = now();
+    for ( int r = 0; r < rounds; r++ )
+        for ( int i = 0; i < COUNT; i++ )
+            fr[ i ] = fm[ i ] * fm[ ( i + r ) % COUNT ];
+    double fTime = now() - start;
+    double error = 0;
+    for ( int i = 0; i < COUNT; i++ )
+        error = max( error, difference( dr[ i ], fr[ i ] ) );
+    report( "multiply", dTime, fTime, ops, error );
+
+    // Matrix times vector.
+    start = now();
+    for ( int r = 0; r < rounds; r++ )
+        for ( int i = 0; i < COUNT; i++ )
+            dvr[ i ] = dm[ ( i + r ) % COUNT ] * dv[ i ];
+    dTime = now() - start;
+    start = now();
+    for ( int r = 0; r < rounds; r++ )
+        for ( int i = 0; i < COUNT; i++ )
+            fvr[ i ] = fm[ ( i + r ) % COUNT ] * fv[ i ];
+    fTime = now() - start;
+    error = 0;
+    for ( int i = 0; i < COUNT; i++ ) {
+        Vector d = dvr[ i ] - fvr[ i ].toVector();
+        d.w = dvr[ i ].w - fvr[ i ].w;
+        error = max( error, sqrt( d.magSquared() + d.w * d.w ) /
+                     sqrt( dvr[ i ].magSquared() + dvr[ i ].w * dvr[ i ].w ) );
+    }
+    report( "transform", dTime, fTime, ops, error );
+
+    // Transpose.
+    start = now();
+    for ( int r = 0; r < rounds; r++ )
+        for ( int i = 0; i < COUNT; i++ )
+            dr[ i ] = dm[ i ].transpose();
+    dTime = now() - start;
+    start = now();
+    for ( int r = 0; r < rounds; r++ )
+        for ( int i = 0; i < COUNT; i++ )
+            fr[ i ] = fm[ i ].transpose();
+    fTime = now() - start;
+    error = 0;
+    for ( int i = 0; i < COUNT; i++ )
+        error = max( error, difference( dr[ i ], fr[ i ] ) );
+    report( "transpose", dTime, fTime, ops, error );
+
+    // General inverse; fewer rounds, since it's much slower.
+    int invRounds = max( 1, rounds / 10 );
+    start = now();
+    for ( int r = 0; r < invRounds; r++ )
+        for ( int i = 0; i < COUNT; i++ )
+            dr[ i ] = dm[ i ].inverse();
+    dTime = now() - start;
+    start = now();
+    for ( int r = 0; r < invRounds; r++ )
+        for ( int i = 0; i < COUNT; i++ )
+            fr[ i ] = fm[ i ].inverse();
+    fTime = now() - start;
+    error = 0;
+    for ( int i = 0; i < COUNT; i++ )
+        error = max( error, difference( dr[ i ], fr[ i ] ) );
+    report( "inverse", dTime, fTime, invRounds * COUNT, error );
+
+    // Points and normals, one Vector at a time through Matrix against
+    // batches of structure-of-arrays coordinates.  The FMatrix column
+    // here is the batch API.
+    int points = COUNT * 64 + 3;
+    vector< float > x( points ), y( points ), z( points );
+    vector< float > ox( points ), oy( points ), oz( points );
+    for ( int i = 0; i < points; i++ ) {
+        x[ i ] = uniform( -1, 1 );
+        y[ i ] = uniform( -1, 1 );
+        z[ i ] = uniform( -1, 1 );
+    }
+    int pointRounds = max( 1, rounds / 64 );
+    Matrix pm = Matrix::translate( 1, 2, 3 ) * Matrix::rotateY( 30 ) *
+        Matrix::rotateX( 75 ) * Matrix::scale( 1, 2, -0.5 );
+    Matrix nm = pm.inverse().transpose();
+    for ( int r = 0; r < 3; r++ )
+        nm[ r ][ 3 ] = nm[ 3 ][ r ] = 0;
+    vector< Vector > dp( points );
+
+    start = now();
+    for ( int r = 0; r < pointRounds; r++ )
+        for ( int i = 0; i < points; i++ ) {
+            Vector p = pm * Vector( x[ i ], y[ i ], z[ i ], 1 );
+            dp[ i ] = p / p.w;
+        }
+    dTime = now() - start;
+    start = now();
+    for ( int r = 0; r < pointRounds; r++ )
+        transformPoints( pm, points, &x[ 0 ], &y[ 0 ], &z[ 0 ], &ox[ 0 ], &oy[ 0 ], &oz[ 0 ] );
+    fTime = now() - start;
+    error = 0;
+    for ( int i = 0; i < points; i++ )
+        error = max( error, ( dp[ i ] - Vector( ox[ i ], oy[ i ], oz[ i ] ) ).mag() /
+                     Vector( dp[ i ].x, dp[ i ].y, dp[ i ].z ).mag() );
+    report( "points", dTime, fTime, pointRounds * points, error );
+
+    start = now();
+    for ( int r = 0; r < pointRounds; r++ )
+        for ( int i = 0; i < points; i++ )
+            dp[ i ] = ( nm * Vector( x[ i ], y[ i ], z[ i ] ) ).norm();
+    dTime = now() - start;
+    start = now();
+    for ( int r = 0; r < pointRounds; r++ )
+        transformNormals( pm, points, &x[ 0 ], &y[ 0 ], &z[ 0 ], &ox[ 0 ], &oy[ 0 ], &oz[ 0 ] );
+    fTime = now() - start;
+    error = 0;
+    for ( int i = 0; i < points; i++ )
+        error = max( error, ( dp[ i ] - Vector( ox[ i ], oy[ i ], oz[ i ] ) ).mag() );
+    report( "normals", dTime, fTime, pointRounds * points, error );
+
+    // Closed form inverses for affine and rigid matrices, against the
+    // elimination the general inverse does.
+    vector< Matrix > am( COUNT ), rm( COUNT );
+    for ( int i = 0; i < COUNT; i++ ) {
+        rm[ i ] = Matrix::translate( uniform( -8, 8 ), uniform( -8, 8 ), uniform( -8, 8 ) ) *
+            Matrix::rotateX( uniform( 0, 360 ) ) * Matrix::rotateY( uniform( 0, 360 ) );
+        am[ i ] = rm[ i ] * Matrix::scale( uniform( 0.5, 2 ), uniform( 0.5, 2 ),
+                                           uniform( -2, -0.5 ) );
+    }
+    printf( "\n%-10s %10s %10s %9s %12s\n", "", "general", "closed", "speedup",
+            "max error" );
+    for ( int kind = 0; kind < 2; kind++ ) {
+        vector< Matrix > &src = kind == 0 ? am : rm;
+        vector< Matrix > closed( COUNT );
+        start = now();
+        for ( int r = 0; r < invRounds; r++ )
+            for ( int i = 0; i < COUNT; i++ )
+                dr[ i ] = src[ i ].generalInverse();
+        dTime = now() - start;
+        start = now();
+        for ( int r = 0; r < invRounds; r++ )
+            for ( int i = 0; i < COUNT; i++ )
+                closed[ i ] = kind == 0 ? src[ i ].affineInverse() :
+                    src[ i ].rigidInverse();
+        fTime = now() - start;
+        error = 0;
+        for ( int i = 0; i < COUNT; i++ )
+            error = max( error, difference( dr[ i ], closed[ i ] ) );
+        report( kind == 0 ? "affine" : "rigid", dTime, fTime, invRounds * COUNT, error );
+    }
+
+    return 0;
+}
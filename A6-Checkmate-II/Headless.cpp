@@ -0,0 +1,97 @@
+//
+// Headless.cpp
+//
+// Offscreen rendering through an EGL pbuffer.  The surfaceless Mesa
+// platform is used when it's there, so no display server is needed.
+//
+
+#include "Headless.h"
+
+#include <iostream>
+
+using namespace std;
+
+#ifdef __APPLE__
+
+bool createHeadlessContext( int width, int height ) {
+    cerr << "Headless mode needs EGL, which isn't available here" << endl;
+    return false;
+}
+
+#else
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// The display, surface and context we made, if any.
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLSurface surface = EGL_NO_SURFACE;
+static EGLContext context = EGL_NO_CONTEXT;
+
+// Release whatever part of the context we managed to make.
+static void destroyContext() {
+    if ( display == EGL_NO_DISPLAY )
+        return;
+
+    eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+    if ( context != EGL_NO_CONTEXT )
+        eglDestroyContext( display, context );
+    if ( surface != EGL_NO_SURFACE )
+        eglDestroySurface( display, surface );
+    eglTerminate( display );
+    display = EGL_NO_DISPLAY;
+    surface = EGL_NO_SURFACE;
+    context = EGL_NO_CONTEXT;
+}
+
+bool createHeadlessContext( int width, int height ) {
+    // Prefer a display that doesn't need a window system at all.
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+    if ( getPlatformDisplay )
+        display = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA,
+                                      EGL_DEFAULT_DISPLAY, NULL );
+    if ( display == EGL_NO_DISPLAY )
+        display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+
+    EGLint major, minor;
+    if ( display == EGL_NO_DISPLAY || !eglInitialize( display, &major, &minor ) ) {
+        cerr << "Can't initialize EGL" << endl;
+        return false;
+    }
+
+    // Same buffers the window asks GLUT for.
+    EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24, EGL_STENCIL_SIZE, 8,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint count;
+    if ( !eglChooseConfig( display, configAttribs, &config, 1, &count ) ||
+         count == 0 ) {
+        cerr << "No suitable EGL pbuffer configuration" << endl;
+        return false;
+    }
+
+    EGLint surfaceAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    surface = eglCreatePbufferSurface( display, config, surfaceAttribs );
+
+    // We use the fixed-function pipeline, so we want a compatibility
+    // context, which is what desktop GL gives by default.
+    eglBindAPI( EGL_OPENGL_API );
+    context = eglCreateContext( display, config, EGL_NO_CONTEXT, NULL );
+
+    if ( surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT ||
+         !eglMakeCurrent( display, surface, surface, context ) ) {
+        cerr << "Can't create an offscreen OpenGL context" << endl;
+        destroyContext();
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef __HEADLESS_H__
+#define __HEADLESS_H__
+
+//
+// Offscreen OpenGL context for running the viewer without a window (or
+// an X server), e.g. for benchmarking on a build machine with only
+// Mesa's software rasterizer.
+//
+
+/** Create an offscreen width x height framebuffer with depth and stencil,
+    and a desktop OpenGL context rendering into it, and make it current.
+    Returns false (after reporting why) if that isn't possible here. */
+bool createHeadlessContext( int width, int height );
+
+#endif
@@ -0,0 +1,215 @@
+//
+// Instancer.cpp
+//
+// Instanced drawing of the piece meshes.
+//
+
+#include "Instancer.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+// Attribute locations for the per-instance data.  The model matrix takes
+// four consecutive locations, one per column.  These stay clear of the
+// low locations some drivers alias to the built-in attributes.
+enum { MODEL_ATTRIB = 4, COLOR_ATTRIB = 8 };
+
+// Vertex shader; lighting is done per vertex, like the fixed function
+// pipeline, using light 0 and the current material.  The ambient and
+// direct parts are kept apart so the fragment shader can drop the direct
+// part where the shadow map says the light is blocked.  Meshes with
+// packed vertex buffers (see VertexPacking.h) are decoded here: positions
+// by positionDecode, and octahedral normals when normalRange isn't 0.
+static char const *vertexSource =
+    "#version 120\n"
+    "attribute mat4 instModel;\n"
+    "attribute vec4 instColor;\n"
+    "attribute vec2 packedNormal;\n"
+    "uniform mat4 shadowMatrix;\n"
+    "uniform mat4 positionDecode;\n"
+    "uniform float normalRange;\n"
+    "varying vec3 ambient;\n"
+    "varying vec3 direct;\n"
+    "varying float alpha;\n"
+    "varying vec4 shadowCoord;\n"
+    "vec3 meshNormal() {\n"
+    "    if (normalRange == 0.0)\n"
+    "        return gl_Normal;\n"
+    "    vec2 f = packedNormal / normalRange;\n"
+    "    vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));\n"
+    "    if (n.z < 0.0)\n"
+    "        n.xy = (1.0 - abs(n.yx)) * vec2(f.x < 0.0 ? -1.0 : 1.0,\n"
+    "                                        f.y < 0.0 ? -1.0 : 1.0);\n"
+    "    return normalize(n);\n"
+    "}\n"
+    "void main() {\n"
+    "    vec4 worldPos = instModel * (positionDecode * gl_Vertex);\n"
+    "    vec4 eyePos = gl_ModelViewMatrix * worldPos;\n"
+    "    gl_Position = gl_ProjectionMatrix * eyePos;\n"
+    "    gl_ClipVertex = eyePos;\n"
+    "    shadowCoord = shadowMatrix * worldPos;\n"
+    "\n"
+    "    // Projected shadows flatten the normal away entirely.\n"
+    "    vec3 n = mat3(instModel) * meshNormal();\n"
+    "    float len = length(n);\n"
+    "    n = gl_NormalMatrix * (len > 0.0 ? n / len : vec3(0.0, 1.0, 0.0));\n"
+    "\n"
+    "    vec4 lpos = gl_LightSource[0].position;\n"
+    "    vec3 l = normalize(lpos.w == 0.0 ? lpos.xyz : lpos.xyz - eyePos.xyz);\n"
+    "    float diffuse = max(dot(n, l), 0.0);\n"
+    "    float specular = 0.0;\n"
+    "    if (diffuse > 0.0 && gl_FrontMaterial.shininess > 0.0)\n"
+    "        specular = pow(max(dot(n, normalize(l + vec3(0.0, 0.0, 1.0))), 0.0),\n"
+    "                       gl_FrontMaterial.shininess);\n"
+    "\n"
+    "    ambient = instColor.rgb * (gl_LightModel.ambient.rgb +\n"
+    "                               gl_LightSource[0].ambient.rgb);\n"
+    "    direct = instColor.rgb * gl_LightSource[0].diffuse.rgb * diffuse +\n"
+    "        gl_FrontMaterial.specular.rgb * gl_LightSource[0].specular.rgb * specular;\n"
+    "    alpha = instColor.a;\n"
+    "}\n";
+
+static char const *fragmentSource =
+    "#version 120\n"
+    "uniform sampler2DShadow shadowMap;\n"
+    "uniform bool useShadows;\n"
+    "varying vec3 ambient;\n"
+    "varying vec3 direct;\n"
+    "varying float alpha;\n"
+    "varying vec4 shadowCoord;\n"
+    "void main() {\n"
+    "    float lit = useShadows ? shadow2DProj(shadowMap, shadowCoord).r : 1.0;\n"
+    "    gl_FragColor = vec4(ambient + direct * lit, alpha);\n"
+    "}\n";
+
+// Compile one shader stage, returning 0 (after reporting why) on failure.
+static GLuint compileShader( GLenum type, char const *source ) {
+    GLuint shader = glCreateShader( type );
+    glShaderSource( shader, 1, &source, NULL );
+    glCompileShader( shader );
+
+    GLint ok;
+    glGetShaderiv( shader, GL_COMPILE_STATUS, &ok );
+    if ( !ok ) {
+        char log[ 1024 ];
+        glGetShaderInfoLog( shader, sizeof( log ), NULL, log );
+        cerr << "Shader compile failed: " << log << endl;
+        glDeleteShader( shader );
+        return 0;
+    }
+    return shader;
+}
+
+Instancer :: Instancer() {
+    program = 0;
+}
+
+Instancer :: ~Instancer() {
+    if ( program )
+        glDeleteProgram( program );
+}
+
+bool Instancer :: init() {
+    // Instanced drawing and attribute divisors are core in OpenGL 3.3.
+    int major = 0, minor = 0;
+    char const *version = (char const *) glGetString( GL_VERSION );
+    if ( !version || sscanf( version, "%d.%d", &major, &minor ) != 2 ||
+         major * 10 + minor < 33 )
+        return false;
+
+    GLuint vs = compileShader( GL_VERTEX_SHADER, vertexSource );
+    GLuint fs = compileShader( GL_FRAGMENT_SHADER, fragmentSource );
+    if ( !vs || !fs )
+        return false;
+
+    program = glCreateProgram();
+    glAttachShader( program, vs );
+    glAttachShader( program, fs );
+    glBindAttribLocation( program, MODEL_ATTRIB, "instModel" );
+    glBindAttribLocation( program, COLOR_ATTRIB, "instColor" );
+    glBindAttribLocation( program, Mesh::PACKED_NORMAL_ATTRIB, "packedNormal" );
+    glLinkProgram( program );
+    glDeleteShader( vs );
+    glDeleteShader( fs );
+
+    GLint ok;
+    glGetProgramiv( program, GL_LINK_STATUS, &ok );
+    if ( !ok ) {
+        cerr << "Shader link failed" << endl;
+        glDeleteProgram( program );
+        program = 0;
+        return false;
+    }
+
+    shadowMatrixLoc = glGetUniformLocation( program, "shadowMatrix" );
+    useShadowsLoc = glGetUniformLocation( program, "useShadows" );
+    positionDecodeLoc = glGetUniformLocation( program, "positionDecode" );
+    normalRangeLoc = glGetUniformLocation( program, "normalRange" );
+    glUseProgram( program );
+    glUniform1i( glGetUniformLocation( program, "shadowMap" ),
+                 ShadowMap::TEXTURE_UNIT );
+    glUniform1i( useShadowsLoc, 0 );
+    glUseProgram( 0 );
+    return true;
+}
+
+void Instancer :: setShadowMap( ShadowMap const *shadowMap ) {
+    if ( !program )
+        return;
+
+    glUseProgram( program );
+    if ( shadowMap ) {
+        GLfloat mat[ 16 ];
+        shadowMap->textureMatrix().glStore( mat );
+        glUniformMatrix4fv( shadowMatrixLoc, 1, GL_FALSE, mat );
+    }
+    glUniform1i( useShadowsLoc, shadowMap != NULL );
+    glUseProgram( 0 );
+
+    // The texture stays bound to its unit while shadows are in use.
+    glActiveTexture( GL_TEXTURE0 + ShadowMap::TEXTURE_UNIT );
+    glBindTexture( GL_TEXTURE_2D, shadowMap ? shadowMap->texture() : 0 );
+    glActiveTexture( GL_TEXTURE0 );
+}
+
+void Instancer :: draw( Mesh *mesh, GLuint instanceBuffer, int first,
+                        int count, int level ) {
+    if ( count == 0 )
+        return;
+
+    // Point the per-instance attributes into the buffer, advancing once
+    // per instance rather than once per vertex.
+    glBindBuffer( GL_ARRAY_BUFFER, instanceBuffer );
+    char *base = (char *) 0 + first * sizeof( Instance );
+    for ( int c = 0; c < 4; c++ ) {
+        glEnableVertexAttribArray( MODEL_ATTRIB + c );
+        glVertexAttribPointer( MODEL_ATTRIB + c, 4, GL_FLOAT, GL_FALSE,
+                               sizeof( Instance ),
+                               base + c * 4 * sizeof( GLfloat ) );
+        glVertexAttribDivisor( MODEL_ATTRIB + c, 1 );
+    }
+    glEnableVertexAttribArray( COLOR_ATTRIB );
+    glVertexAttribPointer( COLOR_ATTRIB, 4, GL_FLOAT, GL_FALSE,
+                           sizeof( Instance ),
+                           base + offsetof( Instance, color ) );
+    glVertexAttribDivisor( COLOR_ATTRIB, 1 );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+    // Tell the shader how this mesh's vertices are stored.
+    GLfloat decode[ 16 ];
+    mesh->positionDecode().glStore( decode );
+    int bits = mesh->packedNormalBits();
+    glUseProgram( program );
+    glUniformMatrix4fv( positionDecodeLoc, 1, GL_FALSE, decode );
+    glUniform1f( normalRangeLoc, bits ? ( 1 << ( bits - 1 ) ) - 1 : 0 );
+    mesh->drawInstanced( count, level );
+    glUseProgram( 0 );
+
+    for ( int a = MODEL_ATTRIB; a <= COLOR_ATTRIB; a++ ) {
+        glVertexAttribDivisor( a, 0 );
+        glDisableVertexAttribArray( a );
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef __INSTANCER_H__
+#define __INSTANCER_H__
+
+#include "Geometry.h"
+#include "Mesh.h"
+#include "ShadowMap.h"
+
+#include <vector>
+
+//
+// Draws many copies of a mesh with a single instanced draw call.  Each
+// instance gets its own model matrix and color, passed as per-instance
+// vertex attributes to a small shader that reproduces the fixed-function
+// lighting the rest of the scene uses (light 0, color material, current
+// material specular), so instanced and non-instanced pieces look alike.
+// It can also darken instances that a ShadowMap says are in shadow, and
+// draws meshes with packed vertex buffers, which the fixed function
+// pipeline can't.
+//
+class Instancer {
+public:
+    /** Per-instance data, in the layout the shader expects. */
+    struct Instance {
+        /** Model matrix, column major, as from Matrix::glStore(). */
+        GLfloat model[ 16 ];
+
+        /** RGBA color. */
+        GLfloat color[ 4 ];
+    };
+
+    // Make an instancer; nothing happens until init() is called.
+    Instancer();
+
+    // Release the shader.
+    ~Instancer();
+
+    /** Build the shader.  Needs a current GL context.  Returns false
+        (and leaves the instancer unusable) if the context doesn't
+        support instancing. */
+    bool init();
+
+    /** Return true if init() succeeded. */
+    bool available() const {
+        return program != 0;
+    }
+
+    /** Make subsequent draws darken whatever the given shadow map says
+        is in shadow, or stop shadowing if shadowMap is NULL.  The map's
+        texture is left bound until shadowing is turned off. */
+    void setShadowMap( ShadowMap const *shadowMap );
+
+    /** Draw count copies of mesh, at the given level of detail, one for
+        each Instance in a buffer object owned by the caller, starting at
+        index first.  The caller keeps instance lists on the GPU while
+        they don't change.  Uses the current modelview matrix as the
+        camera transformation. */
+    void draw( Mesh *mesh, GLuint instanceBuffer, int first, int count,
+               int level = 0 );
+
+private:
+    /** Shader program that applies the per-instance attributes. */
+    GLuint program;
+
+    /** Locations of the shadow uniforms in program. */
+    GLint shadowMatrixLoc, useShadowsLoc;
+
+    /** Locations of the uniforms that decode packed vertices. */
+    GLint positionDecodeLoc, normalRangeLoc;
+};
+
+#endif
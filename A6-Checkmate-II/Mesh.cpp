@@ -10,138 +10,899 @@
 //
 
 #include "Mesh.h"
+#include "FastGeometry.h"
+#include "Simplifier.h"
+#include "VertexCache.h"
+#include "VertexPacking.h"
 #ifdef __APPLE__
 #include <glut/glut.h>
 #else
 #include "GL/glut.h"
 #endif
 
-#include <fstream>
 #include <string>
 #include <iostream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace std;
 
+bool Mesh :: immediateMode = false;
+Mesh::Packing Mesh :: packing = { 0, 1e-4, 1 };
+
+// Header at the front of a binary mesh file.  It's followed by the
+// vertex positions (3 * vNum floats), normals (3 * nNum floats), face
+// start offsets (fNum + 1 int32s), level of detail errors (lNum floats)
+// and start offsets (lNum + 1 int32s), then the corner vertex and normal
+// indices (cNum each) and the level of detail corners (lcNum pairs), all
+// indices indexBytes (2 or 4) wide, padded out to a multiple of 4 bytes.
+struct BinaryMeshHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t vNum, nNum, fNum, cNum;
+    uint32_t lNum, lcNum;
+    uint32_t indexBytes;
+    uint32_t checksum;
+    uint32_t size;
+};
+
+// Identifies a binary mesh file, and the version of the layout above.
+static const char BINARY_MAGIC[4] = { 'B', 'M', 'S', 'H' };
+static const uint32_t BINARY_VERSION = 3;
+
+// Most vertices or normals a mesh can have and still use 16-bit corner
+// indices.
+static const int MAX_SHORT_INDEXED = 65536;
+
+// Return the number of bytes of array data a binary file with the given
+// header should hold after the header.
+static size_t binaryPayloadSize( BinaryMeshHeader const &h ) {
+    size_t bytes = (size_t(h.vNum) * 3 + size_t(h.nNum) * 3) * 4
+        + (size_t(h.fNum) + 1) * 4 + size_t(h.lNum) * 4
+        + (size_t(h.lNum) + 1) * 4 + size_t(h.cNum) * 2 * h.indexBytes
+        + size_t(h.lcNum) * 2 * h.indexBytes;
+    return (bytes + 3) & ~size_t(3);
+}
+
+// FNV-1a, a word at a time, over size bytes of payload (a multiple of 4).
+static uint32_t binaryChecksum( void const *data, size_t size ) {
+    uint32_t const *word = (uint32_t const *) data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size / 4; i++) {
+        hash ^= word[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// True if this machine stores integers and floats little-endian, the
+// byte order used by binary mesh files.
+static bool littleEndian() {
+    uint32_t one = 1;
+    return *(unsigned char *) &one == 1;
+}
+
 // Make a new mesh, with mesh data populated from the given file.
-Mesh :: Mesh( char const *filename ) {
-    // file stream to read in mesh
-    ifstream meshFile;
-    // attempt to open mesh
-    meshFile.open(filename);
-    
-    // check if file failed to open
-    if (!meshFile) {
-        cerr << "invalid file name" << endl;
-        exit(1);
+Mesh :: Mesh( char const *filename, bool allowBinary ) {
+    // nothing allocated yet, so the destructor is safe on an empty mesh
+    vlist = nlist = NULL;
+    fvlist.data = fnlist.data = NULL;
+    fvlist.wide = fnlist.wide = false;
+    fstart = NULL;
+    vNum = nNum = fNum = 0;
+    vbo = ibo = 0;
+    indexType = GL_UNSIGNED_INT;
+    indexSize = 0;
+    vboBytes = vertexStride = 0;
+    packedBits = 0;
+    decodeMatrix = Matrix::identity();
+    for (int level = 0; level < MAX_LODS; level++)
+        indexFirst[level] = indexCount[level] = triangleCounts[level] = 0;
+    lodsBuilt = false;
+    mapping = NULL;
+    mappingSize = 0;
+
+    // Use the precompiled mesh if there's one that's up to date with the
+    // text file, otherwise parse the text.
+    bool loaded = false;
+    if (allowBinary) {
+        string binary = binaryName(filename);
+        struct stat textInfo, binaryInfo;
+        loaded = stat(binary.c_str(), &binaryInfo) == 0 &&
+            (stat(filename, &textInfo) != 0 ||
+             binaryInfo.st_mtime >= textInfo.st_mtime) &&
+            loadBinary(binary.c_str());
+    }
+    if (!loaded && !loadText(filename)) {
+        // leave the mesh empty, so it can still be drawn and deleted
+        delete [] vlist;
+        delete [] nlist;
+        delete [] (char *) fvlist.data;
+        delete [] (char *) fnlist.data;
+        delete [] fstart;
+        vlist = nlist = NULL;
+        fvlist.data = fnlist.data = NULL;
+        fstart = NULL;
+        vNum = nNum = fNum = 0;
+    }
+
+    // every face is drawn as a fan of triangles
+    for (int i = 0; i < fNum; i++)
+        triangleCounts[0] += fstart[i + 1] - fstart[i] - 2;
+
+    // the box around the vertices, and a sphere around the box's center
+    bounds(Matrix::identity(), boxLow, boxHigh);
+    sphereCenter = (boxLow + boxHigh) * 0.5;
+    double r2 = 0;
+    for (int i = 0; i < vNum; i++) {
+        Vector d(vlist[i * 3] - sphereCenter.x, vlist[i * 3 + 1] - sphereCenter.y,
+                 vlist[i * 3 + 2] - sphereCenter.z);
+        r2 = max(r2, d.magSquared());
+    }
+    sphereRadius = sqrt(r2);
+}
+
+string Mesh :: binaryName( char const *filename ) {
+    string name = filename;
+    size_t len = name.size();
+    if (len >= 5 && name.compare(len - 5, 5, ".mesh") == 0)
+        name.erase(len - 5);
+    return name + ".bmesh";
+}
+
+bool Mesh :: loadBinary( char const *filename ) {
+    // the file stores arrays in little-endian order, so we can only use
+    // them in place on a little-endian machine
+    if (!littleEndian())
+        return false;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 ||
+        size_t(info.st_size) < sizeof(BinaryMeshHeader)) {
+        close(fd);
+        return false;
+    }
+
+    // Map the whole file; the mapping stays valid after we close it.
+    size_t size = info.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    // Make sure this is a file we understand, and that it's intact.
+    BinaryMeshHeader const &h = *(BinaryMeshHeader const *) data;
+    char *payload = (char *) data + sizeof(BinaryMeshHeader);
+    if (memcmp(h.magic, BINARY_MAGIC, 4) != 0 ||
+        h.version != BINARY_VERSION ||
+        (h.indexBytes != 2 && h.indexBytes != 4) ||
+        h.size != binaryPayloadSize(h) ||
+        h.size != size - sizeof(BinaryMeshHeader) ||
+        h.checksum != binaryChecksum(payload, h.size)) {
+        cerr << filename << ": bad binary mesh, using text mesh instead\n";
+        munmap(data, size);
+        return false;
+    }
+
+    // Point straight into the mapped arrays.
+    vNum = h.vNum;
+    nNum = h.nNum;
+    fNum = h.fNum;
+    vlist = (GLfloat *) payload;
+    nlist = vlist + vNum * 3;
+    fstart = (int *) (nlist + nNum * 3);
+    float const *errors = (float const *) (fstart + fNum + 1);
+    int const *starts = (int const *) (errors + h.lNum);
+    fvlist.data = starts + h.lNum + 1;
+    fnlist.data = (char const *) fvlist.data + size_t(h.cNum) * h.indexBytes;
+    fvlist.wide = fnlist.wide = h.indexBytes == 4;
+
+    IndexArray corners = { (char const *) fnlist.data + size_t(h.cNum) * h.indexBytes,
+                           fvlist.wide };
+    IndexArray cornerNormals = { (char const *) corners.data + h.indexBytes,
+                                 fvlist.wide };
+
+    // The checksum only shows the file is as it was written, so make sure
+    // every face and corner is in range before anything indexes with it.
+    bool facesOk = fstart[0] == 0 && fstart[fNum] == int(h.cNum);
+    for (int i = 0; facesOk && i < fNum; i++)
+        facesOk = fstart[i + 1] - fstart[i] >= 3;
+    // Each level's start has to follow the one before, on a whole
+    // triangle, within the corners there are.
+    bool startsOk = h.lNum < MAX_LODS && starts[0] == 0 &&
+        size_t(starts[h.lNum]) * 2 == h.lcNum;
+    for (int level = 1; startsOk && level <= int(h.lNum); level++)
+        startsOk = starts[level] >= starts[level - 1] && starts[level] % 3 == 0 &&
+            size_t(starts[level]) <= h.lcNum / 2;
+    char const *problem = NULL;
+    if (!facesOk || badIndex(fvlist, h.cNum, 1, vNum) >= 0 ||
+        badIndex(fnlist, h.cNum, 1, nNum) >= 0)
+        problem = "bad faces";
+    else if (!startsOk ||
+             badIndex(corners, h.lcNum / 2, 2, vNum) >= 0 ||
+             badIndex(cornerNormals, h.lcNum / 2, 2, nNum) >= 0)
+        problem = "bad levels of detail";
+    if (problem) {
+        cerr << filename << ": " << problem << ", using text mesh instead\n";
+        munmap(data, size);
+        return false;
+    }
+
+    // The levels of detail are small, so they're copied out rather than
+    // used in place.
+    lodErrors.assign(errors, errors + h.lNum);
+    lodStart.assign(starts, starts + h.lNum + 1);
+    lodCorners.resize(h.lcNum);
+    for (size_t i = 0; i < h.lcNum; i++)
+        lodCorners[i] = corners[i];
+    for (int level = 1; level <= int(h.lNum); level++)
+        triangleCounts[level] = (lodStart[level] - lodStart[level - 1]) / 3;
+    lodsBuilt = true;
+
+    mapping = data;
+    mappingSize = size;
+    return true;
+}
+
+long Mesh :: badIndex( IndexArray list, size_t count, size_t step,
+                       unsigned limit ) {
+    for (size_t i = 0; i < count; i++)
+        if (list[i * step] >= limit)
+            return i;
+    return -1;
+}
+
+bool Mesh :: save( char const *filename ) const {
+    if (!littleEndian()) {
+        cerr << "Binary meshes can only be written on little-endian hosts\n";
+        return false;
+    }
+
+    // Lay out the payload exactly as loadBinary() expects to find it.
+    BinaryMeshHeader h;
+    memcpy(h.magic, BINARY_MAGIC, 4);
+    h.version = BINARY_VERSION;
+    h.vNum = vNum;
+    h.nNum = nNum;
+    h.fNum = fNum;
+    h.cNum = fstart ? fstart[fNum] : 0;
+    h.lNum = lodErrors.size();
+    h.lcNum = lodCorners.size();
+    h.indexBytes = cornerBytes();
+    h.size = binaryPayloadSize(h);
+
+    vector< char > payload(h.size, 0);
+    char *pos = &payload[0];
+    memcpy(pos, vlist, vNum * 3 * sizeof(GLfloat));
+    pos += vNum * 3 * sizeof(GLfloat);
+    memcpy(pos, nlist, nNum * 3 * sizeof(GLfloat));
+    pos += nNum * 3 * sizeof(GLfloat);
+    if (fstart)
+        memcpy(pos, fstart, (fNum + 1) * sizeof(int));
+    else
+        memset(pos, 0, sizeof(int));
+    pos += (fNum + 1) * sizeof(int);
+    if (h.lNum) {
+        memcpy(pos, &lodErrors[0], h.lNum * sizeof(float));
+        pos += h.lNum * sizeof(float);
+        memcpy(pos, &lodStart[0], (h.lNum + 1) * sizeof(int));
     } else {
-        // temp string for reading
-        string temp;
-        // ensure mesh has vlist
-        if(meshFile >> temp && temp == "vlist") {
-            // read in number of vertices
-            meshFile >> vNum;
-            // store the vertices in an array
-            if (vNum > 0) {
-                vlist = new GLfloat *[vNum];
-                for (int i = 0; i < vNum; i++) {
-                    vlist[i] = new GLfloat[3];
-                    for (int j = 0; j < 3; j++) {
-                        meshFile >> vlist[i][j];
-                    }
-                }
-            }
+        memset(pos, 0, sizeof(int));
+    }
+    pos += (h.lNum + 1) * sizeof(int);
+    memcpy(pos, fvlist.data, h.cNum * h.indexBytes);
+    pos += h.cNum * h.indexBytes;
+    memcpy(pos, fnlist.data, h.cNum * h.indexBytes);
+    pos += h.cNum * h.indexBytes;
+    for (size_t i = 0; i < h.lcNum; i++, pos += h.indexBytes) {
+        if (fvlist.wide) {
+            uint32_t index = lodCorners[i];
+            memcpy(pos, &index, 4);
         } else {
-            cerr << "No vlist in mesh file.\n";
-            exit(1);
-        }
-        // ensure mesh has nlist
-        if (meshFile >> temp && temp == "nlist") {
-            // read in number of normals
-            meshFile >> nNum;
-            // store the vertices in an array
-            if (nNum > 0) {
-                nlist = new GLfloat *[nNum];
-                for (int i = 0; i < nNum; i++) {
-                    nlist[i] = new GLfloat[3];
-                    for (int j = 0; j < 3; j++) {
-                        meshFile >> nlist[i][j];
-                    }
-                }
+            uint16_t index = lodCorners[i];
+            memcpy(pos, &index, 2);
+        }
+    }
+    h.checksum = binaryChecksum(&payload[0], h.size);
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+        return false;
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+        fwrite(&payload[0], h.size, 1, fp) == 1;
+    return fclose(fp) == 0 && ok;
+}
+
+// Cursor over the contents of a text mesh file, held in memory with a
+// terminating NUL.  Numbers are scanned by hand, so there's no per-token
+// string and no dependence on the locale.  The first malformed input is
+// recorded with its line and column; after that, the scanner stays at
+// the end of the text and everything it reads is zero, so the caller
+// only has to check failed() before trusting what it's read.
+class MeshScanner {
+public:
+    MeshScanner( char const *name, char const *text ) {
+        filename = name;
+        pos = lineStart = token = text;
+        end = text + strlen(text);
+        line = 1;
+    }
+
+    // Record a problem with the current token, unless there already is
+    // one, and give up on the rest of the text.
+    void fail( char const *msg ) {
+        if (error.empty()) {
+            char where[32];
+            snprintf(where, sizeof(where), ":%d:%d: ", line, int(token - lineStart + 1));
+            error = filename + string(where) + msg;
+        }
+        pos = lineStart = token = end;
+    }
+
+    // True once something has failed, and what it was.
+    bool failed() const {
+        return !error.empty();
+    }
+    string const &problem() const {
+        return error;
+    }
+
+    // Skip the given keyword, failing if it's not next in the file.
+    void keyword( char const *word, char const *msg ) {
+        skipSpace();
+        int len = strlen(word);
+        if (strncmp(pos, word, len) != 0 || !isBreak(pos[len])) {
+            fail(msg);
+            return;
+        }
+        pos += len;
+    }
+
+    // Read a non-negative integer.
+    long count() {
+        skipSpace();
+        if (*pos < '0' || *pos > '9') {
+            fail("expected a non-negative integer");
+            return 0;
+        }
+        long val = 0;
+        while (*pos >= '0' && *pos <= '9') {
+            val = val * 10 + (*pos++ - '0');
+            if (val > 0x7fffffffL) {
+                fail("integer is too large");
+                return 0;
             }
-        } else {
-            cerr << "No nlist in mesh file.\n";
-            exit(1);
-        }
-        // ensure mesh has flist
-        if (meshFile >> temp && temp == "flist") {
-            // read in number of faces
-            meshFile >> fNum;
-            if (fNum > 0) {
-                // populate fnlist with the indices into the
-                // nlist array
-                // populate fvlist with the indices into the
-                // vlist array
-                fvlist = new GLushort *[fNum];
-                fnlist = new GLushort *[fNum];
-                
-                for (int i = 0; i < fNum; i++) {
-                    
-                    meshFile >> temp;
-                    int vNum = atoi(temp.c_str());
-                    
-                    fvlist[i] = new GLushort [vNum + 1];
-                    fnlist[i] = new GLushort [vNum + 1];
-                    fvlist[i][0] = fnlist[i][0] = vNum;
-                    
-                    if (vNum == 4 || vNum == 3) {
-                        for (int j = 1; j <= vNum; j++) {
-                            meshFile >> fvlist[i][j];
-                            meshFile >> fnlist[i][j];
-                        }
-                    } else {
-                        cerr << "Mesh invalid.\n";
-                    }
+        }
+        if (!isBreak(*pos)) {
+            fail("expected a non-negative integer");
+            return 0;
+        }
+        return val;
+    }
+
+    // Read a decimal floating point value, with optional sign, fraction
+    // and exponent.
+    GLfloat real() {
+        skipSpace();
+        bool negative = *pos == '-';
+        if (*pos == '-' || *pos == '+')
+            pos++;
+
+        // Collect up to 19 significant digits, which fit in 64 bits, and
+        // keep track of the power of ten they need to be scaled by.
+        unsigned long long mantissa = 0;
+        int digits = 0, scale = 0;
+        bool any = false;
+        for (; *pos >= '0' && *pos <= '9'; pos++, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*pos - '0');
+                if (mantissa)
+                    digits++;
+            } else {
+                scale++;
+            }
+        }
+        if (*pos == '.') {
+            pos++;
+            for (; *pos >= '0' && *pos <= '9'; pos++, any = true) {
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + (*pos - '0');
+                    if (mantissa)
+                        digits++;
+                    scale--;
                 }
             }
-        } else {
-            cerr << "No flist in mesh file.\n";
-            exit(1);
         }
+        if (!any) {
+            fail("expected a number");
+            return 0;
+        }
+
+        if (*pos == 'e' || *pos == 'E') {
+            pos++;
+            bool negExp = *pos == '-';
+            if (*pos == '-' || *pos == '+')
+                pos++;
+            if (*pos < '0' || *pos > '9') {
+                fail("expected an exponent");
+                return 0;
+            }
+            int exp = 0;
+            for (; *pos >= '0' && *pos <= '9'; pos++)
+                if (exp < 10000)
+                    exp = exp * 10 + (*pos - '0');
+            scale += negExp ? -exp : exp;
+        }
+        if (!isBreak(*pos)) {
+            fail("expected a number");
+            return 0;
+        }
+
+        // Powers of ten up to 1e22 are exact in a double, so for typical
+        // input this is a single correctly rounded operation.
+        static const double pow10[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        double val = double(mantissa);
+        while (scale > 22) {
+            val *= 1e22;
+            scale -= 22;
+        }
+        while (scale < -22) {
+            val /= 1e22;
+            scale += 22;
+        }
+        if (scale >= 0)
+            val *= pow10[scale];
+        else
+            val /= pow10[-scale];
+        return GLfloat(negative ? -val : val);
+    }
+
+private:
+    // True if c can legally follow a token.
+    static bool isBreak( char c ) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\0';
+    }
+
+    // Move past whitespace, counting lines as we go.
+    void skipSpace() {
+        for (;; pos++) {
+            if (*pos == '\n') {
+                line++;
+                lineStart = pos + 1;
+            } else if (*pos != ' ' && *pos != '\t' && *pos != '\r') {
+                token = pos;
+                return;
+            }
+        }
+    }
+
+    string filename, error;
+    char const *pos;
+    char const *end;
+    char const *lineStart;
+    char const *token;
+    int line;
+};
+
+bool Mesh :: loadText( char const *filename ) {
+    // Read the whole file in one go, with a NUL after it to stop the
+    // scanner.
+    FILE *fp = fopen(filename, "rb");
+    struct stat info;
+    if (!fp || fstat(fileno(fp), &info) != 0) {
+        loadError = string(filename) + ": " + strerror(errno);
+        if (fp)
+            fclose(fp);
+        return false;
+    }
+    vector< char > text(info.st_size + 1);
+    size_t len = fread(&text[0], 1, info.st_size, fp);
+    fclose(fp);
+    text[len] = '\0';
+    
+    // Every number takes at least a character, so a count the file
+    // can't hold is malformed, and isn't allocated for.
+    MeshScanner scan(filename, &text[0]);
+    auto failed = [&]() {
+        if (scan.failed())
+            loadError = scan.problem();
+        return scan.failed();
+    };
+    
+    // read in the vertices, stored in one packed array
+    scan.keyword("vlist", "No vlist in mesh file.");
+    vNum = scan.count();
+    if (vNum * 3L > long(len))
+        scan.fail("Mesh invalid, more vertices than the file holds.");
+    if (failed())
+        return false;
+    vlist = new GLfloat [vNum * 3];
+    for (int i = 0; i < vNum * 3; i++)
+        vlist[i] = scan.real();
+    
+    // read in the normals, stored in one packed array
+    scan.keyword("nlist", "No nlist in mesh file.");
+    nNum = scan.count();
+    if (nNum * 3L > long(len))
+        scan.fail("Mesh invalid, more normals than the file holds.");
+    if (failed())
+        return false;
+    nlist = new GLfloat [nNum * 3];
+    for (int i = 0; i < nNum * 3; i++)
+        nlist[i] = scan.real();
+    
+    // Read in the faces.  Faces are triangles or quads, so four corners
+    // per face is enough room for the corner indices.  fvlist holds the
+    // indices into vlist and fnlist the indices into nlist, and fstart
+    // records where each face begins.  The indices are 16 bits unless
+    // there are too many vertices or normals for that.
+    scan.keyword("flist", "No flist in mesh file.");
+    fNum = scan.count();
+    if (fNum * 7L > long(len))
+        scan.fail("Mesh invalid, more faces than the file holds.");
+    if (failed())
+        return false;
+    bool wide = vNum > MAX_SHORT_INDEXED || nNum > MAX_SHORT_INDEXED;
+    size_t bytes = size_t(fNum) * 4 * (wide ? 4 : 2);
+    char *vindex = new char [bytes];
+    char *nindex = new char [bytes];
+    fvlist.data = vindex;
+    fnlist.data = nindex;
+    fvlist.wide = fnlist.wide = wide;
+    fstart = new int [fNum + 1];
+    
+    int corner = 0;
+    for (int i = 0; i < fNum && !scan.failed(); i++) {
+        fstart[i] = corner;
+        
+        int count = scan.count();
+        if (count != 3 && count != 4)
+            scan.fail("Mesh invalid, faces must have 3 or 4 corners.");
         
-        // close it all up
-        meshFile.close();
+        for (int j = 0; j < count && !scan.failed(); j++) {
+            long v = scan.count();
+            if (v >= vNum)
+                scan.fail("Mesh invalid, vertex index out of range.");
+            long n = scan.count();
+            if (n >= nNum)
+                scan.fail("Mesh invalid, normal index out of range.");
+            if (wide) {
+                ((uint32_t *) vindex)[corner] = v;
+                ((uint32_t *) nindex)[corner] = n;
+            } else {
+                ((uint16_t *) vindex)[corner] = v;
+                ((uint16_t *) nindex)[corner] = n;
+            }
+            corner++;
+        }
     }
+    fstart[fNum] = corner;
+    return !failed();
 }
 
 // Destroy this mesh.
 Mesh :: ~Mesh() {
-    // clear the allocated memory
-    for (int i = 0; i < vNum; i++) {
-        delete [] vlist[i];
+    // clear the allocated memory, or unmap it if it came from a file
+    if (mapping) {
+        munmap(mapping, mappingSize);
+    } else {
+        delete [] vlist;
+        delete [] nlist;
+        delete [] (char *) fvlist.data;
+        delete [] (char *) fnlist.data;
+        delete [] fstart;
+    }
+    if (vbo) {
+        glDeleteBuffers(1, &vbo);
+        glDeleteBuffers(1, &ibo);
+    }
+}
+
+void Mesh :: buildBvh() {
+    // fan each face into triangles, the same way upload() does
+    vector< unsigned > triangles;
+    for (int i = 0; i < fNum; i++) {
+        for (int j = fstart[i] + 2; j < fstart[i + 1]; j++) {
+            triangles.push_back(fvlist[fstart[i]]);
+            triangles.push_back(fvlist[j - 1]);
+            triangles.push_back(fvlist[j]);
+        }
+    }
+    bvh.build(vlist, triangles);
+}
+
+void Mesh :: buildLods() {
+    if (lodsBuilt)
+        return;
+    lodsBuilt = true;
+
+    // fan the faces into (vertex, normal) corners for the simplifier
+    vector< unsigned > corners;
+    for (int i = 0; i < fNum; i++) {
+        for (int j = fstart[i] + 2; j < fstart[i + 1]; j++) {
+            int fan[3] = { fstart[i], j - 1, j };
+            for (int k = 0; k < 3; k++) {
+                corners.push_back(fvlist[fan[k]]);
+                corners.push_back(fnlist[fan[k]]);
+            }
+        }
+    }
+
+    // Each level starts from the one before, aiming for half as many
+    // triangles.  Stop early once the simplifier can't make much of a
+    // dent, since a level that's barely smaller isn't worth drawing.
+    Simplifier simplifier(vlist, vNum, corners);
+    lodStart.assign(1, 0);
+    int previous = triangleCounts[0];
+    for (int level = 1; level < MAX_LODS; level++) {
+        int left = simplifier.reduce(previous / 2);
+        if (left == 0 || left > previous * 3 / 4)
+            break;
+
+        vector< unsigned > simplified;
+        simplifier.corners(simplified);
+        lodCorners.insert(lodCorners.end(), simplified.begin(), simplified.end());
+        lodStart.push_back(lodCorners.size() / 2);
+        lodErrors.push_back(simplifier.error());
+        triangleCounts[level] = left;
+        previous = left;
+    }
+    if (lodErrors.empty())
+        lodStart.clear();
+}
+
+bool Mesh :: intersect( Vector const &origin, Vector const &dir,
+                        double &t ) const {
+    float o[3] = { float(origin.x), float(origin.y), float(origin.z) };
+    float d[3] = { float(dir.x), float(dir.y), float(dir.z) };
+    float ft = t;
+    if (!bvh.intersect(o, d, ft))
+        return false;
+    t = ft;
+    return true;
+}
+
+void Mesh :: bounds( Matrix const &trans, Vector &low, Vector &high ) const {
+    low = Vector(1e30, 1e30, 1e30, 1);
+    high = Vector(-1e30, -1e30, -1e30, 1);
+
+    // transform the vertices a block at a time, split into coordinates
+    const int BLOCK = 256;
+    float x[BLOCK], y[BLOCK], z[BLOCK];
+    for (int i = 0; i < vNum; i += BLOCK) {
+        int n = min(BLOCK, vNum - i);
+        deinterleave(vlist + i * 3, n, x, y, z);
+        transformPoints(trans, n, x, y, z, x, y, z);
+        for (int j = 0; j < n; j++) {
+            low.x = min(low.x, double(x[j]));
+            low.y = min(low.y, double(y[j]));
+            low.z = min(low.z, double(z[j]));
+            high.x = max(high.x, double(x[j]));
+            high.y = max(high.y, double(y[j]));
+            high.z = max(high.z, double(z[j]));
+        }
     }
-    for (int i = 0; i < nNum; i++) {
-        delete [] nlist[i];
+}
+
+void Mesh :: indexed( vector< GLfloat > &verts, vector< GLuint > &indices,
+                      bool optimize ) const {
+    // Faces index positions and normals separately, but a buffer object
+    // needs one index per vertex.  Make a unified vertex for each distinct
+    // (position, normal) pair a corner uses.
+    // The levels of detail reuse the same vertices, and add any new
+    // pairings of their own.
+    map< pair< int, int >, GLuint > unified;
+    verts.clear();
+    int faceCorners = fstart ? fstart[fNum] : 0;
+    vector< GLuint > corners(faceCorners + lodCorners.size() / 2);
+    
+    for (int j = 0; j < (int) corners.size(); j++) {
+        pair< int, int > key;
+        if (j < faceCorners)
+            key = make_pair(fvlist[j], fnlist[j]);
+        else
+            key = make_pair(lodCorners[(j - faceCorners) * 2],
+                            lodCorners[(j - faceCorners) * 2 + 1]);
+        map< pair< int, int >, GLuint >::iterator pos = unified.find(key);
+        if (pos == unified.end()) {
+            GLuint index = verts.size() / 6;
+            verts.insert(verts.end(), vlist + key.first * 3,
+                         vlist + key.first * 3 + 3);
+            verts.insert(verts.end(), nlist + key.second * 3,
+                         nlist + key.second * 3 + 3);
+            pos = unified.insert(make_pair(key, index)).first;
+        }
+        corners[j] = pos->second;
     }
-    delete [] vlist;
-    delete [] nlist;
+    
+    // Break every face into a triangle fan around its first corner.
+    indices.clear();
     for (int i = 0; i < fNum; i++) {
-        delete [] fvlist[i];
-        delete [] fnlist[i];
+        for (int j = fstart[i] + 2; j < fstart[i + 1]; j++) {
+            indices.push_back(corners[fstart[i]]);
+            indices.push_back(corners[j - 1]);
+            indices.push_back(corners[j]);
+        }
+    }
+
+    // the simplified levels are already triangles
+    indices.insert(indices.end(), corners.begin() + faceCorners, corners.end());
+    if (!optimize)
+        return;
+
+    // Order each level's triangles for the post-transform cache, then
+    // renumber the vertices in the order the levels (finest first) use
+    // them, so fetches walk through the buffer.
+    int first = 0;
+    for (int level = 0; level < lodCount(); level++) {
+        optimizeVertexCache(indices, first, triangleCounts[level] * 3,
+                            verts.size() / 6);
+        first += triangleCounts[level] * 3;
+    }
+    optimizeVertexFetch(indices, verts, 6);
+}
+
+void Mesh :: upload() {
+    // only needs doing once
+    if (vbo)
+        return;
+
+    vector< GLfloat > verts;
+    vector< GLuint > indices;
+    indexed(verts, indices);
+    for (int level = 0; level < lodCount(); level++) {
+        indexFirst[level] = level ? indexFirst[level - 1] + indexCount[level - 1] : 0;
+        indexCount[level] = triangleCounts[level] * 3;
+    }
+
+    // Pack the vertices if that's wanted, and if they come back out
+    // close enough to what went in.
+    int count = verts.size() / 6;
+    vertexStride = 6 * sizeof(GLfloat);
+    vector< unsigned char > packed;
+    if (packing.normalBits && count) {
+        PositionQuantizer quantizer(boxLow, boxHigh);
+        packVertices(&verts[0], count, quantizer, packing.normalBits, packed);
+        double positionError, normalDegrees;
+        packingError(&verts[0], count, &packed[0], quantizer, packing.normalBits,
+                     positionError, normalDegrees);
+        if (positionError <= packing.maxPositionError &&
+            normalDegrees <= packing.maxNormalDegrees) {
+            packedBits = packing.normalBits;
+            vertexStride = packedStride(packedBits);
+            decodeMatrix = quantizer.decodeMatrix();
+        } else {
+            cerr << "Mesh can't be packed within the error bounds ("
+                 << positionError << " units, " << normalDegrees
+                 << " degrees), keeping float vertices\n";
+        }
+    }
+    vboBytes = count * vertexStride;
+    
+    // upload both arrays; they never change after this
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vboBytes,
+                 !count ? NULL : packedBits ? (GLvoid *) &packed[0] : (GLvoid *) &verts[0],
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    
+    // Indices are 16 bits whenever they can reach every vertex that way,
+    // since that halves what the GPU has to store and fetch for them.
+    vector< GLushort > shortIndices;
+    GLvoid const *indexData = indices.empty() ? NULL : &indices[0];
+    if (count <= MAX_SHORT_INDEXED) {
+        shortIndices.assign(indices.begin(), indices.end());
+        indexType = GL_UNSIGNED_SHORT;
+        indexSize = sizeof(GLushort);
+        indexData = shortIndices.empty() ? NULL : &shortIndices[0];
+    } else {
+        indexType = GL_UNSIGNED_INT;
+        indexSize = sizeof(GLuint);
     }
-    delete [] fvlist;
-    delete [] fnlist;
+    
+    glGenBuffers(1, &ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * indexSize,
+                 indexData, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 /** Draw all the polygon faces in this mesh. */
-void Mesh :: draw() {
+void Mesh :: draw( int level ) {
+    // the fixed function pipeline can't unpack normals
+    if (immediateMode || packedBits) {
+        drawImmediate(level);
+        return;
+    }
+    
+    // the whole mesh goes out in one call
+    bindBuffers();
+    if (!indexCount[level])
+        level = 0;
+    glDrawElements(GL_TRIANGLES, indexCount[level], indexType,
+                   (GLvoid *) (size_t(indexFirst[level]) * indexSize));
+    unbindBuffers();
+}
+
+void Mesh :: drawInstanced( int count, int level ) {
+    bindBuffers();
+    if (!indexCount[level])
+        level = 0;
+    glDrawElementsInstanced(GL_TRIANGLES, indexCount[level], indexType,
+                            (GLvoid *) (size_t(indexFirst[level]) * indexSize),
+                            count);
+    unbindBuffers();
+}
+
+void Mesh :: bindBuffers() {
+    if (!vbo)
+        upload();
+    
+    // Positions and normals are interleaved in the vertex buffer.
+    // Packed positions are whole numbers for positionDecode() to scale,
+    // and packed normals go to a generic attribute for the shader to
+    // unfold.
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    if (packedBits) {
+        glVertexPointer(3, GL_SHORT, vertexStride, (GLvoid *) 0);
+        glEnableVertexAttribArray(PACKED_NORMAL_ATTRIB);
+        glVertexAttribPointer(PACKED_NORMAL_ATTRIB, 2,
+                              packedBits == 8 ? GL_BYTE : GL_SHORT, GL_FALSE,
+                              vertexStride, (GLvoid *) (3 * sizeof(GLshort)));
+    } else {
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glVertexPointer(3, GL_FLOAT, vertexStride, (GLvoid *) 0);
+        glNormalPointer(GL_FLOAT, vertexStride, (GLvoid *) (3 * sizeof(GLfloat)));
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+}
+
+void Mesh :: unbindBuffers() {
+    if (packedBits)
+        glDisableVertexAttribArray(PACKED_NORMAL_ATTRIB);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Mesh :: drawImmediate( int level ) {
+    // simplified levels are plain triangles
+    if (level > 0 && level < lodCount()) {
+        glBegin(GL_TRIANGLES);
+        for (int j = lodStart[level - 1]; j < lodStart[level]; j++) {
+            glNormal3fv(nlist + lodCorners[j * 2 + 1] * 3);
+            glVertex3fv(vlist + lodCorners[j * 2] * 3);
+        }
+        glEnd();
+        return;
+    }
     
     // loop through all the faces,
     // manually setting the normal and vertex vectors
     for (int i = 0; i < fNum; i++) {
         glBegin(GL_POLYGON);
-        for(int j = 1; j <= fvlist[i][0]; j++) {
-            glNormal3fv(nlist[fnlist[i][j]]);
-            glVertex3fv(vlist[fvlist[i][j]]);
+        for(int j = fstart[i]; j < fstart[i + 1]; j++) {
+            glNormal3fv(nlist + fnlist[j] * 3);
+            glVertex3fv(vlist + fvlist[j] * 3);
         }
         glEnd();
     }
@@ -2,28 +2,326 @@
 #define __MESH_H__
 
 #include "Geometry.h"
+#include "Bvh.h"
+#include <string>
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
 
 //
 // Representation for a polygon mesh model.
 //
+// Meshes are authored as text .mesh files, but can also be precompiled
+// into a binary .bmesh file (see save()).  The binary file starts with a
+// small versioned header and then holds the vertex, normal and face
+// arrays exactly as Mesh keeps them in memory, little-endian, so it can
+// be mapped in and used without any parsing.  It also holds the mesh's
+// simplified levels of detail (see buildLods()), so they don't have to
+// be rebuilt every time the mesh is loaded.
+//
+// Face corners index the vertex and normal arrays with 16-bit integers
+// when both have at most 65,536 entries, and with 32-bit ones otherwise,
+// and every index is checked against the arrays when the mesh is loaded.
+// The index buffer drawn from is likewise 16-bit whenever it can be.
+//
 class Mesh {
 public:
+    /** Most levels of detail a mesh can have, counting the full mesh as
+        level zero. */
+    static const int MAX_LODS = 4;
+
     // Make a new mesh, with mesh data populated from the given file.
-    Mesh( char const *filename );
+    // If a binary copy of the file exists and is at least as new as the
+    // text file, it is mapped in instead, unless allowBinary is false.
+    // If the file can't be read or is malformed, the mesh is left empty
+    // and error() says why.
+    Mesh( char const *filename, bool allowBinary = true );
     
     // Destroy this mesh.
     virtual ~Mesh();
     
-    /** Draw all the polygon faces in this mesh. */
-    void draw();
+    /** Draw all the polygon faces in this mesh, or the simplified
+        triangles of the given level of detail. */
+    void draw( int level = 0 );
+
+    /** Draw count copies of the mesh at the given level of detail with
+        one instanced draw call.  The caller is responsible for setting
+        up the per-instance attributes and the shader that uses them. */
+    void drawInstanced( int count, int level = 0 );
+
+    /** Build and upload the buffer objects used by draw().  This needs a
+        current GL context; draw() calls it itself if it hasn't been
+        called yet. */
+    void upload();
+
+    /** Fill in the vertices and triangle indices upload() puts in the
+        buffer objects: an interleaved x, y, z position and x, y, z
+        normal for each vertex, and three indices for each triangle of
+        each level of detail, the levels one after the other.  Unless
+        optimize is false, the triangles of each level are reordered to
+        make good use of the GPU's vertex cache, and the vertices are
+        stored in the order they're first used. */
+    void indexed( std::vector< GLfloat > &verts, std::vector< GLuint > &indices,
+                  bool optimize = true ) const;
+
+    /** Build the bounding volume hierarchy intersect() uses.  This
+        doesn't need a GL context, so it can be done off the GL thread. */
+    void buildBvh();
+
+    /** Build simplified copies of the mesh, each with about half the
+        triangles of the one before, for drawing it when it's small on
+        the screen.  Meshes mapped from a binary file already have them.
+        Like buildBvh(), this doesn't need a GL context, but it has to
+        happen before upload() for the levels to be drawn. */
+    void buildLods();
+
+    /** Return the number of levels of detail, including the full mesh. */
+    int lodCount() const {
+        return 1 + lodErrors.size();
+    }
+
+    /** Return how far the given level of detail may stray from the full
+        mesh, in model coordinates.  This is zero for level zero. */
+    float lodError( int level ) const {
+        return level ? lodErrors[ level - 1 ] : 0;
+    }
+
+    /** Return the number of triangles drawn for the given level of
+        detail. */
+    int triangles( int level = 0 ) const {
+        return triangleCounts[ level ];
+    }
+
+    /** Cast a ray from origin along dir, both in model coordinates.  If
+        it hits the mesh at a parameter between zero and t, set t to the
+        parameter of the closest hit and return true.  Rays never hit a
+        mesh whose hierarchy hasn't been built. */
+    bool intersect( Vector const &origin, Vector const &dir, double &t ) const;
+
+    /** Find the axis-aligned box around the mesh's vertices after they're
+        transformed by trans, and return its corners in low and high.  An
+        empty mesh gives a box with low above high. */
+    void bounds( Matrix const &trans, Vector &low, Vector &high ) const;
+
+    /** Corners of the axis-aligned box around the mesh's vertices, in
+        model coordinates, computed when the mesh is loaded. */
+    Vector const &lowCorner() const {
+        return boxLow;
+    }
+    Vector const &highCorner() const {
+        return boxHigh;
+    }
+
+    /** Center and radius of a sphere around the mesh's vertices, in
+        model coordinates. */
+    Vector const &center() const {
+        return sphereCenter;
+    }
+    double radius() const {
+        return sphereRadius;
+    }
+
+    /** Write this mesh to the given file in the binary mesh format.
+        Returns false if the file couldn't be written. */
+    bool save( char const *filename ) const;
+
+    /** Return the name of the binary mesh file that goes with the given
+        text mesh file (e.g. pawn.bmesh for pawn.mesh). */
+    static std::string binaryName( char const *filename );
+
+    /** If true, draw() falls back to sending every face through
+        glBegin/glEnd instead of using the buffer objects.  This is
+        mostly here so the two paths can be compared at runtime. */
+    static bool immediateMode;
+
+    /** How upload() lays out the vertex buffer (see VertexPacking.h). */
+    struct Packing {
+        /** Bits per octahedral normal component, 8 or 16, or 0 to keep
+            float positions and normals. */
+        int normalBits;
+
+        /** Most a packed position may move, in model coordinates, and
+            most a packed normal may turn, in degrees.  A mesh that can't
+            be packed within these keeps float vertices. */
+        double maxPositionError, maxNormalDegrees;
+    };
+
+    /** Vertex layout for meshes uploaded from now on.  Packed buffers
+        can only be drawn with drawInstanced(), through a shader that
+        decodes them like Instancer's does; draw() falls back to
+        immediate mode for them. */
+    static Packing packing;
+
+    /** Attribute location drawInstanced() feeds packed normals to. */
+    static const int PACKED_NORMAL_ATTRIB = 9;
+
+    /** Return the bits per normal component in this mesh's vertex
+        buffer, or 0 if it holds floats. */
+    int packedNormalBits() const {
+        return packedBits;
+    }
+
+    /** Return the matrix that takes the positions in this mesh's vertex
+        buffer to model coordinates; the identity unless it's packed. */
+    Matrix const &positionDecode() const {
+        return decodeMatrix;
+    }
+
+    /** Return the size in bytes of the vertex buffer, once uploaded. */
+    int vertexBytes() const {
+        return vboBytes;
+    }
+
+    /** Return the size in bytes of each index in the index buffer (2 or
+        4), once uploaded. */
+    int indexBytes() const {
+        return indexSize;
+    }
+
+    /** Return the size in bytes of each face corner index as the mesh
+        stores them (2 or 4). */
+    int cornerBytes() const {
+        return fvlist.wide ? 4 : 2;
+    }
+
+    /** Return why the mesh couldn't be loaded, with the file name and,
+        for a malformed file, the line and column, or an empty string if
+        it loaded. */
+    std::string const &error() const {
+        return loadError;
+    }
+
+    /** Return the number of vertex positions, normals and faces. */
+    int vertexCount() const {
+        return vNum;
+    }
+    int normalCount() const {
+        return nNum;
+    }
+    int faceCount() const {
+        return fNum;
+    }
     
 private:
-    GLfloat **vlist;
-    GLfloat **nlist;
-    GLushort **fvlist;
-    GLushort **fnlist;
+    /** Read-only view of an array of 16- or 32-bit indices, so faces can
+        use whichever the mesh needs and still be indexed like arrays. */
+    struct IndexArray {
+        void const *data;
+        bool wide;
+
+        unsigned operator[]( size_t i ) const {
+            return wide ? ((uint32_t const *) data)[i]
+                        : ((uint16_t const *) data)[i];
+        }
+    };
+
+    /** Parse the mesh from a text .mesh file.  Returns false, after
+        setting loadError, if it can't be read or is malformed. */
+    bool loadText( char const *filename );
+
+    /** Map in the mesh from a binary .bmesh file.  Returns false, leaving
+        the mesh empty, if the file is missing, out of date or corrupt. */
+    bool loadBinary( char const *filename );
+
+    /** Return the position of the first of count indices, taken every
+        step entries of list, that isn't below limit, or -1 if none. */
+    static long badIndex( IndexArray list, size_t count, size_t step,
+                          unsigned limit );
+
+    /** Bind the mesh's buffer objects and enable the vertex and normal
+        arrays that point into them, uploading first if needed. */
+    void bindBuffers();
+
+    /** Undo bindBuffers(). */
+    void unbindBuffers();
+
+    /** Draw the mesh (or a level of detail) one polygon at a time, in
+        immediate mode. */
+    void drawImmediate( int level );
+
+    /** Vertex positions, packed as x, y, z for each of the vNum vertices. */
+    GLfloat *vlist;
+
+    /** Vertex normals, packed as x, y, z for each of the nNum normals. */
+    GLfloat *nlist;
+
+    /** Vertex index for every face corner, with all the faces stored
+        back to back. */
+    IndexArray fvlist;
+
+    /** Normal index for every face corner, parallel to fvlist, and
+        always the same width. */
+    IndexArray fnlist;
+
+    /** Offset of each face's first corner in fvlist/fnlist.  This has
+        fNum + 1 entries, so face i uses corners fstart[ i ] up to (but
+        not including) fstart[ i + 1 ]. */
+    int *fstart;
+
     int vNum, nNum, fNum;
+
+    /** Buffer object holding interleaved position/normal pairs, one for
+        each distinct (vertex, normal) combination used by a face, either
+        as floats or packed. */
+    GLuint vbo;
+
+    /** Size of vbo, and of each vertex in it, in bytes. */
+    int vboBytes, vertexStride;
+
+    /** Bits per normal component if vbo is packed, otherwise 0. */
+    int packedBits;
+
+    /** Takes the positions in vbo to model coordinates. */
+    Matrix decodeMatrix;
+
+    /** Buffer object holding triangle indices into vbo, for every level
+        of detail one after the other. */
+    GLuint ibo;
+
+    /** Type of the indices in ibo (GL_UNSIGNED_SHORT or GL_UNSIGNED_INT),
+        and their size in bytes. */
+    GLenum indexType;
+    int indexSize;
+
+    /** For each level of detail, the offset of its first index in ibo,
+        and its number of indices (three per triangle). */
+    int indexFirst[ MAX_LODS ], indexCount[ MAX_LODS ];
+
+    /** Number of triangles in each level of detail. */
+    int triangleCounts[ MAX_LODS ];
+
+    /** For each level of detail past the first, its error (see
+        lodError()). */
+    std::vector< float > lodErrors;
+
+    /** Triangle corners of the simplified levels, as (vertex, normal)
+        index pairs like fvlist/fnlist, all levels back to back. */
+    std::vector< GLuint > lodCorners;
+
+    /** Offset of each simplified level's first corner in lodCorners
+        (counting pairs), with one extra entry at the end, like fstart. */
+    std::vector< int > lodStart;
+
+    /** True once the levels of detail have been built or loaded. */
+    bool lodsBuilt;
+
+    /** Bounding box and sphere, in model coordinates. */
+    Vector boxLow, boxHigh, sphereCenter;
+    double sphereRadius;
+
+    /** Hierarchy over the mesh's triangles, for picking. */
+    Bvh bvh;
+
+    /** If the mesh was loaded from a binary file, the mapped file that
+        the arrays above point into.  Otherwise, NULL and the arrays are
+        owned by the mesh. */
+    void *mapping;
+
+    /** Size in bytes of mapping. */
+    size_t mappingSize;
+
+    /** What error() returns. */
+    std::string loadError;
 };
 
 #endif
-
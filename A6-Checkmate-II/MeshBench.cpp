@@ -0,0 +1,131 @@
+//
+// MeshBench.cpp
+//
+// Time the text mesh parser in Mesh against the ifstream-based loader it
+// replaced, on a large synthetic mesh.
+//
+// Usage: meshbench [faces] [scratch file]
+//
+
+#include "Mesh.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/time.h>
+
+using namespace std;
+
+// Return the current time in seconds.
+static double now() {
+    timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Write a synthetic mesh with the given number of faces, a mix of
+// triangles and quads over a grid of shared vertices and normals.
+static void writeMesh( char const *filename, int faces ) {
+    FILE *fp = fopen( filename, "w" );
+    if ( !fp ) {
+        cerr << "Can't write " << filename << endl;
+        exit( 1 );
+    }
+
+    // Keep the grid small enough for 16-bit indices.
+    const int SIDE = 250;
+    fprintf( fp, "vlist %d\n", SIDE * SIDE );
+    for ( int z = 0; z < SIDE; z++ )
+        for ( int x = 0; x < SIDE; x++ )
+            fprintf( fp, "  %.4f %.4f %.4f\n", x * 0.01, 0.5 * sin( x * 0.1 ),
+                     z * -0.01 );
+    fprintf( fp, "nlist %d\n", SIDE * SIDE );
+    for ( int z = 0; z < SIDE; z++ )
+        for ( int x = 0; x < SIDE; x++ )
+            fprintf( fp, "  %.4f %.4f %.4f\n", 0.0, cos( x * 0.1 ),
+                     -sin( x * 0.1 ) );
+
+    fprintf( fp, "flist %d\n", faces );
+    for ( int i = 0; i < faces; i++ ) {
+        int cell = i % ( ( SIDE - 1 ) * ( SIDE - 1 ) );
+        int a = cell / ( SIDE - 1 ) * SIDE + cell % ( SIDE - 1 );
+        int b = a + 1, c = a + SIDE + 1, d = a + SIDE;
+        if ( i % 2 )
+            fprintf( fp, "3 %d %d %d %d %d %d\n", a, a, b, b, c, c );
+        else
+            fprintf( fp, "4 %d %d %d %d %d %d %d %d\n", a, a, b, b, c, c, d, d );
+    }
+    fclose( fp );
+}
+
+// The original loader, token by token through ifstream, kept here as a
+// baseline.  Returns the number of face corners read.
+static long streamLoad( char const *filename ) {
+    ifstream meshFile( filename );
+    string temp;
+    int vNum, nNum, fNum;
+
+    meshFile >> temp >> vNum;
+    GLfloat *vlist = new GLfloat [ vNum * 3 ];
+    for ( int i = 0; i < vNum * 3; i++ )
+        meshFile >> vlist[ i ];
+
+    meshFile >> temp >> nNum;
+    GLfloat *nlist = new GLfloat [ nNum * 3 ];
+    for ( int i = 0; i < nNum * 3; i++ )
+        meshFile >> nlist[ i ];
+
+    meshFile >> temp >> fNum;
+    GLushort *fvlist = new GLushort [ fNum * 4 ];
+    GLushort *fnlist = new GLushort [ fNum * 4 ];
+    long corner = 0;
+    for ( int i = 0; i < fNum; i++ ) {
+        meshFile >> temp;
+        int count = atoi( temp.c_str() );
+        for ( int j = 0; j < count; j++ ) {
+            meshFile >> fvlist[ corner ];
+            meshFile >> fnlist[ corner ];
+            corner++;
+        }
+    }
+
+    delete [] vlist;
+    delete [] nlist;
+    delete [] fvlist;
+    delete [] fnlist;
+    return corner;
+}
+
+int main( int argc, char **argv ) {
+    int faces = argc > 1 ? atoi( argv[ 1 ] ) : 2000000;
+    string filename = argc > 2 ? argv[ 2 ] : "/tmp/meshbench.mesh";
+
+    cout << "Writing " << faces << " faces to " << filename << endl;
+    writeMesh( filename.c_str(), faces );
+
+    // Run each loader a few times and keep the best time, so the file
+    // is warm in the page cache for both.
+    double best[ 2 ] = { 1e9, 1e9 };
+    for ( int run = 0; run < 3; run++ ) {
+        double start = now();
+        streamLoad( filename.c_str() );
+        best[ 0 ] = min( best[ 0 ], now() - start );
+
+        start = now();
+        Mesh mesh( filename.c_str(), false );
+        best[ 1 ] = min( best[ 1 ], now() - start );
+        if ( !mesh.error().empty() ) {
+            cerr << mesh.error() << endl;
+            return 1;
+        }
+    }
+
+    printf( "ifstream loader: %8.3f s\n", best[ 0 ] );
+    printf( "scanner loader:  %8.3f s  (%.1fx)\n", best[ 1 ],
+            best[ 0 ] / best[ 1 ] );
+
+    remove( filename.c_str() );
+    return 0;
+}
@@ -0,0 +1,45 @@
+//
+// MeshConvert.cpp
+//
+// Precompile text .mesh files into the binary .bmesh format, so the
+// viewer can map them in at startup instead of parsing and simplifying
+// them.
+//
+// Usage: meshc input.mesh [output.bmesh]
+//
+
+#include "Mesh.h"
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int main( int argc, char **argv ) {
+    if ( argc < 2 || argc > 3 ) {
+        cerr << "usage: " << argv[ 0 ] << " input.mesh [output.bmesh]" << endl;
+        return 1;
+    }
+
+    // Always parse the text file, even if there's a binary copy already.
+    // The levels of detail are simplified here, once, and saved with it.
+    Mesh mesh( argv[ 1 ], false );
+    if ( !mesh.error().empty() ) {
+        cerr << mesh.error() << endl;
+        return 1;
+    }
+    mesh.buildLods();
+    cout << argv[ 1 ] << ":";
+    for ( int level = 0; level < mesh.lodCount(); level++ )
+        cout << " " << mesh.triangles( level ) << " triangles (error "
+             << mesh.lodError( level ) << ")";
+    cout << endl;
+
+    string output = argc == 3 ? argv[ 2 ] : Mesh::binaryName( argv[ 1 ] );
+    if ( !mesh.save( output.c_str() ) ) {
+        cerr << "Can't write " << output << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+//
+// MeshLoader.cpp
+//
+// Background loading for the piece meshes.
+//
+
+#include "MeshLoader.h"
+
+#include <algorithm>
+
+using namespace std;
+
+MeshLoader :: MeshLoader( vector< string > const &fileList, int threadCount )
+    : files( fileList ), meshes( fileList.size(), NULL ), errors( fileList.size() ),
+      taken( fileList.size(), false ), next( 0 ) {
+    // There's no point in having more workers than files.
+    if ( threadCount <= 0 )
+        threadCount = max( 1u, thread::hardware_concurrency() );
+    threadCount = min( threadCount, int( files.size() ) );
+
+    for ( int i = 0; i < threadCount; i++ )
+        workers.push_back( thread( &MeshLoader::work, this ) );
+}
+
+MeshLoader :: ~MeshLoader() {
+    wait();
+
+    // Anything still here was never handed out.
+    for ( int i = 0; i < meshes.size(); i++ )
+        delete meshes[ i ];
+}
+
+void MeshLoader :: work() {
+    // Claim files one at a time until they're all spoken for.
+    int i;
+    while ( ( i = next++ ) < int( files.size() ) ) {
+        // Parse without holding the lock, that's the slow part.  The
+        // picking hierarchy and levels of detail get built here too.
+        Mesh *mesh = new Mesh( files[ i ].c_str() );
+        if ( !mesh->error().empty() ) {
+            lock_guard< mutex > guard( lock );
+            errors[ i ] = mesh->error();
+            delete mesh;
+            continue;
+        }
+        mesh->buildBvh();
+        mesh->buildLods();
+
+        lock_guard< mutex > guard( lock );
+        meshes[ i ] = mesh;
+    }
+}
+
+Mesh *MeshLoader :: take( int index, string &error ) {
+    lock_guard< mutex > guard( lock );
+    Mesh *mesh = meshes[ index ];
+    error = errors[ index ];
+    errors[ index ].clear();
+    if ( mesh || !error.empty() ) {
+        meshes[ index ] = NULL;
+        taken[ index ] = true;
+    }
+    return mesh;
+}
+
+bool MeshLoader :: finished() const {
+    lock_guard< mutex > guard( lock );
+    return find( taken.begin(), taken.end(), false ) == taken.end();
+}
+
+void MeshLoader :: wait() {
+    for ( int i = 0; i < workers.size(); i++ )
+        if ( workers[ i ].joinable() )
+            workers[ i ].join();
+}
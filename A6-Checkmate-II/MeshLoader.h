@@ -0,0 +1,70 @@
+#ifndef __MESHLOADER_H__
+#define __MESHLOADER_H__
+
+#include "Mesh.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Loads a list of mesh files in the background, on a small pool of
+// threads.  Parsing (or mapping) the files happens off the GL thread; the
+// GL thread calls take() to collect finished meshes, uploads them and
+// puts them to use, so the window can come up before loading is done.
+// A file that can't be loaded doesn't stop the workers; take() hands
+// back why instead of a mesh, for the GL thread to deal with.
+//
+class MeshLoader {
+public:
+    // Start loading the given mesh files, using up to threadCount worker
+    // threads (or one per hardware thread, if threadCount is zero).
+    MeshLoader( std::vector< std::string > const &files, int threadCount = 0 );
+
+    // Wait for the workers to finish, and delete any mesh that was never
+    // taken.
+    ~MeshLoader();
+
+    // If the mesh for files[ index ] has finished loading and hasn't been
+    // taken yet, return it and hand ownership to the caller.  Otherwise,
+    // return NULL, and if the file turned out not to be loadable, set
+    // error to why (Mesh::error()); it then counts as taken.
+    Mesh *take( int index, std::string &error );
+
+    // Return true if every mesh has been loaded and taken.
+    bool finished() const;
+
+    // Block until every mesh has finished loading.
+    void wait();
+
+private:
+    // Body of each worker thread; loads meshes until none are left.
+    void work();
+
+    /** Files to load, in the order the caller wants them back. */
+    std::vector< std::string > files;
+
+    /** Loaded meshes, parallel to files.  Entries become non-NULL as
+        workers finish them, and go back to NULL when they are taken. */
+    std::vector< Mesh * > meshes;
+
+    /** Why each file that couldn't be loaded failed, parallel to files,
+        until it's taken.  Empty for the rest. */
+    std::vector< std::string > errors;
+
+    /** True for each entry of files that has been returned by take(). */
+    std::vector< bool > taken;
+
+    /** Index of the next file a worker should pick up. */
+    std::atomic< int > next;
+
+    /** Guards meshes, errors and taken. */
+    mutable std::mutex lock;
+
+    /** The worker threads. */
+    std::vector< std::thread > workers;
+};
+
+#endif
@@ -0,0 +1,196 @@
+//
+// MeshReplay.cpp
+//
+// Check that the piece meshes still draw exactly the polygons they drew
+// when every vertex, normal and face was its own allocation.  draw() is
+// replayed in immediate mode through stand-ins for the GL calls it
+// makes, and a checksum of everything they're given is compared with
+// one recorded from the original Mesh.  The triangles upload() puts in
+// the buffer objects are checked too, against the same polygons broken
+// into fans.
+//
+// Usage: meshreplay file.mesh ...
+//
+// Each file is read as text, and again from a binary copy of it.  The
+// exit status is 1 if any mesh draws anything different, or isn't one
+// of the six piece meshes.
+//
+
+#include "Mesh.h"
+#ifdef __APPLE__
+#include <glut/glut.h>
+#else
+#include "GL/glut.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// What each piece mesh drew with the original Mesh: its number of
+// polygons and corners, and the checksum of its calls.
+struct Reference {
+    char const *name;
+    long polygons, corners;
+    uint32_t checksum;
+};
+
+static const Reference REFERENCES[] = {
+    { "pawn", 264, 1032, 0x2b7f919d },
+    { "rook", 324, 1284, 0x18698a15 },
+    { "knight", 476, 1536, 0xf49655b3 },
+    { "bishop", 389, 1516, 0x0d5efac8 },
+    { "queen", 444, 1752, 0x76b9cfd9 },
+    { "king", 548, 2122, 0xf6b0d99d },
+};
+
+// Everything the stand-ins have been given since the last reset(): the
+// checksum (FNV-1a over the primitive types, a marker for each call, and
+// the bits of every normal and vertex), counts of polygons and corners,
+// and the polygons as fans of triangles, with a position and normal for
+// each corner, like the vertices Mesh::indexed() makes.
+static struct Capture {
+    uint32_t checksum;
+    long polygons, corners;
+    vector< GLfloat > polygon, fans;
+    GLfloat normal[ 3 ];
+
+    void reset() {
+        checksum = 2166136261u;
+        polygons = corners = 0;
+        polygon.clear();
+        fans.clear();
+    }
+
+    void word( uint32_t w ) {
+        checksum = ( checksum ^ w ) * 16777619u;
+    }
+
+    void floats( GLfloat const *v ) {
+        for ( int i = 0; i < 3; i++ ) {
+            uint32_t w;
+            memcpy( &w, v + i, 4 );
+            word( w );
+        }
+    }
+} capture;
+
+// The stand-ins, which take the place of libGL's for the whole program.
+// The original Mesh made these calls, and nothing else, for each face.
+void glBegin( GLenum mode ) {
+    capture.word( mode );
+    capture.polygons++;
+    capture.polygon.clear();
+}
+
+void glNormal3fv( GLfloat const *v ) {
+    capture.word( 1 );
+    capture.floats( v );
+    memcpy( capture.normal, v, sizeof( capture.normal ) );
+}
+
+void glVertex3fv( GLfloat const *v ) {
+    capture.word( 2 );
+    capture.floats( v );
+    capture.corners++;
+    capture.polygon.insert( capture.polygon.end(), v, v + 3 );
+    capture.polygon.insert( capture.polygon.end(), capture.normal, capture.normal + 3 );
+}
+
+void glEnd() {
+    capture.word( 0xffffffffu );
+    vector< GLfloat > const &p = capture.polygon;
+    for ( size_t j = 2; j < p.size() / 6; j++ ) {
+        size_t fan[ 3 ] = { 0, j - 1, j };
+        for ( int k = 0; k < 3; k++ )
+            capture.fans.insert( capture.fans.end(), p.begin() + fan[ k ] * 6,
+                                 p.begin() + fan[ k ] * 6 + 6 );
+    }
+}
+
+// Replay mesh, read as described by how, and compare what it draws with
+// want.  Returns true if it all matches, after reporting how it went.
+static bool replay( Mesh &mesh, Reference const &want, char const *how ) {
+    capture.reset();
+    mesh.draw();
+    bool polygonsOk = capture.polygons == want.polygons &&
+        capture.corners == want.corners && capture.checksum == want.checksum;
+
+    // The buffer objects hold the same corners, fanned the same way,
+    // before the triangles are reordered for the vertex cache.
+    vector< GLfloat > verts;
+    vector< GLuint > indices;
+    mesh.indexed( verts, indices, false );
+    size_t count = mesh.triangles() * 3;
+    bool buffersOk = count * 6 == capture.fans.size() && count <= indices.size();
+    for ( size_t i = 0; buffersOk && i < count; i++ )
+        buffersOk = memcmp( &verts[ indices[ i ] * 6 ], &capture.fans[ i * 6 ],
+                            6 * sizeof( GLfloat ) ) == 0;
+
+    printf( "%s  %-8s %-7s %4ld polygons, %5ld corners, checksum %08x%s\n",
+            polygonsOk && buffersOk ? "ok  " : "FAIL", want.name, how, capture.polygons,
+            capture.corners, capture.checksum,
+            !polygonsOk ? ", expected otherwise" : !buffersOk ? ", buffers differ" : "" );
+    return polygonsOk && buffersOk;
+}
+
+int main( int argc, char **argv ) {
+    if ( argc < 2 ) {
+        fprintf( stderr, "usage: %s file.mesh ...\n", argv[ 0 ] );
+        return 1;
+    }
+
+    // Binary copies go in a directory of their own, where there's no
+    // text file for them to be out of date with.
+    char directory[] = "/tmp/meshreplayXXXXXX";
+    if ( !mkdtemp( directory ) ) {
+        perror( directory );
+        return 1;
+    }
+
+    Mesh::immediateMode = true;
+    int failures = 0;
+    for ( int a = 1; a < argc; a++ ) {
+        string name = argv[ a ];
+        name = name.substr( name.rfind( '/' ) + 1 );
+        name = name.substr( 0, name.rfind( ".mesh" ) );
+        Reference const *want = NULL;
+        for ( int r = 0; r < int( sizeof( REFERENCES ) / sizeof( REFERENCES[ 0 ] ) ); r++ )
+            if ( name == REFERENCES[ r ].name )
+                want = &REFERENCES[ r ];
+        if ( !want ) {
+            printf( "FAIL  %-8s isn't a piece mesh\n", name.c_str() );
+            failures++;
+            continue;
+        }
+
+        Mesh text( argv[ a ], false );
+        if ( !text.error().empty() ) {
+            printf( "FAIL  %-8s %s\n", want->name, text.error().c_str() );
+            failures++;
+            continue;
+        }
+        failures += !replay( text, *want, "text" );
+
+        string copy = string( directory ) + "/" + name + ".mesh";
+        string binary = Mesh::binaryName( copy.c_str() );
+        bool saved = text.save( binary.c_str() );
+        if ( saved ) {
+            Mesh mapped( copy.c_str() );
+            failures += !replay( mapped, *want, "binary" );
+        } else {
+            printf( "FAIL  %-8s binary  can't be written\n", want->name );
+            failures++;
+        }
+        unlink( binary.c_str() );
+    }
+    rmdir( directory );
+    printf( "%s\n", failures ? "FAILED" : "passed" );
+    return failures ? 1 : 0;
+}
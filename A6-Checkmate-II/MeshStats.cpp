@@ -0,0 +1,125 @@
+//
+// MeshStats.cpp
+//
+// Report how well the triangle order of each mesh uses the GPU's vertex
+// cache, as Mesh uploads it, before and after the cache optimization,
+// and how small and how accurate its packed vertex buffers would be.
+//
+// Usage: meshstats [-check] file.mesh ...
+//
+// With -check, the cache report is skipped, and the exit status is 1 if
+// any mesh can't be packed within Mesh's default error bounds.
+//
+
+#include "Mesh.h"
+#include "VertexCache.h"
+#include "VertexPacking.h"
+
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <vector>
+
+using namespace std;
+
+// Print the vertex cache report for mesh, read from name.
+static void reportCache( Mesh const &mesh, char const *name ) {
+    vector< GLfloat > verts, optVerts;
+    vector< GLuint > indices, optIndices;
+    mesh.indexed( verts, indices, false );
+    mesh.indexed( optVerts, optIndices, true );
+
+    // Each level of detail is drawn on its own, so it's measured on its
+    // own too.
+    int first = 0;
+    for ( int level = 0; level < mesh.lodCount(); level++ ) {
+        int count = mesh.triangles( level ) * 3;
+        char label[ 64 ];
+        if ( level )
+            snprintf( label, sizeof( label ), "  level %d", level );
+        else
+            snprintf( label, sizeof( label ), "%s", name );
+        // Every vertex the level uses has to miss at least once, so this
+        // over the triangle count bounds the ratio from below.
+        set< GLuint > used( indices.begin() + first, indices.begin() + first + count );
+        printf( "%-14s %6d %6d %8.3f %9.3f %8.3f %9.3f\n", label, count / 3,
+                int( used.size() ),
+                averageCacheMissRatio( indices, first, count, 16 ),
+                averageCacheMissRatio( optIndices, first, count, 16 ),
+                averageCacheMissRatio( indices, first, count, 32 ),
+                averageCacheMissRatio( optIndices, first, count, 32 ) );
+        first += count;
+    }
+}
+
+// Print the packed buffer sizes and errors for mesh, read from name, and
+// return false if any of them are outside Mesh's bounds.
+static bool reportPacking( Mesh const &mesh, char const *name ) {
+    vector< GLfloat > verts;
+    vector< GLuint > indices;
+    mesh.indexed( verts, indices );
+    int count = verts.size() / 6;
+    if ( count == 0 )
+        return true;
+
+    bool ok = true;
+    PositionQuantizer quantizer( mesh.lowCorner(), mesh.highCorner() );
+    for ( int bits = 8; bits <= 16; bits += 8 ) {
+        vector< unsigned char > packed;
+        packVertices( &verts[ 0 ], count, quantizer, bits, packed );
+        double positionError, normalDegrees;
+        packingError( &verts[ 0 ], count, &packed[ 0 ], quantizer, bits,
+                      positionError, normalDegrees );
+        bool within = positionError <= Mesh::packing.maxPositionError &&
+            normalDegrees <= Mesh::packing.maxNormalDegrees;
+        printf( "%-14s %4d %8d %8d %12.2e %10.3f%s\n", bits == 8 ? name : "", bits,
+                int( verts.size() * sizeof( GLfloat ) ), int( packed.size() ),
+                positionError, normalDegrees, within ? "" : "  out of bounds" );
+        ok = ok && within;
+    }
+    return ok;
+}
+
+int main( int argc, char **argv ) {
+    bool check = argc > 1 && strcmp( argv[ 1 ], "-check" ) == 0;
+    int firstFile = check ? 2 : 1;
+    if ( argc <= firstFile ) {
+        fprintf( stderr, "usage: %s [-check] file.mesh ...\n", argv[ 0 ] );
+        return 1;
+    }
+
+    // Read the text files, so the order is the one the exporter wrote.
+    vector< Mesh * > meshes;
+    for ( int a = firstFile; a < argc; a++ ) {
+        meshes.push_back( new Mesh( argv[ a ], false ) );
+        if ( !meshes.back()->error().empty() ) {
+            fprintf( stderr, "%s\n", meshes.back()->error().c_str() );
+            return 1;
+        }
+        meshes.back()->buildLods();
+    }
+
+    if ( !check ) {
+        // ACMR is vertices transformed per triangle, on FIFO caches of
+        // the sizes typical of older and newer GPUs.
+        printf( "%-14s %6s %6s %18s %18s\n", "", "", "", "ACMR, 16 entries",
+                "ACMR, 32 entries" );
+        printf( "%-14s %6s %6s %8s %9s %8s %9s\n", "mesh", "tris", "verts", "before",
+                "after", "before", "after" );
+        for ( int i = 0; i < meshes.size(); i++ )
+            reportCache( *meshes[ i ], argv[ firstFile + i ] );
+        printf( "\n" );
+    }
+
+    // Errors are the largest over all vertices, against bounds of
+    // maxPositionError units and maxNormalDegrees.
+    printf( "%-14s %4s %8s %8s %12s %10s   (bounds %.0e, %.1f degrees)\n", "mesh",
+            "bits", "floats", "packed", "position", "normal",
+            Mesh::packing.maxPositionError, Mesh::packing.maxNormalDegrees );
+    bool ok = true;
+    for ( int i = 0; i < meshes.size(); i++ ) {
+        ok = reportPacking( *meshes[ i ], argv[ firstFile + i ] ) && ok;
+        delete meshes[ i ];
+    }
+    return ok ? 0 : 1;
+}
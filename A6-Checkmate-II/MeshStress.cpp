@@ -0,0 +1,189 @@
+//
+// MeshStress.cpp
+//
+// Load, simplify, save, reload and draw a synthetic mesh far too big for
+// 16-bit indices, checking that nothing wraps around on the way, and
+// that meshes with bad indices are turned away.
+//
+// Usage: meshstress [side] [scratch file]
+//
+// The mesh is a side x side grid of quads (a million faces by default).
+// The exit status is 1 if any check fails.
+//
+
+#include "Mesh.h"
+#include "Headless.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <sys/time.h>
+
+using namespace std;
+
+// Number of checks that have failed so far.
+static int failures = 0;
+
+// Report whether a check passed, and count it if it didn't.
+static void check( bool ok, char const *what ) {
+    printf( "%s  %s\n", ok ? "ok  " : "FAIL", what );
+    if ( !ok )
+        failures++;
+}
+
+// Return the current time in seconds.
+static double now() {
+    timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Height of the synthetic surface at grid point (x, z).
+static double height( int x, int z ) {
+    return 0.05 * sin( x * 0.01 ) * cos( z * 0.01 );
+}
+
+// Write a side x side grid of quads over a gently curved surface, with a
+// vertex and a normal for every grid point.
+static void writeMesh( char const *filename, int side ) {
+    FILE *fp = fopen( filename, "w" );
+    if ( !fp ) {
+        cerr << "Can't write " << filename << endl;
+        exit( 1 );
+    }
+
+    int points = ( side + 1 ) * ( side + 1 );
+    fprintf( fp, "vlist %d\n", points );
+    for ( int z = 0; z <= side; z++ )
+        for ( int x = 0; x <= side; x++ )
+            fprintf( fp, "%d %.6f %d\n", x, height( x, z ), -z );
+    fprintf( fp, "nlist %d\n", points );
+    for ( int z = 0; z <= side; z++ )
+        for ( int x = 0; x <= side; x++ ) {
+            double dx = height( x + 1, z ) - height( x, z );
+            double dz = height( x, z + 1 ) - height( x, z );
+            double len = sqrt( dx * dx + 1 + dz * dz );
+            fprintf( fp, "%.6f %.6f %.6f\n", -dx / len, 1 / len, dz / len );
+        }
+
+    fprintf( fp, "flist %d\n", side * side );
+    for ( int z = 0; z < side; z++ )
+        for ( int x = 0; x < side; x++ ) {
+            int a = z * ( side + 1 ) + x, b = a + 1, c = b + side + 1, d = c - 1;
+            fprintf( fp, "4 %d %d %d %d %d %d %d %d\n", a, a, b, b, c, c, d, d );
+        }
+    fclose( fp );
+}
+
+// Check that the unoptimized triangles of mesh are the grid's: a vertex
+// for every grid point (the simplified levels can add a few more), every
+// index in range, and the last face (whose indices are the largest) in
+// the right place.
+static void checkTriangles( Mesh const &mesh, int side, char const *what ) {
+    vector< GLfloat > verts;
+    vector< GLuint > indices;
+    mesh.indexed( verts, indices, false );
+
+    int count = verts.size() / 6;
+    bool inRange = true;
+    for ( int i = 0; i < mesh.triangles() * 3; i++ )
+        inRange = inRange && indices[ i ] < GLuint( count );
+    string name = what;
+    check( count >= ( side + 1 ) * ( side + 1 ),
+           ( name + ": a vertex for every grid point" ).c_str() );
+    check( inRange, ( name + ": indices in range" ).c_str() );
+
+    // The last quad fans into two triangles from its first corner.
+    int last = ( mesh.triangles() - 1 ) * 3;
+    GLfloat const *p = &verts[ indices[ last + 2 ] * 6 ];
+    check( inRange && p[ 0 ] == side - 1 && p[ 2 ] == -side,
+           ( name + ": last face in place" ).c_str() );
+}
+
+// Return true if a mesh whose faces point past its vertices loads as an
+// empty mesh, with an error saying where, as it should.
+static bool rejectsBadIndex( char const *filename ) {
+    FILE *fp = fopen( filename, "w" );
+    if ( !fp )
+        return false;
+    fprintf( fp, "vlist 3\n0 0 0\n1 0 0\n0 1 0\nnlist 1\n0 0 1\n"
+             "flist 1\n3 0 0 1 0 3 0\n" );
+    fclose( fp );
+
+    Mesh mesh( filename, false );
+    remove( filename );
+    return mesh.faceCount() == 0 && mesh.triangles() == 0 &&
+        mesh.error().find( "vertex index out of range" ) != string::npos;
+}
+
+int main( int argc, char **argv ) {
+    int side = argc > 1 ? atoi( argv[ 1 ] ) : 1000;
+    string filename = argc > 2 ? argv[ 2 ] : "/tmp/meshstress.mesh";
+    string binary = Mesh::binaryName( filename.c_str() );
+
+    // Past 65,536 vertices the mesh needs 32-bit indices throughout.
+    int wantBytes = ( side + 1 ) * ( side + 1 ) > 65536 ? 4 : 2;
+    cout << "Writing " << side * side << " faces to " << filename << endl;
+    writeMesh( filename.c_str(), side );
+
+    double start = now();
+    Mesh text( filename.c_str(), false );
+    printf( "text load     %8.3f s\n", now() - start );
+    check( text.vertexCount() == ( side + 1 ) * ( side + 1 ) &&
+           text.faceCount() == side * side, "text: every vertex and face read" );
+    check( text.cornerBytes() == wantBytes, "text: corner indices just wide enough" );
+    checkTriangles( text, side, "text" );
+
+    start = now();
+    text.buildBvh();
+    printf( "hierarchy     %8.3f s\n", now() - start );
+    double t = 1e9;
+    check( text.intersect( Vector( side - 0.25, 1, -side + 0.75 ), Vector( 0, -1, 0 ), t ),
+           "text: ray hits the far corner" );
+
+    start = now();
+    text.buildLods();
+    printf( "simplify      %8.3f s, %d levels, %d triangles in the last\n", now() - start,
+            text.lodCount(), text.triangles( text.lodCount() - 1 ) );
+    check( text.lodCount() > 1, "text: simplified levels built" );
+
+    check( text.save( binary.c_str() ), "binary: saved" );
+    start = now();
+    Mesh mapped( filename.c_str() );
+    printf( "binary load   %8.3f s\n", now() - start );
+    check( mapped.cornerBytes() == wantBytes && mapped.lodCount() == text.lodCount(),
+           "binary: mapped with the same corners and every level" );
+    checkTriangles( mapped, side, "binary" );
+
+    check( rejectsBadIndex( "/tmp/meshstress-bad.mesh" ), "out of range index rejected" );
+
+    // Upload and draw, if there's a GL to do it with.
+    if ( createHeadlessContext( 64, 64 ) ) {
+        start = now();
+        mapped.upload();
+        printf( "upload        %8.3f s\n", now() - start );
+        mapped.draw();
+        mapped.draw( mapped.lodCount() - 1 );
+        glFinish();
+        // The simplified levels add vertices of their own, so the index
+        // buffer's width goes by what was uploaded.
+        int uploaded = mapped.vertexBytes() / ( 6 * sizeof( GLfloat ) );
+        check( mapped.indexBytes() == ( uploaded > 65536 ? 4 : 2 ),
+               "GL: index buffer just wide enough" );
+        check( glGetError() == GL_NO_ERROR, "GL: drawn without errors" );
+
+        Mesh small( "pawn.mesh", false );
+        small.upload();
+        check( small.cornerBytes() == 2 && small.indexBytes() == 2,
+               "GL: small meshes keep 16-bit indices" );
+    } else {
+        printf( "skipped GL checks\n" );
+    }
+
+    remove( filename.c_str() );
+    remove( binary.c_str() );
+    printf( "%s\n", failures ? "FAILED" : "passed" );
+    return failures ? 1 : 0;
+}
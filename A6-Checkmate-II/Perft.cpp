@@ -0,0 +1,239 @@
+//
+// Perft.cpp
+//
+// Check the move generator by counting the positions reachable from
+// well-known test positions, against the published counts, check the
+// Zobrist keys kept up as moves are made along the way, the quick test
+// for a single move's legality and FEN export, check that impossible
+// positions are refused, and measure how fast it goes.
+//
+// Usage: perft                    run the test suite
+//        perft -bench [depth]     time the starting position
+//        perft -divide depth fen  count below each move, for debugging
+//
+// The suite's exit status is 1 if any count is wrong.
+//
+
+#include "Position.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+#include <vector>
+
+using namespace std;
+
+// A test position and its node counts at depths 1, 2, ... until a 0.
+struct PerftCase {
+    char const *name;
+    char const *fen;
+    uint64_t nodes[ 7 ];
+};
+
+// The standard positions from the Chess Programming Wiki, which between
+// them exercise castling through and out of check, en passant pins,
+// promotions with and without captures, and discovered checks.  Depths
+// are limited to what runs in a few seconds without optimization.
+static const PerftCase CASES[] = {
+    { "start", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      { 20, 400, 8902, 197281, 4865609, 0 } },
+    { "kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+      { 48, 2039, 97862, 4085603, 0 } },
+    { "position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+      { 14, 191, 2812, 43238, 674624, 11030083, 0 } },
+    { "position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+      { 6, 264, 9467, 422333, 15833292, 0 } },
+    { "position 4 mirrored", "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+      { 6, 264, 9467, 422333, 0 } },
+    { "position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+      { 44, 1486, 62379, 2103487, 0 } },
+    { "position 6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+      { 46, 2079, 89890, 3894594, 0 } },
+};
+
+// Positions setFen() must turn away, since move generation can't cope
+// with them: the side that just moved left its king in check (so the
+// king could be captured), or a pawn stands where it can never be.
+static const struct {
+    char const *name, *fen;
+} REJECTED[] = {
+    { "white may take king", "4k3/4R3/8/8/8/8/8/4K3 w - - 0 1" },
+    { "black may take king", "4k3/8/8/8/8/8/3q4/4K3 b - - 0 1" },
+    { "pawn on rank 8", "P3k3/8/8/8/8/8/8/4K3 w - - 0 1" },
+    { "pawn on rank 1", "4k3/8/8/8/8/8/8/p3K3 w - - 0 1" },
+    { "two white kings", "4k3/8/8/8/8/8/8/3KK3 w - - 0 1" },
+};
+
+// Return the current time in seconds.
+static double now() {
+    timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Return the number of positions within depth moves of pos whose
+// Zobrist key, as kept up by makeMove() and unmakeMove(), differs from
+// the one computed from scratch.
+static int badKeys( Position &pos, int depth ) {
+    int bad = pos.hashKey() != pos.computeKey();
+    if ( depth == 0 )
+        return bad;
+
+    Move moves[ Position::MAX_MOVES ];
+    int count = pos.legalMoves( moves );
+    Position::Undo undo;
+    for ( int i = 0; i < count; i++ ) {
+        pos.makeMove( moves[ i ], undo );
+        bad += badKeys( pos, depth - 1 );
+        pos.unmakeMove( moves[ i ], undo );
+    }
+    return bad;
+}
+
+// Return the number of positions within depth moves of pos where
+// isLegalMove() disagrees with legalMoves() about any of the 65,536
+// possible moves.
+static int badLegality( Position &pos, int depth ) {
+    Move moves[ Position::MAX_MOVES ];
+    int count = pos.legalMoves( moves );
+    vector< bool > legal( 65536, false );
+    for ( int i = 0; i < count; i++ )
+        legal[ moves[ i ].raw() ] = true;
+    int bad = 0;
+    for ( int bits = 0; bits < 65536 && !bad; bits++ )
+        bad = pos.isLegalMove( Move::fromRaw( bits ) ) != legal[ bits ];
+    if ( depth == 0 )
+        return bad;
+
+    Position::Undo undo;
+    for ( int i = 0; i < count; i++ ) {
+        pos.makeMove( moves[ i ], undo );
+        bad += badLegality( pos, depth - 1 );
+        pos.unmakeMove( moves[ i ], undo );
+    }
+    return bad;
+}
+
+// Return the number of positions within depth moves of pos whose FEN,
+// from fen(), doesn't read back as the same position.
+static int badFens( Position &pos, int depth ) {
+    Position copy;
+    int bad = !copy.setFen( pos.fen().c_str() ) || copy.hashKey() != pos.hashKey() ||
+        copy.fen() != pos.fen();
+    if ( depth == 0 )
+        return bad;
+
+    Move moves[ Position::MAX_MOVES ];
+    int count = pos.legalMoves( moves );
+    Position::Undo undo;
+    for ( int i = 0; i < count; i++ ) {
+        pos.makeMove( moves[ i ], undo );
+        bad += badFens( pos, depth - 1 );
+        pos.unmakeMove( moves[ i ], undo );
+    }
+    return bad;
+}
+
+// Run every case to every depth it lists, and report any mismatch.
+static int runSuite() {
+    int failures = 0;
+    uint64_t total = 0;
+    double seconds = 0;
+    for ( int c = 0; c < int( sizeof( CASES ) / sizeof( CASES[ 0 ] ) ); c++ ) {
+        Position pos;
+        if ( !pos.setFen( CASES[ c ].fen ) ) {
+            printf( "FAIL  %s: bad FEN\n", CASES[ c ].name );
+            failures++;
+            continue;
+        }
+        for ( int d = 0; CASES[ c ].nodes[ d ]; d++ ) {
+            double start = now();
+            uint64_t nodes = pos.perft( d + 1 );
+            seconds += now() - start;
+            bool ok = nodes == CASES[ c ].nodes[ d ];
+            printf( "%s  %-20s depth %d %12llu", ok ? "ok  " : "FAIL", CASES[ c ].name,
+                    d + 1, (unsigned long long) nodes );
+            if ( !ok )
+                printf( ", expected %llu", (unsigned long long) CASES[ c ].nodes[ d ] );
+            printf( "\n" );
+            failures += !ok;
+            total += nodes;
+        }
+
+        int bad = badKeys( pos, 3 );
+        printf( "%s  %-20s keys    %12d wrong\n", bad ? "FAIL" : "ok  ",
+                CASES[ c ].name, bad );
+        failures += bad != 0;
+
+        bad = badLegality( pos, 1 );
+        printf( "%s  %-20s legal   %12d wrong\n", bad ? "FAIL" : "ok  ",
+                CASES[ c ].name, bad );
+        failures += bad != 0;
+
+        // The cases' FENs are written the way fen() writes them.
+        bad = badFens( pos, 2 ) + ( pos.fen() != CASES[ c ].fen );
+        printf( "%s  %-20s fen     %12d wrong\n", bad ? "FAIL" : "ok  ",
+                CASES[ c ].name, bad );
+        failures += bad != 0;
+    }
+    // A position that's turned away leaves the old one as it was.
+    for ( int r = 0; r < int( sizeof( REJECTED ) / sizeof( REJECTED[ 0 ] ) ); r++ ) {
+        Position pos;
+        bool ok = !pos.setFen( REJECTED[ r ].fen ) && pos.fen() == Position().fen();
+        printf( "%s  %-20s rejected\n", ok ? "ok  " : "FAIL", REJECTED[ r ].name );
+        failures += !ok;
+    }
+
+    printf( "%llu nodes in %.2f s, %.0f nodes/s\n", (unsigned long long) total,
+            seconds, total / seconds );
+    printf( "%s\n", failures ? "FAILED" : "passed" );
+    return failures ? 1 : 0;
+}
+
+int main( int argc, char **argv ) {
+    if ( argc == 1 )
+        return runSuite();
+
+    // Time the starting position, best of three.
+    if ( strcmp( argv[ 1 ], "-bench" ) == 0 ) {
+        int depth = argc > 2 ? atoi( argv[ 2 ] ) : 5;
+        Position pos;
+        double best = 1e9;
+        uint64_t nodes = 0;
+        for ( int run = 0; run < 3; run++ ) {
+            double start = now();
+            nodes = pos.perft( depth );
+            best = min( best, now() - start );
+        }
+        printf( "perft %d: %llu nodes in %.3f s, %.0f nodes/s\n", depth,
+                (unsigned long long) nodes, best, nodes / best );
+        return 0;
+    }
+
+    // Count below each legal move, to narrow down a wrong total.
+    if ( strcmp( argv[ 1 ], "-divide" ) == 0 && argc > 3 ) {
+        Position pos;
+        if ( !pos.setFen( argv[ 3 ] ) ) {
+            fprintf( stderr, "bad FEN: %s\n", argv[ 3 ] );
+            return 1;
+        }
+        int depth = max( 1, atoi( argv[ 2 ] ) );
+        Move moves[ Position::MAX_MOVES ];
+        int count = pos.legalMoves( moves );
+        uint64_t total = 0;
+        for ( int i = 0; i < count; i++ ) {
+            Position::Undo undo;
+            pos.makeMove( moves[ i ], undo );
+            uint64_t nodes = pos.perft( depth - 1 );
+            pos.unmakeMove( moves[ i ], undo );
+            printf( "%s: %llu\n", moves[ i ].name().c_str(), (unsigned long long) nodes );
+            total += nodes;
+        }
+        printf( "\n%d moves, %llu nodes\n", count, (unsigned long long) total );
+        return 0;
+    }
+
+    fprintf( stderr, "usage: %s [-bench [depth] | -divide depth fen]\n", argv[ 0 ] );
+    return 1;
+}
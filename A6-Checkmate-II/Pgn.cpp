@@ -0,0 +1,294 @@
+//
+// Pgn.cpp
+//
+// A streaming PGN reader over a memory-mapped file.
+//
+
+#include "Pgn.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Return true for characters that end a move or other symbol in the
+// movetext.  Dots end move numbers.
+static bool endsSymbol( char c ) {
+    switch ( c ) {
+    case ' ': case '\t': case '\n': case '\r':
+    case '{': case '}': case '(': case ')': case '[': case ']':
+    case ';': case '$': case '.':
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Move p past white space and comments: {braced} ones, ones from a
+// semicolon to the end of the line, and lines escaped with a % in the
+// first column.
+static void skipBetween( char const *&p, char const *begin, char const *end ) {
+    while ( p < end ) {
+        char c = *p;
+        if ( c == ' ' || c == '\n' || c == '\r' || c == '\t' ) {
+            p++;
+        } else if ( c == '{' ) {
+            char const *close = (char const *) memchr( p, '}', end - p );
+            p = close ? close + 1 : end;
+        } else if ( c == ';' || ( c == '%' && ( p == begin || p[ -1 ] == '\n' ) ) ) {
+            char const *eol = (char const *) memchr( p, '\n', end - p );
+            p = eol ? eol + 1 : end;
+        } else {
+            break;
+        }
+    }
+}
+
+// Return true if the n characters at s are a game result.
+static bool isResult( char const *s, int n ) {
+    return ( n == 1 && s[ 0 ] == '*' ) ||
+        ( n == 3 && ( memcmp( s, "1-0", 3 ) == 0 || memcmp( s, "0-1", 3 ) == 0 ) ) ||
+        ( n == 7 && memcmp( s, "1/2-1/2", 7 ) == 0 );
+}
+
+string PgnGame :: tag( char const *name ) const {
+    for ( int i = 0; i < int( tags.size() ); i++ )
+        if ( tags[ i ].first == name )
+            return tags[ i ].second;
+    return string();
+}
+
+PgnReader :: PgnReader() : data( NULL ), length( 0 ), offset( 0 ), chunk( 0 ) {
+}
+
+PgnReader :: ~PgnReader() {
+    close();
+}
+
+bool PgnReader :: open( char const *filename ) {
+    close();
+    int fd = ::open( filename, O_RDONLY );
+    if ( fd < 0 ) {
+        perror( filename );
+        return false;
+    }
+
+    struct stat info;
+    if ( fstat( fd, &info ) != 0 || info.st_size == 0 ) {
+        fprintf( stderr, "%s: empty or unreadable\n", filename );
+        ::close( fd );
+        return false;
+    }
+
+    // Map the whole file; the mapping stays valid after we close it.
+    void *map = mmap( NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close( fd );
+    if ( map == MAP_FAILED ) {
+        perror( filename );
+        return false;
+    }
+    data = (char const *) map;
+    length = info.st_size;
+    madvise( map, length, MADV_SEQUENTIAL );
+    madvise( map, min< uint64_t >( length, CHUNK_BYTES ), MADV_WILLNEED );
+    offset = chunk = 0;
+    return true;
+}
+
+void PgnReader :: close() {
+    if ( data )
+        munmap( (void *) data, length );
+    data = NULL;
+    length = offset = chunk = 0;
+}
+
+void PgnReader :: seek( uint64_t where ) {
+    offset = min( where, length );
+    follow();
+}
+
+uint64_t PgnReader :: findGameStart( uint64_t where ) const {
+    // afterBlank says whether p, at the start of a line, follows a blank
+    // one (or the start of the file).  Starting mid-line, it doesn't.
+    char const *end = data + length;
+    char const *p = data + min( where, length );
+    bool afterBlank = p == data;
+    while ( p < end ) {
+        if ( afterBlank && *p == '[' )
+            return p - data;
+        char const *eol = (char const *) memchr( p, '\n', end - p );
+        if ( !eol )
+            break;
+        bool blank = p == data || p[ -1 ] == '\n';
+        for ( char const *c = p; blank && c < eol; c++ )
+            blank = *c == ' ' || *c == '\t' || *c == '\r';
+        afterBlank = blank;
+        p = eol + 1;
+    }
+    return length;
+}
+
+bool PgnReader :: next( PgnGame &game ) {
+    return read( &game );
+}
+
+bool PgnReader :: skip() {
+    return read( NULL );
+}
+
+void PgnReader :: follow() {
+    uint64_t now = offset / CHUNK_BYTES;
+    if ( now == chunk )
+        return;
+
+    // Get the disk going on the next chunk while this one is parsed.
+    uint64_t ahead = ( now + 1 ) * CHUNK_BYTES;
+    if ( ahead < length )
+        madvise( (void *) ( data + ahead ), min< uint64_t >( CHUNK_BYTES, length - ahead ),
+                 MADV_WILLNEED );
+
+    // Reading forward, the chunks behind won't be wanted again (and if
+    // they are, after a seek, they're just read back in).  Chunks start
+    // on page boundaries, as madvise() needs.
+    if ( now > chunk )
+        madvise( (void *) ( data + chunk * CHUNK_BYTES ), ( now - chunk ) * CHUNK_BYTES,
+                 MADV_DONTNEED );
+    chunk = now;
+}
+
+bool PgnReader :: read( PgnGame *game ) {
+    static const Position initial;
+
+    char const *begin = data, *end = data + length;
+    char const *p = begin + offset;
+    skipBetween( p, begin, end );
+    if ( p == end ) {
+        offset = length;
+        return false;
+    }
+
+    if ( game ) {
+        game->offset = p - begin;
+        game->tags.clear();
+        game->moves.clear();
+        game->keys.clear();
+        game->result.clear();
+        game->error.clear();
+        game->start = initial;
+    }
+
+    // Tag pairs, like [White "Tal, Mikhail"], with \" and \\ escapes in
+    // the value.
+    bool resolving = game != NULL;
+    while ( p < end && *p == '[' ) {
+        p++;
+        while ( p < end && ( *p == ' ' || *p == '\t' ) )
+            p++;
+        char const *name = p;
+        while ( p < end && !endsSymbol( *p ) && *p != '"' )
+            p++;
+        int nameLength = p - name;
+        while ( p < end && ( *p == ' ' || *p == '\t' ) )
+            p++;
+
+        string value;
+        if ( p < end && *p == '"' ) {
+            for ( p++; p < end && *p != '"' && *p != '\n'; p++ ) {
+                if ( *p == '\\' && p + 1 < end )
+                    p++;
+                if ( game )
+                    value += *p;
+            }
+            if ( p < end && *p == '"' )
+                p++;
+        } else if ( game && game->error.empty() ) {
+            game->error = "tag without a value";
+        }
+        while ( p < end && *p != ']' && *p != '\n' )
+            p++;
+        if ( p < end && *p == ']' )
+            p++;
+
+        if ( game ) {
+            game->tags.push_back( make_pair( string( name, nameLength ), value ) );
+            if ( game->tags.back().first == "FEN" && !game->start.setFen( value.c_str() ) ) {
+                game->error = "bad FEN tag";
+                resolving = false;
+            }
+        }
+        skipBetween( p, begin, end );
+    }
+
+    // The movetext, up to the result, or to the next game's tags if
+    // there's no result.  Moves in variations (in parentheses, nested
+    // to any depth) are alternatives to the game's, so they're passed
+    // over.
+    Position board( resolving ? game->start : initial );
+    if ( resolving )
+        game->keys.push_back( board.hashKey() );
+    int depth = 0;
+    for ( ;; ) {
+        skipBetween( p, begin, end );
+        if ( p == end || *p == '[' )
+            break;
+
+        char c = *p;
+        if ( c == '(' || c == ')' ) {
+            depth = max( 0, depth + ( c == '(' ? 1 : -1 ) );
+            p++;
+            continue;
+        }
+        if ( c == '$' ) {
+            for ( p++; p < end && *p >= '0' && *p <= '9'; p++ )
+                ;
+            continue;
+        }
+        if ( endsSymbol( c ) ) {
+            p++;
+            continue;
+        }
+
+        char const *symbol = p;
+        while ( p < end && !endsSymbol( *p ) )
+            p++;
+        int n = p - symbol;
+
+        // Move numbers are just for reading; the result ends the game.
+        bool number = true;
+        for ( int i = 0; number && i < n; i++ )
+            number = symbol[ i ] >= '0' && symbol[ i ] <= '9';
+        if ( number )
+            continue;
+        if ( isResult( symbol, n ) ) {
+            if ( depth > 0 )
+                continue;
+            if ( game )
+                game->result.assign( symbol, n );
+            break;
+        }
+        if ( depth > 0 || !resolving )
+            continue;
+
+        Move m = board.parseSan( symbol, n );
+        if ( m.isNull() ) {
+            char where[ 32 ];
+            snprintf( where, sizeof( where ), " at ply %d", int( game->moves.size() ) + 1 );
+            game->error = "illegal move " + string( symbol, n ) + where;
+            resolving = false;
+            continue;
+        }
+        Position::Undo undo;
+        board.makeMove( m, undo );
+        game->moves.push_back( m );
+        game->keys.push_back( board.hashKey() );
+    }
+
+    offset = p - begin;
+    follow();
+    return true;
+}
@@ -0,0 +1,120 @@
+#ifndef __PGN_H__
+#define __PGN_H__
+
+#include "Position.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+//
+// Reading games from PGN (Portable Game Notation) files of any size.
+// The file is mapped into memory and read straight through, one game at
+// a time, with each move resolved against a Position as it's read, so
+// nothing is kept but the game at hand.  The kernel is asked to read
+// the next chunk ahead of the reader and to drop the ones behind it,
+// so even a multi-gigabyte archive only ever has a chunk or two in
+// memory.
+//
+
+/** One game, as read from a PGN file. */
+struct PgnGame {
+    /** Offset in the file where the game starts, for seeking back. */
+    uint64_t offset;
+
+    /** Tag pairs, in the order they're given, like ( "White", "Tal" ). */
+    std::vector< std::pair< std::string, std::string > > tags;
+
+    /** Position the game starts from: the starting position, unless
+        there's a FEN tag. */
+    Position start;
+
+    /** The moves played, from start. */
+    std::vector< Move > moves;
+
+    /** Zobrist keys of the positions the game goes through, from start
+        to the position after the last move, so one more than there are
+        moves, or none if the FEN tag is bad. */
+    std::vector< uint64_t > keys;
+
+    /** "1-0", "0-1", "1/2-1/2" or "*", or empty if the game ends
+        without saying. */
+    std::string result;
+
+    /** Empty if the game read cleanly, otherwise what went wrong.  The
+        moves before the problem are kept. */
+    std::string error;
+
+    /** Return the value of the tag with the given name, or an empty
+        string if there isn't one. */
+    std::string tag( char const *name ) const;
+};
+
+/**
+   Reads the games in a PGN file, one after another.
+*/
+class PgnReader {
+public:
+    /** Bytes the kernel is asked to read ahead at a time. */
+    enum { CHUNK_BYTES = 16 << 20 };
+
+    PgnReader();
+
+    /** Unmap the file, if there is one. */
+    ~PgnReader();
+
+    /** Map the named file and get ready to read its first game.
+        Returns false, after reporting why, if it can't be read. */
+    bool open( char const *filename );
+
+    /** Unmap the file. */
+    void close();
+
+    /** Return the size of the file in bytes. */
+    uint64_t size() const {
+        return length;
+    }
+
+    /** Return the offset in the file the next game will be read from. */
+    uint64_t tell() const {
+        return offset;
+    }
+
+    /** Read on from offset, which should be where a game starts, as
+        recorded in PgnGame::offset. */
+    void seek( uint64_t where );
+
+    /** Return the offset of the first line at or after where that
+        starts with a tag and follows a blank line, which is where a
+        game starts in an exported file, or size() if there isn't one.
+        This is only a guess (the line could be in a comment), but it
+        lets a file be split up without reading it all. */
+    uint64_t findGameStart( uint64_t where ) const;
+
+    /** Read the next game into game, reusing its storage.  Returns
+        false if there are no games left. */
+    bool next( PgnGame &game );
+
+    /** Pass over the next game, finding where it ends but not what its
+        moves are, which is much quicker.  Returns false if there are no
+        games left. */
+    bool skip();
+
+private:
+    /** Read the next game into game, or if game is NULL, just find its
+        end.  Returns false if there are no games left. */
+    bool read( PgnGame *game );
+
+    /** Tell the kernel which chunks to read ahead and which to drop,
+        now the reader has reached offset. */
+    void follow();
+
+    /** The mapped file, its size, and the offset of the next game. */
+    char const *data;
+    uint64_t length, offset;
+
+    /** Chunk the reader was in at the last follow(). */
+    uint64_t chunk;
+};
+
+#endif
@@ -0,0 +1,307 @@
+//
+// PgnBench.cpp
+//
+// Measure how fast games can be read from a PGN file, write files of
+// random games to measure with, and check the reader against games
+// with every kind of PGN awkwardness in them.
+//
+// Usage: pgnbench file.pgn               read every game, report games/s
+//        pgnbench -generate n file.pgn   write n random games
+//        pgnbench -check                 check the reader
+//
+// The check's exit status is 1 if anything is read wrong.
+//
+
+#include "Pgn.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Return the current time in seconds.
+static double now() {
+    timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Small generator for random games (xorshift64*), seeded the same way
+// every run, so the files come out the same.
+class GameRandom {
+public:
+    GameRandom( uint64_t seed ) : state( seed ) {
+    }
+
+    // Return a number from 0 to n - 1.
+    int below( int n ) {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return ( state * 2685821657736338717ull >> 33 ) % n;
+    }
+
+private:
+    uint64_t state;
+};
+
+// Play a random game of up to maxPlies, putting its moves in moves,
+// and return its result.  Captures are favored, to get promotions,
+// en passant and the endgame into the mix.
+static char const *randomGame( GameRandom &random, int maxPlies, vector< Move > &moves ) {
+    Position pos;
+    moves.clear();
+    for ( int ply = 0; ply < maxPlies; ply++ ) {
+        Move legal[ Position::MAX_MOVES ];
+        int count = pos.legalMoves( legal );
+        if ( count == 0 )
+            return !pos.inCheck() ? "1/2-1/2" :
+                pos.sideToMove() == Position::WHITE ? "0-1" : "1-0";
+
+        Move m = legal[ random.below( count ) ];
+        for ( int tries = 0; tries < 3 && pos.pieceOn( m.to() ) == Position::NO_PIECE; tries++ )
+            m = legal[ random.below( count ) ];
+        Position::Undo undo;
+        pos.makeMove( m, undo );
+        moves.push_back( m );
+    }
+    return "*";
+}
+
+// Write game number index, with the given moves and result, to out in
+// PGN, with the odd comment, annotation and variation thrown in.
+static void writeGame( FILE *out, GameRandom &random, int index,
+                       vector< Move > const &moves, char const *result ) {
+    fprintf( out, "[Event \"Random game\"]\n[Site \"pgnbench\"]\n[Date \"????.??.??\"]\n"
+             "[Round \"%d\"]\n[White \"White %d\"]\n[Black \"Black %d\"]\n"
+             "[Result \"%s\"]\n\n", index, index % 97, index % 89, result );
+
+    Position pos;
+    string line;
+    for ( int i = 0; i < int( moves.size() ); i++ ) {
+        string text;
+        if ( i % 2 == 0 )
+            text = to_string( i / 2 + 1 ) + ". ";
+        text += pos.san( moves[ i ] );
+        switch ( random.below( 16 ) ) {
+        case 0:
+            text += " { a comment }";
+            break;
+        case 1:
+            text += " $" + to_string( 1 + random.below( 6 ) );
+            break;
+        case 2: {
+            // Another move from the same position, as a variation.
+            Move legal[ Position::MAX_MOVES ];
+            int count = pos.legalMoves( legal );
+            text += " (" + to_string( i / 2 + 1 ) + ( i % 2 ? "... " : ". " ) +
+                pos.san( legal[ random.below( count ) ] ) + ")";
+            break;
+        }
+        }
+
+        if ( line.size() + text.size() + 1 > 79 ) {
+            fprintf( out, "%s\n", line.c_str() );
+            line.clear();
+        }
+        line += ( line.empty() ? "" : " " ) + text;
+
+        Position::Undo undo;
+        pos.makeMove( moves[ i ], undo );
+    }
+    line += ( line.empty() ? "" : " " ) + string( result );
+    fprintf( out, "%s\n\n", line.c_str() );
+}
+
+// Write count random games to the named file.  If all is given, the
+// games' moves are put in it too.
+static bool generate( char const *filename, int count,
+                      vector< vector< Move > > *all = NULL ) {
+    FILE *out = fopen( filename, "w" );
+    if ( !out ) {
+        perror( filename );
+        return false;
+    }
+    GameRandom random( 0x853c49e6748fea9bull );
+    vector< Move > moves;
+    for ( int i = 0; i < count; i++ ) {
+        char const *result = randomGame( random, 20 + random.below( 200 ), moves );
+        writeGame( out, random, i + 1, moves, result );
+        if ( all )
+            all->push_back( moves );
+    }
+    fclose( out );
+    return true;
+}
+
+// Games that between them have tag escapes, comments of both kinds,
+// escaped lines, move numbers with and without black's dots, NAGs and
+// suffix annotations, nested variations, castling with letters and
+// zeros, en passant, promotion, an illegal move, a FEN tag, and a game
+// with no result.
+static char const TRICKY_PGN[] =
+    "[Event \"Tricky \\\"quoted\\\" \\\\ tag\"]\n"
+    "[White \"A\"]\n"
+    "[Black \"B\"]\n"
+    "[Result \"1-0\"]\n"
+    "\n"
+    "% An escaped line, 1. a4 isn't a move\n"
+    "1. e4 {a comment (with parens) and 1. d4} e5 ; rest of line 2. d4\n"
+    "2. Nf3 $1 Nc6!? 3. Bb5 (3. Bc4 Bc5 (3... Nf6) 4. c3) 3... a6 4.Ba4 Nf6\n"
+    "5. O-O Be7 1-0\n"
+    "\n"
+    "[Event \"Promotion\"]\n"
+    "[SetUp \"1\"]\n"
+    "[FEN \"4k3/P7/8/8/8/8/8/K6R w - - 0 1\"]\n"
+    "\n"
+    "1. a8=Q+ Ke7 2. Rh7+ Kf6 3. Qf8+ Kg6 *\n"
+    "\n"
+    "[Event \"Illegal\"]\n"
+    "\n"
+    "1. e4 e5 2. Ke3 Nc6 3. Nf3 0-1\n"
+    "\n"
+    "1. d4 d5 2. c4\n"
+    "\n"
+    "[Event \"En passant\"]\n"
+    "\n"
+    "1. e4 d5 2. e5 f5 3. exf6 Nxf6 4. d4 Bf5 5. Nc3 Qd7 6. Be3 Nc6 7. Qd2 0-0-0\n"
+    "8. O-O-O 1/2-1/2\n";
+
+// What should be read from each game of TRICKY_PGN.
+struct TrickyGame {
+    char const *name;
+    int plies;
+    char const *moves;
+    char const *result;
+    char const *error;
+};
+
+static const TrickyGame TRICKY_GAMES[] = {
+    { "comments", 10, "e2e4 e7e5 g1f3 b8c6 f1b5 a7a6 b5a4 g8f6 e1g1 f8e7", "1-0", "" },
+    { "FEN and promotion", 6, "a7a8q e8e7 h1h7 e7f6 a8f8 f6g6", "*", "" },
+    { "illegal move", 2, "e2e4 e7e5", "0-1", "illegal move Ke3 at ply 3" },
+    { "no tags or result", 3, "d2d4 d7d5 c2c4", "", "" },
+    { "en passant, castling", 15,
+      "e2e4 d7d5 e4e5 f7f5 e5f6 g8f6 d2d4 c8f5 b1c3 d8d7 c1e3 b8c6 d1d2 e8c8 e1c1",
+      "1/2-1/2", "" },
+};
+
+// Return the moves of game as coordinate names, separated by spaces.
+static string moveNames( PgnGame const &game ) {
+    string names;
+    for ( int i = 0; i < int( game.moves.size() ); i++ )
+        names += ( i ? " " : "" ) + game.moves[ i ].name();
+    return names;
+}
+
+// Check the reader on TRICKY_PGN, and on random games read back after
+// writing them out.
+static int runCheck() {
+    int failures = 0;
+    char filename[] = "/tmp/pgnbenchXXXXXX";
+    int fd = mkstemp( filename );
+    if ( fd < 0 || write( fd, TRICKY_PGN, sizeof( TRICKY_PGN ) - 1 ) !=
+         ssize_t( sizeof( TRICKY_PGN ) - 1 ) ) {
+        perror( filename );
+        return 1;
+    }
+    close( fd );
+
+    PgnReader reader;
+    PgnGame game;
+    vector< uint64_t > offsets;
+    if ( !reader.open( filename ) )
+        return 1;
+    int count = sizeof( TRICKY_GAMES ) / sizeof( TRICKY_GAMES[ 0 ] );
+    for ( int g = 0; g < count; g++ ) {
+        TrickyGame const &want = TRICKY_GAMES[ g ];
+        bool ok = reader.next( game ) && int( game.moves.size() ) == want.plies &&
+            moveNames( game ) == want.moves && game.result == want.result &&
+            game.error == want.error;
+        offsets.push_back( game.offset );
+        printf( "%s  %-22s %s\n", ok ? "ok  " : "FAIL", want.name,
+                ok ? "" : ( moveNames( game ) + " / " + game.result + " / " +
+                            game.error ).c_str() );
+        failures += !ok;
+    }
+
+    bool ok = !reader.next( game ) &&
+        game.tag( "Event" ) == "En passant" && game.moves[ 4 ].kind() == Move::EN_PASSANT;
+    reader.seek( offsets[ 0 ] );
+    ok = ok && reader.next( game ) && game.tag( "Event" ) == "Tricky \"quoted\" \\ tag";
+    reader.seek( offsets[ 1 ] );
+    ok = ok && reader.skip() && reader.next( game ) && game.tag( "Event" ) == "Illegal";
+    printf( "%s  %-22s\n", ok ? "ok  " : "FAIL", "tags, seeking, skipping" );
+    failures += !ok;
+
+    // Random games, through SAN and back.
+    vector< vector< Move > > all;
+    int games = 300;
+    ok = generate( filename, games, &all ) && reader.open( filename );
+    int wrong = 0, read = 0;
+    while ( ok && reader.next( game ) ) {
+        wrong += read >= games || game.moves != all[ read ] || !game.error.empty();
+        read++;
+    }
+    ok = ok && read == games && wrong == 0;
+    printf( "%s  %-22s %d of %d games read back wrong\n", ok ? "ok  " : "FAIL",
+            "random games", wrong, games );
+    failures += !ok;
+
+    reader.close();
+    unlink( filename );
+    printf( "%s\n", failures ? "FAILED" : "passed" );
+    return failures ? 1 : 0;
+}
+
+// Read every game in the named file, then skip through them all, and
+// report how fast each went.
+static int runBench( char const *filename ) {
+    PgnReader reader;
+    if ( !reader.open( filename ) )
+        return 1;
+
+    PgnGame game;
+    long games = 0, plies = 0, errors = 0;
+    double start = now();
+    while ( reader.next( game ) ) {
+        games++;
+        plies += game.moves.size();
+        errors += !game.error.empty();
+        if ( !game.error.empty() && errors <= 5 )
+            fprintf( stderr, "%s: game %ld: %s\n", filename, games, game.error.c_str() );
+    }
+    double seconds = now() - start;
+    double megabytes = reader.size() / 1048576.0;
+    printf( "%s: %.1f MB, %ld games, %ld plies, %ld with errors\n", filename, megabytes,
+            games, plies, errors );
+    printf( "read:     %.3f s, %.0f games/s, %.0f plies/s, %.1f MB/s\n", seconds,
+            games / seconds, plies / seconds, megabytes / seconds );
+
+    reader.seek( 0 );
+    start = now();
+    long skipped = 0;
+    while ( reader.skip() )
+        skipped++;
+    seconds = now() - start;
+    printf( "skipped:  %.3f s, %.0f games/s, %.1f MB/s\n", seconds, skipped / seconds,
+            megabytes / seconds );
+    return 0;
+}
+
+int main( int argc, char **argv ) {
+    if ( argc == 2 && strcmp( argv[ 1 ], "-check" ) == 0 )
+        return runCheck();
+    if ( argc == 4 && strcmp( argv[ 1 ], "-generate" ) == 0 )
+        return generate( argv[ 3 ], atoi( argv[ 2 ] ) ) ? 0 : 1;
+    if ( argc == 2 && argv[ 1 ][ 0 ] != '-' )
+        return runBench( argv[ 1 ] );
+
+    fprintf( stderr, "usage: %s file.pgn | -generate n file.pgn | -check\n", argv[ 0 ] );
+    return 1;
+}
@@ -0,0 +1,521 @@
+//
+// PgnIndex.cpp
+//
+// Building PGN indexes on several threads, and mapping and searching
+// them.
+//
+
+#include "PgnIndex.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <queue>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Header at the front of an index file.  It's followed by the games
+// (games PgnIndexGames), the positions (positions PgnIndexEntries,
+// sorted by key), the bucket directory (2^bucketBits + 1 entry numbers:
+// where the keys with each value of their top bucketBits bits start),
+// the moves (moves uint16s, each game's together) and the text
+// (textBytes of NUL-terminated fields, FIELDS of them for each game).
+// startKey is the key of the starting position, which changes if the
+// Zobrist keys ever do, making the index useless.
+struct PgnIndexHeader {
+    char magic[ 4 ];
+    uint32_t version;
+    uint64_t pgnSize;
+    uint64_t startKey;
+    uint64_t games, positions, moves, textBytes;
+    uint32_t bucketBits, reserved;
+};
+
+// Where a game starts in the PGN file, where its first field is in the
+// text, and where its moves are.
+struct PgnIndexGame {
+    uint64_t offset;
+    uint64_t text;
+    uint64_t firstMove;
+    uint32_t plies, reserved;
+};
+
+// A position, by key, with the first game and ply that reach it, and
+// how many times it's reached.
+struct PgnIndexEntry {
+    uint64_t key;
+    uint32_t game;
+    uint16_t ply, reached;
+};
+
+// Identifies an index file, and the version of the layout above.
+static const char INDEX_MAGIC[ 4 ] = { 'P', 'G', 'N', 'X' };
+static const uint32_t INDEX_VERSION = 1;
+
+// Largest ply and count an entry can hold.  Positions further into a
+// game than MAX_PLY aren't indexed.
+static const int MAX_PLY = 65535;
+static const int MAX_REACHED = 65535;
+
+// Tags kept for each game, in Field order, up to RESULT.
+static char const *const TAG_NAMES[] = { "Event", "Site", "Date", "Round", "White", "Black" };
+
+// Return true if we're on a little-endian host, which is the only
+// kind that can use the index in place.
+static bool littleEndian() {
+    uint32_t one = 1;
+    return *(unsigned char *) &one == 1;
+}
+
+// Return true if entry a should come before b: by key, then by where
+// it's reached.
+static bool entryBefore( PgnIndexEntry const &a, PgnIndexEntry const &b ) {
+    if ( a.key != b.key )
+        return a.key < b.key;
+    return a.game != b.game ? a.game < b.game : a.ply < b.ply;
+}
+
+// Fold entry e into the last of entries if it's the same position,
+// keeping the first place it's reached, or add it if it's a new one.
+static void addEntry( vector< PgnIndexEntry > &entries, PgnIndexEntry const &e ) {
+    if ( !entries.empty() && entries.back().key == e.key )
+        entries.back().reached = min( MAX_REACHED, entries.back().reached + e.reached );
+    else
+        entries.push_back( e );
+}
+
+// Sort entries, then fold together the ones for the same position,
+// putting the result in sorted.  Keys are spread evenly, so dealing the
+// entries out by the top bits of their keys leaves just a few in each
+// group to sort properly.
+static void sortEntries( vector< PgnIndexEntry > const &entries,
+                         vector< PgnIndexEntry > &sorted ) {
+    int bits = 1;
+    while ( bits < 22 && ( size_t( 8 ) << bits ) < entries.size() )
+        bits++;
+    vector< uint32_t > start( ( 1 << bits ) + 1, 0 );
+    for ( size_t i = 0; i < entries.size(); i++ )
+        start[ ( entries[ i ].key >> ( 64 - bits ) ) + 1 ]++;
+    for ( size_t g = 1; g < start.size(); g++ )
+        start[ g ] += start[ g - 1 ];
+
+    vector< PgnIndexEntry > dealt( entries.size() );
+    vector< uint32_t > next( start.begin(), start.end() - 1 );
+    for ( size_t i = 0; i < entries.size(); i++ )
+        dealt[ next[ entries[ i ].key >> ( 64 - bits ) ]++ ] = entries[ i ];
+
+    sorted.clear();
+    sorted.reserve( entries.size() );
+    for ( size_t g = 0; g + 1 < start.size(); g++ ) {
+        sort( dealt.begin() + start[ g ], dealt.begin() + start[ g + 1 ], entryBefore );
+        for ( uint32_t i = start[ g ]; i < start[ g + 1 ]; i++ )
+            addEntry( sorted, dealt[ i ] );
+    }
+}
+
+// The games starting in one stretch of the PGN file, from begin up to
+// end, as read by one thread.  Game numbers and move and text offsets
+// count from the start of the stretch.  last is where its last game
+// ends.  entries are sorted by key, one for each position.
+struct IndexChunk {
+    uint64_t begin, end, last;
+    bool failed;
+    vector< PgnIndexGame > games;
+    vector< PgnIndexEntry > entries;
+    vector< uint16_t > moves;
+    string text;
+};
+
+// Add a field to text, ending it with a NUL.
+static void addField( string &text, string const &value ) {
+    text += value.c_str();
+    text += '\0';
+}
+
+// Read the games in chunk's stretch of the named PGN file, then sort
+// their positions.
+static void indexChunk( char const *pgnFile, IndexChunk *chunk ) {
+    PgnReader reader;
+    chunk->last = chunk->begin;
+    chunk->failed = !reader.open( pgnFile );
+    if ( chunk->failed )
+        return;
+
+    reader.seek( chunk->begin );
+    PgnGame game;
+    vector< PgnIndexEntry > entries;
+    while ( reader.next( game ) && game.offset < chunk->end ) {
+        PgnIndexGame g;
+        g.offset = game.offset;
+        g.text = chunk->text.size();
+        g.firstMove = chunk->moves.size();
+        g.plies = game.moves.size();
+        g.reserved = 0;
+        uint32_t number = chunk->games.size();
+        chunk->games.push_back( g );
+
+        for ( int t = 0; t < PgnIndex::RESULT; t++ )
+            addField( chunk->text, game.tag( TAG_NAMES[ t ] ) );
+        addField( chunk->text, game.result );
+        addField( chunk->text, game.tag( "FEN" ) );
+        addField( chunk->text, game.error );
+
+        for ( int i = 0; i < int( game.moves.size() ); i++ )
+            chunk->moves.push_back( game.moves[ i ].raw() );
+        for ( int ply = 0; ply < int( game.keys.size() ) && ply <= MAX_PLY; ply++ ) {
+            PgnIndexEntry e = { game.keys[ ply ], number, uint16_t( ply ), 1 };
+            entries.push_back( e );
+        }
+        chunk->last = reader.tell();
+    }
+    sortEntries( entries, chunk->entries );
+}
+
+// Merge the positions of all the chunks with keys from low up to high
+// (or to the end, if high is 0) into merged, numbering their games from
+// each chunk's first in gameBase.  Where chunks share a position, the
+// earlier one has the first game to reach it.
+static void mergeEntries( vector< IndexChunk > const *chunks,
+                          vector< uint64_t > const *gameBase, uint64_t low, uint64_t high,
+                          vector< PgnIndexEntry > *merged ) {
+    typedef pair< uint64_t, int > Head;
+    priority_queue< Head, vector< Head >, greater< Head > > heads;
+    int count = chunks->size();
+    vector< PgnIndexEntry const * > next( count ), last( count );
+    for ( int k = 0; k < count; k++ ) {
+        PgnIndexEntry const *first = ( *chunks )[ k ].entries.data();
+        PgnIndexEntry const *end = first + ( *chunks )[ k ].entries.size();
+        PgnIndexEntry bound = { low, 0, 0, 0 };
+        next[ k ] = lower_bound( first, end, bound, entryBefore );
+        bound.key = high;
+        last[ k ] = high ? lower_bound( first, end, bound, entryBefore ) : end;
+        if ( next[ k ] < last[ k ] )
+            heads.push( Head( next[ k ]->key, k ) );
+    }
+
+    while ( !heads.empty() ) {
+        int k = heads.top().second;
+        heads.pop();
+        PgnIndexEntry e = *next[ k ]++;
+        e.game += ( *gameBase )[ k ];
+        addEntry( *merged, e );
+        if ( next[ k ] < last[ k ] )
+            heads.push( Head( next[ k ]->key, k ) );
+    }
+}
+
+bool PgnIndex :: build( char const *pgnFile, char const *indexFile, int threads ) {
+    if ( !littleEndian() ) {
+        fprintf( stderr, "PGN indexes can only be written on little-endian hosts\n" );
+        return false;
+    }
+    PgnReader reader;
+    if ( !reader.open( pgnFile ) )
+        return false;
+
+    // Split the file into a stretch for each thread, each starting
+    // where a game looks like it does.
+    uint64_t size = reader.size();
+    vector< IndexChunk > chunks( max( 1, threads ) );
+    int count = chunks.size();
+    chunks[ 0 ].begin = 0;
+    for ( int k = 1; k < count; k++ )
+        chunks[ k ].begin = max( chunks[ k - 1 ].begin,
+                                 reader.findGameStart( size * k / count ) );
+    for ( int k = 0; k < count; k++ )
+        chunks[ k ].end = k + 1 < count ? chunks[ k + 1 ].begin : size;
+    reader.close();
+
+    vector< thread > workers;
+    for ( int k = 1; k < count; k++ )
+        workers.push_back( thread( indexChunk, pgnFile, &chunks[ k ] ) );
+    indexChunk( pgnFile, &chunks[ 0 ] );
+    for ( int k = 0; k < int( workers.size() ); k++ )
+        workers[ k ].join();
+
+    // If a stretch started in the middle of a game after all (at a tag
+    // inside a comment, say), the game before runs past its start.
+    // Then the file has to be read in one piece.
+    bool clean = true;
+    for ( int k = 0; k < count; k++ ) {
+        if ( chunks[ k ].failed )
+            return false;
+        clean = clean && ( k == 0 || chunks[ k - 1 ].last <= chunks[ k ].begin );
+    }
+    if ( !clean ) {
+        fprintf( stderr, "%s: games don't split cleanly, indexing on one thread\n", pgnFile );
+        chunks.assign( 1, IndexChunk() );
+        chunks[ 0 ].begin = 0;
+        chunks[ 0 ].end = size;
+        indexChunk( pgnFile, &chunks[ 0 ] );
+        count = 1;
+    }
+
+    // Number the games straight through, and merge the chunks' sorted
+    // positions.  Where chunks share a position, the earlier one has the
+    // first game to reach it.
+    PgnIndexHeader h;
+    memcpy( h.magic, INDEX_MAGIC, 4 );
+    h.version = INDEX_VERSION;
+    h.pgnSize = size;
+    h.startKey = Position().hashKey();
+    h.games = h.moves = h.textBytes = 0;
+    h.reserved = 0;
+    vector< uint64_t > gameBase( count );
+    for ( int k = 0; k < count; k++ ) {
+        gameBase[ k ] = h.games;
+        for ( size_t i = 0; i < chunks[ k ].games.size(); i++ ) {
+            chunks[ k ].games[ i ].text += h.textBytes;
+            chunks[ k ].games[ i ].firstMove += h.moves;
+        }
+        h.games += chunks[ k ].games.size();
+        h.moves += chunks[ k ].moves.size();
+        h.textBytes += chunks[ k ].text.size();
+    }
+    if ( h.games > uint64_t( INT_MAX ) ) {
+        fprintf( stderr, "%s: too many games to index\n", pgnFile );
+        return false;
+    }
+
+    // Each thread merges an even share of the keys.
+    vector< vector< PgnIndexEntry > > ranges( count );
+    if ( count == 1 ) {
+        ranges[ 0 ].swap( chunks[ 0 ].entries );
+    } else {
+        uint64_t share = ~uint64_t( 0 ) / count + 1;
+        for ( int k = 1; k < count; k++ )
+            workers[ k - 1 ] = thread( mergeEntries, &chunks, &gameBase, share * k,
+                                       k + 1 < count ? share * ( k + 1 ) : 0, &ranges[ k ] );
+        mergeEntries( &chunks, &gameBase, 0, share, &ranges[ 0 ] );
+        for ( int k = 1; k < count; k++ )
+            workers[ k - 1 ].join();
+    }
+    h.positions = 0;
+    for ( int k = 0; k < count; k++ )
+        h.positions += ranges[ k ].size();
+
+    // About eight entries to a bucket.
+    h.bucketBits = 1;
+    while ( h.bucketBits < 40 && ( uint64_t( 8 ) << h.bucketBits ) < h.positions )
+        h.bucketBits++;
+    vector< uint64_t > buckets( ( uint64_t( 1 ) << h.bucketBits ) + 1, h.positions );
+    uint64_t e = 0, b = 0;
+    for ( int k = 0; k < count; k++ )
+        for ( size_t i = 0; i < ranges[ k ].size(); i++, e++ )
+            for ( ; b <= ranges[ k ][ i ].key >> ( 64 - h.bucketBits ); b++ )
+                buckets[ b ] = e;
+
+    // Lay the file out exactly as open() expects to find it.
+    FILE *out = fopen( indexFile, "wb" );
+    if ( !out ) {
+        perror( indexFile );
+        return false;
+    }
+    fwrite( &h, sizeof( h ), 1, out );
+    for ( int k = 0; k < count; k++ )
+        fwrite( chunks[ k ].games.data(), sizeof( PgnIndexGame ), chunks[ k ].games.size(), out );
+    for ( int k = 0; k < count; k++ )
+        fwrite( ranges[ k ].data(), sizeof( PgnIndexEntry ), ranges[ k ].size(), out );
+    fwrite( buckets.data(), sizeof( uint64_t ), buckets.size(), out );
+    for ( int k = 0; k < count; k++ )
+        fwrite( chunks[ k ].moves.data(), sizeof( uint16_t ), chunks[ k ].moves.size(), out );
+    for ( int k = 0; k < count; k++ )
+        fwrite( chunks[ k ].text.data(), 1, chunks[ k ].text.size(), out );
+    if ( ferror( out ) | fclose( out ) ) {
+        perror( indexFile );
+        return false;
+    }
+    return true;
+}
+
+PgnIndex :: PgnIndex() : mapping( NULL ), mappingSize( 0 ), header( NULL ) {
+}
+
+PgnIndex :: ~PgnIndex() {
+    close();
+}
+
+bool PgnIndex :: open( char const *filename ) {
+    close();
+    if ( !littleEndian() ) {
+        fprintf( stderr, "PGN indexes can only be read on little-endian hosts\n" );
+        return false;
+    }
+
+    int fd = ::open( filename, O_RDONLY );
+    if ( fd < 0 ) {
+        perror( filename );
+        return false;
+    }
+    struct stat info;
+    if ( fstat( fd, &info ) != 0 || uint64_t( info.st_size ) < sizeof( PgnIndexHeader ) ) {
+        fprintf( stderr, "%s: not a PGN index\n", filename );
+        ::close( fd );
+        return false;
+    }
+
+    // Map the whole file; the mapping stays valid after we close it.
+    uint64_t size = info.st_size;
+    void *data = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close( fd );
+    if ( data == MAP_FAILED ) {
+        perror( filename );
+        return false;
+    }
+
+    // Make sure it's an index we understand, and that its parts add up
+    // to the size of the file.  Each count is checked against the size
+    // before it's multiplied, so nothing can overflow.
+    PgnIndexHeader const &h = *(PgnIndexHeader const *) data;
+    bool ok = memcmp( h.magic, INDEX_MAGIC, 4 ) == 0 && h.version == INDEX_VERSION &&
+        h.startKey == Position().hashKey() && h.bucketBits >= 1 && h.bucketBits <= 40 &&
+        h.games <= uint64_t( INT_MAX );
+    uint64_t need = sizeof( PgnIndexHeader );
+    uint64_t counts[] = { h.games, h.positions, ( uint64_t( 1 ) << h.bucketBits ) + 1,
+                          h.moves, h.textBytes };
+    uint64_t sizes[] = { sizeof( PgnIndexGame ), sizeof( PgnIndexEntry ), sizeof( uint64_t ),
+                         sizeof( uint16_t ), 1 };
+    for ( int i = 0; ok && i < 5; i++ ) {
+        ok = counts[ i ] <= size / sizes[ i ];
+        need += counts[ i ] * sizes[ i ];
+    }
+    if ( !ok || need != size ) {
+        fprintf( stderr, "%s: not a PGN index, or one from another version\n", filename );
+        munmap( data, size );
+        return false;
+    }
+
+    header = &h;
+    gameList = (PgnIndexGame const *) ( header + 1 );
+    entries = (PgnIndexEntry const *) ( gameList + h.games );
+    buckets = (uint64_t const *) ( entries + h.positions );
+    moves = (uint16_t const *) ( buckets + ( uint64_t( 1 ) << h.bucketBits ) + 1 );
+    text = (char const *) ( moves + h.moves );
+
+    // The text must end in a NUL, so every field in it does.
+    if ( h.textBytes && text[ h.textBytes - 1 ] != '\0' ) {
+        fprintf( stderr, "%s: bad text\n", filename );
+        munmap( data, size );
+        header = NULL;
+        return false;
+    }
+
+    // Lookups jump all over the table, so reading ahead doesn't help.
+    madvise( data, size, MADV_RANDOM );
+    mapping = data;
+    mappingSize = size;
+    return true;
+}
+
+void PgnIndex :: close() {
+    if ( mapping )
+        munmap( mapping, mappingSize );
+    mapping = NULL;
+    mappingSize = 0;
+    header = NULL;
+}
+
+uint64_t PgnIndex :: pgnSize() const {
+    return header ? header->pgnSize : 0;
+}
+
+int PgnIndex :: games() const {
+    return header ? header->games : 0;
+}
+
+uint64_t PgnIndex :: positions() const {
+    return header ? header->positions : 0;
+}
+
+PgnIndexGame const *PgnIndex :: entry( int i ) const {
+    if ( !header || i < 0 || uint64_t( i ) >= header->games )
+        return NULL;
+    PgnIndexGame const *g = gameList + i;
+    if ( g->text >= header->textBytes || g->firstMove > header->moves ||
+         g->plies > header->moves - g->firstMove )
+        return NULL;
+    return g;
+}
+
+char const *PgnIndex :: field( int i, Field f ) const {
+    PgnIndexGame const *g = entry( i );
+    if ( !g )
+        return "";
+    char const *p = text + g->text, *end = text + header->textBytes;
+    for ( int k = 0; k < f && p < end; k++ )
+        p += strlen( p ) + 1;
+    return p < end ? p : "";
+}
+
+bool PgnIndex :: game( int i, PgnGame &game ) const {
+    static const Position initial;
+
+    PgnIndexGame const *g = entry( i );
+    if ( !g )
+        return false;
+    game.offset = g->offset;
+    game.tags.clear();
+    for ( int t = 0; t < RESULT; t++ )
+        if ( *field( i, Field( t ) ) )
+            game.tags.push_back( make_pair( string( TAG_NAMES[ t ] ), field( i, Field( t ) ) ) );
+    game.result = field( i, RESULT );
+    game.error = field( i, ERROR );
+    game.start = initial;
+    game.moves.clear();
+    game.keys.clear();
+    if ( *field( i, FEN ) ) {
+        game.tags.push_back( make_pair( string( "FEN" ), string( field( i, FEN ) ) ) );
+        if ( !game.start.setFen( field( i, FEN ) ) ) {
+            game.error = "bad FEN tag";
+            return true;
+        }
+    }
+
+    // The moves were legal when the index was written, but a damaged
+    // index could hold anything, so they're checked as they're played.
+    Position pos( game.start );
+    game.keys.push_back( pos.hashKey() );
+    for ( uint32_t m = 0; m < g->plies; m++ ) {
+        Move move = Move::fromRaw( moves[ g->firstMove + m ] );
+        if ( !pos.isLegalMove( move ) ) {
+            game.error = "bad move in the index at ply " + to_string( m + 1 );
+            break;
+        }
+        Position::Undo undo;
+        pos.makeMove( move, undo );
+        game.moves.push_back( move );
+        game.keys.push_back( pos.hashKey() );
+    }
+    return true;
+}
+
+PgnIndex::Hit PgnIndex :: find( uint64_t key ) const {
+    Hit hit = { -1, 0, 0 };
+    if ( !header )
+        return hit;
+
+    // Keys are sorted, so the bucket's run is the only place to look.
+    uint64_t b = key >> ( 64 - header->bucketBits );
+    uint64_t last = min( buckets[ b + 1 ], header->positions );
+    for ( uint64_t i = buckets[ b ]; i < last && entries[ i ].key <= key; i++ ) {
+        if ( entries[ i ].key != key )
+            continue;
+        PgnIndexGame const *g = entry( entries[ i ].game );
+        if ( g && entries[ i ].ply <= g->plies ) {
+            hit.game = entries[ i ].game;
+            hit.ply = entries[ i ].ply;
+            hit.reached = entries[ i ].reached;
+        }
+        break;
+    }
+    return hit;
+}
@@ -0,0 +1,105 @@
+#ifndef __PGN_INDEX_H__
+#define __PGN_INDEX_H__
+
+#include "Pgn.h"
+
+#include <stdint.h>
+
+struct PgnIndexHeader;
+struct PgnIndexGame;
+struct PgnIndexEntry;
+
+//
+// An on-disk index of a PGN file, so any game, or any position reached
+// in any game, can be found straight away, however big the file is.
+//
+// The index is built by reading the file on several threads at once,
+// each taking the games in one stretch of it.  It holds, for each game,
+// where it starts in the file, its main tags, and its moves (16 bits
+// each, so a game can be played out without going back to the PGN), and
+// a table of every position reached, by Zobrist key, with the first game
+// and ply that reach it.  The table is sorted by key, with a directory
+// of where each run of keys with the same top bits starts.  Runs
+// average at most eight entries, and finding a position looks through
+// the start of just one of them.
+//
+// Like the binary mesh files, the index is laid out in the file just as
+// it's used, little-endian, and mapped in rather than read.  It isn't
+// checksummed, since that would mean reading all of it; instead,
+// everything taken from it is checked against its bounds as it's used.
+//
+
+/**
+   An index of a PGN file, mapped from disk.
+*/
+class PgnIndex {
+public:
+    /** What's kept about each game: the Seven Tag Roster, the FEN tag,
+        and PgnGame::error.  RESULT is the result at the end of the
+        movetext, like PgnGame::result. */
+    enum Field { EVENT, SITE, DATE, ROUND, WHITE, BLACK, RESULT, FEN, ERROR, FIELDS };
+
+    /** Where a position is first reached: a game, from 0, and the number
+        of moves into it, or a game of -1 if it isn't reached at all.
+        reached is how many times the position comes up, up to 65,535. */
+    struct Hit {
+        int game, ply, reached;
+    };
+
+    PgnIndex();
+
+    /** Unmap the index, if there is one. */
+    ~PgnIndex();
+
+    /** Index the PGN file named pgnFile on the given number of threads,
+        and write the index to indexFile.  Returns false, after
+        reporting why, if either file can't be used. */
+    static bool build( char const *pgnFile, char const *indexFile, int threads );
+
+    /** Map the named index file.  Returns false, after reporting why,
+        if it can't be read or isn't an index this build understands. */
+    bool open( char const *filename );
+
+    /** Unmap the index. */
+    void close();
+
+    /** Return the size of the PGN file the index was built from, to
+        check it hasn't changed since. */
+    uint64_t pgnSize() const;
+
+    /** Return the number of games, and of different positions. */
+    int games() const;
+    uint64_t positions() const;
+
+    /** Return the field of game i, or an empty string if it's missing
+        or the game is out of range. */
+    char const *field( int i, Field f ) const;
+
+    /** Fill in game with game i, from the index alone, and return true,
+        or return false if there's no such game or its entry is bad.  A
+        move that isn't legal where it's played ends the game there,
+        with an error, just as it would in the PGN file. */
+    bool game( int i, PgnGame &game ) const;
+
+    /** Find where the position with the given key is first reached. */
+    Hit find( uint64_t key ) const;
+
+private:
+    /** Return game i's entry, or NULL if it's out of range or points
+        outside the index. */
+    PgnIndexGame const *entry( int i ) const;
+
+    /** The mapped file and its size, or NULL. */
+    void *mapping;
+    uint64_t mappingSize;
+
+    /** The parts of the mapped file. */
+    PgnIndexHeader const *header;
+    PgnIndexGame const *gameList;
+    PgnIndexEntry const *entries;
+    uint64_t const *buckets;
+    uint16_t const *moves;
+    char const *text;
+};
+
+#endif
@@ -0,0 +1,305 @@
+//
+// PgnIndexer.cpp
+//
+// Build indexes of PGN files, measure how building them scales with
+// threads and how fast they're searched, and check an index against the
+// file it was built from.
+//
+// Usage: pgnindex [-threads n] file.pgn file.idx   build the index
+//        pgnindex -bench file.pgn                  build times for 1, 2,
+//                                                  4, ... threads, and
+//                                                  lookup speed
+//        pgnindex -check file.pgn                  check indexes of the file
+//
+// The check's exit status is 1 if anything in an index is wrong.
+//
+
+#include "PgnIndex.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Return the current time in seconds.
+static double now() {
+    timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Return the contents of the named file, or an empty string if it
+// can't be read.
+static string readFile( char const *filename ) {
+    string contents;
+    FILE *in = fopen( filename, "rb" );
+    if ( !in )
+        return contents;
+    char buffer[ 65536 ];
+    size_t n;
+    while ( ( n = fread( buffer, 1, sizeof( buffer ), in ) ) > 0 )
+        contents.append( buffer, n );
+    fclose( in );
+    return contents;
+}
+
+// Write contents to the named file.
+static bool writeFile( char const *filename, string const &contents ) {
+    FILE *out = fopen( filename, "wb" );
+    if ( !out )
+        return false;
+    bool ok = fwrite( contents.data(), 1, contents.size(), out ) == contents.size();
+    return fclose( out ) == 0 && ok;
+}
+
+// Games whose export-format look is misleading: a comment holding a
+// blank line and a tag, where a split could land, and games with no
+// blank lines between them at all.
+static char const TRICKY_PGN[] =
+    "[Event \"Comment\"]\n"
+    "\n"
+    "1. e4 { a comment with a game in it:\n"
+    "\n"
+    "[Event \"Not a game\"]\n"
+    "\n"
+    "1. d4 } e5 2. Nf3 1-0\n"
+    "\n"
+    "[Event \"Packed\"]\n"
+    "1. d4 d5 *\n"
+    "[Event \"Packed too\"]\n"
+    "1. d4 d5 2. c4 *\n"
+    "\n"
+    "[Event \"Set up\"]\n"
+    "[FEN \"4k3/8/8/8/8/8/8/4K2R w K - 0 1\"]\n"
+    "\n"
+    "1. O-O Kd7 *\n";
+
+// Check the index in indexFile against the games in pgnFile, reading
+// them again and following each game's positions.  Returns the number
+// of problems found, after reporting the first few.
+static int checkAgainst( char const *pgnFile, char const *indexFile ) {
+    PgnIndex index;
+    PgnReader reader;
+    if ( !index.open( indexFile ) || !reader.open( pgnFile ) )
+        return 1;
+
+    // Where each position is first reached, and how often, found the
+    // slow way.
+    struct Seen {
+        int game, ply, reached;
+    };
+    unordered_map< uint64_t, Seen > seen;
+    seen.reserve( index.positions() );
+
+    int problems = 0, games = 0;
+    PgnGame game, indexed;
+    while ( reader.next( game ) ) {
+        bool ok = index.game( games, indexed ) && indexed.offset == game.offset &&
+            indexed.moves == game.moves && indexed.keys == game.keys &&
+            indexed.result == game.result &&
+            indexed.error == game.error && indexed.tag( "White" ) == game.tag( "White" ) &&
+            indexed.tag( "FEN" ) == game.tag( "FEN" ) &&
+            indexed.start.hashKey() == game.start.hashKey();
+        if ( !ok && problems++ < 5 )
+            printf( "  game %d doesn't match\n", games + 1 );
+
+        for ( int ply = 0; ply < int( game.keys.size() ); ply++ ) {
+            Seen &s = seen[ game.keys[ ply ] ];
+            if ( s.reached == 0 ) {
+                s.game = games;
+                s.ply = ply;
+            }
+            s.reached = min( 65535, s.reached + 1 );
+        }
+        games++;
+    }
+    if ( index.games() != games || index.positions() != seen.size() ) {
+        printf( "  %d games and %lu positions, expected %d and %lu\n", index.games(),
+                (unsigned long) index.positions(), games, (unsigned long) seen.size() );
+        problems++;
+    }
+
+    for ( auto s = seen.begin(); s != seen.end(); ++s ) {
+        PgnIndex::Hit hit = index.find( s->first );
+        if ( ( hit.game != s->second.game || hit.ply != s->second.ply ||
+               hit.reached != s->second.reached ) && problems++ < 5 )
+            printf( "  position %016llx found at game %d ply %d (%d times), expected "
+                    "game %d ply %d (%d times)\n", (unsigned long long) s->first, hit.game,
+                    hit.ply, hit.reached, s->second.game, s->second.ply, s->second.reached );
+    }
+
+    // A position no game reaches, and game numbers past the end.
+    Position nowhere;
+    if ( !nowhere.setFen( "QQQQQQQQ/8/8/8/8/8/8/k6K b - - 0 1" ) ||
+         index.find( nowhere.hashKey() ).game != -1 || index.game( games, indexed ) ||
+         index.game( -1, indexed ) || *index.field( games, PgnIndex::WHITE ) )
+        problems++;
+    return problems;
+}
+
+// Build indexes of the named file on one thread and on several, which
+// should come out the same, and check them against the file.  Then make
+// sure damaged and out of date indexes are turned away.
+static int runCheck( char const *pgnFile ) {
+    int failures = 0;
+    char oneName[] = "/tmp/pgnindexXXXXXX", manyName[] = "/tmp/pgnindexXXXXXX";
+    char trickyName[] = "/tmp/pgnindexXXXXXX";
+    int fds[] = { mkstemp( oneName ), mkstemp( manyName ), mkstemp( trickyName ) };
+    for ( int i = 0; i < 3; i++ )
+        if ( fds[ i ] >= 0 )
+            close( fds[ i ] );
+
+    // The file given, split three ways, and the tricky games split every
+    // which way.
+    struct Case {
+        char const *name, *pgn;
+        int threads;
+    };
+    Case cases[] = { { "file", pgnFile, 3 }, { "tricky games", trickyName, 16 } };
+    bool ok = writeFile( trickyName, TRICKY_PGN );
+    for ( int c = 0; ok && c < 2; c++ ) {
+        bool built = PgnIndex::build( cases[ c ].pgn, oneName, 1 ) &&
+            PgnIndex::build( cases[ c ].pgn, manyName, cases[ c ].threads );
+        string one = readFile( oneName );
+        bool same = built && !one.empty() && one == readFile( manyName );
+        printf( "%s  %-24s 1 and %d threads build %s indexes\n", same ? "ok  " : "FAIL",
+                cases[ c ].name, cases[ c ].threads, same ? "the same" : "different" );
+        failures += !same;
+
+        int problems = built ? checkAgainst( cases[ c ].pgn, manyName ) : 1;
+        printf( "%s  %-24s %d problems\n", problems ? "FAIL" : "ok  ", cases[ c ].name,
+                problems );
+        failures += problems > 0;
+    }
+
+    // Cut short, or with a byte of the header changed, it's not an
+    // index any more.
+    PgnIndex index;
+    string contents = readFile( manyName );
+    ok = ok && !contents.empty() && writeFile( oneName, contents.substr( 0, contents.size() - 1 ) );
+    bool rejected = ok && !index.open( oneName );
+    contents[ 20 ]++;
+    ok = ok && writeFile( oneName, contents );
+    rejected = rejected && ok && !index.open( oneName );
+    printf( "%s  %-24s\n", rejected ? "ok  " : "FAIL", "damaged indexes" );
+    failures += !rejected;
+
+    unlink( oneName );
+    unlink( manyName );
+    unlink( trickyName );
+    printf( "%s\n", failures ? "FAILED" : "passed" );
+    return failures ? 1 : 0;
+}
+
+// Build an index of the named file on each number of threads, then time
+// looking up positions and games in it.
+static int runBench( char const *pgnFile ) {
+    char indexName[] = "/tmp/pgnindexXXXXXX";
+    int fd = mkstemp( indexName );
+    if ( fd < 0 ) {
+        perror( indexName );
+        return 1;
+    }
+    close( fd );
+
+    PgnIndex index;
+    int maxThreads = max( 1u, thread::hardware_concurrency() );
+    printf( "%u hardware threads\n", thread::hardware_concurrency() );
+    printf( "threads     seconds      games/s     MB/s  speedup\n" );
+    double baseSeconds = 0;
+    for ( int threads = 1; ; threads = min( threads * 2, maxThreads ) ) {
+        double start = now();
+        if ( !PgnIndex::build( pgnFile, indexName, threads ) || !index.open( indexName ) ) {
+            unlink( indexName );
+            return 1;
+        }
+        double seconds = now() - start;
+        if ( threads == 1 )
+            baseSeconds = seconds;
+        printf( "%7d %11.3f %12.0f %8.1f %7.2fx\n", threads, seconds, index.games() / seconds,
+                index.pgnSize() / 1048576.0 / seconds, baseSeconds / seconds );
+        if ( threads == maxThreads )
+            break;
+    }
+    struct stat info;
+    printf( "%d games, %lu positions, index %.1f MB\n", index.games(),
+            (unsigned long) index.positions(),
+            stat( indexName, &info ) == 0 ? info.st_size / 1048576.0 : 0.0 );
+
+    // Keys of positions from the games, and made up ones that aren't in
+    // the index, looked up in turn.
+    vector< uint64_t > keys;
+    PgnReader reader;
+    PgnGame game;
+    reader.open( pgnFile );
+    for ( int g = 0; keys.size() < 200000 && reader.next( game ); g++ ) {
+        Position pos( game.start );
+        for ( int i = 0; i < int( game.moves.size() ); i++ ) {
+            Position::Undo undo;
+            pos.makeMove( game.moves[ i ], undo );
+            keys.push_back( pos.hashKey() );
+            keys.push_back( pos.hashKey() * 0x9e3779b97f4a7c15ull + g );
+        }
+    }
+    double start = now();
+    long found = 0;
+    for ( int pass = 0; pass < 5; pass++ )
+        for ( size_t i = 0; i < keys.size(); i++ )
+            found += index.find( keys[ i ] ).game >= 0;
+    double seconds = now() - start;
+    printf( "find:     %.0f ns per lookup, %ld of %lu found\n",
+            seconds * 1e9 / ( 5 * keys.size() ), found / 5, (unsigned long) keys.size() );
+
+    start = now();
+    long plies = 0;
+    for ( int g = 0; g < index.games(); g++ ) {
+        index.game( g, game );
+        plies += game.moves.size();
+    }
+    seconds = now() - start;
+    printf( "games:    %.0f games/s, %.0f plies/s loaded from the index\n",
+            index.games() / seconds, plies / seconds );
+    unlink( indexName );
+    return 0;
+}
+
+int main( int argc, char **argv ) {
+    // Build the move tables up front, so they aren't timed.
+    Position warmUp;
+
+    if ( argc == 3 && strcmp( argv[ 1 ], "-check" ) == 0 )
+        return runCheck( argv[ 2 ] );
+    if ( argc == 3 && strcmp( argv[ 1 ], "-bench" ) == 0 )
+        return runBench( argv[ 2 ] );
+
+    int threads = max( 1u, thread::hardware_concurrency() );
+    int first = 1;
+    if ( argc == 5 && strcmp( argv[ 1 ], "-threads" ) == 0 ) {
+        threads = max( 1, atoi( argv[ 2 ] ) );
+        first = 3;
+    }
+    if ( argc == first + 2 && argv[ first ][ 0 ] != '-' ) {
+        double start = now();
+        PgnIndex index;
+        if ( !PgnIndex::build( argv[ first ], argv[ first + 1 ], threads ) ||
+             !index.open( argv[ first + 1 ] ) )
+            return 1;
+        double seconds = now() - start;
+        printf( "%s: %d games, %lu positions, %.3f s on %d threads, %.1f MB/s\n",
+                argv[ first + 1 ], index.games(), (unsigned long) index.positions(), seconds,
+                threads, index.pgnSize() / 1048576.0 / seconds );
+        return 0;
+    }
+
+    fprintf( stderr, "usage: %s [-threads n] file.pgn file.idx | -bench file.pgn | "
+             "-check file.pgn\n", argv[ 0 ] );
+    return 1;
+}
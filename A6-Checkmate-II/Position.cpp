@@ -0,0 +1,776 @@
+//
+// Position.cpp
+//
+// Legal move generation, and making and unmaking moves, over bitboards.
+//
+
+#include "Position.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+using namespace std;
+
+char const *const Position :: START_FEN =
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+// Letters for the pieces, white's in upper case, in Piece order.
+static char const PIECE_LETTERS[] = "PNBRQKpnbrqk";
+
+// Squares the kings and rooks castle from and to, by castling right
+// (white kingside, white queenside, black kingside, black queenside).
+static const int CASTLE_KING_FROM[ 4 ] = { 4, 4, 60, 60 };
+static const int CASTLE_KING_TO[ 4 ] = { 6, 2, 62, 58 };
+static const int CASTLE_ROOK_FROM[ 4 ] = { 7, 0, 63, 56 };
+static const int CASTLE_ROOK_TO[ 4 ] = { 5, 3, 61, 59 };
+
+// Return the castling rights that survive a move from or to sq: moving
+// a king or rook, or capturing a rook, gives up the rights that use it.
+static int castlingKept( int sq ) {
+    switch ( sq ) {
+    case 0:  return ~Position::WHITE_QUEENSIDE;
+    case 4:  return ~( Position::WHITE_KINGSIDE | Position::WHITE_QUEENSIDE );
+    case 7:  return ~Position::WHITE_KINGSIDE;
+    case 56: return ~Position::BLACK_QUEENSIDE;
+    case 60: return ~( Position::BLACK_KINGSIDE | Position::BLACK_QUEENSIDE );
+    case 63: return ~Position::BLACK_KINGSIDE;
+    default: return ~0;
+    }
+}
+
+// Zobrist keys for each piece of each color on each square, for each
+// set of castling rights, for each en passant file, and for black to
+// move.
+static uint64_t pieceKeys[ 2 ][ 6 ][ 64 ];
+static uint64_t castlingKeys[ 16 ];
+static uint64_t enPassantKeys[ 8 ];
+static uint64_t sideKey;
+
+// Fill in the Zobrist keys, from a fixed seed so they're the same every
+// run.
+static void buildKeys() {
+    // splitmix64, which gives well-mixed values from a counter.
+    uint64_t state = 0x2545f4914f6cdd1dull;
+    auto next = [ &state ]() {
+        uint64_t z = ( state += 0x9e3779b97f4a7c15ull );
+        z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ull;
+        z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebull;
+        return z ^ ( z >> 31 );
+    };
+
+    for ( int color = 0; color < 2; color++ )
+        for ( int piece = 0; piece < 6; piece++ )
+            for ( int sq = 0; sq < 64; sq++ )
+                pieceKeys[ color ][ piece ][ sq ] = next();
+
+    // Rights combine, so each set's key is the xor of its single rights'
+    // keys.
+    uint64_t rightKeys[ 4 ];
+    for ( int right = 0; right < 4; right++ )
+        rightKeys[ right ] = next();
+    for ( int rights = 0; rights < 16; rights++ ) {
+        castlingKeys[ rights ] = 0;
+        for ( int right = 0; right < 4; right++ )
+            if ( rights & ( 1 << right ) )
+                castlingKeys[ rights ] ^= rightKeys[ right ];
+    }
+
+    for ( int file = 0; file < 8; file++ )
+        enPassantKeys[ file ] = next();
+    sideKey = next();
+}
+
+string Move :: name() const {
+    string result;
+    result += char( 'a' + from() % 8 );
+    result += char( '1' + from() / 8 );
+    result += char( 'a' + to() % 8 );
+    result += char( '1' + to() / 8 );
+    if ( kind() == PROMOTION )
+        result += PIECE_LETTERS[ 6 + promotion() ];
+    return result;
+}
+
+Position :: Position() {
+    initBitboards();
+    static once_flag once;
+    call_once( once, buildKeys );
+    memset( byColor, 0, sizeof( byColor ) );
+    memset( byType, 0, sizeof( byType ) );
+    memset( board, NO_PIECE, sizeof( board ) );
+    side = WHITE;
+    castling = halfmoves = 0;
+    enPassant = -1;
+    fullmoves = 1;
+    key = 0;
+    setFen( START_FEN );
+}
+
+bool Position :: setFen( char const *fen ) {
+    // Build the new position on the side, so a bad string leaves this
+    // one alone.
+    Position p( *this );
+    memset( p.byColor, 0, sizeof( p.byColor ) );
+    memset( p.byType, 0, sizeof( p.byType ) );
+    memset( p.board, NO_PIECE, sizeof( p.board ) );
+
+    // Ranks run from 8 down to 1, each from the a file to the h file.
+    char const *c = fen;
+    int rank = 7, file = 0;
+    for ( ; *c && *c != ' '; c++ ) {
+        if ( *c == '/' ) {
+            if ( file != 8 || rank == 0 )
+                return false;
+            rank--;
+            file = 0;
+        } else if ( *c >= '1' && *c <= '8' ) {
+            file += *c - '0';
+            if ( file > 8 )
+                return false;
+        } else {
+            char const *letter = strchr( PIECE_LETTERS, *c );
+            if ( !letter || file == 8 )
+                return false;
+            int index = letter - PIECE_LETTERS;
+            p.put( index / 6, index % 6, rank * 8 + file );
+            file++;
+        }
+    }
+    if ( rank != 0 || file != 8 || squareCount( p.pieces( WHITE, KING ) ) != 1 ||
+         squareCount( p.pieces( BLACK, KING ) ) != 1 )
+        return false;
+
+    // Side to move.
+    while ( *c == ' ' )
+        c++;
+    if ( *c != 'w' && *c != 'b' )
+        return false;
+    p.side = *c++ == 'w' ? WHITE : BLACK;
+
+    // Castling rights, keeping only those the pieces are still there for.
+    while ( *c == ' ' )
+        c++;
+    p.castling = 0;
+    if ( *c == '-' ) {
+        c++;
+    } else {
+        for ( ; *c && *c != ' '; c++ ) {
+            char const *flags = "KQkq";
+            char const *flag = strchr( flags, *c );
+            if ( !flag )
+                return false;
+            p.castling |= 1 << ( flag - flags );
+        }
+    }
+    for ( int right = 0; right < 4; right++ ) {
+        int color = right / 2;
+        if ( !( p.pieces( color, KING ) & squareBit( CASTLE_KING_FROM[ right ] ) ) ||
+             !( p.pieces( color, ROOK ) & squareBit( CASTLE_ROOK_FROM[ right ] ) ) )
+            p.castling &= ~( 1 << right );
+    }
+
+    // En passant square, kept only if a pawn could actually capture
+    // there, so positions that play the same compare the same.
+    while ( *c == ' ' )
+        c++;
+    p.enPassant = -1;
+    if ( *c == '-' ) {
+        c++;
+    } else {
+        if ( c[ 0 ] < 'a' || c[ 0 ] > 'h' || ( c[ 1 ] != '3' && c[ 1 ] != '6' ) )
+            return false;
+        int sq = ( c[ 1 ] - '1' ) * 8 + c[ 0 ] - 'a';
+        c += 2;
+        if ( p.pawnAttacksTo( sq ) )
+            p.enPassant = sq;
+    }
+
+    // The move counters are optional.
+    p.halfmoves = 0;
+    p.fullmoves = 1;
+    char *end;
+    long n = strtol( c, &end, 10 );
+    if ( end != c ) {
+        p.halfmoves = n;
+        c = end;
+        n = strtol( c, &end, 10 );
+        if ( end != c )
+            p.fullmoves = n;
+    }
+
+    // Pawns can't stand on the first or last rank, and the side that
+    // just moved can't have left its king in check; move generation
+    // counts on both.
+    Bitboard backRanks = Bitboard( 0xff ) | Bitboard( 0xff ) << 56;
+    if ( ( p.byType[ PAWN ] & backRanks ) ||
+         ( p.attackersTo( p.kingSquare( !p.side ), p.occupied() ) & p.byColor[ p.side ] ) )
+        return false;
+
+    p.key = p.computeKey();
+    *this = p;
+    return true;
+}
+
+string Position :: fen() const {
+    string result;
+    for ( int rank = 7; rank >= 0; rank-- ) {
+        int empty = 0;
+        for ( int file = 0; file < 8; file++ ) {
+            int sq = rank * 8 + file;
+            if ( board[ sq ] == NO_PIECE ) {
+                empty++;
+                continue;
+            }
+            if ( empty )
+                result += char( '0' + empty );
+            empty = 0;
+            result += PIECE_LETTERS[ colorOn( sq ) * 6 + board[ sq ] ];
+        }
+        if ( empty )
+            result += char( '0' + empty );
+        if ( rank )
+            result += '/';
+    }
+
+    result += side == WHITE ? " w " : " b ";
+    for ( int right = 0; right < 4; right++ )
+        if ( castling & 1 << right )
+            result += "KQkq"[ right ];
+    if ( !castling )
+        result += '-';
+    result += ' ';
+    if ( enPassant >= 0 ) {
+        result += char( 'a' + enPassant % 8 );
+        result += char( '1' + enPassant / 8 );
+    } else {
+        result += '-';
+    }
+    return result + ' ' + to_string( halfmoves ) + ' ' + to_string( fullmoves );
+}
+
+uint64_t Position :: computeKey() const {
+    uint64_t result = castlingKeys[ castling ];
+    for ( int color = 0; color < 2; color++ )
+        for ( int piece = 0; piece < 6; piece++ ) {
+            Bitboard b = pieces( color, piece );
+            while ( b )
+                result ^= pieceKeys[ color ][ piece ][ popSquare( b ) ];
+        }
+    if ( enPassant >= 0 )
+        result ^= enPassantKeys[ enPassant % 8 ];
+    if ( side == BLACK )
+        result ^= sideKey;
+    return result;
+}
+
+void Position :: put( int color, int piece, int sq ) {
+    byColor[ color ] |= squareBit( sq );
+    byType[ piece ] |= squareBit( sq );
+    board[ sq ] = piece;
+    key ^= pieceKeys[ color ][ piece ][ sq ];
+}
+
+void Position :: remove( int sq ) {
+    Bitboard bit = squareBit( sq );
+    key ^= pieceKeys[ colorOn( sq ) ][ board[ sq ] ][ sq ];
+    byColor[ WHITE ] &= ~bit;
+    byColor[ BLACK ] &= ~bit;
+    byType[ board[ sq ] ] &= ~bit;
+    board[ sq ] = NO_PIECE;
+}
+
+void Position :: relocate( int from, int to ) {
+    Bitboard both = squareBit( from ) | squareBit( to );
+    uint64_t const *keys = pieceKeys[ colorOn( from ) ][ board[ from ] ];
+    key ^= keys[ from ] ^ keys[ to ];
+    byColor[ colorOn( from ) ] ^= both;
+    byType[ board[ from ] ] ^= both;
+    board[ to ] = board[ from ];
+    board[ from ] = NO_PIECE;
+}
+
+Bitboard Position :: attackersTo( int sq, Bitboard occupied ) const {
+    return ( pawnAttacks( BLACK, sq ) & pieces( WHITE, PAWN ) ) |
+        ( pawnAttacks( WHITE, sq ) & pieces( BLACK, PAWN ) ) |
+        ( knightAttacks( sq ) & byType[ KNIGHT ] ) |
+        ( kingAttacks( sq ) & byType[ KING ] ) |
+        ( rookAttacks( sq, occupied ) & ( byType[ ROOK ] | byType[ QUEEN ] ) ) |
+        ( bishopAttacks( sq, occupied ) & ( byType[ BISHOP ] | byType[ QUEEN ] ) );
+}
+
+bool Position :: inCheck() const {
+    return attackersTo( kingSquare( side ), occupied() ) & byColor[ !side ];
+}
+
+Bitboard Position :: pawnAttacksTo( int sq ) const {
+    return pawnAttacks( !side, sq ) & pieces( side, PAWN );
+}
+
+Bitboard Position :: pinnedPieces() const {
+    // Look out from the king as if it were each kind of slider, through
+    // nothing, for enemy sliders; any with exactly one piece between
+    // them and the king pin it, if it's ours.
+    int king = kingSquare( side );
+    Bitboard them = byColor[ !side ];
+    Bitboard snipers =
+        ( rookAttacks( king, 0 ) & them & ( byType[ ROOK ] | byType[ QUEEN ] ) ) |
+        ( bishopAttacks( king, 0 ) & them & ( byType[ BISHOP ] | byType[ QUEEN ] ) );
+    Bitboard pinned = 0, occ = occupied();
+    while ( snipers ) {
+        Bitboard between = betweenSquares( king, popSquare( snipers ) ) & occ;
+        if ( between && !( between & ( between - 1 ) ) )
+            pinned |= between & byColor[ side ];
+    }
+    return pinned;
+}
+
+bool Position :: enPassantLegal( int from ) const {
+    // The capture takes two pieces off the capturing pawn's rank at
+    // once, which can expose the king in ways pins don't catch, so play
+    // it out on the occupancy and look.
+    int captured = enPassant + ( side == WHITE ? -8 : 8 );
+    Bitboard occ = ( occupied() ^ squareBit( from ) ^ squareBit( captured ) ) |
+        squareBit( enPassant );
+    return !( attackersTo( kingSquare( side ), occ ) & byColor[ !side ] &
+              ~squareBit( captured ) );
+}
+
+int Position :: legalMoves( Move *moves ) const {
+    Move *out = moves;
+    int us = side, them = !side;
+    Bitboard own = byColor[ us ], enemy = byColor[ them ], occ = own | enemy;
+    int king = kingSquare( us );
+    Bitboard checkers = attackersTo( king, occ ) & enemy;
+
+    // The king can go anywhere it isn't attacked, looking past its own
+    // square, since it can't block a slider by stepping back along its
+    // line.
+    Bitboard targets = kingAttacks( king ) & ~own;
+    while ( targets ) {
+        int to = popSquare( targets );
+        if ( !( attackersTo( to, occ ^ squareBit( king ) ) & enemy ) )
+            *out++ = Move( king, to );
+    }
+
+    // Nothing else helps against a double check.
+    if ( checkers & ( checkers - 1 ) )
+        return out - moves;
+
+    // Out of check, anything goes; in check, other pieces have to take
+    // the checker or get in its way.
+    Bitboard allowed = ~Bitboard( 0 );
+    if ( checkers )
+        allowed = betweenSquares( king, firstSquare( checkers ) ) | checkers;
+    Bitboard pinned = pinnedPieces();
+
+    // Pinned pieces can only move along the line of the pin, and a
+    // pinned knight never can.
+    Bitboard movers = own & ~byType[ PAWN ] & ~byType[ KING ] &
+        ~( byType[ KNIGHT ] & pinned );
+    while ( movers ) {
+        int from = popSquare( movers );
+        switch ( board[ from ] ) {
+        case KNIGHT: targets = knightAttacks( from ); break;
+        case BISHOP: targets = bishopAttacks( from, occ ); break;
+        case ROOK:   targets = rookAttacks( from, occ ); break;
+        default:     targets = queenAttacks( from, occ ); break;
+        }
+        targets &= ~own & allowed;
+        if ( pinned & squareBit( from ) )
+            targets &= lineThrough( king, from );
+        while ( targets )
+            *out++ = Move( from, popSquare( targets ) );
+    }
+
+    // Pawns push forward and capture diagonally, promoting on the last
+    // rank.
+    int up = us == WHITE ? 8 : -8;
+    int startRank = us == WHITE ? 1 : 6, lastRank = us == WHITE ? 7 : 0;
+    Bitboard pawns = pieces( us, PAWN );
+    while ( pawns ) {
+        int from = popSquare( pawns );
+        Bitboard mask = allowed;
+        if ( pinned & squareBit( from ) )
+            mask &= lineThrough( king, from );
+
+        targets = pawnAttacks( us, from ) & enemy;
+        int ahead = from + up;
+        if ( !( occ & squareBit( ahead ) ) ) {
+            targets |= squareBit( ahead );
+            if ( from / 8 == startRank && !( occ & squareBit( ahead + up ) ) )
+                targets |= squareBit( ahead + up );
+        }
+        targets &= mask;
+        while ( targets ) {
+            int to = popSquare( targets );
+            if ( to / 8 == lastRank ) {
+                for ( int piece = QUEEN; piece >= KNIGHT; piece-- )
+                    *out++ = Move( from, to, Move::PROMOTION, piece );
+            } else {
+                *out++ = Move( from, to );
+            }
+        }
+
+        if ( enPassant >= 0 && ( pawnAttacks( us, from ) & squareBit( enPassant ) ) &&
+             enPassantLegal( from ) )
+            *out++ = Move( from, enPassant, Move::EN_PASSANT );
+    }
+
+    // Castling needs the squares between king and rook empty, and the
+    // king not to start in, pass through or land on an attacked square.
+    if ( !checkers ) {
+        for ( int right = us * 2; right < us * 2 + 2; right++ ) {
+            if ( !( castling & ( 1 << right ) ) )
+                continue;
+            int kingTo = CASTLE_KING_TO[ right ];
+            if ( betweenSquares( king, CASTLE_ROOK_FROM[ right ] ) & occ )
+                continue;
+            Bitboard path = betweenSquares( king, kingTo ) | squareBit( kingTo );
+            bool safe = true;
+            while ( safe && path )
+                safe = !( attackersTo( popSquare( path ), occ ) & enemy );
+            if ( safe )
+                *out++ = Move( king, kingTo, Move::CASTLE );
+        }
+    }
+    return out - moves;
+}
+
+Move Position :: findMove( int from, int to, int promotion ) const {
+    Move moves[ MAX_MOVES ];
+    int count = legalMoves( moves );
+    for ( int i = 0; i < count; i++ )
+        if ( moves[ i ].from() == from && moves[ i ].to() == to &&
+             ( moves[ i ].kind() != Move::PROMOTION || moves[ i ].promotion() == promotion ) )
+            return moves[ i ];
+    return Move();
+}
+
+bool Position :: isLegalMove( Move m ) const {
+    int from = m.from(), to = m.to();
+    Bitboard own = byColor[ side ], occ = occupied();
+    if ( !( own & squareBit( from ) ) || ( own & squareBit( to ) ) )
+        return false;
+
+    // Castling and en passant are rare enough to look up the slow way.
+    if ( m.kind() == Move::CASTLE || m.kind() == Move::EN_PASSANT )
+        return findMove( from, to ) == m;
+
+    // Only a pawn reaching the last rank promotes, and other moves
+    // don't name a piece.
+    int piece = board[ from ], up = side == WHITE ? 8 : -8;
+    bool lastRank = to / 8 == ( side == WHITE ? 7 : 0 );
+    if ( m.kind() == Move::PROMOTION ? piece != PAWN || !lastRank :
+         ( piece == PAWN && lastRank ) || m.promotion() != KNIGHT )
+        return false;
+
+    Bitboard reach;
+    switch ( piece ) {
+    case PAWN:
+        reach = pawnAttacks( side, from ) & byColor[ !side ];
+        if ( from + up >= 0 && from + up < 64 && board[ from + up ] == NO_PIECE ) {
+            reach |= squareBit( from + up );
+            if ( from / 8 == ( side == WHITE ? 1 : 6 ) && board[ from + 2 * up ] == NO_PIECE )
+                reach |= squareBit( from + 2 * up );
+        }
+        break;
+    case KNIGHT: reach = knightAttacks( from ); break;
+    case BISHOP: reach = bishopAttacks( from, occ ); break;
+    case ROOK:   reach = rookAttacks( from, occ ); break;
+    case QUEEN:  reach = queenAttacks( from, occ ); break;
+    default:     reach = kingAttacks( from ); break;
+    }
+    return ( reach & squareBit( to ) ) && isLegal( m );
+}
+
+// Return the index of c in letters, or -1 if it isn't there.
+static int letterIndex( char const *letters, char c ) {
+    char const *found = c ? strchr( letters, c ) : NULL;
+    return found ? found - letters : -1;
+}
+
+Move Position :: parseSan( char const *text, int length ) const {
+    // Drop check marks and annotations from the end.
+    while ( length > 0 && letterIndex( "+#!?", text[ length - 1 ] ) >= 0 )
+        length--;
+
+    // Castling names the side, not the squares.
+    if ( length >= 3 && ( text[ 0 ] == 'O' || text[ 0 ] == '0' ) ) {
+        bool queenside;
+        if ( length == 3 && text[ 1 ] == '-' && text[ 2 ] == text[ 0 ] )
+            queenside = false;
+        else if ( length == 5 && text[ 1 ] == '-' && text[ 2 ] == text[ 0 ] &&
+                  text[ 3 ] == '-' && text[ 4 ] == text[ 0 ] )
+            queenside = true;
+        else
+            return Move();
+        Move moves[ MAX_MOVES ];
+        int count = legalMoves( moves );
+        for ( int i = 0; i < count; i++ )
+            if ( moves[ i ].kind() == Move::CASTLE &&
+                 ( moves[ i ].to() < moves[ i ].from() ) == queenside )
+                return moves[ i ];
+        return Move();
+    }
+
+    // Piece letter, or none for a pawn.
+    int piece = PAWN;
+    if ( length > 0 && letterIndex( "NBRQK", text[ 0 ] ) >= 0 ) {
+        piece = KNIGHT + letterIndex( "NBRQK", text[ 0 ] );
+        text++;
+        length--;
+    }
+
+    // Promotion on the end, usually after an '='.
+    int promotion = NO_PIECE;
+    if ( piece == PAWN && length > 0 && letterIndex( "NBRQ", text[ length - 1 ] ) >= 0 ) {
+        promotion = KNIGHT + letterIndex( "NBRQ", text[ length - 1 ] );
+        length -= length > 1 && text[ length - 2 ] == '=' ? 2 : 1;
+    }
+
+    // Destination square last, and whatever's left says which piece
+    // moves: a file, a rank or both, and maybe an x for a capture.
+    if ( length < 2 || text[ length - 2 ] < 'a' || text[ length - 2 ] > 'h' ||
+         text[ length - 1 ] < '1' || text[ length - 1 ] > '8' )
+        return Move();
+    int to = ( text[ length - 1 ] - '1' ) * 8 + text[ length - 2 ] - 'a';
+    int file = -1, rank = -1;
+    for ( int i = 0; i < length - 2; i++ ) {
+        if ( text[ i ] >= 'a' && text[ i ] <= 'h' )
+            file = text[ i ] - 'a';
+        else if ( text[ i ] >= '1' && text[ i ] <= '8' )
+            rank = text[ i ] - '1';
+        else if ( text[ i ] != 'x' && text[ i ] != ':' )
+            return Move();
+    }
+
+    // Rather than generate every move, look back from the destination
+    // for the pieces of the kind that could have come from there.
+    Bitboard own = byColor[ side ], occ = occupied(), from = 0;
+    if ( own & squareBit( to ) )
+        return Move();
+    int kind = Move::NORMAL, up = side == WHITE ? 8 : -8;
+    switch ( piece ) {
+    case PAWN:
+        // Pawns capture from the file given, and only then; otherwise
+        // they push onto an empty square.
+        if ( file >= 0 && file != to % 8 ) {
+            if ( board[ to ] == NO_PIECE && to != enPassant )
+                return Move();
+            from = pawnAttacks( !side, to );
+            kind = to == enPassant ? Move::EN_PASSANT : Move::NORMAL;
+        } else if ( board[ to ] == NO_PIECE && to - up >= 0 && to - up < 64 ) {
+            // A push, of one square or two from the starting rank.
+            from = squareBit( to - up );
+            if ( board[ to - up ] == NO_PIECE && to / 8 == ( side == WHITE ? 3 : 4 ) )
+                from = squareBit( to - 2 * up );
+        }
+        if ( to / 8 == ( side == WHITE ? 7 : 0 ) )
+            kind = Move::PROMOTION;
+        break;
+    case KNIGHT: from = knightAttacks( to ); break;
+    case BISHOP: from = bishopAttacks( to, occ ); break;
+    case ROOK:   from = rookAttacks( to, occ ); break;
+    case QUEEN:  from = queenAttacks( to, occ ); break;
+    default:     from = kingAttacks( to ); break;
+    }
+    from &= pieces( side, piece );
+    if ( ( kind == Move::PROMOTION ) != ( promotion != NO_PIECE ) )
+        return Move();
+
+    // It has to pick out exactly one legal move.
+    Move found;
+    while ( from ) {
+        int sq = popSquare( from );
+        Move m( sq, to, kind, kind == Move::PROMOTION ? promotion : KNIGHT );
+        if ( ( file >= 0 && sq % 8 != file ) || ( rank >= 0 && sq / 8 != rank ) ||
+             !isLegal( m ) )
+            continue;
+        if ( !found.isNull() )
+            return Move();
+        found = m;
+    }
+    return found;
+}
+
+bool Position :: isLegal( Move m ) const {
+    int from = m.from(), to = m.to(), king = kingSquare( side );
+    Bitboard occ = occupied(), enemy = byColor[ !side ];
+    if ( m.kind() == Move::EN_PASSANT )
+        return enPassantLegal( from );
+    if ( from == king )
+        return !( attackersTo( to, occ ^ squareBit( king ) ) & enemy );
+
+    // In check, the move has to take the only checker or block it, and
+    // a pinned piece has to stay on the line of the pin.
+    Bitboard checkers = attackersTo( king, occ ) & enemy;
+    if ( checkers && ( ( checkers & ( checkers - 1 ) ) ||
+                       !( ( betweenSquares( king, firstSquare( checkers ) ) | checkers ) &
+                          squareBit( to ) ) ) )
+        return false;
+    return !( pinnedPieces() & squareBit( from ) ) || ( lineThrough( king, from ) &
+                                                         squareBit( to ) );
+}
+
+string Position :: san( Move m ) const {
+    int from = m.from(), to = m.to(), piece = board[ from ];
+    string result;
+    if ( m.kind() == Move::CASTLE ) {
+        result = to > from ? "O-O" : "O-O-O";
+    } else {
+        bool capture = board[ to ] != NO_PIECE || m.kind() == Move::EN_PASSANT;
+        if ( piece == PAWN ) {
+            if ( capture )
+                result += char( 'a' + from % 8 );
+        } else {
+            result += PIECE_LETTERS[ piece ];
+
+            // Name the file, the rank, or both, if another piece of the
+            // same kind could go to the same square.
+            Move moves[ MAX_MOVES ];
+            int count = legalMoves( moves );
+            bool rivals = false, sameFile = false, sameRank = false;
+            for ( int i = 0; i < count; i++ )
+                if ( moves[ i ].to() == to && moves[ i ].from() != from &&
+                     board[ moves[ i ].from() ] == piece ) {
+                    rivals = true;
+                    sameFile |= moves[ i ].from() % 8 == from % 8;
+                    sameRank |= moves[ i ].from() / 8 == from / 8;
+                }
+            if ( rivals && ( !sameFile || sameRank ) )
+                result += char( 'a' + from % 8 );
+            if ( rivals && sameFile )
+                result += char( '1' + from / 8 );
+        }
+        if ( capture )
+            result += 'x';
+        result += char( 'a' + to % 8 );
+        result += char( '1' + to / 8 );
+        if ( m.kind() == Move::PROMOTION ) {
+            result += '=';
+            result += PIECE_LETTERS[ m.promotion() ];
+        }
+    }
+
+    // Mark checks, and mates.
+    Position after( *this );
+    Undo undo;
+    after.makeMove( m, undo );
+    if ( after.inCheck() ) {
+        Move replies[ MAX_MOVES ];
+        result += after.legalMoves( replies ) ? '+' : '#';
+    }
+    return result;
+}
+
+void Position :: makeMove( Move m, Undo &undo ) {
+    int from = m.from(), to = m.to();
+    undo.captured = board[ to ];
+    undo.castling = castling;
+    undo.enPassant = enPassant;
+    undo.halfmoves = halfmoves;
+    undo.key = key;
+
+    bool pawnMove = board[ from ] == PAWN;
+    switch ( m.kind() ) {
+    case Move::EN_PASSANT:
+        undo.captured = PAWN;
+        remove( to + ( side == WHITE ? -8 : 8 ) );
+        relocate( from, to );
+        break;
+    case Move::CASTLE: {
+        int right = side * 2 + ( to < from );
+        relocate( from, to );
+        relocate( CASTLE_ROOK_FROM[ right ], CASTLE_ROOK_TO[ right ] );
+        break;
+    }
+    case Move::PROMOTION:
+        if ( undo.captured != NO_PIECE )
+            remove( to );
+        remove( from );
+        put( side, m.promotion(), to );
+        break;
+    default:
+        if ( undo.captured != NO_PIECE )
+            remove( to );
+        relocate( from, to );
+        break;
+    }
+
+    key ^= castlingKeys[ castling ];
+    castling &= castlingKept( from ) & castlingKept( to );
+    key ^= castlingKeys[ castling ] ^ sideKey;
+    if ( enPassant >= 0 )
+        key ^= enPassantKeys[ enPassant % 8 ];
+    halfmoves = pawnMove || undo.captured != NO_PIECE ? 0 : halfmoves + 1;
+    if ( side == BLACK )
+        fullmoves++;
+    side = !side;
+
+    // A double push leaves an en passant square behind, if there's a
+    // pawn there to use it.
+    enPassant = -1;
+    if ( pawnMove && ( to - from == 16 || from - to == 16 ) &&
+         pawnAttacksTo( ( from + to ) / 2 ) ) {
+        enPassant = ( from + to ) / 2;
+        key ^= enPassantKeys[ enPassant % 8 ];
+    }
+}
+
+void Position :: unmakeMove( Move m, Undo const &undo ) {
+    int from = m.from(), to = m.to();
+    side = !side;
+    if ( side == BLACK )
+        fullmoves--;
+    castling = undo.castling;
+    enPassant = undo.enPassant;
+    halfmoves = undo.halfmoves;
+
+    switch ( m.kind() ) {
+    case Move::EN_PASSANT:
+        relocate( to, from );
+        put( !side, PAWN, to + ( side == WHITE ? -8 : 8 ) );
+        break;
+    case Move::CASTLE: {
+        int right = side * 2 + ( to < from );
+        relocate( to, from );
+        relocate( CASTLE_ROOK_TO[ right ], CASTLE_ROOK_FROM[ right ] );
+        break;
+    }
+    case Move::PROMOTION:
+        remove( to );
+        put( side, PAWN, from );
+        if ( undo.captured != NO_PIECE )
+            put( !side, undo.captured, to );
+        break;
+    default:
+        relocate( to, from );
+        if ( undo.captured != NO_PIECE )
+            put( !side, undo.captured, to );
+        break;
+    }
+
+    // Putting the pieces back xored the key back and forth; the saved
+    // one is where it ends up anyway.
+    key = undo.key;
+}
+
+uint64_t Position :: perft( int depth ) {
+    Move moves[ MAX_MOVES ];
+    int count = legalMoves( moves );
+
+    // The moves are legal, so at the last ply they're the count.
+    if ( depth <= 1 )
+        return depth == 1 ? count : 1;
+
+    uint64_t nodes = 0;
+    Undo undo;
+    for ( int i = 0; i < count; i++ ) {
+        makeMove( moves[ i ], undo );
+        nodes += perft( depth - 1 );
+        unmakeMove( moves[ i ], undo );
+    }
+    return nodes;
+}
@@ -0,0 +1,280 @@
+#ifndef __POSITION_H__
+#define __POSITION_H__
+
+#include "Bitboard.h"
+
+#include <string>
+
+//
+// The rules of chess, kept apart from how the board is drawn.  A
+// Position holds a set of squares for each color and each type of
+// piece, plus whose move it is, castling rights and the en passant
+// square, and generates the legal moves from it.  Squares are numbered
+// as in Bitboard.h.
+//
+// Each position also carries a Zobrist key: a random 64-bit number for
+// every (color, piece, square), castling right, en passant file and side
+// to move, xored together for the ones that apply.  Making a move only
+// xors in what changed, so the key is always at hand for looking the
+// position up in a hash table.
+//
+
+/**
+   A move, packed into 16 bits: the from and to squares, what kind of
+   move it is, and for promotions, the piece the pawn becomes.  Castling
+   is a king move of two squares.
+*/
+class Move {
+public:
+    /** Kinds of moves that need more than moving one piece. */
+    enum Kind { NORMAL, PROMOTION, EN_PASSANT, CASTLE };
+
+    /** Make the null move, which is never legal. */
+    Move() : bits( 0 ) {
+    }
+
+    /** Make a move of the given kind.  promotion is a Position::Piece
+        from KNIGHT to QUEEN, and only matters for promotions. */
+    Move( int from, int to, int kind = NORMAL, int promotion = 1 )
+        : bits( from | to << 6 | kind << 12 | ( promotion - 1 ) << 14 ) {
+    }
+
+    int from() const {
+        return bits & 63;
+    }
+
+    int to() const {
+        return bits >> 6 & 63;
+    }
+
+    int kind() const {
+        return bits >> 12 & 3;
+    }
+
+    /** Return the piece a promoting pawn becomes. */
+    int promotion() const {
+        return ( bits >> 14 ) + 1;
+    }
+
+    /** Return true for the null move. */
+    bool isNull() const {
+        return bits == 0;
+    }
+
+    bool operator==( Move const &other ) const {
+        return bits == other.bits;
+    }
+
+    bool operator!=( Move const &other ) const {
+        return bits != other.bits;
+    }
+
+    /** Return the move in coordinate notation, e.g. e2e4 or e7e8q. */
+    std::string name() const;
+
+    /** Return the move's 16 bits, for storing it. */
+    uint16_t raw() const {
+        return bits;
+    }
+
+    /** Make the move whose raw() bits are given. */
+    static Move fromRaw( uint16_t bits ) {
+        Move m;
+        m.bits = bits;
+        return m;
+    }
+
+private:
+    uint16_t bits;
+};
+
+/**
+   A chess position, with legal move generation and a way to make and
+   take back moves.
+*/
+class Position {
+public:
+    enum Color { WHITE, BLACK };
+    enum Piece { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING, NO_PIECE };
+
+    /** Castling rights, as bits of castlingRights(). */
+    enum {
+        WHITE_KINGSIDE = 1, WHITE_QUEENSIDE = 2,
+        BLACK_KINGSIDE = 4, BLACK_QUEENSIDE = 8
+    };
+
+    /** Most legal moves any position can have, with room to spare. */
+    enum { MAX_MOVES = 256 };
+
+    /** The starting position, in Forsyth-Edwards notation. */
+    static char const *const START_FEN;
+
+    /** What makeMove() saves so unmakeMove() can restore it. */
+    struct Undo {
+        int captured;
+        int castling;
+        int enPassant;
+        int halfmoves;
+        uint64_t key;
+    };
+
+    /** Make the starting position. */
+    Position();
+
+    /** Set up the position described by fen, in Forsyth-Edwards
+        notation.  The move counters may be left off.  Returns false,
+        leaving the position unchanged, if fen is malformed, either
+        side doesn't have exactly one king, a pawn is on the first or
+        last rank, or the side not to move is in check.  Castling rights without the
+        king and rook on their squares are dropped. */
+    bool setFen( char const *fen );
+
+    /** Return the position in Forsyth-Edwards notation, which setFen()
+        reads back as the same position. */
+    std::string fen() const;
+
+    /** Return the pieces of the given color and type. */
+    Bitboard pieces( int color, int piece ) const {
+        return byColor[ color ] & byType[ piece ];
+    }
+
+    /** Return all the pieces of the given color. */
+    Bitboard pieces( int color ) const {
+        return byColor[ color ];
+    }
+
+    /** Return every occupied square. */
+    Bitboard occupied() const {
+        return byColor[ WHITE ] | byColor[ BLACK ];
+    }
+
+    /** Return the type of the piece on sq, or NO_PIECE. */
+    int pieceOn( int sq ) const {
+        return board[ sq ];
+    }
+
+    /** Return the color of the piece on sq, which mustn't be empty. */
+    int colorOn( int sq ) const {
+        return byColor[ WHITE ] & squareBit( sq ) ? WHITE : BLACK;
+    }
+
+    /** Return the color whose move it is. */
+    int sideToMove() const {
+        return side;
+    }
+
+    /** Return the castling rights still held, as bits. */
+    int castlingRights() const {
+        return castling;
+    }
+
+    /** Return the square a pawn can capture en passant on, or -1. */
+    int enPassantSquare() const {
+        return enPassant;
+    }
+
+    /** Return the number of moves since the last capture or pawn move,
+        and the number of the current full move. */
+    int halfmoveClock() const {
+        return halfmoves;
+    }
+    int fullmoveNumber() const {
+        return fullmoves;
+    }
+
+    /** Return the position's Zobrist key.  Positions with the same
+        pieces, side to move, castling rights and en passant square have
+        the same key, however they were reached. */
+    uint64_t hashKey() const {
+        return key;
+    }
+
+    /** Return the Zobrist key worked out from scratch, for checking the
+        one kept up to date move by move. */
+    uint64_t computeKey() const;
+
+    /** Return the square of the given color's king. */
+    int kingSquare( int color ) const {
+        return firstSquare( pieces( color, KING ) );
+    }
+
+    /** Return the pieces of both colors that attack sq, with pieces on
+        occupied blocking the sliders. */
+    Bitboard attackersTo( int sq, Bitboard occupied ) const;
+
+    /** Return true if the side to move is in check. */
+    bool inCheck() const;
+
+    /** Fill in moves (which needs room for MAX_MOVES) with every legal
+        move for the side to move, and return how many there are. */
+    int legalMoves( Move *moves ) const;
+
+    /** Return the legal move from one square to another (promoting to
+        the given piece, if it's a promotion), or the null move if there
+        isn't one. */
+    Move findMove( int from, int to, int promotion = QUEEN ) const;
+
+    /** Return true if m is a legal move.  This is much quicker than
+        looking for it in legalMoves(), for checking moves that come
+        from somewhere that can't be trusted, like a file. */
+    bool isLegalMove( Move m ) const;
+
+    /** Return the legal move written as the length characters at text
+        in standard algebraic notation (e.g. Nbd7, exd5, e8=Q+, O-O), or
+        the null move if it isn't one.  Check marks and annotations like
+        "!?" are allowed on the end, and castling may use zeros. */
+    Move parseSan( char const *text, int length ) const;
+
+    /** Return the legal move m in standard algebraic notation. */
+    std::string san( Move m ) const;
+
+    /** Make the legal move m, saving what's needed to take it back in
+        undo. */
+    void makeMove( Move m, Undo &undo );
+
+    /** Take back m, which must be the last move made, with the undo
+        makeMove() filled in for it. */
+    void unmakeMove( Move m, Undo const &undo );
+
+    /** Count the positions depth moves from this one, for checking the
+        move generator against known counts. */
+    uint64_t perft( int depth );
+
+private:
+    /** Put a piece of the given color and type on the empty square sq. */
+    void put( int color, int piece, int sq );
+
+    /** Take the piece off sq. */
+    void remove( int sq );
+
+    /** Move the piece on from to the empty square to. */
+    void relocate( int from, int to );
+
+    /** Return the pawns of the side to move that attack sq. */
+    Bitboard pawnAttacksTo( int sq ) const;
+
+    /** Return the pieces of the side to move that are pinned to its
+        king. */
+    Bitboard pinnedPieces() const;
+
+    /** Return true if the side to move can capture en passant from
+        from without leaving its king in check. */
+    bool enPassantLegal( int from ) const;
+
+    /** Return true if m, which moves a piece of the side to move the
+        way it's allowed to move, doesn't leave its king in check. */
+    bool isLegal( Move m ) const;
+
+    /** Squares of each color, and of each type of piece. */
+    Bitboard byColor[ 2 ], byType[ 6 ];
+
+    /** Type of the piece on each square, or NO_PIECE. */
+    signed char board[ 64 ];
+
+    int side, castling, enPassant, halfmoves, fullmoves;
+
+    /** Zobrist key of the position. */
+    uint64_t key;
+};
+
+#endif
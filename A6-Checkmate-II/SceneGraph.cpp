@@ -0,0 +1,96 @@
+//
+// SceneGraph.cpp
+//
+// Transformation hierarchy with cached world matrices.
+//
+
+#include "SceneGraph.h"
+
+#include <algorithm>
+
+using namespace std;
+
+SceneGraph :: SceneGraph() :
+    mirror( Matrix::identity() ), shadow( Matrix::identity() ), recomputeCount( 0 ) {
+}
+
+int SceneGraph :: add( int parent, Matrix const &local, bool derived ) {
+    Node node;
+    node.parent = parent;
+    node.local = local;
+    node.derived = derived;
+    node.dirty = false;
+    node.version = 0;
+    nodes.push_back( node );
+
+    int n = nodes.size() - 1;
+    if ( parent >= 0 )
+        nodes[ parent ].children.push_back( n );
+    touch( n );
+    return n;
+}
+
+void SceneGraph :: setDerived( Matrix const &mirrorMatrix, Matrix const &shadowMatrix ) {
+    mirror = mirrorMatrix;
+    shadow = shadowMatrix;
+    for ( int n = 0; n < nodes.size(); n++ )
+        if ( nodes[ n ].derived )
+            touch( n );
+}
+
+void SceneGraph :: setLocal( int n, Matrix const &local ) {
+    nodes[ n ].local = local;
+    touch( n );
+}
+
+void SceneGraph :: setParent( int n, int parent ) {
+    int old = nodes[ n ].parent;
+    if ( old >= 0 ) {
+        vector< int > &siblings = nodes[ old ].children;
+        siblings.erase( find( siblings.begin(), siblings.end(), n ) );
+    }
+
+    nodes[ n ].parent = parent;
+    if ( parent >= 0 )
+        nodes[ parent ].children.push_back( n );
+    touch( n );
+}
+
+void SceneGraph :: reserve( int n, int children ) {
+    nodes[ n ].children.reserve( children );
+}
+
+void SceneGraph :: update() {
+    // A node may already have been refreshed along with a dirty
+    // ancestor, in which case it's clean by the time we get to it.
+    for ( int i = 0; i < pending.size(); i++ )
+        if ( nodes[ pending[ i ] ].dirty )
+            refresh( pending[ i ] );
+    pending.clear();
+}
+
+void SceneGraph :: touch( int n ) {
+    if ( !nodes[ n ].dirty ) {
+        nodes[ n ].dirty = true;
+        pending.push_back( n );
+    }
+}
+
+void SceneGraph :: refresh( int n ) {
+    Node &node = nodes[ n ];
+    if ( node.parent >= 0 )
+        node.world = nodes[ node.parent ].world * node.local;
+    else
+        node.world = node.local;
+
+    if ( node.derived ) {
+        node.mirrored = node.world * mirror;
+        node.shadowed = shadow * node.world;
+        node.inverse = node.world.affineInverse();
+    }
+    node.dirty = false;
+    node.version = ++recomputeCount;
+
+    for ( int i = 0; i < node.children.size(); i++ )
+        refresh( node.children[ i ] );
+}
@@ -0,0 +1,141 @@
+#ifndef __SCENE_GRAPH_H__
+#define __SCENE_GRAPH_H__
+
+#include "Geometry.h"
+
+#include <vector>
+
+//
+// Hierarchy of transformations, e.g. boards holding squares holding
+// pieces.  Each node has a local matrix, relative to its parent, and
+// caches its world matrix.  Changing a node only marks it dirty; the
+// next update() recomputes the world matrices of the dirty nodes and
+// their descendants, and nothing else.  Nodes can also cache matrices
+// derived from their world matrix (a mirrored copy, a flattened shadow
+// and the inverse), for nodes that are drawn.
+//
+class SceneGraph {
+public:
+    // Make an empty graph.  Derived matrices use the identity for the
+    // mirror and shadow projection until setDerived() is called.
+    SceneGraph();
+
+    /** Add a node under the given parent (or as a root, if parent is -1)
+        with the given local matrix, and return its index.  If derived is
+        true, the node also caches mirrored(), shadowed() and inverse(). */
+    int add( int parent, Matrix const &local, bool derived = false );
+
+    /** Set the matrices derived matrices are made with: mirrored() is
+        world * mirror, and shadowed() is shadow * world.  Every node
+        with derived matrices is marked dirty. */
+    void setDerived( Matrix const &mirror, Matrix const &shadow );
+
+    /** Give node n a new local matrix. */
+    void setLocal( int n, Matrix const &local );
+
+    /** Move node n (and its subtree) under a new parent, keeping its
+        local matrix. */
+    void setParent( int n, int parent );
+    /** Make room for node n to have the given number of children, so
+        moving nodes under it with setParent() doesn't allocate. */
+    void reserve( int n, int children );
+
+    /** Bring the world and derived matrices of every changed node and its
+        descendants up to date.  Does nothing if nothing has changed. */
+    void update();
+
+    /** Return the parent of node n, or -1 for a root. */
+    int parent( int n ) const {
+        return nodes[ n ].parent;
+    }
+
+    /** Return the local matrix of node n. */
+    Matrix const &local( int n ) const {
+        return nodes[ n ].local;
+    }
+
+    /** Return the world matrix of node n, as of the last update(). */
+    Matrix const &world( int n ) const {
+        return nodes[ n ].world;
+    }
+
+    /** Return node n's world matrix followed by the mirror. */
+    Matrix const &mirrored( int n ) const {
+        return nodes[ n ].mirrored;
+    }
+
+    /** Return node n's world matrix flattened by the shadow projection. */
+    Matrix const &shadowed( int n ) const {
+        return nodes[ n ].shadowed;
+    }
+
+    /** Return the inverse of node n's world matrix, which must be
+        affine. */
+    Matrix const &inverse( int n ) const {
+        return nodes[ n ].inverse;
+    }
+
+    /** Return the value recomputed() had when node n's matrices were
+        last recomputed, so a caller can tell whether they've changed
+        since it last looked. */
+    long version( int n ) const {
+        return nodes[ n ].version;
+    }
+
+    /** Return the number of nodes. */
+    int size() const {
+        return nodes.size();
+    }
+
+    /** Return the number of nodes whose matrices have been recomputed
+        since the graph was made, for checking how much work updates do. */
+    long recomputed() const {
+        return recomputeCount;
+    }
+
+private:
+    /** A node of the graph. */
+    struct Node {
+        /** Index of the parent node, or -1 for a root. */
+        int parent;
+
+        /** Indices of the child nodes. */
+        std::vector< int > children;
+
+        /** Transformation relative to the parent, and the product of it
+            with all its ancestors'. */
+        Matrix local, world;
+
+        /** Cached derived matrices, if derived is true. */
+        Matrix mirrored, shadowed, inverse;
+
+        /** True if the node caches derived matrices. */
+        bool derived;
+
+        /** True if the node is waiting for update(). */
+        bool dirty;
+
+        /** Value of recomputeCount when the node was last refreshed. */
+        long version;
+    };
+
+    /** Mark node n as needing update(). */
+    void touch( int n );
+
+    /** Recompute node n's matrices, and those of its descendants. */
+    void refresh( int n );
+
+    /** All the nodes, in the order they were added. */
+    std::vector< Node > nodes;
+
+    /** Dirty nodes, in the order they were marked. */
+    std::vector< int > pending;
+
+    /** Matrices derived matrices are made with. */
+    Matrix mirror, shadow;
+
+    /** Running count of node recomputations. */
+    long recomputeCount;
+};
+
+#endif
@@ -0,0 +1,534 @@
+//
+// Search.cpp
+//
+// Lazy SMP alpha-beta search, its shared transposition table, and the
+// evaluation it scores positions with.
+//
+
+#include "Search.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+// Bigger than any score.
+static const int INFINITE = Search::MATE + 1;
+
+// Material values, in centipawns, in Position::Piece order.  The king's
+// is never counted, since it can't be captured.
+static const int PIECE_VALUES[ 6 ] = { 100, 320, 330, 500, 900, 0 };
+
+// Bonuses for where each type of piece (pawn to queen) stands, from the
+// "simplified evaluation function".  They're laid out as a white player
+// sees the board, with the eighth rank on top, so the entry for square
+// sq is at sq ^ 56 for white and sq for black.
+static const int PIECE_SQUARES[ 5 ][ 64 ] = {
+    {   0,   0,   0,   0,   0,   0,   0,   0,
+       50,  50,  50,  50,  50,  50,  50,  50,
+       10,  10,  20,  30,  30,  20,  10,  10,
+        5,   5,  10,  25,  25,  10,   5,   5,
+        0,   0,   0,  20,  20,   0,   0,   0,
+        5,  -5, -10,   0,   0, -10,  -5,   5,
+        5,  10,  10, -20, -20,  10,  10,   5,
+        0,   0,   0,   0,   0,   0,   0,   0 },
+    { -50, -40, -30, -30, -30, -30, -40, -50,
+      -40, -20,   0,   0,   0,   0, -20, -40,
+      -30,   0,  10,  15,  15,  10,   0, -30,
+      -30,   5,  15,  20,  20,  15,   5, -30,
+      -30,   0,  15,  20,  20,  15,   0, -30,
+      -30,   5,  10,  15,  15,  10,   5, -30,
+      -40, -20,   0,   5,   5,   0, -20, -40,
+      -50, -40, -30, -30, -30, -30, -40, -50 },
+    { -20, -10, -10, -10, -10, -10, -10, -20,
+      -10,   0,   0,   0,   0,   0,   0, -10,
+      -10,   0,   5,  10,  10,   5,   0, -10,
+      -10,   5,   5,  10,  10,   5,   5, -10,
+      -10,   0,  10,  10,  10,  10,   0, -10,
+      -10,  10,  10,  10,  10,  10,  10, -10,
+      -10,   5,   0,   0,   0,   0,   5, -10,
+      -20, -10, -10, -10, -10, -10, -10, -20 },
+    {   0,   0,   0,   0,   0,   0,   0,   0,
+        5,  10,  10,  10,  10,  10,  10,   5,
+       -5,   0,   0,   0,   0,   0,   0,  -5,
+       -5,   0,   0,   0,   0,   0,   0,  -5,
+       -5,   0,   0,   0,   0,   0,   0,  -5,
+       -5,   0,   0,   0,   0,   0,   0,  -5,
+       -5,   0,   0,   0,   0,   0,   0,  -5,
+        0,   0,   0,   5,   5,   0,   0,   0 },
+    { -20, -10, -10,  -5,  -5, -10, -10, -20,
+      -10,   0,   0,   0,   0,   0,   0, -10,
+      -10,   0,   5,   5,   5,   5,   0, -10,
+       -5,   0,   5,   5,   5,   5,   0,  -5,
+        0,   0,   5,   5,   5,   5,   0,  -5,
+      -10,   5,   5,   5,   5,   5,   0, -10,
+      -10,   0,   5,   0,   0,   0,   0, -10,
+      -20, -10, -10,  -5,  -5, -10, -10, -20 }
+};
+
+// The king hides behind its pawns while there are pieces about to
+// attack it, and comes out to the middle once there aren't.
+static const int KING_SQUARES[ 2 ][ 64 ] = {
+    { -30, -40, -40, -50, -50, -40, -40, -30,
+      -30, -40, -40, -50, -50, -40, -40, -30,
+      -30, -40, -40, -50, -50, -40, -40, -30,
+      -30, -40, -40, -50, -50, -40, -40, -30,
+      -20, -30, -30, -40, -40, -30, -30, -20,
+      -10, -20, -20, -20, -20, -20, -20, -10,
+       20,  20,   0,   0,   0,   0,  20,  20,
+       20,  30,  10,   0,   0,  10,  30,  20 },
+    { -50, -40, -30, -20, -20, -30, -40, -50,
+      -30, -20, -10,   0,   0, -10, -20, -30,
+      -30, -10,  20,  30,  30,  20, -10, -30,
+      -30, -10,  30,  40,  40,  30, -10, -30,
+      -30, -10,  30,  40,  40,  30, -10, -30,
+      -30, -10,  20,  30,  30,  20, -10, -30,
+      -30, -30,   0,   0,   0,   0, -30, -30,
+      -50, -30, -30, -30, -30, -30, -30, -50 }
+};
+
+// Most material, besides pawns, either side can have in the endgame.
+static const int ENDGAME_MATERIAL = 1300;
+
+// Return the current time in seconds.
+static double now() {
+    return chrono::duration< double >(
+        chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// A table entry's data word holds the move's 16 bits, the score offset
+// to be unsigned (16 bits), the depth (8), the bound (2) and the search
+// generation (6).  The bound is never 0, so neither is a stored word.
+static uint64_t packEntry( Move move, int score, int depth, int bound, int generation ) {
+    uint64_t bits = move.from() | move.to() << 6 | move.kind() << 12 |
+        ( move.promotion() - 1 ) << 14;
+    return bits | uint64_t( score + 32768 ) << 16 | uint64_t( depth ) << 32 |
+        uint64_t( bound ) << 40 | uint64_t( generation ) << 42;
+}
+
+TranspositionTable :: TranspositionTable( int megabytes ) : generation( 0 ) {
+    // A power of two of slots, so a key's slot is just its low bits.
+    uint64_t bytes = uint64_t( max( megabytes, 1 ) ) << 20, count = 1;
+    while ( count * 2 * sizeof( Slot ) <= bytes )
+        count *= 2;
+    slots.reset( new Slot[ count ] );
+    mask = count - 1;
+    clear();
+}
+
+void TranspositionTable :: clear() {
+    for ( uint64_t i = 0; i <= mask; i++ ) {
+        slots[ i ].check.store( 0, memory_order_relaxed );
+        slots[ i ].data.store( 0, memory_order_relaxed );
+    }
+}
+
+void TranspositionTable :: newSearch() {
+    generation = ( generation + 1 ) & 63;
+}
+
+bool TranspositionTable :: probe( uint64_t key, Entry &entry ) const {
+    Slot const &slot = slots[ key & mask ];
+    uint64_t data = slot.data.load( memory_order_relaxed );
+    if ( !data || ( slot.check.load( memory_order_relaxed ) ^ data ) != key )
+        return false;
+
+    entry.move = Move( data & 63, data >> 6 & 63, data >> 12 & 3, ( data >> 14 & 3 ) + 1 );
+    entry.score = int( data >> 16 & 0xffff ) - 32768;
+    entry.depth = data >> 32 & 0xff;
+    entry.bound = data >> 40 & 3;
+    return true;
+}
+
+void TranspositionTable :: store( uint64_t key, Move move, int score, int depth,
+                                  int bound ) {
+    Slot &slot = slots[ key & mask ];
+    uint64_t old = slot.data.load( memory_order_relaxed );
+    bool same = old && ( slot.check.load( memory_order_relaxed ) ^ old ) == key;
+
+    // Something else found deeper in this search is worth more.
+    if ( old && !same && int( old >> 42 ) == generation && int( old >> 32 & 0xff ) > depth )
+        return;
+
+    // A bound that failed low has no best move; keep the one we had.
+    if ( same && move.isNull() )
+        move = Move( old & 63, old >> 6 & 63, old >> 12 & 3, ( old >> 14 & 3 ) + 1 );
+
+    uint64_t data = packEntry( move, score, depth, bound, generation );
+    slot.check.store( key ^ data, memory_order_relaxed );
+    slot.data.store( data, memory_order_relaxed );
+}
+
+// Everything one thread searches with.
+struct Search :: Worker {
+    /** Index of the thread; the first one leads. */
+    int id;
+
+    /** The thread's own copy of the board. */
+    Position pos;
+
+    /** Keys of the positions from the start of the game to pos. */
+    vector< uint64_t > keys;
+
+    /** Two quiet moves at each ply that recently caused a cutoff, to
+        try early at that ply elsewhere in the tree. */
+    Move killers[ MAX_PLY ][ 2 ];
+
+    /** Positions this thread has visited. */
+    uint64_t nodes;
+
+    /** Best move at the root in the depth being searched. */
+    Move rootBest;
+
+    /** Best move, its score and depth from the deepest search
+        finished. */
+    Result result;
+};
+
+// Mate scores are stored relative to the position they're stored for,
+// not the root, so they stay right wherever the position comes up.
+static int toTable( int score, int ply ) {
+    if ( score > Search::MATE - Search::MAX_PLY )
+        return score + ply;
+    if ( score < -Search::MATE + Search::MAX_PLY )
+        return score - ply;
+    return score;
+}
+
+static int fromTable( int score, int ply ) {
+    if ( score > Search::MATE - Search::MAX_PLY )
+        return score - ply;
+    if ( score < -Search::MATE + Search::MAX_PLY )
+        return score + ply;
+    return score;
+}
+
+// Return the value of the piece m captures, or -1 if it doesn't.
+static int capturedValue( Position const &pos, Move m ) {
+    if ( m.kind() == Move::EN_PASSANT )
+        return PIECE_VALUES[ Position::PAWN ];
+    int victim = pos.pieceOn( m.to() );
+    return victim == Position::NO_PIECE ? -1 : PIECE_VALUES[ victim ];
+}
+
+// Give each move a score to order the search by: the table's best move
+// first, then captures of the most valuable pieces by the least
+// valuable ones, then promotions, then the killer moves, then the rest.
+static void scoreMoves( Position const &pos, Move const *moves, int *scores, int count,
+                        Move hashMove, Move const *killers ) {
+    for ( int i = 0; i < count; i++ ) {
+        Move m = moves[ i ];
+        int victim = capturedValue( pos, m );
+        if ( m == hashMove )
+            scores[ i ] = 1000000;
+        else if ( victim >= 0 )
+            scores[ i ] = 100000 + victim * 10 - PIECE_VALUES[ pos.pieceOn( m.from() ) ] / 10;
+        else if ( m.kind() == Move::PROMOTION )
+            scores[ i ] = 90000 + m.promotion();
+        else if ( killers && m == killers[ 0 ] )
+            scores[ i ] = 80001;
+        else if ( killers && m == killers[ 1 ] )
+            scores[ i ] = 80000;
+        else
+            scores[ i ] = 0;
+    }
+}
+
+// Swap the best scoring of moves i onward into place i.  Cutoffs often
+// come early, so this beats sorting them all up front.
+static void pickMove( Move *moves, int *scores, int i, int count ) {
+    int best = i;
+    for ( int j = i + 1; j < count; j++ )
+        if ( scores[ j ] > scores[ best ] )
+            best = j;
+    swap( moves[ i ], moves[ best ] );
+    swap( scores[ i ], scores[ best ] );
+}
+
+Search :: Search( int tableMegabytes )
+    : table( tableMegabytes ), stopping( false ), startTime( 0 ), timeLimit( 0 ) {
+}
+
+Search :: ~Search() {
+    stop();
+    wait();
+}
+
+void Search :: start( Position const &root, vector< uint64_t > const &history,
+                      Limits const &limits, Callback done ) {
+    stop();
+    wait();
+
+    int threads = limits.threads > 0 ? limits.threads :
+        max( 1u, thread::hardware_concurrency() );
+    workers.clear();
+    for ( int i = 0; i < threads; i++ ) {
+        unique_ptr< Worker > w( new Worker );
+        w->id = i;
+        w->pos = root;
+        w->keys.reserve( history.size() + MAX_PLY + 1 );
+        w->keys = history;
+        w->keys.push_back( root.hashKey() );
+        w->nodes = 0;
+        w->result = Result();
+        workers.push_back( move( w ) );
+    }
+
+    table.newSearch();
+    stopping = false;
+    startTime = now();
+    timeLimit = limits.milliseconds / 1000.0;
+    leader = thread( &Search::lead, this, limits, done );
+}
+
+void Search :: stop() {
+    stopping = true;
+}
+
+void Search :: wait() {
+    if ( leader.joinable() )
+        leader.join();
+}
+
+Search::Result Search :: run( Position const &root, Limits const &limits ) {
+    Result result;
+    start( root, vector< uint64_t >(), limits,
+           [ &result ]( Result const &r ) { result = r; } );
+    wait();
+    return result;
+}
+
+void Search :: clearTable() {
+    table.clear();
+}
+
+void Search :: lead( Limits limits, Callback done ) {
+    // The helpers search with no depth limit; they're stopped once
+    // the lead is done.
+    vector< thread > helpers;
+    for ( int i = 1; i < int( workers.size() ); i++ )
+        helpers.push_back( thread( &Search::deepen, this, ref( *workers[ i ] ),
+                                   int( MAX_PLY ) - 1 ) );
+    deepen( *workers[ 0 ], limits.depth > 0 ? min( limits.depth, MAX_PLY - 1 ) :
+            MAX_PLY - 1 );
+    stopping = true;
+    for ( int i = 0; i < int( helpers.size() ); i++ )
+        helpers[ i ].join();
+
+    Result result = workers[ 0 ]->result;
+    result.nodes = 0;
+    for ( int i = 0; i < int( workers.size() ); i++ )
+        result.nodes += workers[ i ]->nodes;
+    result.seconds = now() - startTime;
+    result.threads = workers.size();
+    done( result );
+}
+
+void Search :: deepen( Worker &w, int maxDepth ) {
+    // Odd numbered threads start a ply deeper, so the threads spread
+    // over two depths at a time rather than all racing through the same
+    // tree.
+    for ( int depth = 1 + w.id % 2; depth <= maxDepth; depth++ ) {
+        w.rootBest = Move();
+        int score = search( w, -INFINITE, INFINITE, depth, 0 );
+
+        // A search cut short can't be trusted, so the last finished one
+        // stands.
+        if ( stopping )
+            break;
+        w.result.best = w.rootBest;
+        w.result.score = score;
+        w.result.depth = depth;
+
+        // A mate within the depth searched won't get any closer.
+        if ( abs( score ) > MATE - MAX_PLY && MATE - abs( score ) <= depth )
+            break;
+    }
+}
+
+void Search :: countNode( Worker &w ) {
+    // The lead finishes at least one depth, so there's always a move.
+    if ( ++w.nodes % 1024 == 0 && w.id == 0 && timeLimit > 0 && w.result.depth > 0 &&
+         now() - startTime >= timeLimit )
+        stopping = true;
+}
+
+bool Search :: isDraw( Worker const &w ) {
+    Position const &pos = w.pos;
+    if ( pos.halfmoveClock() >= 100 )
+        return true;
+
+    // Only positions since the last capture or pawn move can come up
+    // again, and only every other one has the same side to move.  It
+    // takes at least four plies to get back.
+    int last = int( w.keys.size() ) - 1;
+    for ( int i = last - 4; i >= 0 && i >= last - pos.halfmoveClock(); i -= 2 )
+        if ( w.keys[ i ] == w.keys[ last ] )
+            return true;
+    return false;
+}
+
+int Search :: search( Worker &w, int alpha, int beta, int depth, int ply ) {
+    Position &pos = w.pos;
+    if ( ply >= MAX_PLY - 1 )
+        return evaluate( pos );
+
+    // Look a ply further past checks, so lines of checks don't get cut
+    // off just short of a mate.
+    bool inCheck = pos.inCheck();
+    if ( inCheck )
+        depth++;
+    if ( depth <= 0 )
+        return quiesce( w, alpha, beta, ply );
+
+    countNode( w );
+    if ( stopping.load( memory_order_relaxed ) )
+        return 0;
+    if ( ply > 0 && isDraw( w ) )
+        return 0;
+
+    // Anything searched deep enough already, by this thread or another,
+    // can be used as is.  Otherwise its best move is tried first.
+    uint64_t key = pos.hashKey();
+    TranspositionTable::Entry entry;
+    Move hashMove;
+    if ( table.probe( key, entry ) ) {
+        hashMove = entry.move;
+        int score = fromTable( entry.score, ply );
+        if ( ply > 0 && entry.depth >= depth &&
+             ( entry.bound == TranspositionTable::EXACT ||
+               ( entry.bound == TranspositionTable::LOWER && score >= beta ) ||
+               ( entry.bound == TranspositionTable::UPPER && score <= alpha ) ) )
+            return score;
+    }
+
+    Move moves[ Position::MAX_MOVES ];
+    int count = pos.legalMoves( moves );
+    if ( count == 0 )
+        return inCheck ? -MATE + ply : 0;
+
+    int scores[ Position::MAX_MOVES ];
+    scoreMoves( pos, moves, scores, count, hashMove, w.killers[ ply ] );
+
+    int best = -INFINITE, startAlpha = alpha;
+    Move bestMove;
+    for ( int i = 0; i < count; i++ ) {
+        pickMove( moves, scores, i, count );
+        Move m = moves[ i ];
+        bool quiet = capturedValue( pos, m ) < 0 && m.kind() != Move::PROMOTION;
+
+        // After the first move, just check that each is no better than
+        // the best so far, with a null window, and only search it fully
+        // if it is.
+        Position::Undo undo;
+        pos.makeMove( m, undo );
+        w.keys.push_back( pos.hashKey() );
+        int score;
+        if ( i == 0 ) {
+            score = -search( w, -beta, -alpha, depth - 1, ply + 1 );
+        } else {
+            score = -search( w, -alpha - 1, -alpha, depth - 1, ply + 1 );
+            if ( score > alpha && score < beta )
+                score = -search( w, -beta, -alpha, depth - 1, ply + 1 );
+        }
+        w.keys.pop_back();
+        pos.unmakeMove( m, undo );
+
+        if ( stopping.load( memory_order_relaxed ) )
+            return 0;
+        if ( score > best ) {
+            best = score;
+            bestMove = m;
+            if ( ply == 0 )
+                w.rootBest = m;
+            if ( score > alpha )
+                alpha = score;
+            if ( alpha >= beta ) {
+                if ( quiet && m != w.killers[ ply ][ 0 ] ) {
+                    w.killers[ ply ][ 1 ] = w.killers[ ply ][ 0 ];
+                    w.killers[ ply ][ 0 ] = m;
+                }
+                break;
+            }
+        }
+    }
+
+    int bound = best >= beta ? TranspositionTable::LOWER :
+        best > startAlpha ? TranspositionTable::EXACT : TranspositionTable::UPPER;
+    table.store( key, bound == TranspositionTable::UPPER ? Move() : bestMove,
+                 toTable( best, ply ), depth, bound );
+    return best;
+}
+
+int Search :: quiesce( Worker &w, int alpha, int beta, int ply ) {
+    Position &pos = w.pos;
+    countNode( w );
+    if ( stopping.load( memory_order_relaxed ) )
+        return 0;
+
+    // The side to move can usually do at least as well as standing
+    // still, so that's the score to beat.
+    int best = evaluate( pos );
+    if ( ply >= MAX_PLY - 1 || best >= beta )
+        return best;
+    alpha = max( alpha, best );
+
+    Move moves[ Position::MAX_MOVES ];
+    int count = pos.legalMoves( moves );
+    if ( count == 0 )
+        return pos.inCheck() ? -MATE + ply : 0;
+
+    // Keep just the captures, and promotions to a queen.
+    int tactical = 0;
+    for ( int i = 0; i < count; i++ )
+        if ( capturedValue( pos, moves[ i ] ) >= 0 ||
+             ( moves[ i ].kind() == Move::PROMOTION &&
+               moves[ i ].promotion() == Position::QUEEN ) )
+            moves[ tactical++ ] = moves[ i ];
+
+    int scores[ Position::MAX_MOVES ];
+    scoreMoves( pos, moves, scores, tactical, Move(), NULL );
+    for ( int i = 0; i < tactical; i++ ) {
+        pickMove( moves, scores, i, tactical );
+        Position::Undo undo;
+        pos.makeMove( moves[ i ], undo );
+        int score = -quiesce( w, -beta, -alpha, ply + 1 );
+        pos.unmakeMove( moves[ i ], undo );
+
+        if ( stopping.load( memory_order_relaxed ) )
+            return 0;
+        if ( score > best ) {
+            best = score;
+            if ( score > alpha )
+                alpha = score;
+            if ( alpha >= beta )
+                break;
+        }
+    }
+    return best;
+}
+
+int Search :: evaluate( Position const &pos ) {
+    int score[ 2 ] = { 0, 0 }, material[ 2 ] = { 0, 0 };
+    for ( int color = 0; color < 2; color++ ) {
+        int flip = color == Position::WHITE ? 56 : 0;
+        for ( int piece = Position::PAWN; piece <= Position::QUEEN; piece++ ) {
+            Bitboard b = pos.pieces( color, piece );
+            while ( b ) {
+                int sq = popSquare( b );
+                score[ color ] += PIECE_VALUES[ piece ] + PIECE_SQUARES[ piece ][ sq ^ flip ];
+                if ( piece != Position::PAWN )
+                    material[ color ] += PIECE_VALUES[ piece ];
+            }
+        }
+    }
+
+    bool endgame = material[ 0 ] <= ENDGAME_MATERIAL && material[ 1 ] <= ENDGAME_MATERIAL;
+    for ( int color = 0; color < 2; color++ )
+        score[ color ] += KING_SQUARES[ endgame ][ pos.kingSquare( color ) ^
+                                                  ( color == Position::WHITE ? 56 : 0 ) ];
+
+    int white = score[ Position::WHITE ] - score[ Position::BLACK ];
+    return pos.sideToMove() == Position::WHITE ? white : -white;
+}
@@ -0,0 +1,197 @@
+#ifndef __SEARCH_H__
+#define __SEARCH_H__
+
+#include "Position.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+//
+// A computer player: iterative-deepening alpha-beta search over
+// Position, spread over threads in the Lazy SMP style.  Every thread
+// searches the same root position, deeper and deeper, on its own copy
+// of the board; all they share is the transposition table, so what one
+// thread finds out about a position, the others pick up when they reach
+// it.  Searches run in the background, and report through a callback.
+//
+
+/**
+   Table of what searches have found out about positions, keyed by
+   Zobrist key, and shared between threads without locking.  Each slot
+   is two 64-bit words, the data and the key xored with the data.  If
+   two threads write the same slot at once, the words can come from
+   different writes, but then the key check fails and the slot just
+   reads as empty.
+*/
+class TranspositionTable {
+public:
+    /** How a stored score relates to the position's real score. */
+    enum Bound { EXACT = 1, LOWER, UPPER };
+
+    /** What's known about one position. */
+    struct Entry {
+        /** Best move found, or the null move. */
+        Move move;
+
+        /** Score, from the side to move's point of view. */
+        int score;
+
+        /** Depth the score was searched to. */
+        int depth;
+
+        /** Which Bound the score is. */
+        int bound;
+    };
+
+    /** Make an empty table of about the given size. */
+    TranspositionTable( int megabytes );
+
+    /** Empty the table.  Nothing may be searching with it. */
+    void clear();
+
+    /** Note that a new search is starting, so entries from earlier
+        ones are the first to be replaced. */
+    void newSearch();
+
+    /** Look up the position with the given key, and fill in entry and
+        return true if it's there. */
+    bool probe( uint64_t key, Entry &entry ) const;
+
+    /** Record what was found about the position with the given key,
+        unless its slot holds something from this search that was
+        searched deeper. */
+    void store( uint64_t key, Move move, int score, int depth, int bound );
+
+private:
+    struct Slot {
+        std::atomic< uint64_t > check, data;
+    };
+
+    /** The slots, a power of two of them. */
+    std::unique_ptr< Slot[] > slots;
+
+    /** Number of slots less one, for picking a slot from a key. */
+    uint64_t mask;
+
+    /** Counter of searches, kept in each entry to tell old ones. */
+    int generation;
+};
+
+/**
+   Finds moves for the computer to play, on a pool of threads.
+*/
+class Search {
+public:
+    /** Scores: a mate in n plies scores MATE - n, and anything within
+        MAX_PLY of MATE is a mate. */
+    enum { MATE = 32000, MAX_PLY = 64 };
+
+    /** When to stop searching.  A zero means no limit, or for threads,
+        one per hardware thread. */
+    struct Limits {
+        Limits() : depth( 0 ), milliseconds( 0 ), threads( 0 ) {
+        }
+
+        int depth;
+        int milliseconds;
+        int threads;
+    };
+
+    /** What a finished search found. */
+    struct Result {
+        /** Move to play, or the null move if there isn't one. */
+        Move best;
+
+        /** Score of best, and the depth it was searched to. */
+        int score, depth;
+
+        /** Positions visited by all the threads, and how long it took. */
+        uint64_t nodes;
+        double seconds;
+
+        /** Number of threads searched with. */
+        int threads;
+    };
+
+    /** Called with the result on the search's own thread, so it must
+        be careful what it touches. */
+    typedef std::function< void( Result const & ) > Callback;
+
+    /** Make a searcher with a transposition table of about the given
+        size. */
+    Search( int tableMegabytes = 16 );
+
+    /** Stop any search in progress, and wait for it to finish. */
+    ~Search();
+
+    /** Start searching root in the background, and call done when it
+        finishes.  history holds the keys of the positions played before
+        root, oldest first, so repetitions can be scored as draws.  Any
+        search in progress is stopped first. */
+    void start( Position const &root, std::vector< uint64_t > const &history,
+                Limits const &limits, Callback done );
+
+    /** Ask the search in progress, if any, to finish early.  It still
+        reports the best move from the last depth it completed. */
+    void stop();
+
+    /** Wait for the search in progress, if any, to finish. */
+    void wait();
+
+    /** Search root and wait for the result. */
+    Result run( Position const &root, Limits const &limits );
+
+    /** Empty the transposition table.  Nothing may be searching. */
+    void clearTable();
+
+    /** Return a static estimate of pos, in centipawns, from the side to
+        move's point of view. */
+    static int evaluate( Position const &pos );
+
+private:
+    struct Worker;
+
+    /** Body of the first thread: starts the others, searches, and once
+        it's done, stops them and reports. */
+    void lead( Limits limits, Callback done );
+
+    /** Search deeper and deeper on w until told to stop (or, for the
+        first thread, until the depth limit). */
+    void deepen( Worker &w, int maxDepth );
+
+    /** Alpha-beta search of w's position to the given depth, ply moves
+        from the root. */
+    int search( Worker &w, int alpha, int beta, int depth, int ply );
+
+    /** Search only captures and promotions, until the position is
+        quiet enough to evaluate. */
+    int quiesce( Worker &w, int alpha, int beta, int ply );
+
+    /** Return true if w's position is drawn by the fifty move rule or
+        by repeating one since the last capture or pawn move. */
+    static bool isDraw( Worker const &w );
+
+    /** Count a node on w, and for the first thread, check the clock
+        every so often. */
+    void countNode( Worker &w );
+
+    TranspositionTable table;
+
+    /** One per thread; the first leads. */
+    std::vector< std::unique_ptr< Worker > > workers;
+
+    /** The leading thread, which joins the others. */
+    std::thread leader;
+
+    /** Set to make every thread finish up. */
+    std::atomic< bool > stopping;
+
+    /** Time the search started, in seconds, and how long it may take
+        (or 0 for no limit). */
+    double startTime, timeLimit;
+};
+
+#endif
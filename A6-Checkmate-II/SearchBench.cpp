@@ -0,0 +1,127 @@
+//
+// SearchBench.cpp
+//
+// Measure how the computer player's search scales with threads, and
+// check that it finds known mates.
+//
+// Usage: searchbench [-time ms] [-threads n]   nodes/s and depth for 1, 2,
+//                                               4, ... up to n threads
+//        searchbench -check                     solve the mate problems
+//
+// The check's exit status is 1 if any mate is missed.
+//
+
+#include "Search.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+// Positions to time the search on, from the opening to the endgame.
+static char const *const BENCH_FENS[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+};
+
+// A position with a forced mate, how many moves it takes, and the move
+// that mates if there's only one.
+struct MateCase {
+    char const *name;
+    char const *fen;
+    int moves;
+    char const *best;
+};
+
+static const MateCase MATES[] = {
+    { "back rank", "6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1", 1, "a1a8" },
+    { "back rank, black", "r5k1/8/8/8/8/8/5PPP/6K1 b - - 0 1", 1, "a8a1" },
+    { "scholar's mate",
+      "r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4", 1, "h5f7" },
+    { "king and rook", "k7/8/2K5/8/8/8/8/7R w - - 0 1", 2, NULL },
+};
+
+// Solve each mate problem on several threads, and report any that
+// aren't found at the depth they need.
+static int runCheck() {
+    Search search;
+    int failures = 0;
+    for ( int c = 0; c < int( sizeof( MATES ) / sizeof( MATES[ 0 ] ) ); c++ ) {
+        Position pos;
+        pos.setFen( MATES[ c ].fen );
+        Search::Limits limits;
+        limits.depth = MATES[ c ].moves * 2 + 1;
+        limits.threads = 4;
+        search.clearTable();
+        Search::Result result = search.run( pos, limits );
+
+        int want = Search::MATE - ( MATES[ c ].moves * 2 - 1 );
+        bool ok = result.score == want &&
+            ( !MATES[ c ].best || result.best.name() == MATES[ c ].best );
+        printf( "%s  %-18s mate in %d: %s, score %d", ok ? "ok  " : "FAIL",
+                MATES[ c ].name, MATES[ c ].moves, result.best.name().c_str(),
+                result.score );
+        if ( !ok )
+            printf( ", expected %d%s%s", want, MATES[ c ].best ? " and " : "",
+                    MATES[ c ].best ? MATES[ c ].best : "" );
+        printf( "\n" );
+        failures += !ok;
+    }
+    printf( "%s\n", failures ? "FAILED" : "passed" );
+    return failures ? 1 : 0;
+}
+
+// Search each bench position for the given time on the given number of
+// threads, from an empty table, and report the speed and average depth.
+static void runBench( int threads, int milliseconds, double &baseSpeed ) {
+    Search search;
+    uint64_t nodes = 0;
+    double seconds = 0, depth = 0;
+    int count = sizeof( BENCH_FENS ) / sizeof( BENCH_FENS[ 0 ] );
+    for ( int c = 0; c < count; c++ ) {
+        Position pos;
+        pos.setFen( BENCH_FENS[ c ] );
+        Search::Limits limits;
+        limits.milliseconds = milliseconds;
+        limits.threads = threads;
+        search.clearTable();
+        Search::Result result = search.run( pos, limits );
+        nodes += result.nodes;
+        seconds += result.seconds;
+        depth += result.depth;
+    }
+
+    double speed = nodes / seconds;
+    if ( threads == 1 )
+        baseSpeed = speed;
+    printf( "%7d %12.0f %8.2fx %10.1f\n", threads, speed, speed / baseSpeed,
+            depth / count );
+}
+
+int main( int argc, char **argv ) {
+    if ( argc > 1 && strcmp( argv[ 1 ], "-check" ) == 0 )
+        return runCheck();
+
+    int milliseconds = 1000;
+    int maxThreads = max( 1u, thread::hardware_concurrency() );
+    for ( int i = 1; i + 1 < argc; i++ ) {
+        if ( strcmp( argv[ i ], "-time" ) == 0 )
+            milliseconds = max( 1, atoi( argv[ i + 1 ] ) );
+        if ( strcmp( argv[ i ], "-threads" ) == 0 )
+            maxThreads = max( 1, atoi( argv[ i + 1 ] ) );
+    }
+
+    printf( "%d ms per position, %d positions, %u hardware threads\n", milliseconds,
+            int( sizeof( BENCH_FENS ) / sizeof( BENCH_FENS[ 0 ] ) ),
+            thread::hardware_concurrency() );
+    printf( "threads      nodes/s  speedup  avg depth\n" );
+    double baseSpeed = 0;
+    for ( int threads = 1; threads < maxThreads; threads *= 2 )
+        runBench( threads, milliseconds, baseSpeed );
+    runBench( maxThreads, milliseconds, baseSpeed );
+    return 0;
+}
@@ -0,0 +1,235 @@
+//
+// ShadowMap.cpp
+//
+// Shadow mapping for the board and pieces.
+//
+
+#include "ShadowMap.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+// Overlay shader; discards lit fragments and draws shadowed ones as
+// transparent black, matching the look of the old projected shadows.
+static char const *overlayVertexSource =
+    "#version 120\n"
+    "uniform mat4 shadowMatrix;\n"
+    "varying vec4 shadowCoord;\n"
+    "void main() {\n"
+    "    shadowCoord = shadowMatrix * gl_Vertex;\n"
+    "    gl_Position = ftransform();\n"
+    "    gl_ClipVertex = gl_ModelViewMatrix * gl_Vertex;\n"
+    "}\n";
+
+static char const *overlayFragmentSource =
+    "#version 120\n"
+    "uniform sampler2DShadow shadowMap;\n"
+    "varying vec4 shadowCoord;\n"
+    "void main() {\n"
+    "    float lit = shadow2DProj(shadowMap, shadowCoord).r;\n"
+    "    if (lit > 0.99)\n"
+    "        discard;\n"
+    "    gl_FragColor = vec4(0.0, 0.0, 0.0, 0.5 * (1.0 - lit));\n"
+    "}\n";
+
+// Compile and link a vertex/fragment shader pair, returning 0 (after
+// reporting why) on failure.
+static GLuint buildProgram( char const *vertexSource,
+                            char const *fragmentSource ) {
+    char const *sources[ 2 ] = { vertexSource, fragmentSource };
+    GLenum types[ 2 ] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    GLuint program = glCreateProgram();
+
+    for ( int i = 0; i < 2; i++ ) {
+        GLuint shader = glCreateShader( types[ i ] );
+        glShaderSource( shader, 1, &sources[ i ], NULL );
+        glCompileShader( shader );
+
+        GLint ok;
+        glGetShaderiv( shader, GL_COMPILE_STATUS, &ok );
+        if ( !ok ) {
+            char log[ 1024 ];
+            glGetShaderInfoLog( shader, sizeof( log ), NULL, log );
+            cerr << "Shader compile failed: " << log << endl;
+            glDeleteShader( shader );
+            glDeleteProgram( program );
+            return 0;
+        }
+        glAttachShader( program, shader );
+        glDeleteShader( shader );
+    }
+
+    glLinkProgram( program );
+    GLint ok;
+    glGetProgramiv( program, GL_LINK_STATUS, &ok );
+    if ( !ok ) {
+        cerr << "Shader link failed" << endl;
+        glDeleteProgram( program );
+        return 0;
+    }
+    return program;
+}
+
+ShadowMap :: ShadowMap() {
+    fbo = 0;
+    depthTexture = 0;
+    overlayProgram = 0;
+    size = 0;
+    lightProjection = lightView = texMatrix = Matrix::identity();
+}
+
+ShadowMap :: ~ShadowMap() {
+    if ( fbo ) {
+        glDeleteFramebuffers( 1, &fbo );
+        glDeleteTextures( 1, &depthTexture );
+        glDeleteProgram( overlayProgram );
+    }
+}
+
+bool ShadowMap :: init( int mapSize ) {
+    // Depth textures as framebuffer attachments need OpenGL 3.0.
+    int major = 0, minor = 0;
+    char const *version = (char const *) glGetString( GL_VERSION );
+    if ( !version || sscanf( version, "%d.%d", &major, &minor ) != 2 ||
+         major < 3 )
+        return false;
+
+    overlayProgram = buildProgram( overlayVertexSource, overlayFragmentSource );
+    if ( !overlayProgram )
+        return false;
+    overlayMatrixLoc = glGetUniformLocation( overlayProgram, "shadowMatrix" );
+    glUseProgram( overlayProgram );
+    glUniform1i( glGetUniformLocation( overlayProgram, "shadowMap" ),
+                 TEXTURE_UNIT );
+    glUseProgram( 0 );
+
+    // Everything outside the map counts as lit, and lookups compare
+    // against the stored depth (with hardware filtering of the result).
+    size = mapSize;
+    glGenTextures( 1, &depthTexture );
+    glBindTexture( GL_TEXTURE_2D, depthTexture );
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0,
+                  GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER );
+    GLfloat border[] = { 1, 1, 1, 1 };
+    glTexParameterfv( GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE,
+                     GL_COMPARE_REF_TO_TEXTURE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    GLint previous;
+    glGetIntegerv( GL_FRAMEBUFFER_BINDING, &previous );
+    glGenFramebuffers( 1, &fbo );
+    glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+    glFramebufferTexture2D( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_TEXTURE_2D, depthTexture, 0 );
+    glDrawBuffer( GL_NONE );
+    glReadBuffer( GL_NONE );
+    bool complete =
+        glCheckFramebufferStatus( GL_FRAMEBUFFER ) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer( GL_FRAMEBUFFER, previous );
+
+    if ( !complete ) {
+        glDeleteFramebuffers( 1, &fbo );
+        glDeleteTextures( 1, &depthTexture );
+        glDeleteProgram( overlayProgram );
+        fbo = 0;
+        return false;
+    }
+    return true;
+}
+
+void ShadowMap :: aim( Vector const &light, Vector const &center,
+                       double radius ) {
+    // Build a frame at the light, looking back along its z axis at the
+    // center.  Pick an up direction that isn't parallel to the view.
+    Vector back = ( light - center ).norm();
+    Vector up = fabs( back.y ) < 0.99 ? Vector( 0, 1, 0 ) : Vector( 0, 0, -1 );
+    Vector right = up.cross( back ).norm();
+    up = back.cross( right );
+    Vector origin( light.x, light.y, light.z, 1 );
+    lightView = Matrix::frame( right, up, back, origin ).rigidInverse();
+
+    // A symmetric perspective that just contains the sphere, based on
+    // the matrix in OpenGL's documentation for gluPerspective.
+    double dist = ( light - center ).mag();
+    double nearZ = max( dist - radius, 0.1 );
+    double farZ = dist + radius;
+    double f = 1 / tan( asin( min( radius / dist, 0.99 ) ) );
+    lightProjection = Matrix::identity();
+    lightProjection[ 0 ][ 0 ] = f;
+    lightProjection[ 1 ][ 1 ] = f;
+    lightProjection[ 2 ][ 2 ] = ( farZ + nearZ ) / ( nearZ - farZ );
+    lightProjection[ 2 ][ 3 ] = 2 * farZ * nearZ / ( nearZ - farZ );
+    lightProjection[ 3 ][ 2 ] = -1;
+    lightProjection[ 3 ][ 3 ] = 0;
+
+    // Clip coordinates are in [ -1, 1 ], textures want [ 0, 1 ].
+    texMatrix = Matrix::translate( 0.5, 0.5, 0.5 ) *
+        Matrix::scale( 0.5, 0.5, 0.5 ) * lightProjection * lightView;
+}
+
+void ShadowMap :: begin() {
+    glGetIntegerv( GL_FRAMEBUFFER_BINDING, &savedFbo );
+    glGetIntegerv( GL_VIEWPORT, savedViewport );
+    glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+    glViewport( 0, 0, size, size );
+    glClear( GL_DEPTH_BUFFER_BIT );
+
+    // Only depth matters, pushed back a little to keep surfaces from
+    // shadowing themselves.
+    glPushAttrib( GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_POLYGON_BIT );
+    glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+    glDisable( GL_BLEND );
+    glDisable( GL_STENCIL_TEST );
+    glDisable( GL_CLIP_PLANE0 );
+    glEnable( GL_DEPTH_TEST );
+    glEnable( GL_POLYGON_OFFSET_FILL );
+    glPolygonOffset( 2, 4 );
+
+    glMatrixMode( GL_PROJECTION );
+    glPushMatrix();
+    glLoadIdentity();
+    lightProjection.glMult();
+    glMatrixMode( GL_MODELVIEW );
+    glPushMatrix();
+    glLoadIdentity();
+    lightView.glMult();
+}
+
+void ShadowMap :: end() {
+    glMatrixMode( GL_PROJECTION );
+    glPopMatrix();
+    glMatrixMode( GL_MODELVIEW );
+    glPopMatrix();
+    glPopAttrib();
+
+    glBindFramebuffer( GL_FRAMEBUFFER, savedFbo );
+    glViewport( savedViewport[ 0 ], savedViewport[ 1 ],
+                savedViewport[ 2 ], savedViewport[ 3 ] );
+}
+
+void ShadowMap :: beginOverlay() {
+    glActiveTexture( GL_TEXTURE0 + TEXTURE_UNIT );
+    glBindTexture( GL_TEXTURE_2D, depthTexture );
+    glActiveTexture( GL_TEXTURE0 );
+
+    GLfloat mat[ 16 ];
+    texMatrix.glStore( mat );
+    glUseProgram( overlayProgram );
+    glUniformMatrix4fv( overlayMatrixLoc, 1, GL_FALSE, mat );
+}
+
+void ShadowMap :: endOverlay() {
+    glUseProgram( 0 );
+    glActiveTexture( GL_TEXTURE0 + TEXTURE_UNIT );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+    glActiveTexture( GL_TEXTURE0 );
+}
@@ -0,0 +1,93 @@
+#ifndef __SHADOWMAP_H__
+#define __SHADOWMAP_H__
+
+#include "Geometry.h"
+
+//
+// Depth-texture shadow map for a single point light.  The scene's
+// shadow casters are rendered from the light into a depth texture
+// between begin() and end(); that only needs doing when something moves.
+// Receivers then compare against it, either through the overlay shader
+// (beginOverlay()/endOverlay(), for the board) or by sampling the
+// texture with textureMatrix() themselves (see Instancer).
+//
+class ShadowMap {
+public:
+    // Make a shadow map; nothing happens until init() is called.
+    ShadowMap();
+
+    // Release the texture, framebuffer and shader.
+    ~ShadowMap();
+
+    /** Make a size x size depth texture and the framebuffer to render
+        into it.  Needs a current GL context.  Returns false (and leaves
+        the shadow map unusable) if the context can't support it. */
+    bool init( int size );
+
+    /** Return true if init() succeeded. */
+    bool available() const {
+        return fbo != 0;
+    }
+
+    /** Place the light at the given point, aimed so its view just
+        covers a sphere with the given center and radius. */
+    void aim( Vector const &light, Vector const &center, double radius );
+
+    /** Start rendering shadow casters into the depth texture.  Until
+        end(), the GL matrices are set up for the light's view, and only
+        depth is written. */
+    void begin();
+
+    /** Finish rendering shadow casters, and restore the framebuffer,
+        viewport and matrices that were current at begin(). */
+    void end();
+
+    /** Start drawing shadow receivers, given in world coordinates, with a
+        shader that darkens the parts in shadow and leaves everything else
+        alone.  Blending should be enabled. */
+    void beginOverlay();
+
+    /** Finish drawing shadow receivers. */
+    void endOverlay();
+
+    /** Return the matrix taking world coordinates to shadow texture
+        coordinates, with depth in the r coordinate. */
+    Matrix const &textureMatrix() const {
+        return texMatrix;
+    }
+
+    /** Return the depth texture. */
+    GLuint texture() const {
+        return depthTexture;
+    }
+
+    /** Texture unit the depth texture is sampled from. */
+    enum { TEXTURE_UNIT = 1 };
+
+private:
+    /** Framebuffer with the depth texture attached. */
+    GLuint fbo;
+
+    /** The shadow map itself. */
+    GLuint depthTexture;
+
+    /** Width and height of depthTexture. */
+    int size;
+
+    /** Shader for beginOverlay(), and the location of its shadow matrix
+        uniform. */
+    GLuint overlayProgram;
+    GLint overlayMatrixLoc;
+
+    /** Projection and view transformations for the light. */
+    Matrix lightProjection, lightView;
+
+    /** World to shadow texture coordinates. */
+    Matrix texMatrix;
+
+    /** Framebuffer and viewport to go back to at end(). */
+    GLint savedFbo;
+    GLint savedViewport[ 4 ];
+};
+
+#endif
@@ -0,0 +1,298 @@
+//
+// Simplifier.cpp
+//
+// Quadric error metric mesh simplification, for levels of detail.
+//
+
+#include "Simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+
+using namespace std;
+
+// Weight of the planes that hold open edges in place, relative to the
+// planes of the triangles, so outlines don't shrink away.
+static const double BOUNDARY_WEIGHT = 10;
+
+// Smallest cosine allowed between a triangle's normal before and after
+// a collapse moves one of its corners; anything less is a fold.
+static const double MIN_NORMAL_COSINE = 0.2;
+
+// Cross product of b - a and c - a, for points stored in p.
+static void triangleNormal( vector< double > const &p, int a, int b, int c,
+                            double n[ 3 ] ) {
+    double u[ 3 ], v[ 3 ];
+    for ( int k = 0; k < 3; k++ ) {
+        u[ k ] = p[ b * 3 + k ] - p[ a * 3 + k ];
+        v[ k ] = p[ c * 3 + k ] - p[ a * 3 + k ];
+    }
+    n[ 0 ] = u[ 1 ] * v[ 2 ] - u[ 2 ] * v[ 1 ];
+    n[ 1 ] = u[ 2 ] * v[ 0 ] - u[ 0 ] * v[ 2 ];
+    n[ 2 ] = u[ 0 ] * v[ 1 ] - u[ 1 ] * v[ 0 ];
+}
+
+Simplifier :: Simplifier( float const *positions, int vertexCount,
+                          vector< unsigned > const &corners ) {
+    // Weld vertices that sit at the same place, so seams where the mesh
+    // file repeats a vertex can still collapse.
+    map< pair< pair< float, float >, float >, int > welded;
+    vector< int > rep( vertexCount );
+    pos.resize( vertexCount * 3 );
+    for ( int i = 0; i < vertexCount; i++ ) {
+        float const *p = positions + i * 3;
+        rep[ i ] = welded.insert( make_pair( make_pair( make_pair( p[ 0 ], p[ 1 ] ), p[ 2 ] ),
+                                             i ) ).first->second;
+        for ( int k = 0; k < 3; k++ )
+            pos[ i * 3 + k ] = p[ k ];
+    }
+
+    // Keep the triangles that still have three distinct corners.
+    for ( int c = 0; c + 6 <= int( corners.size() ); c += 6 ) {
+        Triangle t;
+        for ( int k = 0; k < 3; k++ ) {
+            t.v[ k ] = rep[ corners[ c + k * 2 ] ];
+            t.n[ k ] = corners[ c + k * 2 + 1 ];
+        }
+        t.dead = false;
+        if ( t.v[ 0 ] != t.v[ 1 ] && t.v[ 1 ] != t.v[ 2 ] && t.v[ 0 ] != t.v[ 2 ] )
+            tris.push_back( t );
+    }
+    live = tris.size();
+    maxCost = 0;
+
+    quadrics.resize( vertexCount );
+    for ( int i = 0; i < vertexCount; i++ )
+        fill( quadrics[ i ].q, quadrics[ i ].q + 10, 0.0 );
+    vertTris.resize( vertexCount );
+    stamps.assign( vertexCount, 0 );
+    removed.assign( vertexCount, false );
+
+    // Each vertex starts with the planes of the triangles around it, and
+    // each edge used by only one triangle gets a plane through it, at
+    // right angles to that triangle.
+    map< pair< int, int >, int > edgeUses;
+    for ( int t = 0; t < tris.size(); t++ )
+        for ( int k = 0; k < 3; k++ ) {
+            int a = tris[ t ].v[ k ], b = tris[ t ].v[ ( k + 1 ) % 3 ];
+            edgeUses[ make_pair( min( a, b ), max( a, b ) ) ]++;
+        }
+
+    for ( int t = 0; t < tris.size(); t++ ) {
+        int const *v = tris[ t ].v;
+        double n[ 3 ];
+        triangleNormal( pos, v[ 0 ], v[ 1 ], v[ 2 ], n );
+        double len = sqrt( n[ 0 ] * n[ 0 ] + n[ 1 ] * n[ 1 ] + n[ 2 ] * n[ 2 ] );
+        for ( int k = 0; k < 3; k++ )
+            vertTris[ v[ k ] ].push_back( t );
+        if ( len == 0 )
+            continue;
+        for ( int k = 0; k < 3; k++ )
+            n[ k ] /= len;
+
+        double const *p0 = &pos[ v[ 0 ] * 3 ];
+        double d = -( n[ 0 ] * p0[ 0 ] + n[ 1 ] * p0[ 1 ] + n[ 2 ] * p0[ 2 ] );
+        for ( int k = 0; k < 3; k++ )
+            addPlane( quadrics[ v[ k ] ], n[ 0 ], n[ 1 ], n[ 2 ], d, 1 );
+
+        for ( int k = 0; k < 3; k++ ) {
+            int a = v[ k ], b = v[ ( k + 1 ) % 3 ];
+            if ( edgeUses[ make_pair( min( a, b ), max( a, b ) ) ] != 1 )
+                continue;
+            double e[ 3 ], m[ 3 ];
+            for ( int j = 0; j < 3; j++ )
+                e[ j ] = pos[ b * 3 + j ] - pos[ a * 3 + j ];
+            m[ 0 ] = e[ 1 ] * n[ 2 ] - e[ 2 ] * n[ 1 ];
+            m[ 1 ] = e[ 2 ] * n[ 0 ] - e[ 0 ] * n[ 2 ];
+            m[ 2 ] = e[ 0 ] * n[ 1 ] - e[ 1 ] * n[ 0 ];
+            double mlen = sqrt( m[ 0 ] * m[ 0 ] + m[ 1 ] * m[ 1 ] + m[ 2 ] * m[ 2 ] );
+            if ( mlen == 0 )
+                continue;
+            for ( int j = 0; j < 3; j++ )
+                m[ j ] /= mlen;
+            double md = -( m[ 0 ] * pos[ a * 3 ] + m[ 1 ] * pos[ a * 3 + 1 ] +
+                           m[ 2 ] * pos[ a * 3 + 2 ] );
+            addPlane( quadrics[ a ], m[ 0 ], m[ 1 ], m[ 2 ], md, BOUNDARY_WEIGHT );
+            addPlane( quadrics[ b ], m[ 0 ], m[ 1 ], m[ 2 ], md, BOUNDARY_WEIGHT );
+        }
+    }
+
+    // Every edge can go either way to begin with.
+    vector< int > adjacent;
+    for ( int v = 0; v < vertexCount; v++ ) {
+        neighbors( v, adjacent );
+        for ( int i = 0; i < adjacent.size(); i++ )
+            queueCollapse( v, adjacent[ i ] );
+    }
+}
+
+void Simplifier :: addPlane( Quadric &q, double a, double b, double c, double d,
+                             double weight ) {
+    double p[ 4 ] = { a, b, c, d };
+    int k = 0;
+    for ( int r = 0; r < 4; r++ )
+        for ( int s = r; s < 4; s++ )
+            q.q[ k++ ] += weight * p[ r ] * p[ s ];
+}
+
+double Simplifier :: evaluate( Quadric const &q, int v ) const {
+    double p[ 4 ] = { pos[ v * 3 ], pos[ v * 3 + 1 ], pos[ v * 3 + 2 ], 1 };
+    double sum = 0;
+    int k = 0;
+    for ( int r = 0; r < 4; r++ )
+        for ( int s = r; s < 4; s++ )
+            sum += ( r == s ? 1 : 2 ) * q.q[ k++ ] * p[ r ] * p[ s ];
+
+    // Rounding can take a cost that should be zero a little negative.
+    return max( sum, 0.0 );
+}
+
+void Simplifier :: neighbors( int v, vector< int > &result ) const {
+    result.clear();
+    for ( int i = 0; i < vertTris[ v ].size(); i++ ) {
+        Triangle const &t = tris[ vertTris[ v ][ i ] ];
+        if ( t.dead )
+            continue;
+        for ( int k = 0; k < 3; k++ )
+            if ( t.v[ k ] != v &&
+                 find( result.begin(), result.end(), t.v[ k ] ) == result.end() )
+                result.push_back( t.v[ k ] );
+    }
+}
+
+void Simplifier :: queueCollapse( int from, int to ) {
+    Quadric sum = quadrics[ from ];
+    for ( int k = 0; k < 10; k++ )
+        sum.q[ k ] += quadrics[ to ].q[ k ];
+
+    Candidate c;
+    c.cost = evaluate( sum, to );
+    c.from = from;
+    c.to = to;
+    c.fromStamp = stamps[ from ];
+    c.toStamp = stamps[ to ];
+    heap.push_back( c );
+    push_heap( heap.begin(), heap.end() );
+}
+
+void Simplifier :: queueNeighbors( int v ) {
+    vector< int > adjacent;
+    neighbors( v, adjacent );
+    for ( int i = 0; i < adjacent.size(); i++ ) {
+        queueCollapse( v, adjacent[ i ] );
+        queueCollapse( adjacent[ i ], v );
+    }
+}
+
+bool Simplifier :: canCollapse( int from, int to ) const {
+    // The ends of the edge may only share the neighbors across the
+    // triangles on the edge; any more, and the collapse would pinch the
+    // surface into something that isn't a manifold.
+    vector< int > fromAdjacent, toAdjacent;
+    neighbors( from, fromAdjacent );
+    neighbors( to, toAdjacent );
+    int common = 0;
+    for ( int i = 0; i < fromAdjacent.size(); i++ )
+        if ( find( toAdjacent.begin(), toAdjacent.end(), fromAdjacent[ i ] ) !=
+             toAdjacent.end() )
+            common++;
+
+    int shared = 0;
+    for ( int i = 0; i < vertTris[ from ].size(); i++ ) {
+        Triangle const &t = tris[ vertTris[ from ][ i ] ];
+        if ( t.dead )
+            continue;
+        if ( t.v[ 0 ] == to || t.v[ 1 ] == to || t.v[ 2 ] == to ) {
+            shared++;
+            continue;
+        }
+
+        // Triangles that survive mustn't flip over or collapse to a line.
+        int moved[ 3 ];
+        for ( int k = 0; k < 3; k++ )
+            moved[ k ] = t.v[ k ] == from ? to : t.v[ k ];
+        double before[ 3 ], after[ 3 ];
+        triangleNormal( pos, t.v[ 0 ], t.v[ 1 ], t.v[ 2 ], before );
+        triangleNormal( pos, moved[ 0 ], moved[ 1 ], moved[ 2 ], after );
+        double dot = before[ 0 ] * after[ 0 ] + before[ 1 ] * after[ 1 ] +
+            before[ 2 ] * after[ 2 ];
+        double lenBefore = sqrt( before[ 0 ] * before[ 0 ] + before[ 1 ] * before[ 1 ] +
+                                 before[ 2 ] * before[ 2 ] );
+        double lenAfter = sqrt( after[ 0 ] * after[ 0 ] + after[ 1 ] * after[ 1 ] +
+                                after[ 2 ] * after[ 2 ] );
+        if ( lenAfter <= 1e-12 || dot < MIN_NORMAL_COSINE * lenBefore * lenAfter )
+            return false;
+    }
+    return shared > 0 && common <= shared;
+}
+
+void Simplifier :: collapse( int from, int to ) {
+    // Triangles on the edge disappear, and the rest move to the
+    // surviving vertex.
+    for ( int i = 0; i < vertTris[ from ].size(); i++ ) {
+        int index = vertTris[ from ][ i ];
+        Triangle &t = tris[ index ];
+        if ( t.dead )
+            continue;
+        if ( t.v[ 0 ] == to || t.v[ 1 ] == to || t.v[ 2 ] == to ) {
+            t.dead = true;
+            live--;
+            continue;
+        }
+        for ( int k = 0; k < 3; k++ )
+            if ( t.v[ k ] == from )
+                t.v[ k ] = to;
+        vertTris[ to ].push_back( index );
+    }
+    vertTris[ from ].clear();
+
+    // Drop the dead triangles from the survivor's list while we're here.
+    vector< int > &list = vertTris[ to ];
+    int kept = 0;
+    for ( int i = 0; i < list.size(); i++ )
+        if ( !tris[ list[ i ] ].dead )
+            list[ kept++ ] = list[ i ];
+    list.resize( kept );
+
+    for ( int k = 0; k < 10; k++ )
+        quadrics[ to ].q[ k ] += quadrics[ from ].q[ k ];
+    removed[ from ] = true;
+    stamps[ from ]++;
+    stamps[ to ]++;
+    queueNeighbors( to );
+}
+
+int Simplifier :: reduce( int target ) {
+    while ( live > target && !heap.empty() ) {
+        pop_heap( heap.begin(), heap.end() );
+        Candidate c = heap.back();
+        heap.pop_back();
+
+        // Skip collapses whose vertices have changed since they were
+        // queued; there's a fresher copy in the heap if it still matters.
+        if ( removed[ c.from ] || removed[ c.to ] ||
+             c.fromStamp != stamps[ c.from ] || c.toStamp != stamps[ c.to ] )
+            continue;
+        if ( !canCollapse( c.from, c.to ) )
+            continue;
+
+        collapse( c.from, c.to );
+        maxCost = max( maxCost, c.cost );
+    }
+    return live;
+}
+
+float Simplifier :: error() const {
+    return sqrt( maxCost );
+}
+
+void Simplifier :: corners( vector< unsigned > &result ) const {
+    for ( int t = 0; t < tris.size(); t++ )
+        if ( !tris[ t ].dead )
+            for ( int k = 0; k < 3; k++ ) {
+                result.push_back( tris[ t ].v[ k ] );
+                result.push_back( tris[ t ].n[ k ] );
+            }
+}
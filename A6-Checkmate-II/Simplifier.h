@@ -0,0 +1,125 @@
+#ifndef __SIMPLIFIER_H__
+#define __SIMPLIFIER_H__
+
+#include <vector>
+
+//
+// Reduces a triangle mesh by collapsing edges, cheapest first, using
+// quadric error metrics (Garland and Heckbert): each vertex keeps the
+// sum of the squared distances to the planes of the triangles around
+// it, and collapsing an edge costs that sum at the vertex it collapses
+// onto.  Collapses always move one end of an edge onto the other, so
+// the simplified mesh only uses the original vertices, and can share
+// their vertex buffer.
+//
+class Simplifier {
+public:
+    /** Start simplifying the given triangles.  positions holds x, y, z
+        for each of vertexCount vertices, and corners holds a (vertex,
+        normal) index pair for each triangle corner, three corners per
+        triangle.  Vertices at the same location are treated as one. */
+    Simplifier( float const *positions, int vertexCount,
+                std::vector< unsigned > const &corners );
+
+    /** Collapse edges until no more than target triangles are left, or
+        until every remaining collapse would fold a triangle over or
+        pinch the surface.  Returns the number of triangles left.  This
+        can be called again with smaller targets to make coarser
+        levels from finer ones. */
+    int reduce( int target );
+
+    /** Return the number of triangles left. */
+    int triangles() const {
+        return live;
+    }
+
+    /** Return an estimate of how far the simplified surface is from the
+        original: the square root of the largest collapse cost so far, in
+        the units of the positions. */
+    float error() const;
+
+    /** Append the remaining triangles to result, as (vertex, normal)
+        pairs in the same form the constructor takes.  Each corner keeps
+        the normal it started with. */
+    void corners( std::vector< unsigned > &result ) const;
+
+private:
+    /** Symmetric 4x4 matrix summing squared plane distances, stored as
+        its upper triangle. */
+    struct Quadric {
+        double q[ 10 ];
+    };
+
+    /** A triangle, with the index of each corner's vertex and normal. */
+    struct Triangle {
+        int v[ 3 ];
+        unsigned n[ 3 ];
+        bool dead;
+    };
+
+    /** A possible collapse of vertex from onto vertex to.  It's stale if
+        either vertex has changed since it was queued. */
+    struct Candidate {
+        double cost;
+        int from, to;
+        unsigned fromStamp, toStamp;
+
+        bool operator<( Candidate const &other ) const {
+            return cost > other.cost;
+        }
+    };
+
+    /** Add the plane a x + b y + c z + d = 0, scaled by weight, to q. */
+    static void addPlane( Quadric &q, double a, double b, double c, double d,
+                          double weight );
+
+    /** Return the cost of moving to vertex v with quadric q. */
+    double evaluate( Quadric const &q, int v ) const;
+
+    /** Fill in the vertices that share a live triangle with v. */
+    void neighbors( int v, std::vector< int > &result ) const;
+
+    /** Queue the collapse of from onto to, at its current cost. */
+    void queueCollapse( int from, int to );
+
+    /** Queue collapses of v onto each of its neighbors, and of each
+        neighbor onto v. */
+    void queueNeighbors( int v );
+
+    /** Return true if collapsing from onto to leaves the mesh intact. */
+    bool canCollapse( int from, int to ) const;
+
+    /** Collapse from onto to. */
+    void collapse( int from, int to );
+
+    /** Vertex positions, x, y, z for each vertex. */
+    std::vector< double > pos;
+
+    /** Triangles, dead ones included. */
+    std::vector< Triangle > tris;
+
+    /** For each vertex, its quadric. */
+    std::vector< Quadric > quadrics;
+
+    /** For each vertex, the triangles that use it.  Lists may hold
+        triangles that have since died. */
+    std::vector< std::vector< int > > vertTris;
+
+    /** For each vertex, a count of the changes made to it, for spotting
+        stale candidates. */
+    std::vector< unsigned > stamps;
+
+    /** For each vertex, true if it has been collapsed away. */
+    std::vector< bool > removed;
+
+    /** Collapses waiting to be tried, cheapest first. */
+    std::vector< Candidate > heap;
+
+    /** Number of triangles still alive. */
+    int live;
+
+    /** Largest cost of any collapse made. */
+    double maxCost;
+};
+
+#endif
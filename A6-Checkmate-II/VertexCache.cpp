@@ -0,0 +1,139 @@
+//
+// VertexCache.cpp
+//
+// Triangle and vertex ordering for post-transform cache and fetch
+// locality.
+//
+
+#include "VertexCache.h"
+
+#include <algorithm>
+#include <deque>
+
+using namespace std;
+
+// Size of the FIFO cache the triangle ordering plans for.  Caches on
+// real hardware are at least this big, and a bigger one only does
+// better with the same order.
+static const int CACHE_SIZE = 16;
+
+void optimizeVertexCache( vector< unsigned > &indices, int first, int count,
+                          int vertexCount ) {
+    int triCount = count / 3;
+    if ( triCount == 0 )
+        return;
+    unsigned const *tris = &indices[ first ];
+
+    // Triangles around each vertex, as offsets into one shared array,
+    // and how many of them are still to be drawn.
+    vector< int > live( vertexCount, 0 ), start( vertexCount + 1, 0 );
+    for ( int i = 0; i < triCount * 3; i++ )
+        live[ tris[ i ] ]++;
+    for ( int v = 0; v < vertexCount; v++ )
+        start[ v + 1 ] = start[ v ] + live[ v ];
+    vector< int > vertTris( start[ vertexCount ] ), fill( start.begin(), start.end() - 1 );
+    for ( int t = 0; t < triCount; t++ )
+        for ( int k = 0; k < 3; k++ )
+            vertTris[ fill[ tris[ t * 3 + k ] ]++ ] = t;
+
+    // Tipsify (Sander, Nehab and Barczak): draw every remaining triangle
+    // around a fanning vertex, then move on to the vertex just drawn that
+    // will stay in the cache longest while its own triangles are drawn.
+    // time counts cache misses, and stamp records when each vertex last
+    // went into the cache, so time - stamp[ v ] is its position.
+    vector< int > stamp( vertexCount, 0 ), deadEnds, candidates;
+    vector< bool > drawn( triCount, false );
+    vector< unsigned > result;
+    result.reserve( triCount * 3 );
+    int fan = tris[ 0 ], time = CACHE_SIZE + 1, scan = 0;
+    while ( fan >= 0 ) {
+        candidates.clear();
+        for ( int i = start[ fan ]; i < start[ fan + 1 ]; i++ ) {
+            int t = vertTris[ i ];
+            if ( drawn[ t ] )
+                continue;
+            drawn[ t ] = true;
+            for ( int k = 0; k < 3; k++ ) {
+                int v = tris[ t * 3 + k ];
+                result.push_back( v );
+                deadEnds.push_back( v );
+                candidates.push_back( v );
+                live[ v ]--;
+                if ( time - stamp[ v ] > CACHE_SIZE )
+                    stamp[ v ] = time++;
+            }
+        }
+
+        // Prefer the candidate that's been in the cache longest but
+        // will still be there after its triangles are drawn (each can
+        // add up to two misses).  Any live one will do otherwise.
+        fan = -1;
+        int bestAge = -1;
+        for ( int i = 0; i < candidates.size(); i++ ) {
+            int v = candidates[ i ];
+            if ( live[ v ] == 0 )
+                continue;
+            int age = time - stamp[ v ] + 2 * live[ v ] <= CACHE_SIZE ? time - stamp[ v ] : 0;
+            if ( age > bestAge ) {
+                bestAge = age;
+                fan = v;
+            }
+        }
+
+        // At a dead end, back up to the most recent vertex with
+        // triangles left, and failing that, the next one in index order.
+        while ( fan < 0 && !deadEnds.empty() ) {
+            if ( live[ deadEnds.back() ] > 0 )
+                fan = deadEnds.back();
+            deadEnds.pop_back();
+        }
+        for ( ; fan < 0 && scan < vertexCount; scan++ )
+            if ( live[ scan ] > 0 )
+                fan = scan;
+    }
+
+    // Some meshes come from the exporter in long strips that are about
+    // as good already; don't make those worse.
+    vector< unsigned > original( indices.begin() + first, indices.begin() + first + count );
+    if ( averageCacheMissRatio( result, 0, count, CACHE_SIZE ) <
+         averageCacheMissRatio( original, 0, count, CACHE_SIZE ) )
+        copy( result.begin(), result.end(), indices.begin() + first );
+}
+
+void optimizeVertexFetch( vector< unsigned > &indices, vector< float > &verts,
+                          int stride ) {
+    int vertexCount = verts.size() / stride;
+    vector< int > remap( vertexCount, -1 );
+    int next = 0;
+    for ( int i = 0; i < indices.size(); i++ ) {
+        if ( remap[ indices[ i ] ] < 0 )
+            remap[ indices[ i ] ] = next++;
+        indices[ i ] = remap[ indices[ i ] ];
+    }
+    for ( int v = 0; v < vertexCount; v++ )
+        if ( remap[ v ] < 0 )
+            remap[ v ] = next++;
+
+    vector< float > moved( verts.size() );
+    for ( int v = 0; v < vertexCount; v++ )
+        copy( verts.begin() + v * stride, verts.begin() + ( v + 1 ) * stride,
+              moved.begin() + remap[ v ] * stride );
+    swap( verts, moved );
+}
+
+double averageCacheMissRatio( vector< unsigned > const &indices, int first,
+                              int count, int cacheSize ) {
+    if ( count < 3 )
+        return 0;
+
+    deque< unsigned > cache;
+    int misses = 0;
+    for ( int i = first; i < first + count; i++ )
+        if ( find( cache.begin(), cache.end(), indices[ i ] ) == cache.end() ) {
+            misses++;
+            cache.push_back( indices[ i ] );
+            if ( cache.size() > cacheSize )
+                cache.pop_front();
+        }
+    return double( misses ) / ( count / 3 );
+}
@@ -0,0 +1,44 @@
+#ifndef __VERTEX_CACHE_H__
+#define __VERTEX_CACHE_H__
+
+#include <vector>
+
+//
+// Reordering of indexed triangle lists for the GPU's vertex caches.
+// After a vertex is transformed it stays in a small cache for a while,
+// so triangles that reuse recent vertices are cheaper to draw, and
+// vertices stored in the order they're first used are cheaper to fetch.
+// Indices here are plain unsigned ints, the same values as the GLuint
+// indices Mesh uploads.
+//
+
+/**
+   Reorder the triangles in indices[ first ] up to indices[ first +
+   count ] (count a multiple of three) so that each one reuses as many
+   recently used vertices as it can, using the Tipsify ordering for a
+   16-entry FIFO cache.  If that isn't an improvement on the order the
+   triangles were already in, they're left alone.  vertexCount must be
+   more than every index in the range.  The triangles keep their
+   winding.
+*/
+void optimizeVertexCache( std::vector< unsigned > &indices, int first, int count,
+                          int vertexCount );
+
+/**
+   Renumber the vertices in the order indices first uses them, and move
+   them in verts (stride floats per vertex) to match, so vertex fetches
+   walk through the buffer.  Vertices no index uses go at the end.
+*/
+void optimizeVertexFetch( std::vector< unsigned > &indices, std::vector< float > &verts,
+                          int stride );
+
+/**
+   Return the average cache miss ratio (vertices transformed per
+   triangle) for drawing the count indices from first, on a FIFO vertex
+   cache with cacheSize entries.  This is 3 with no reuse at all, and
+   approaches 0.5 for a large regular grid.
+*/
+double averageCacheMissRatio( std::vector< unsigned > const &indices, int first,
+                              int count, int cacheSize );
+
+#endif
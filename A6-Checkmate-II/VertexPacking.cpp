@@ -0,0 +1,176 @@
+//
+// VertexPacking.cpp
+//
+// Quantized positions and octahedral normals for compact mesh buffers.
+//
+
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+// Largest magnitude a quantized position coordinate takes.
+static const int POSITION_RANGE = 32767;
+
+// Return the largest magnitude an octahedral component of the given
+// number of bits takes.
+static int normalRange( int bits ) {
+    return ( 1 << ( bits - 1 ) ) - 1;
+}
+
+// Return -1 for negative x, otherwise 1, so the fold of the lower half
+// of the octahedron has no seam at zero.
+static float signNotZero( float x ) {
+    return x < 0 ? -1.0f : 1.0f;
+}
+
+PositionQuantizer :: PositionQuantizer( Vector const &low, Vector const &high ) {
+    double lo[ 3 ] = { low.x, low.y, low.z }, hi[ 3 ] = { high.x, high.y, high.z };
+    for ( int k = 0; k < 3; k++ ) {
+        center[ k ] = ( lo[ k ] + hi[ k ] ) / 2;
+
+        // A flat box still needs a step, so anything in it encodes as 0.
+        step[ k ] = max( hi[ k ] - lo[ k ], 1e-12 ) / ( 2 * POSITION_RANGE );
+    }
+}
+
+void PositionQuantizer :: encode( float const p[ 3 ], short q[ 3 ] ) const {
+    for ( int k = 0; k < 3; k++ ) {
+        double s = floor( ( p[ k ] - center[ k ] ) / step[ k ] + 0.5 );
+        q[ k ] = short( max( -double( POSITION_RANGE ), min( double( POSITION_RANGE ), s ) ) );
+    }
+}
+
+void PositionQuantizer :: decode( short const q[ 3 ], float p[ 3 ] ) const {
+    for ( int k = 0; k < 3; k++ )
+        p[ k ] = center[ k ] + q[ k ] * step[ k ];
+}
+
+Matrix PositionQuantizer :: decodeMatrix() const {
+    return Matrix::translate( center[ 0 ], center[ 1 ], center[ 2 ] ) *
+        Matrix::scale( step[ 0 ], step[ 1 ], step[ 2 ] );
+}
+
+double PositionQuantizer :: maxError() const {
+    return sqrt( step[ 0 ] * step[ 0 ] + step[ 1 ] * step[ 1 ] + step[ 2 ] * step[ 2 ] ) / 2;
+}
+
+void encodeOctahedral( float const n[ 3 ], int bits, int &u, int &v ) {
+    float sum = fabs( n[ 0 ] ) + fabs( n[ 1 ] ) + fabs( n[ 2 ] );
+    float x = sum > 0 ? n[ 0 ] / sum : 0, y = sum > 0 ? n[ 1 ] / sum : 0;
+    if ( n[ 2 ] < 0 ) {
+        float fx = ( 1 - fabs( y ) ) * signNotZero( x );
+        float fy = ( 1 - fabs( x ) ) * signNotZero( y );
+        x = fx;
+        y = fy;
+    }
+
+    // Rounding each component on its own isn't always closest once the
+    // result is unfolded, so try the four neighbors and keep the best.
+    int range = normalRange( bits );
+    int bu = 0, bv = 0;
+    float best = -2;
+    for ( int du = 0; du < 2; du++ )
+        for ( int dv = 0; dv < 2; dv++ ) {
+            int cu = int( floor( x * range ) ) + du;
+            int cv = int( floor( y * range ) ) + dv;
+            cu = max( -range, min( range, cu ) );
+            cv = max( -range, min( range, cv ) );
+            float d[ 3 ];
+            decodeOctahedral( cu, cv, bits, d );
+            float dot = d[ 0 ] * n[ 0 ] + d[ 1 ] * n[ 1 ] + d[ 2 ] * n[ 2 ];
+            if ( dot > best ) {
+                best = dot;
+                bu = cu;
+                bv = cv;
+            }
+        }
+    u = bu;
+    v = bv;
+}
+
+void decodeOctahedral( int u, int v, int bits, float n[ 3 ] ) {
+    int range = normalRange( bits );
+    float x = float( u ) / range, y = float( v ) / range;
+    float z = 1 - fabs( x ) - fabs( y );
+    if ( z < 0 ) {
+        float fx = ( 1 - fabs( y ) ) * signNotZero( x );
+        float fy = ( 1 - fabs( x ) ) * signNotZero( y );
+        x = fx;
+        y = fy;
+    }
+    float len = sqrt( x * x + y * y + z * z );
+    n[ 0 ] = x / len;
+    n[ 1 ] = y / len;
+    n[ 2 ] = z / len;
+}
+
+int packedStride( int normalBits ) {
+    return ( 3 * sizeof( short ) + 2 * normalBits / 8 + 3 ) & ~3;
+}
+
+void packVertices( float const *verts, int count, PositionQuantizer const &quantizer,
+                   int normalBits, vector< unsigned char > &result ) {
+    int stride = packedStride( normalBits );
+    result.assign( count * stride, 0 );
+    for ( int i = 0; i < count; i++ ) {
+        unsigned char *out = &result[ i * stride ];
+        short q[ 3 ];
+        quantizer.encode( verts + i * 6, q );
+        memcpy( out, q, sizeof( q ) );
+
+        int u, v;
+        encodeOctahedral( verts + i * 6 + 3, normalBits, u, v );
+        if ( normalBits == 8 ) {
+            signed char c[ 2 ] = { (signed char) u, (signed char) v };
+            memcpy( out + sizeof( q ), c, sizeof( c ) );
+        } else {
+            short s[ 2 ] = { short( u ), short( v ) };
+            memcpy( out + sizeof( q ), s, sizeof( s ) );
+        }
+    }
+}
+
+void unpackVertex( unsigned char const *data, int i, PositionQuantizer const &quantizer,
+                   int normalBits, float verts[ 6 ] ) {
+    unsigned char const *in = data + i * packedStride( normalBits );
+    short q[ 3 ];
+    memcpy( q, in, sizeof( q ) );
+    quantizer.decode( q, verts );
+
+    if ( normalBits == 8 ) {
+        signed char c[ 2 ];
+        memcpy( c, in + sizeof( q ), sizeof( c ) );
+        decodeOctahedral( c[ 0 ], c[ 1 ], normalBits, verts + 3 );
+    } else {
+        short s[ 2 ];
+        memcpy( s, in + sizeof( q ), sizeof( s ) );
+        decodeOctahedral( s[ 0 ], s[ 1 ], normalBits, verts + 3 );
+    }
+}
+
+void packingError( float const *verts, int count, unsigned char const *data,
+                   PositionQuantizer const &quantizer, int normalBits,
+                   double &positionError, double &normalDegrees ) {
+    positionError = 0;
+    double minCosine = 1;
+    for ( int i = 0; i < count; i++ ) {
+        float const *v = verts + i * 6;
+        float u[ 6 ];
+        unpackVertex( data, i, quantizer, normalBits, u );
+
+        double d2 = 0, dot = 0, len2 = 0;
+        for ( int k = 0; k < 3; k++ ) {
+            d2 += ( u[ k ] - v[ k ] ) * ( u[ k ] - v[ k ] );
+            dot += u[ k + 3 ] * v[ k + 3 ];
+            len2 += v[ k + 3 ] * v[ k + 3 ];
+        }
+        positionError = max( positionError, sqrt( d2 ) );
+        if ( len2 > 0 )
+            minCosine = min( minCosine, dot / sqrt( len2 ) );
+    }
+    normalDegrees = acos( max( -1.0, min( 1.0, minCosine ) ) ) * 180 / PI;
+}
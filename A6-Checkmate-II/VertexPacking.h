@@ -0,0 +1,87 @@
+#ifndef __VERTEX_PACKING_H__
+#define __VERTEX_PACKING_H__
+
+#include "Geometry.h"
+
+#include <vector>
+
+//
+// Compact vertex layout for mesh buffers: positions quantized to 16-bit
+// integers across the mesh's bounding box, and unit normals folded onto
+// an octahedron and stored as two 8- or 16-bit integers.  A vertex
+// takes 8 bytes with 8-bit normals and 12 with 16-bit ones, against 24
+// for floats.  Everything here runs on the CPU; the instancing shader
+// does the same decoding on the GPU.
+//
+
+/**
+   Maps points in a box to three 16-bit signed integers and back.  The
+   integers span -32767 to 32767 along each axis of the box.
+*/
+class PositionQuantizer {
+public:
+    /** Make a quantizer that covers the box from low to high. */
+    PositionQuantizer( Vector const &low, Vector const &high );
+
+    /** Quantize the point p into q. */
+    void encode( float const p[ 3 ], short q[ 3 ] ) const;
+
+    /** Recover the point quantized in q, into p. */
+    void decode( short const q[ 3 ], float p[ 3 ] ) const;
+
+    /** Return the matrix that takes the integers (as x, y, z, with w
+        of 1) back to the point, for decoding on the GPU. */
+    Matrix decodeMatrix() const;
+
+    /** Return the most encode() and decode() can move a point in the
+        box: half a step along every axis. */
+    double maxError() const;
+
+private:
+    /** Middle of the box, and the size of one step along each axis. */
+    double center[ 3 ], step[ 3 ];
+};
+
+/**
+   Encode the unit vector n as two integers in u and v, each with the
+   given number of bits (8 or 16), by projecting it onto the octahedron
+   |x| + |y| + |z| = 1 and unfolding the lower half over the upper one.
+*/
+void encodeOctahedral( float const n[ 3 ], int bits, int &u, int &v );
+
+/**
+   Recover the unit vector encoded in u and v, into n.
+*/
+void decodeOctahedral( int u, int v, int bits, float n[ 3 ] );
+
+/**
+   Return the size in bytes of a packed vertex with normals of the given
+   bits, rounded up to a multiple of four for the GL.
+*/
+int packedStride( int normalBits );
+
+/**
+   Pack count vertices, each given as an x, y, z position followed by an
+   x, y, z unit normal, into result, packedStride( normalBits ) bytes
+   apiece: three shorts of position, then the two normal integers.
+*/
+void packVertices( float const *verts, int count, PositionQuantizer const &quantizer,
+                   int normalBits, std::vector< unsigned char > &result );
+
+/**
+   Unpack vertex i of data made by packVertices() back into a position
+   and normal, six floats in verts.
+*/
+void unpackVertex( unsigned char const *data, int i, PositionQuantizer const &quantizer,
+                   int normalBits, float verts[ 6 ] );
+
+/**
+   Unpack every one of the count vertices in data, and compare them with
+   the verts they were packed from.  Sets positionError to the farthest
+   any position moved, and normalDegrees to the most any normal turned.
+*/
+void packingError( float const *verts, int count, unsigned char const *data,
+                   PositionQuantizer const &quantizer, int normalBits,
+                   double &positionError, double &normalDegrees );
+
+#endif